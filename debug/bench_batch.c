@@ -0,0 +1,213 @@
+// SPDX-License-Identifier: 0BSD
+
+///////////////////////////////////////////////////////////////////////////////
+//
+/// \file       bench_batch.c
+/// \brief      Measures the speed of decoding many .xz streams in batches
+///
+/// The file given on the command line is cut into messages which are
+/// compressed as separate .xz streams. The streams are decompressed one
+/// at a time with lzma_code() and then with lzma_code_batch() using
+/// a few different numbers of streams per call. Each stream is decoded
+/// with a single call to a buffer that holds all of its output. The best
+/// throughput of a few rounds and the CRC32 of the decompressed data are
+/// printed. The CRC32 must be the same with every method.
+///
+/// Usage: bench_batch FILE [PRESET]
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "sysdefs.h"
+#include "lzma.h"
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#define ROUNDS 3
+
+/// Each message size is decoded until this many bytes have been processed.
+#define TOTAL_SIZE (UINT32_C(32) << 20)
+
+/// Maximum number of streams per lzma_code_batch() call
+#define BATCH_MAX 16
+
+
+static const size_t msg_sizes[] = {
+	4 << 10,
+	64 << 10,
+	1 << 20,
+};
+
+static const size_t batch_sizes[] = { 1, 2, 4, BATCH_MAX };
+
+
+static uint8_t *
+read_file(const char *name, size_t *size)
+{
+	FILE *f = fopen(name, "rb");
+	if (f == NULL)
+		return NULL;
+
+	size_t alloc = 1 << 20;
+	uint8_t *buf = malloc(alloc);
+	*size = 0;
+
+	while (buf != NULL) {
+		*size += fread(buf + *size, 1, alloc - *size, f);
+		if (*size < alloc)
+			break;
+
+		alloc *= 2;
+		uint8_t *p = realloc(buf, alloc);
+		if (p == NULL)
+			free(buf);
+
+		buf = p;
+	}
+
+	if (ferror(f)) {
+		free(buf);
+		buf = NULL;
+	}
+
+	fclose(f);
+	return buf;
+}
+
+
+/// Decodes count streams from in (in_sizes[i] bytes at i * msg_out) to
+/// out (msg_size bytes each). With batch == 1 lzma_code() is used.
+/// Returns false on error.
+static bool
+decode(lzma_stream *strms, size_t batch, const uint8_t *in,
+		const size_t *in_sizes, size_t msg_out, size_t count,
+		uint8_t *out, size_t msg_size)
+{
+	lzma_stream *ptrs[BATCH_MAX];
+	lzma_ret rets[BATCH_MAX];
+
+	for (size_t i = 0; i < count; i += batch) {
+		const size_t n = my_min(batch, count - i);
+
+		for (size_t j = 0; j < n; ++j) {
+			lzma_stream *strm = &strms[j];
+			if (lzma_stream_reset(strm) != LZMA_OK)
+				return false;
+
+			strm->next_in = in + (i + j) * msg_out;
+			strm->avail_in = in_sizes[i + j];
+			strm->next_out = out + (i + j) * msg_size;
+			strm->avail_out = msg_size;
+			ptrs[j] = strm;
+		}
+
+		if (batch == 1) {
+			rets[0] = lzma_code(ptrs[0], LZMA_FINISH);
+		} else if (lzma_code_batch(ptrs, rets, n, LZMA_FINISH)
+				!= LZMA_OK) {
+			return false;
+		}
+
+		for (size_t j = 0; j < n; ++j)
+			if (rets[j] != LZMA_STREAM_END
+					|| strms[j].avail_out != 0)
+				return false;
+	}
+
+	return true;
+}
+
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "Usage: %s FILE [PRESET]\n", argv[0]);
+		return 1;
+	}
+
+	const uint32_t preset = argc > 2 ? (uint32_t)atoi(argv[2]) : 6;
+
+	size_t in_size;
+	uint8_t *in = read_file(argv[1], &in_size);
+	if (in == NULL) {
+		fprintf(stderr, "%s: Cannot read the file\n", argv[1]);
+		return 1;
+	}
+
+	lzma_stream strms[BATCH_MAX];
+	for (size_t i = 0; i < BATCH_MAX; ++i) {
+		lzma_stream tmp = LZMA_STREAM_INIT;
+		strms[i] = tmp;
+		if (lzma_stream_decoder(&strms[i], UINT64_MAX, 0) != LZMA_OK)
+			return 1;
+	}
+
+	printf("preset %" PRIu32 ", best of %d\n\n", preset, ROUNDS);
+	printf("message  batch  MiB/s    crc32\n");
+
+	for (size_t m = 0; m < ARRAY_SIZE(msg_sizes); ++m) {
+		const size_t msg_size = msg_sizes[m];
+		if (msg_size > in_size)
+			continue;
+
+		const size_t count = TOTAL_SIZE / msg_size;
+		const size_t msg_out = lzma_stream_buffer_bound(msg_size);
+		uint8_t *comp = malloc(count * msg_out);
+		size_t *comp_sizes = malloc(count * sizeof(size_t));
+		uint8_t *out = malloc(count * msg_size);
+		if (comp == NULL || comp_sizes == NULL || out == NULL)
+			return 1;
+
+		for (size_t i = 0; i < count; ++i) {
+			const size_t pos = i * msg_size
+					% (in_size - msg_size + 1);
+			comp_sizes[i] = 0;
+			if (lzma_easy_buffer_encode(preset, LZMA_CHECK_CRC32,
+					NULL, in + pos, msg_size,
+					comp + i * msg_out, &comp_sizes[i],
+					msg_out) != LZMA_OK)
+				return 1;
+		}
+
+		for (size_t b = 0; b < ARRAY_SIZE(batch_sizes); ++b) {
+			double best = HUGE_VAL;
+
+			for (unsigned r = 0; r < ROUNDS; ++r) {
+				memset(out, 0, count * msg_size);
+
+				const clock_t start = clock();
+				const bool ok = decode(strms, batch_sizes[b],
+						comp, comp_sizes, msg_out,
+						count, out, msg_size);
+				const double secs = (double)(clock() - start)
+						/ CLOCKS_PER_SEC;
+
+				if (!ok) {
+					printf("%-7zu  %5zu  ERROR\n",
+							msg_size,
+							batch_sizes[b]);
+					return 1;
+				}
+
+				best = my_min(best, secs);
+			}
+
+			printf("%-7zu  %5zu  %7.1f  %08" PRIX32 "\n",
+					msg_size, batch_sizes[b],
+					(double)(count * msg_size)
+						/ (1 << 20) / best,
+					lzma_crc32(out, count * msg_size, 0));
+		}
+
+		free(out);
+		free(comp_sizes);
+		free(comp);
+	}
+
+	for (size_t i = 0; i < BATCH_MAX; ++i)
+		lzma_end(&strms[i]);
+
+	free(in);
+	return 0;
+}
@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: 0BSD
+
+///////////////////////////////////////////////////////////////////////////////
+//
+/// \file       bench_decoder.c
+/// \brief      Measures the speed of decoding into one big output buffer
+///
+/// The .xz file given on the command line is decompressed into a buffer
+/// that holds all of the uncompressed data. First lzma_stream_buffer_decode()
+/// is used. It decodes straight into the output buffer. Then lzma_code()
+/// is called with at most CHUNK_SIZE bytes of output space at a time
+/// (but without moving the data anywhere). Then only the first call of
+/// each Block decodes straight to the output and the rest goes through
+/// the dictionary buffer. The difference between the two is the cost of
+/// copying from the dictionary. The best throughput of a few rounds and
+/// the CRC32 of the uncompressed data are printed.
+///
+/// Usage: bench_decoder FILE.xz
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "sysdefs.h"
+#include "lzma.h"
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#define ROUNDS 3
+#define CHUNK_SIZE (64 << 10)
+
+
+static uint8_t *
+read_file(const char *name, size_t *size)
+{
+	FILE *f = fopen(name, "rb");
+	if (f == NULL)
+		return NULL;
+
+	size_t alloc = 1 << 20;
+	uint8_t *buf = malloc(alloc);
+	*size = 0;
+
+	while (buf != NULL) {
+		*size += fread(buf + *size, 1, alloc - *size, f);
+		if (*size < alloc)
+			break;
+
+		alloc *= 2;
+		uint8_t *p = realloc(buf, alloc);
+		if (p == NULL)
+			free(buf);
+
+		buf = p;
+	}
+
+	if (ferror(f)) {
+		free(buf);
+		buf = NULL;
+	}
+
+	fclose(f);
+	return buf;
+}
+
+
+/// Gets the uncompressed size from the Index of the last Stream.
+static uint64_t
+get_size(const uint8_t *in, size_t in_size)
+{
+	lzma_stream_flags flags;
+	if (in_size < 2 * LZMA_STREAM_HEADER_SIZE
+			|| lzma_stream_footer_decode(&flags, in + in_size
+				- LZMA_STREAM_HEADER_SIZE) != LZMA_OK
+			|| flags.backward_size > in_size
+				- 2 * LZMA_STREAM_HEADER_SIZE)
+		return 0;
+
+	size_t in_pos = in_size - LZMA_STREAM_HEADER_SIZE
+			- (size_t)(flags.backward_size);
+	uint64_t memlimit = UINT64_MAX;
+	lzma_index *idx;
+	if (lzma_index_buffer_decode(&idx, &memlimit, NULL,
+			in, &in_pos, in_size - LZMA_STREAM_HEADER_SIZE)
+			!= LZMA_OK)
+		return 0;
+
+	const uint64_t size = lzma_index_uncompressed_size(idx);
+	lzma_index_end(idx, NULL);
+	return size;
+}
+
+
+static bool
+decode_buffer(const uint8_t *in, size_t in_size,
+		uint8_t *out, size_t out_size)
+{
+	uint64_t memlimit = UINT64_MAX;
+	size_t in_pos = 0;
+	size_t out_pos = 0;
+	return lzma_stream_buffer_decode(&memlimit, 0, NULL,
+			in, &in_pos, in_size, out, &out_pos, out_size)
+			== LZMA_OK && out_pos == out_size;
+}
+
+
+static bool
+decode_chunks(const uint8_t *in, size_t in_size,
+		uint8_t *out, size_t out_size)
+{
+	lzma_stream strm = LZMA_STREAM_INIT;
+	if (lzma_stream_decoder(&strm, UINT64_MAX, 0) != LZMA_OK)
+		return false;
+
+	strm.next_in = in;
+	strm.avail_in = in_size;
+	strm.next_out = out;
+
+	lzma_ret ret;
+	do {
+		strm.avail_out = my_min(CHUNK_SIZE,
+				out_size - (size_t)(strm.next_out - out));
+		ret = lzma_code(&strm, LZMA_FINISH);
+	} while (ret == LZMA_OK);
+
+	lzma_end(&strm);
+	return ret == LZMA_STREAM_END && strm.total_out == out_size;
+}
+
+
+int
+main(int argc, char **argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s FILE.xz\n", argv[0]);
+		return 1;
+	}
+
+	size_t in_size;
+	uint8_t *in = read_file(argv[1], &in_size);
+	if (in == NULL) {
+		fprintf(stderr, "%s: Cannot read the file\n", argv[1]);
+		return 1;
+	}
+
+	const uint64_t size = get_size(in, in_size);
+	if (size == 0 || size > SIZE_MAX) {
+		fprintf(stderr, "%s: Cannot get the uncompressed size\n",
+				argv[1]);
+		return 1;
+	}
+
+	const size_t out_size = (size_t)(size);
+	uint8_t *out = malloc(out_size);
+	if (out == NULL)
+		return 1;
+
+	printf("%zu bytes, best of %d\n\n", out_size, ROUNDS);
+	printf("method  MiB/s    crc32\n");
+
+	for (unsigned m = 0; m < 2; ++m) {
+		double best = HUGE_VAL;
+
+		for (unsigned r = 0; r < ROUNDS; ++r) {
+			memset(out, 0, out_size);
+
+			const clock_t start = clock();
+			const bool ok = m == 0
+					? decode_buffer(in, in_size,
+						out, out_size)
+					: decode_chunks(in, in_size,
+						out, out_size);
+			const double secs = (double)(clock() - start)
+					/ CLOCKS_PER_SEC;
+
+			if (!ok) {
+				printf("%-6s  ERROR\n",
+						m == 0 ? "buffer" : "chunks");
+				return 1;
+			}
+
+			best = my_min(best, secs);
+		}
+
+		printf("%-6s  %7.1f  %08" PRIX32 "\n",
+				m == 0 ? "buffer" : "chunks",
+				(double)out_size / (1 << 20) / best,
+				lzma_crc32(out, out_size, 0));
+	}
+
+	free(out);
+	free(in);
+	return 0;
+}
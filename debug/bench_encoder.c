@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: 0BSD
+
+///////////////////////////////////////////////////////////////////////////////
+//
+/// \file       bench_encoder.c
+/// \brief      Measures the speed of the LZMA2 encoder
+///
+/// Each file given on the command line is compressed as a raw LZMA2
+/// stream using presets 6, 9, and 9e. The best throughput of a few
+/// rounds, the compressed size, and the CRC32 of the compressed data
+/// are printed. Run the same program linked against two versions of
+/// liblzma to compare them. The CRC32 shows if an optimization changed
+/// the encoded output.
+///
+/// Usage: bench_encoder FILE...
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "sysdefs.h"
+#include "lzma.h"
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#define ROUNDS 3
+
+
+static const uint32_t presets[] = {
+	6,
+	9,
+	9 | LZMA_PRESET_EXTREME,
+};
+
+
+static uint8_t *
+read_file(const char *name, size_t *size)
+{
+	FILE *f = fopen(name, "rb");
+	if (f == NULL)
+		return NULL;
+
+	size_t alloc = 1 << 20;
+	uint8_t *buf = malloc(alloc);
+	*size = 0;
+
+	while (buf != NULL) {
+		*size += fread(buf + *size, 1, alloc - *size, f);
+		if (*size < alloc)
+			break;
+
+		alloc *= 2;
+		uint8_t *p = realloc(buf, alloc);
+		if (p == NULL)
+			free(buf);
+
+		buf = p;
+	}
+
+	if (ferror(f)) {
+		free(buf);
+		buf = NULL;
+	}
+
+	fclose(f);
+	return buf;
+}
+
+
+/// Compresses in_size bytes and returns the compressed size or zero on
+/// error. The time is stored in *secs.
+static size_t
+compress(const lzma_options_lzma *opt, const uint8_t *in, size_t in_size,
+		uint8_t *out, size_t out_size, double *secs)
+{
+	const lzma_filter filters[] = {
+		{ .id = LZMA_FILTER_LZMA2, .options = (void *)opt },
+		{ .id = LZMA_VLI_UNKNOWN, .options = NULL },
+	};
+
+	size_t out_pos = 0;
+	const clock_t start = clock();
+	const lzma_ret ret = lzma_raw_buffer_encode(filters, NULL,
+			in, in_size, out, &out_pos, out_size);
+	*secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	return ret == LZMA_OK ? out_pos : 0;
+}
+
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s FILE...\n", argv[0]);
+		return 1;
+	}
+
+	printf("best of %d\n\n", ROUNDS);
+	printf("file        preset  MiB/s  size          crc32\n");
+
+	for (int i = 1; i < argc; ++i) {
+		size_t in_size;
+		uint8_t *in = read_file(argv[i], &in_size);
+		if (in == NULL) {
+			fprintf(stderr, "%s: Cannot read the file\n",
+					argv[i]);
+			return 1;
+		}
+
+		const size_t out_size = lzma_stream_buffer_bound(in_size);
+		uint8_t *out = malloc(out_size);
+		if (out == NULL)
+			return 1;
+
+		for (size_t j = 0; j < ARRAY_SIZE(presets); ++j) {
+			lzma_options_lzma opt;
+			if (lzma_lzma_preset(&opt, presets[j]))
+				return 1;
+
+			double secs = HUGE_VAL;
+			size_t size = 0;
+
+			for (unsigned r = 0; r < ROUNDS; ++r) {
+				double s;
+				size = compress(&opt, in, in_size,
+						out, out_size, &s);
+				if (size == 0) {
+					printf("%-10s  ERROR\n", argv[i]);
+					return 1;
+				}
+
+				secs = my_min(secs, s);
+			}
+
+			printf("%-10s  %d%-5s  %5.2f  %-12zu  %08" PRIX32 "\n",
+					j == 0 ? argv[i] : "",
+					(int)(presets[j] & LZMA_PRESET_LEVEL_MASK),
+					(presets[j] & LZMA_PRESET_EXTREME)
+						? "e" : "",
+					(double)in_size / (1 << 20) / secs,
+					size, lzma_crc32(out, size, 0));
+		}
+
+		free(out);
+		free(in);
+	}
+
+	return 0;
+}
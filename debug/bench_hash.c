@@ -0,0 +1,197 @@
+// SPDX-License-Identifier: 0BSD
+
+///////////////////////////////////////////////////////////////////////////////
+//
+/// \file       bench_hash.c
+/// \brief      Compares the table and multiplicative match finder hashes
+///
+/// Each file given on the command line is compressed with LZMA2 using
+/// a few match finders, once with mf_hash = LZMA_MF_HASH_TABLE and once
+/// with LZMA_MF_HASH_MUL. The throughput and the compressed size are
+/// printed for both. Each output is decompressed and compared to the
+/// input to catch bugs.
+///
+/// Usage: bench_hash FILE...
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "sysdefs.h"
+#include "lzma.h"
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#define ROUNDS 3
+
+
+typedef struct {
+	const char *name;
+	uint32_t preset;
+	lzma_match_finder mf;
+} config;
+
+
+static const config configs[] = {
+	{ "hc4 -1", 1, LZMA_MF_HC4 },
+	{ "hr4 -1", 1, LZMA_MF_HR4 },
+	{ "hc3 -3", 3, LZMA_MF_HC3 },
+	{ "bt4 -6", 6, LZMA_MF_BT4 },
+	{ "bt3 -6", 6, LZMA_MF_BT3 },
+	{ "bt4 -9", 9, LZMA_MF_BT4 },
+};
+
+
+static uint8_t *
+read_file(const char *name, size_t *size)
+{
+	FILE *f = fopen(name, "rb");
+	if (f == NULL)
+		return NULL;
+
+	size_t alloc = 1 << 20;
+	uint8_t *buf = malloc(alloc);
+	*size = 0;
+
+	while (buf != NULL) {
+		*size += fread(buf + *size, 1, alloc - *size, f);
+		if (*size < alloc)
+			break;
+
+		alloc *= 2;
+		uint8_t *p = realloc(buf, alloc);
+		if (p == NULL)
+			free(buf);
+
+		buf = p;
+	}
+
+	if (ferror(f)) {
+		free(buf);
+		buf = NULL;
+	}
+
+	fclose(f);
+	return buf;
+}
+
+
+/// Compresses in_size bytes and returns the compressed size or zero on
+/// error. The time is added to *secs.
+static size_t
+compress(const lzma_options_lzma *opt, const uint8_t *in, size_t in_size,
+		uint8_t *out, size_t out_size, double *secs)
+{
+	const lzma_filter filters[] = {
+		{ .id = LZMA_FILTER_LZMA2, .options = (void *)opt },
+		{ .id = LZMA_VLI_UNKNOWN, .options = NULL },
+	};
+
+	size_t out_pos = 0;
+	const clock_t start = clock();
+	const lzma_ret ret = lzma_raw_buffer_encode(filters, NULL,
+			in, in_size, out, &out_pos, out_size);
+	*secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	return ret == LZMA_OK ? out_pos : 0;
+}
+
+
+static bool
+verify(const lzma_options_lzma *opt, const uint8_t *in, size_t in_size,
+		const uint8_t *out, size_t out_size, uint8_t *tmp)
+{
+	const lzma_filter filters[] = {
+		{ .id = LZMA_FILTER_LZMA2, .options = (void *)opt },
+		{ .id = LZMA_VLI_UNKNOWN, .options = NULL },
+	};
+
+	size_t in_pos = 0;
+	size_t tmp_pos = 0;
+	return lzma_raw_buffer_decode(filters, NULL, out, &in_pos, out_size,
+				tmp, &tmp_pos, in_size) == LZMA_OK
+			&& tmp_pos == in_size
+			&& memcmp(in, tmp, in_size) == 0;
+}
+
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s FILE...\n", argv[0]);
+		return 1;
+	}
+
+	for (int i = 1; i < argc; ++i) {
+		size_t in_size;
+		uint8_t *in = read_file(argv[i], &in_size);
+		if (in == NULL) {
+			fprintf(stderr, "%s: Cannot read the file\n",
+					argv[i]);
+			return 1;
+		}
+
+		const size_t out_size = lzma_stream_buffer_bound(in_size);
+		uint8_t *out = malloc(out_size);
+		uint8_t *tmp = malloc(in_size + 1);
+		if (out == NULL || tmp == NULL)
+			return 1;
+
+		printf("%s, %zu bytes\n", argv[i], in_size);
+		printf("            table hash           multiplicative\n");
+		printf("config      MiB/s  size          MiB/s  size"
+				"          speed  size\n");
+
+		for (size_t j = 0; j < ARRAY_SIZE(configs); ++j) {
+			lzma_options_lzma opt;
+			if (lzma_lzma_preset(&opt, configs[j].preset))
+				return 1;
+
+			opt.mf = configs[j].mf;
+
+			double secs[2] = { HUGE_VAL, HUGE_VAL };
+			size_t sizes[2] = { 0, 0 };
+
+			// Alternate the runs and take the fastest of each
+			// to reduce the noise.
+			for (unsigned r = 0; r < ROUNDS; ++r) {
+				for (unsigned h = 0; h < 2; ++h) {
+					opt.mf_hash = h == 0
+						? LZMA_MF_HASH_TABLE
+						: LZMA_MF_HASH_MUL;
+
+					double s;
+					sizes[h] = compress(&opt, in, in_size,
+							out, out_size, &s);
+					if (sizes[h] == 0 || (r == 0
+							&& !verify(&opt, in,
+							in_size, out,
+							sizes[h], tmp))) {
+						printf("%-10s  ERROR\n",
+							configs[j].name);
+						return 1;
+					}
+
+					secs[h] = my_min(secs[h], s);
+				}
+			}
+
+			const double mib = (double)in_size / (1 << 20);
+			printf("%-10s  %5.1f  %-12zu  %5.1f  %-12zu  "
+					"%5.3fx %+.3f %%\n",
+					configs[j].name,
+					mib / secs[0], sizes[0],
+					mib / secs[1], sizes[1],
+					secs[0] / secs[1],
+					100.0 * ((double)sizes[1]
+						/ (double)sizes[0] - 1.0));
+		}
+
+		printf("\n");
+		free(tmp);
+		free(out);
+		free(in);
+	}
+
+	return 0;
+}
@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: 0BSD
+
+///////////////////////////////////////////////////////////////////////////////
+//
+/// \file       bench_hugepage.c
+/// \brief      Compares coding with and without transparent huge pages
+///
+/// Each file given on the command line is compressed with preset 9 and
+/// decompressed again, alternating between lzma_stream.huge_pages set to
+/// LZMA_HUGE_PAGES_AUTO and LZMA_HUGE_PAGES_DISABLED. The best times
+/// are printed. The amount of memory in huge pages is read from
+/// /proc/self/smaps_rollup right before lzma_end() to show if huge pages
+/// were actually used. It's -1 if the file isn't available.
+///
+/// Usage: bench_hugepage FILE...
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "sysdefs.h"
+#include "lzma.h"
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#define ROUNDS 3
+#define PRESET 9
+
+
+static uint8_t *
+read_file(const char *name, size_t *size)
+{
+	FILE *f = fopen(name, "rb");
+	if (f == NULL)
+		return NULL;
+
+	size_t alloc = 1 << 20;
+	uint8_t *buf = malloc(alloc);
+	*size = 0;
+
+	while (buf != NULL) {
+		*size += fread(buf + *size, 1, alloc - *size, f);
+		if (*size < alloc)
+			break;
+
+		alloc *= 2;
+		uint8_t *p = realloc(buf, alloc);
+		if (p == NULL)
+			free(buf);
+
+		buf = p;
+	}
+
+	if (ferror(f)) {
+		free(buf);
+		buf = NULL;
+	}
+
+	fclose(f);
+	return buf;
+}
+
+
+/// Returns the amount of memory in huge pages in KiB or -1 if unknown.
+static long
+huge_kib(void)
+{
+	FILE *f = fopen("/proc/self/smaps_rollup", "r");
+	if (f == NULL)
+		return -1;
+
+	long kib = -1;
+	char line[256];
+	while (fgets(line, sizeof(line), f) != NULL)
+		if (sscanf(line, "AnonHugePages: %ld kB", &kib) == 1)
+			break;
+
+	fclose(f);
+	return kib;
+}
+
+
+/// Runs the stream until LZMA_STREAM_END and returns the output size
+/// or zero on error. *secs gets the time and *kib the amount of huge
+/// pages before lzma_end().
+static size_t
+run(lzma_stream *strm, const uint8_t *in, size_t in_size,
+		uint8_t *out, size_t out_size, clock_t start,
+		double *secs, long *kib)
+{
+	strm->next_in = in;
+	strm->avail_in = in_size;
+	strm->next_out = out;
+	strm->avail_out = out_size;
+
+	const lzma_ret ret = lzma_code(strm, LZMA_FINISH);
+	*secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+	*kib = huge_kib();
+
+	const size_t out_pos = (size_t)strm->total_out;
+	lzma_end(strm);
+
+	return ret == LZMA_STREAM_END ? out_pos : 0;
+}
+
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s FILE...\n", argv[0]);
+		return 1;
+	}
+
+	printf("preset %d, best of %d\n\n", PRESET, ROUNDS);
+	printf("                      compress             decompress\n");
+	printf("file       pages      MiB/s  huge KiB      MiB/s  huge KiB\n");
+
+	for (int i = 1; i < argc; ++i) {
+		size_t in_size;
+		uint8_t *in = read_file(argv[i], &in_size);
+		if (in == NULL) {
+			fprintf(stderr, "%s: Cannot read the file\n",
+					argv[i]);
+			return 1;
+		}
+
+		const size_t out_size = lzma_stream_buffer_bound(in_size);
+		uint8_t *out = malloc(out_size);
+		uint8_t *tmp = malloc(in_size + 1);
+		if (out == NULL || tmp == NULL)
+			return 1;
+
+		double secs[2][2] = {
+			{ HUGE_VAL, HUGE_VAL }, { HUGE_VAL, HUGE_VAL } };
+		long kib[2][2];
+
+		for (unsigned r = 0; r < ROUNDS; ++r) {
+			for (unsigned h = 0; h < 2; ++h) {
+				const lzma_huge_pages mode = h == 0
+						? LZMA_HUGE_PAGES_AUTO
+						: LZMA_HUGE_PAGES_DISABLED;
+
+				lzma_stream strm = LZMA_STREAM_INIT;
+				strm.huge_pages = mode;
+
+				double s;
+				clock_t start = clock();
+				if (lzma_easy_encoder(&strm, PRESET,
+						LZMA_CHECK_CRC64) != LZMA_OK)
+					return 1;
+
+				const size_t out_used = run(&strm, in, in_size,
+						out, out_size, start,
+						&s, &kib[h][0]);
+				if (out_used == 0)
+					return 1;
+
+				secs[h][0] = my_min(secs[h][0], s);
+
+				strm.huge_pages = mode;
+				start = clock();
+				if (lzma_stream_decoder(&strm, UINT64_MAX, 0)
+						!= LZMA_OK)
+					return 1;
+
+				if (run(&strm, out, out_used, tmp, in_size + 1,
+						start, &s, &kib[h][1])
+							!= in_size
+						|| memcmp(in, tmp, in_size)
+							!= 0) {
+					printf("%s: ERROR\n", argv[i]);
+					return 1;
+				}
+
+				secs[h][1] = my_min(secs[h][1], s);
+			}
+		}
+
+		const double mib = (double)in_size / (1 << 20);
+		for (unsigned h = 0; h < 2; ++h)
+			printf("%-10s %-8s  %6.2f  %8ld    %7.1f  %8ld\n",
+					h == 0 ? argv[i] : "",
+					h == 0 ? "auto" : "disabled",
+					mib / secs[h][0], kib[h][0],
+					mib / secs[h][1], kib[h][1]);
+
+		free(tmp);
+		free(out);
+		free(in);
+	}
+
+	return 0;
+}
@@ -0,0 +1,202 @@
+// SPDX-License-Identifier: 0BSD
+
+///////////////////////////////////////////////////////////////////////////////
+//
+/// \file       bench_memcmplen.c
+/// \brief      Compares the match extension kernels of lzma_memcmplen()
+///
+/// Synthetic log-like and VM-image-like data is generated and every
+/// position is compared against an earlier occurrence in the same way
+/// as lzma_mf_find() extends a match of nice_len bytes up to
+/// match_len_max (273) bytes. The time spent is reported for each
+/// kernel supported by the processor.
+///
+/// The kernels are static functions in memcmplen.c, so that file is
+/// included here directly.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "../src/liblzma/common/memcmplen.c"
+#include <stdio.h>
+#include <time.h>
+
+#ifndef LZMA_MEMCMPLEN_DISPATCH
+
+int
+main(void)
+{
+	fprintf(stderr, "SIMD kernels for lzma_memcmplen() "
+			"were not built on this platform.\n");
+	return 1;
+}
+
+#else
+
+#define DATA_SIZE (UINT32_C(32) << 20)
+#define MATCH_LEN_MAX 273
+#define ROUNDS 4
+
+
+static uint32_t seed = 12345;
+
+static uint32_t
+rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+
+/// Log lines with a mostly constant prefix and a varying tail.
+static uint32_t
+gen_log(uint8_t *buf)
+{
+	static const char *const templ[] = {
+		"2026-10-16T12:00:00Z host=ingest-07 svc=api level=INFO "
+			"msg=\"request completed\" route=/v1/objects "
+			"status=200 bytes=",
+		"2026-10-16T12:00:00Z host=ingest-07 svc=api level=WARN "
+			"msg=\"slow upstream response\" route=/v1/objects "
+			"upstream=storage-3 latency_ms=",
+	};
+
+	uint32_t size = 0;
+	while (size < DATA_SIZE - 512) {
+		const char *t = templ[rnd() % 2];
+		const size_t n = strlen(t);
+		memcpy(buf + size, t, n);
+		size += (uint32_t)n;
+		size += (uint32_t)sprintf((char *)buf + size, "%u\n",
+				rnd() % 100000);
+	}
+
+	return size;
+}
+
+
+/// 4 KiB blocks of which most are copies of earlier blocks with
+/// a few modified bytes.
+static uint32_t
+gen_vm(uint8_t *buf)
+{
+	for (uint32_t i = 0; i < 4 * 4096; ++i)
+		buf[i] = (uint8_t)rnd();
+
+	for (uint32_t pos = 4 * 4096; pos < DATA_SIZE; pos += 4096) {
+		memcpy(buf + pos, buf + pos - 4096 * (1 + rnd() % 4), 4096);
+		for (uint32_t j = rnd() % 4; j > 0; --j)
+			buf[pos + rnd() % 4096] = (uint8_t)rnd();
+	}
+
+	return DATA_SIZE;
+}
+
+
+/// Runs the same code path as lzma_memcmplen() with the given kernel.
+static uint64_t
+run(memcmplen_func_type func, const uint8_t *buf, uint32_t size,
+		const uint32_t *dists, uint32_t dists_count)
+{
+	uint64_t total = 0;
+
+	for (uint32_t pos = 4096 * 4; pos + MATCH_LEN_MAX < size; ++pos) {
+		const uint8_t *cur = buf + pos;
+		const uint8_t *prev = cur - dists[pos % dists_count];
+
+		uint32_t len = 0;
+		while (len < 16 && read64ne(cur + len) == read64ne(prev + len))
+			len += 8;
+
+		if (len == 16)
+			len = func(cur, prev, len, MATCH_LEN_MAX);
+
+		total += len;
+	}
+
+	return total;
+}
+
+
+static void
+bench(const char *name, const uint8_t *buf, uint32_t size,
+		const uint32_t *dists, uint32_t dists_count)
+{
+	static const struct {
+		const char *name;
+		memcmplen_func_type func;
+		const char *feature;
+	} kernels[] = {
+		{ "generic", &memcmplen_generic, NULL },
+		{ "avx2", &memcmplen_avx2, "avx2" },
+		{ "avx512bw", &memcmplen_avx512, "avx512bw" },
+	};
+
+	printf("%s:\n", name);
+
+	uint64_t expected = 0;
+	double base = 0.0;
+
+	for (size_t i = 0; i < ARRAY_SIZE(kernels); ++i) {
+		if (kernels[i].feature != NULL && !(
+				i == 1 ? __builtin_cpu_supports("avx2")
+				: __builtin_cpu_supports("avx512bw")))
+			continue;
+
+		uint64_t total = 0;
+		const clock_t start = clock();
+
+		for (unsigned r = 0; r < ROUNDS; ++r)
+			total += run(kernels[i].func, buf, size,
+					dists, dists_count);
+
+		const double secs = (double)(clock() - start)
+				/ CLOCKS_PER_SEC;
+
+		if (i == 0) {
+			expected = total;
+			base = secs;
+		} else if (total != expected) {
+			printf("  %-9s MISMATCH\n", kernels[i].name);
+			continue;
+		}
+
+		printf("  %-9s %8.3f s  %8.1f MiB/s compared  %5.2fx\n",
+				kernels[i].name, secs,
+				(double)total / (1 << 20) / secs,
+				base / secs);
+	}
+}
+
+
+int
+main(void)
+{
+	// LZMA_MEMCMPLEN_EXTRA bytes after the data must be readable.
+	uint8_t *buf = malloc(DATA_SIZE + LZMA_MEMCMPLEN_EXTRA);
+	if (buf == NULL)
+		return 1;
+
+	memcmplen_set_func();
+	printf("Selected kernel: %s\n\n",
+			lzma_memcmplen_long == &memcmplen_avx512 ? "avx512bw"
+			: lzma_memcmplen_long == &memcmplen_avx2 ? "avx2"
+			: "generic");
+
+	// The distances to the previous log lines are roughly multiples
+	// of the line length. Try a few so that matches of varying length
+	// are found like the match finder would find them.
+	memzero(buf, DATA_SIZE + LZMA_MEMCMPLEN_EXTRA);
+	uint32_t size = gen_log(buf);
+	const uint32_t log_dists[] = { 120, 121, 122, 123, 240, 241, 243 };
+	bench("Log lines", buf, size, log_dists, ARRAY_SIZE(log_dists));
+
+	memzero(buf, DATA_SIZE + LZMA_MEMCMPLEN_EXTRA);
+	size = gen_vm(buf);
+	const uint32_t vm_dists[] = { 4096, 8192, 12288, 16384 };
+	bench("VM image blocks", buf, size, vm_dists, ARRAY_SIZE(vm_dists));
+
+	free(buf);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,176 @@
+// SPDX-License-Identifier: 0BSD
+
+///////////////////////////////////////////////////////////////////////////////
+//
+/// \file       bench_normalize.c
+/// \brief      Measures the latency of the match finder normalization
+///
+/// The file is compressed with LZMA2 over and over as a single raw stream
+/// until at least TOTAL MiB have been fed to the encoder. The positions
+/// in the match finder wrap around every 4 GiB so TOTAL should be bigger
+/// than that minus the dictionary size. The input is given in 64 KiB
+/// chunks and the slowest and the average lzma_code() calls are printed
+/// for every match finder. The first two dictionaries of input are
+/// ignored when looking for the slowest call. A stall caused by
+/// normalizing the whole hash table and tree at once shows up as
+/// a big difference between the two.
+///
+/// The output is discarded. The hash chain and hash row match finders
+/// are used with a short search depth because a lot of data is needed.
+///
+/// Usage: bench_normalize DICT_MIB TOTAL_MIB FILE
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "sysdefs.h"
+#include "lzma.h"
+#include <stdio.h>
+#include <time.h>
+
+#define CHUNK_SIZE (64 << 10)
+#define OUT_SIZE (1 << 20)
+
+
+static const lzma_match_finder mfs[] = {
+	LZMA_MF_HC4,
+	LZMA_MF_HR4,
+};
+
+
+static uint8_t *
+read_file(const char *name, size_t *size)
+{
+	FILE *f = fopen(name, "rb");
+	if (f == NULL)
+		return NULL;
+
+	size_t alloc = 1 << 20;
+	uint8_t *buf = malloc(alloc);
+	*size = 0;
+
+	while (buf != NULL) {
+		*size += fread(buf + *size, 1, alloc - *size, f);
+		if (*size < alloc)
+			break;
+
+		alloc *= 2;
+		uint8_t *p = realloc(buf, alloc);
+		if (p == NULL)
+			free(buf);
+
+		buf = p;
+	}
+
+	if (ferror(f)) {
+		free(buf);
+		buf = NULL;
+	}
+
+	fclose(f);
+	return buf;
+}
+
+
+static double
+now(void)
+{
+	const clock_t t = clock();
+	return (double)t / CLOCKS_PER_SEC;
+}
+
+
+int
+main(int argc, char **argv)
+{
+	if (argc != 4) {
+		fprintf(stderr, "Usage: %s DICT_MIB TOTAL_MIB FILE\n",
+				argv[0]);
+		return 1;
+	}
+
+	const uint32_t dict_size = (uint32_t)atoi(argv[1]) << 20;
+	const uint64_t total = (uint64_t)atoi(argv[2]) << 20;
+
+	size_t in_size;
+	uint8_t *in = read_file(argv[3], &in_size);
+	if (in == NULL || in_size < CHUNK_SIZE) {
+		fprintf(stderr, "%s: Cannot read the file or it is smaller "
+				"than 64 KiB\n", argv[3]);
+		return 1;
+	}
+
+	uint8_t *out = malloc(OUT_SIZE);
+	if (out == NULL)
+		return 1;
+
+	printf("dict %s MiB, %s MiB in 64 KiB chunks\n\n", argv[1], argv[2]);
+	printf("mf     MiB/s   avg ms   max ms\n");
+
+	for (size_t i = 0; i < ARRAY_SIZE(mfs); ++i) {
+		lzma_options_lzma opt;
+		if (lzma_lzma_preset(&opt, 1))
+			return 1;
+
+		opt.dict_size = dict_size;
+		opt.mf = mfs[i];
+		opt.nice_len = 16;
+		opt.depth = 4;
+
+		const lzma_filter filters[] = {
+			{ .id = LZMA_FILTER_LZMA2, .options = &opt },
+			{ .id = LZMA_VLI_UNKNOWN, .options = NULL },
+		};
+
+		lzma_stream strm = LZMA_STREAM_INIT;
+		if (lzma_raw_encoder(&strm, filters) != LZMA_OK) {
+			fprintf(stderr, "Cannot initialize the encoder\n");
+			return 1;
+		}
+
+		double max = 0.0;
+		uint64_t chunks = 0;
+		size_t in_pos = 0;
+		const double start = now();
+
+		while (strm.total_in < total) {
+			const size_t amount = my_min(in_size - in_pos,
+					(size_t)CHUNK_SIZE);
+			strm.next_in = in + in_pos;
+			strm.avail_in = amount;
+
+			const double t = now();
+
+			do {
+				strm.next_out = out;
+				strm.avail_out = OUT_SIZE;
+				if (lzma_code(&strm, LZMA_RUN) != LZMA_OK)
+					return 1;
+			} while (strm.avail_in > 0);
+
+			// Skip the first two dictionaries of input when
+			// looking for the slowest call. Then the arrays have
+			// been touched once and the page faults don't show.
+			if (strm.total_in > 2 * (uint64_t)dict_size)
+				max = my_max(max, now() - t);
+
+			++chunks;
+
+			in_pos += amount;
+			if (in_pos == in_size)
+				in_pos = 0;
+		}
+
+		const double secs = now() - start;
+		lzma_end(&strm);
+
+		printf("%s    %6.1f   %6.3f   %6.1f\n",
+				mfs[i] == LZMA_MF_HC4 ? "hc4" : "hr4",
+				(double)total / (1 << 20) / secs,
+				1000.0 * secs / (double)chunks,
+				1000.0 * max);
+	}
+
+	free(out);
+	free(in);
+	return 0;
+}
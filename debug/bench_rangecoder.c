@@ -0,0 +1,139 @@
+// SPDX-License-Identifier: 0BSD
+
+///////////////////////////////////////////////////////////////////////////////
+//
+/// \file       bench_rangecoder.c
+/// \brief      Measures the speed of the range encoder alone
+///
+/// Literal-heavy input is range coded like the LZMA encoder does it:
+/// one is_match bit and an 8-bit literal tree per byte with a call to
+/// rc_encode() after each byte. No match finding or price calculation
+/// is done, so the time is spent in the range encoder. The data is
+/// random with a varying amount of bias so that the probabilities move
+/// around like they do with hard-to-compress data.
+///
+/// The best throughput of a few rounds, the output size, and the CRC32
+/// of the output are printed. Build the program against two versions
+/// of range_encoder.h to compare them. The CRC32 shows if a change
+/// altered the encoded output.
+///
+/// Usage: bench_rangecoder [SIZE_MIB]
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "range_encoder.h"
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#define ROUNDS 5
+
+/// The literal coder is selected by the highest three bits of the
+/// previous byte like with lc=3.
+#define LITERAL_CODERS 8
+
+
+static uint32_t seed = 12345;
+
+static uint32_t
+rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+
+/// Fills buf with bytes whose randomness changes every 64 KiB: from
+/// uniformly random bytes to a few common values.
+static void
+generate(uint8_t *buf, size_t size)
+{
+	for (size_t i = 0; i < size; ++i) {
+		const uint32_t bias = (uint32_t)(i >> 16) % 4;
+		uint32_t r = rnd();
+
+		if (bias != 0 && (r & 3) < bias)
+			r = (r >> 2) % 16 + 'a';
+
+		buf[i] = (uint8_t)(r);
+	}
+
+	return;
+}
+
+
+static size_t
+encode(const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size,
+		probability *probs, double *secs)
+{
+	probability is_match;
+	bit_reset(is_match);
+
+	for (size_t i = 0; i < LITERAL_CODERS * 0x300; ++i)
+		bit_reset(probs[i]);
+
+	lzma_range_encoder rc;
+	rc_reset(&rc);
+
+	size_t out_pos = 0;
+	uint8_t prev_byte = 0;
+
+	const clock_t start = clock();
+
+	for (size_t i = 0; i < in_size; ++i) {
+		rc_bit(&rc, &is_match, 0);
+		rc_bittree(&rc, probs + 0x300 * (prev_byte >> 5), 8, in[i]);
+		prev_byte = in[i];
+
+		if (rc_encode(&rc, out, &out_pos, out_size))
+			return 0;
+	}
+
+	rc_flush(&rc);
+	if (rc_encode(&rc, out, &out_pos, out_size))
+		return 0;
+
+	*secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+	return out_pos;
+}
+
+
+int
+main(int argc, char **argv)
+{
+	const size_t in_size = (size_t)(argc > 1 ? atoi(argv[1]) : 32) << 20;
+
+	uint8_t *in = malloc(in_size);
+	uint8_t *out = malloc(in_size + in_size / 8 + 1024);
+	probability *probs = malloc(LITERAL_CODERS * 0x300
+			* sizeof(probability));
+	if (in == NULL || out == NULL || probs == NULL)
+		return 1;
+
+	generate(in, in_size);
+
+	double best = HUGE_VAL;
+	size_t out_size = 0;
+
+	for (unsigned r = 0; r < ROUNDS; ++r) {
+		double secs = 0;
+		out_size = encode(in, in_size, out,
+				in_size + in_size / 8 + 1024, probs, &secs);
+		if (out_size == 0) {
+			fprintf(stderr, "Output buffer is too small\n");
+			return 1;
+		}
+
+		best = my_min(best, secs);
+	}
+
+	printf("%zu bytes, best of %d: %.1f MiB/s, size %zu, crc32 %08" PRIX32
+			"\n", in_size, ROUNDS,
+			(double)in_size / (1 << 20) / best,
+			out_size, lzma_crc32(out, out_size, 0));
+
+	free(probs);
+	free(out);
+	free(in);
+	return 0;
+}
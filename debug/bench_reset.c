@@ -0,0 +1,201 @@
+// SPDX-License-Identifier: 0BSD
+
+///////////////////////////////////////////////////////////////////////////////
+//
+/// \file       bench_reset.c
+/// \brief      Measures the speed of coding many small .xz streams
+///
+/// The file given on the command line is cut into messages of 1 KiB and
+/// 64 KiB which are compressed and decompressed one .xz stream at a time.
+/// The coders are initialized either once per message or once in total
+/// with lzma_stream_reset() between the messages. The number of messages
+/// per second and the CRC32 of the compressed data are printed. The CRC32
+/// must be the same with both methods.
+///
+/// Usage: bench_reset FILE [PRESET]
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "sysdefs.h"
+#include "lzma.h"
+#include <stdio.h>
+#include <time.h>
+
+/// Each message size is coded until this many bytes have been processed.
+#define TOTAL_SIZE (UINT32_C(32) << 20)
+
+
+static const size_t msg_sizes[] = {
+	1 << 10,
+	64 << 10,
+};
+
+
+static uint8_t *
+read_file(const char *name, size_t *size)
+{
+	FILE *f = fopen(name, "rb");
+	if (f == NULL)
+		return NULL;
+
+	size_t alloc = 1 << 20;
+	uint8_t *buf = malloc(alloc);
+	*size = 0;
+
+	while (buf != NULL) {
+		*size += fread(buf + *size, 1, alloc - *size, f);
+		if (*size < alloc)
+			break;
+
+		alloc *= 2;
+		uint8_t *p = realloc(buf, alloc);
+		if (p == NULL)
+			free(buf);
+
+		buf = p;
+	}
+
+	if (ferror(f)) {
+		free(buf);
+		buf = NULL;
+	}
+
+	fclose(f);
+	return buf;
+}
+
+
+/// Codes one stream from in[in_size] to out[out_size] and returns the
+/// output size or zero on error.
+static size_t
+code(lzma_stream *strm, const uint8_t *in, size_t in_size,
+		uint8_t *out, size_t out_size)
+{
+	strm->next_in = in;
+	strm->avail_in = in_size;
+	strm->next_out = out;
+	strm->avail_out = out_size;
+
+	if (lzma_code(strm, LZMA_FINISH) != LZMA_STREAM_END)
+		return 0;
+
+	return out_size - strm->avail_out;
+}
+
+
+/// Compresses count messages of msg_size bytes to out (msg_out bytes per
+/// message) and decompresses them back. The compressed sizes are stored
+/// in sizes[]. Returns false on error.
+static bool
+run(uint32_t preset, bool reset, const uint8_t *in, size_t in_size,
+		size_t msg_size, size_t count, uint8_t *out, size_t msg_out,
+		size_t *sizes, uint8_t *dec, double *enc_secs,
+		double *dec_secs)
+{
+	lzma_stream strm = LZMA_STREAM_INIT;
+	clock_t start = clock();
+
+	for (size_t i = 0; i < count; ++i) {
+		const size_t pos = i * msg_size % (in_size - msg_size + 1);
+
+		if (i == 0 || !reset) {
+			if (lzma_easy_encoder(&strm, preset, LZMA_CHECK_CRC32)
+					!= LZMA_OK)
+				return false;
+		} else if (lzma_stream_reset(&strm) != LZMA_OK) {
+			return false;
+		}
+
+		sizes[i] = code(&strm, in + pos, msg_size,
+				out + i * msg_out, msg_out);
+		if (sizes[i] == 0)
+			return false;
+	}
+
+	*enc_secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+	start = clock();
+
+	for (size_t i = 0; i < count; ++i) {
+		if (i == 0 || !reset) {
+			if (lzma_stream_decoder(&strm, UINT64_MAX, 0)
+					!= LZMA_OK)
+				return false;
+		} else if (lzma_stream_reset(&strm) != LZMA_OK) {
+			return false;
+		}
+
+		if (code(&strm, out + i * msg_out, sizes[i], dec, msg_size)
+				!= msg_size)
+			return false;
+	}
+
+	*dec_secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	lzma_end(&strm);
+	return true;
+}
+
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "Usage: %s FILE [PRESET]\n", argv[0]);
+		return 1;
+	}
+
+	const uint32_t preset = argc > 2 ? (uint32_t)atoi(argv[2]) : 6;
+
+	size_t in_size;
+	uint8_t *in = read_file(argv[1], &in_size);
+	if (in == NULL) {
+		fprintf(stderr, "%s: Cannot read the file\n", argv[1]);
+		return 1;
+	}
+
+	printf("preset %" PRIu32 "\n\n", preset);
+	printf("message  method  encode/s  decode/s  crc32\n");
+
+	for (size_t j = 0; j < ARRAY_SIZE(msg_sizes); ++j) {
+		const size_t msg_size = msg_sizes[j];
+		if (msg_size > in_size)
+			continue;
+
+		const size_t count = TOTAL_SIZE / msg_size;
+		const size_t msg_out = lzma_stream_buffer_bound(msg_size);
+		uint8_t *out = malloc(count * msg_out);
+		size_t *sizes = malloc(count * sizeof(size_t));
+		uint8_t *dec = malloc(msg_size);
+		if (out == NULL || sizes == NULL || dec == NULL)
+			return 1;
+
+		for (unsigned m = 0; m < 2; ++m) {
+			double enc_secs;
+			double dec_secs;
+			if (!run(preset, m == 1, in, in_size, msg_size,
+					count, out, msg_out, sizes, dec,
+					&enc_secs, &dec_secs)) {
+				printf("%-7zu  ERROR\n", msg_size);
+				return 1;
+			}
+
+			uint32_t crc = 0;
+			for (size_t i = 0; i < count; ++i)
+				crc = lzma_crc32(out + i * msg_out,
+						sizes[i], crc);
+
+			printf("%-7zu  %-6s  %8.0f  %8.0f  %08" PRIX32 "\n",
+					msg_size,
+					m == 0 ? "init" : "reset",
+					(double)count / enc_secs,
+					(double)count / dec_secs, crc);
+		}
+
+		free(dec);
+		free(sizes);
+		free(out);
+	}
+
+	free(in);
+	return 0;
+}
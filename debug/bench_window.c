@@ -0,0 +1,256 @@
+// SPDX-License-Identifier: 0BSD
+
+///////////////////////////////////////////////////////////////////////////////
+//
+/// \file       bench_window.c
+/// \brief      Compares the double-mapped and memmove()d LZ encoder windows
+///
+/// The same synthetic data is compressed with LZMA2 using the default
+/// allocator, which lets liblzma map the history buffer as a ring on
+/// Linux, and with a custom allocator which makes liblzma use a normal
+/// buffer that is moved with memmove(). The outputs must be identical.
+/// The ring is used only with history buffers of at least 8 MiB, so
+/// the presets below 6 would use memmove() in both cases.
+///
+/// The number of bytes the normal buffer copies with memmove() is
+/// calculated from the window geometry in lz_encoder.c assuming that
+/// the encoder stops exactly at read_limit. The real amount is a little
+/// bigger but the difference is negligible.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "sysdefs.h"
+#include "lzma.h"
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#define DATA_SIZE (UINT32_C(48) << 20)
+#define ROUNDS 3
+
+// These match lzma_encoder.c and lzma2_encoder.c.
+#define OPTS 4096
+#define LOOP_INPUT_MAX (OPTS + 1)
+#define MATCH_LEN_MAX 273
+#define LZMA2_CHUNK_MAX (UINT32_C(1) << 16)
+
+// Input is passed to liblzma in blocks of this size like xz does.
+#define IN_BLOCK (UINT32_C(1) << 16)
+
+
+static uint32_t seed = 12345;
+
+static uint32_t
+rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+
+/// Log lines mixed with 4 KiB blocks that repeat with small changes.
+static void
+gen_data(uint8_t *buf)
+{
+	static const char *const templ[] = {
+		"2026-10-16T12:00:00Z host=ingest-07 svc=api level=INFO "
+			"msg=\"request completed\" route=/v1/objects "
+			"status=200 bytes=",
+		"2026-10-16T12:00:00Z host=ingest-07 svc=api level=WARN "
+			"msg=\"slow upstream response\" route=/v1/objects "
+			"upstream=storage-3 latency_ms=",
+	};
+
+	uint32_t size = 0;
+	while (size < DATA_SIZE - 8192) {
+		if (rnd() % 8 != 0 || size < 65536) {
+			const char *t = templ[rnd() % 2];
+			const size_t n = strlen(t);
+			memcpy(buf + size, t, n);
+			size += (uint32_t)n;
+			size += (uint32_t)sprintf((char *)buf + size, "%u\n",
+					rnd() % 100000);
+		} else {
+			memcpy(buf + size, buf + size - 4096 * (1 + rnd() % 8),
+					4096);
+			buf[size + rnd() % 4096] = (uint8_t)rnd();
+			size += 4096;
+		}
+	}
+
+	while (size < DATA_SIZE)
+		buf[size++] = (uint8_t)rnd();
+
+	return;
+}
+
+
+static void *
+plain_alloc(void *opaque lzma_attribute((__unused__)),
+		size_t nmemb lzma_attribute((__unused__)), size_t size)
+{
+	return malloc(size);
+}
+
+
+static void
+plain_free(void *opaque lzma_attribute((__unused__)), void *ptr)
+{
+	free(ptr);
+}
+
+
+/// Calculates how many bytes move_window() in lz_encoder.c copies when
+/// DATA_SIZE bytes are encoded with the given dictionary size.
+static uint64_t
+moved_bytes(uint32_t dict_size)
+{
+	uint32_t before_size = OPTS;
+	if (before_size + dict_size < LZMA2_CHUNK_MAX)
+		before_size = LZMA2_CHUNK_MAX - dict_size;
+
+	const uint32_t keep_size_before = before_size + dict_size;
+	const uint32_t keep_size_after = LOOP_INPUT_MAX + MATCH_LEN_MAX;
+
+	uint32_t reserve = dict_size / 2;
+	if (reserve > (UINT32_C(1) << 30))
+		reserve /= 2;
+
+	reserve += (before_size + MATCH_LEN_MAX + LOOP_INPUT_MAX) / 2
+			+ (UINT32_C(1) << 19);
+
+	const uint32_t size = keep_size_before + reserve + keep_size_after;
+
+	uint64_t moved = 0;
+	uint64_t in_left = DATA_SIZE;
+	uint32_t read_pos = 0;
+	uint32_t write_pos = 0;
+
+	while (in_left > 0) {
+		if (read_pos >= size - keep_size_after) {
+			const uint32_t move_offset = (read_pos
+					- keep_size_before) & ~UINT32_C(15);
+			moved += write_pos - move_offset;
+			read_pos -= move_offset;
+			write_pos -= move_offset;
+		}
+
+		const uint32_t n = (uint32_t)my_min(in_left,
+				my_min(IN_BLOCK, size - write_pos));
+		write_pos += n;
+		in_left -= n;
+
+		if (write_pos > keep_size_after)
+			read_pos = my_max(read_pos,
+					write_pos - keep_size_after);
+	}
+
+	return moved;
+}
+
+
+/// Compresses the data and returns the compressed size or zero on error.
+static size_t
+compress(const lzma_options_lzma *opt, const lzma_allocator *allocator,
+		const uint8_t *in, uint8_t *out, size_t out_size,
+		double *secs)
+{
+	const lzma_filter filters[] = {
+		{ .id = LZMA_FILTER_LZMA2, .options = (void *)opt },
+		{ .id = LZMA_VLI_UNKNOWN, .options = NULL },
+	};
+
+	lzma_stream strm = LZMA_STREAM_INIT;
+	strm.allocator = allocator;
+
+	const clock_t start = clock();
+
+	if (lzma_raw_encoder(&strm, filters) != LZMA_OK)
+		return 0;
+
+	strm.next_out = out;
+	strm.avail_out = out_size;
+
+	size_t in_pos = 0;
+	lzma_ret ret = LZMA_OK;
+	while (ret == LZMA_OK) {
+		if (strm.avail_in == 0 && in_pos < DATA_SIZE) {
+			strm.next_in = in + in_pos;
+			strm.avail_in = my_min(IN_BLOCK, DATA_SIZE - in_pos);
+			in_pos += strm.avail_in;
+		}
+
+		ret = lzma_code(&strm, in_pos == DATA_SIZE
+				? LZMA_FINISH : LZMA_RUN);
+	}
+
+	*secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	const size_t out_pos = (size_t)strm.total_out;
+	lzma_end(&strm);
+
+	return ret == LZMA_STREAM_END ? out_pos : 0;
+}
+
+
+int
+main(void)
+{
+	static const uint32_t presets[] = { 6, 7 };
+
+	const size_t out_size = DATA_SIZE + DATA_SIZE / 8;
+	uint8_t *in = malloc(DATA_SIZE);
+	uint8_t *out_ring = malloc(out_size);
+	uint8_t *out_plain = malloc(out_size);
+	if (in == NULL || out_ring == NULL || out_plain == NULL)
+		return 1;
+
+	gen_data(in);
+
+	const lzma_allocator plain = { &plain_alloc, &plain_free, NULL };
+
+	printf("%u MiB of input\n\n", (unsigned)(DATA_SIZE >> 20));
+	printf("preset  memmove()d    ring       memmove()  speedup\n");
+
+	for (size_t i = 0; i < ARRAY_SIZE(presets); ++i) {
+		lzma_options_lzma opt;
+		if (lzma_lzma_preset(&opt, presets[i]))
+			return 1;
+
+		// Alternate the runs and take the fastest of each to reduce
+		// the noise.
+		double ring_secs = HUGE_VAL;
+		double plain_secs = HUGE_VAL;
+		size_t ring_size = 0;
+		size_t plain_size = 0;
+
+		for (unsigned r = 0; r < ROUNDS; ++r) {
+			double secs;
+			ring_size = compress(&opt, NULL, in,
+					out_ring, out_size, &secs);
+			ring_secs = my_min(ring_secs, secs);
+
+			plain_size = compress(&opt, &plain, in,
+					out_plain, out_size, &secs);
+			plain_secs = my_min(plain_secs, secs);
+		}
+
+		if (ring_size == 0 || ring_size != plain_size
+				|| memcmp(out_ring, out_plain, ring_size) != 0) {
+			printf("%6u  MISMATCH\n", (unsigned)presets[i]);
+			return 1;
+		}
+
+		printf("%6u  %6.1f MiB  %7.3f s  %7.3f s    %5.3fx\n",
+				(unsigned)presets[i],
+				(double)(moved_bytes(opt.dict_size) >> 10)
+					/ 1024,
+				ring_secs, plain_secs,
+				plain_secs / ring_secs);
+	}
+
+	free(in);
+	free(out_ring);
+	free(out_plain);
+	return 0;
+}
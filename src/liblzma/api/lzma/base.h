@@ -470,6 +470,33 @@ typedef struct {
 } lzma_allocator;
 
 
+/**
+ * \brief       Use of huge pages
+ *
+ * \since       5.9.0
+ */
+typedef enum {
+	LZMA_HUGE_PAGES_AUTO        = 0,
+		/**<
+		 * \brief       Use huge pages for big buffers if possible
+		 *
+		 * On Linux, liblzma asks the kernel to back the big
+		 * arrays of the match finders and the dictionary of the
+		 * LZMA decoder with transparent huge pages. This reduces
+		 * TLB misses with big dictionaries. Huge pages are never
+		 * used with a custom allocator.
+		 */
+
+	LZMA_HUGE_PAGES_DISABLED    = 1
+		/**<
+		 * \brief       Don't use huge pages
+		 *
+		 * Huge pages may increase the memory usage slightly because
+		 * the kernel allocates memory in bigger pieces.
+		 */
+} lzma_huge_pages;
+
+
 /**
  * \brief       Internal data structure
  *
@@ -580,8 +607,16 @@ typedef struct {
 	/** \private     Reserved member. */
 	size_t reserved_int4;
 
-	/** \private     Reserved member. */
-	lzma_reserved_enum reserved_enum1;
+	/**
+	 * \brief       Use of huge pages
+	 *
+	 * This is read when a coder is initialized and when lzma_code()
+	 * allocates memory, so it should be set before initializing
+	 * the coder. LZMA_STREAM_INIT sets this to LZMA_HUGE_PAGES_AUTO.
+	 *
+	 * \since       5.9.0
+	 */
+	lzma_huge_pages huge_pages;
 
 	/** \private     Reserved member. */
 	lzma_reserved_enum reserved_enum2;
@@ -610,7 +645,7 @@ typedef struct {
 #define LZMA_STREAM_INIT \
 	{ NULL, 0, 0, NULL, 0, 0, NULL, NULL, \
 	NULL, NULL, NULL, NULL, 0, 0, 0, 0, \
-	LZMA_RESERVED_ENUM, LZMA_RESERVED_ENUM }
+	LZMA_HUGE_PAGES_AUTO, LZMA_RESERVED_ENUM }
 
 
 /**
@@ -637,6 +672,45 @@ extern LZMA_API(lzma_ret) lzma_code(lzma_stream *strm, lzma_action action)
 		lzma_nothrow lzma_attr_warn_unused_result;
 
 
+/**
+ * \brief       Decode with several lzma_streams at once
+ *
+ * The result is the same as if lzma_code(strms[i], action) was called
+ * for each stream and the return value was stored to rets[i]. The LZMA
+ * decoding of two streams at a time is interleaved so that one CPU core
+ * can work on both of them in parallel. This helps when there are many
+ * independent .xz files to decompress, for example, small objects that
+ * are all in memory. The streams are paired in the order they are in
+ * strms[]. After a stream has been finished, the next stream in strms[]
+ * takes its place. The benefit depends on the data: it is largest when
+ * the data has many literals and few matches. When interleaving doesn't
+ * help, the streams are decoded one at a time.
+ *
+ * Interleaving is done with lzma_stream_decoder(), lzma_raw_decoder(),
+ * and lzma_block_decoder() when the filter chain is only LZMA1 or LZMA2.
+ * Other streams are coded with one lzma_code() call each at their turn.
+ *
+ * Each stream must appear in strms[] only once.
+ *
+ * \param       strms   Array of count pointers to lzma_streams
+ * \param[out]  rets    Array of count lzma_ret values
+ * \param       count   Number of streams
+ * \param       action  Action for lzma_code(). Usually this is
+ *                      LZMA_FINISH or LZMA_RUN.
+ *
+ * \return      Possible lzma_ret values:
+ *              - LZMA_OK: All streams were coded. See rets[] for
+ *                the results.
+ *              - LZMA_PROG_ERROR: strms or rets is NULL, or an element
+ *                of strms[] is NULL.
+ *
+ * \since       5.9.0
+ */
+extern LZMA_API(lzma_ret) lzma_code_batch(lzma_stream *const *strms,
+		lzma_ret *rets, size_t count, lzma_action action)
+		lzma_nothrow;
+
+
 /**
  * \brief       Free memory allocated for the coder data structures
  *
@@ -653,6 +727,38 @@ extern LZMA_API(lzma_ret) lzma_code(lzma_stream *strm, lzma_action action)
 extern LZMA_API(void) lzma_end(lzma_stream *strm) lzma_nothrow;
 
 
+/**
+ * \brief       Reset the coder to start a new Stream with the same settings
+ *
+ * This puts the coder back to the state it had right after it was
+ * initialized, using the same options as in the initialization. All
+ * the memory allocated by the coder is kept, so encoding or decoding
+ * many small Streams one after another is cheaper than with calling
+ * the initialization function for each of them. The time taken is
+ * proportional to the size of the probability tables, not to the size
+ * of the dictionary.
+ *
+ * This can be called at any point, also in the middle of a Stream.
+ * strm->total_in and strm->total_out are set to zero.
+ *
+ * Resetting is supported by lzma_easy_encoder() and lzma_stream_encoder()
+ * (but not lzma_stream_encoder_mt()) and by lzma_stream_decoder().
+ *
+ * \param       strm    Pointer to lzma_stream that has been initialized
+ *                      with a coder that supports resetting.
+ *
+ * \return      Possible lzma_ret values:
+ *              - LZMA_OK: Resetting was successful.
+ *              - LZMA_MEM_ERROR
+ *              - LZMA_PROG_ERROR: The coder doesn't support resetting
+ *                or strm hasn't been initialized.
+ *
+ * \since       5.9.0
+ */
+extern LZMA_API(lzma_ret) lzma_stream_reset(lzma_stream *strm)
+		lzma_nothrow;
+
+
 /**
  * \brief       Get progress information
  *
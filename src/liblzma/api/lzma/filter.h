@@ -317,6 +317,38 @@ extern LZMA_API(lzma_ret) lzma_raw_buffer_encode(
 		size_t *out_pos, size_t out_size) lzma_nothrow;
 
 
+/**
+ * \brief       Calculate the size of raw encoded data without storing it
+ *
+ * This encodes the input like lzma_raw_buffer_encode() but the encoded
+ * data is discarded and only its size is returned. This is useful for
+ * comparing the compression ratios of different filter chains or
+ * options without allocating an output buffer for each of them.
+ *
+ * \param       filters     Array of filters terminated with
+ *                          .id == LZMA_VLI_UNKNOWN.
+ * \param       allocator   lzma_allocator for custom allocator functions.
+ *                          Set to NULL to use malloc() and free().
+ * \param       in          Beginning of the input buffer
+ * \param       in_size     Size of the input buffer
+ * \param[out]  out_size    The size of the encoded data is stored here
+ *                          if encoding succeeds.
+ *
+ * \return      Possible lzma_ret values:
+ *              - LZMA_OK: Encoding was successful.
+ *              - LZMA_OPTIONS_ERROR
+ *              - LZMA_MEM_ERROR
+ *              - LZMA_DATA_ERROR
+ *              - LZMA_PROG_ERROR
+ *
+ * \since       5.9.0
+ */
+extern LZMA_API(lzma_ret) lzma_raw_encoded_size(
+		const lzma_filter *filters, const lzma_allocator *allocator,
+		const uint8_t *in, size_t in_size, uint64_t *out_size)
+		lzma_nothrow;
+
+
 /**
  * \brief       Single-call raw decoder
  *
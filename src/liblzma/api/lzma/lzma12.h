@@ -119,7 +119,7 @@ typedef enum {
 		 *  - dict_size > 16 MiB: dict_size * 9.5 + 64 MiB
 		 */
 
-	LZMA_MF_BT4     = 0x14
+	LZMA_MF_BT4     = 0x14,
 		/**<
 		 * \brief       Binary Tree with 2-, 3-, and 4-byte hashing
 		 *
@@ -129,6 +129,51 @@ typedef enum {
 		 *  - dict_size <= 32 MiB: dict_size * 11.5
 		 *  - dict_size > 32 MiB: dict_size * 10.5
 		 */
+
+	LZMA_MF_HR4     = 0x24,
+		/**<
+		 * \brief       Hash Rows with 2-, 3-, and 4-byte hashing
+		 *
+		 * The candidates for the 4-byte hash are kept in rows of
+		 * 16 positions. Each row has 8-bit tags which are compared
+		 * in parallel, so only the candidates that are likely to
+		 * match are read. This is faster than the hash chains but
+		 * remembers fewer old candidates, so the compression ratio
+		 * is usually slightly worse than with LZMA_MF_HC4.
+		 *
+		 * Minimum nice_len: 4
+		 *
+		 * Memory usage: dict_size * 6.5
+		 *
+		 * \since       5.9.0
+		 */
+
+	LZMA_MF_SA      = 0x42
+		/**<
+		 * \brief       Suffix array
+		 *
+		 * The input is split into segments. A suffix array of each
+		 * segment and the dict_size bytes before it is built, and
+		 * the longest match and the nearest match of every shorter
+		 * length are found for every byte. Unlike with the other
+		 * match finders, nothing is missed because of the search
+		 * depth or hash collisions. The depth option is ignored.
+		 * Usually the compression ratio and speed are close to
+		 * LZMA_MF_BT4 with a high depth, so this is mostly useful
+		 * with highly repetitive data where the binary tree search
+		 * gets slow. Frequent LZMA_SYNC_FLUSH makes this very slow.
+		 *
+		 * The encoder buffers dict_size / 2 bytes (at least 1 MiB)
+		 * of input before it starts encoding.
+		 *
+		 * Minimum nice_len: 2
+		 *
+		 * Memory usage:
+		 *  - dict_size <= 2 MiB: dict_size * 23 + 8 MiB
+		 *  - dict_size > 2 MiB: dict_size * 23
+		 *
+		 * \since       5.9.0
+		 */
 } lzma_match_finder;
 
 
@@ -169,7 +214,7 @@ typedef enum {
 		 * a hash chain match finder.
 		 */
 
-	LZMA_MODE_NORMAL = 2
+	LZMA_MODE_NORMAL = 2,
 		/**<
 		 * \brief       Normal compression
 		 *
@@ -177,6 +222,20 @@ typedef enum {
 		 * together with binary tree match finders to expose the
 		 * full potential of the LZMA1 or LZMA2 encoder.
 		 */
+
+	LZMA_MODE_LAZY = 3
+		/**<
+		 * \brief       Lazy compression
+		 *
+		 * The match of each byte is chosen using the same price
+		 * estimates as in the normal mode, but only the next two
+		 * bytes are checked for a cheaper match instead of
+		 * searching for the optimal sequence of matches and
+		 * literals. Speed and compression ratio are between
+		 * the fast and normal modes.
+		 *
+		 * \since       5.9.0
+		 */
 } lzma_mode;
 
 
@@ -481,6 +540,134 @@ typedef struct {
 	 */
 	uint32_t ext_size_high;
 
+	/**
+	 * \brief       Minimum length of long-distance matches
+	 *
+	 * If this is non-zero, the encoder runs a long-distance matcher
+	 * in addition to the match finder. It rolls a hash over windows
+	 * of long_len bytes and remembers a sample of them (on average one
+	 * in 64 positions) from the whole dictionary. When a window
+	 * repeats, the long match is offered to the encoder as a candidate
+	 * together with the matches from the match finder. This finds
+	 * distant repeats of long_len + 64 or more bytes that the match
+	 * finder misses due to its limited search depth, which is useful
+	 * with big dictionaries and data like disk images or backups.
+	 *
+	 * The table of the long-distance matcher needs dict_size / 16
+	 * to dict_size / 8 bytes of memory. This is ignored by the decoder.
+	 *
+	 * This is read only if ext_enable is LZMA_OPTIONS_LZMA_EXT.
+	 * Otherwise the long-distance matcher isn't used. The value must
+	 * be zero or in the range [LZMA_LONG_LEN_MIN, LZMA_LONG_LEN_MAX].
+	 * lzma_lzma_preset() sets this to zero.
+	 *
+	 * \since       5.9.0
+	 */
+	uint32_t long_len;
+#	define LZMA_LONG_LEN_MIN  32
+#	define LZMA_LONG_LEN_MAX  1024
+
+	/**
+	 * \brief       Use a helper thread for match finding
+	 *
+	 * If this is 1, the binary tree match finders (LZMA_MF_BT2,
+	 * LZMA_MF_BT3, and LZMA_MF_BT4) run in a separate thread ahead
+	 * of the encoder. The encoder takes the matches from a queue
+	 * instead of searching them itself, so encoding a single block
+	 * can use two CPU cores. The output is identical to the output
+	 * without the helper thread.
+	 *
+	 * The helper thread isn't used with the hash chain and hash row
+	 * match finders, with the long-distance matcher (see long_len),
+	 * or if liblzma was built without threading support. The queue
+	 * between the threads needs less than 1 MiB of memory.
+	 *
+	 * This is read only if ext_enable is LZMA_OPTIONS_LZMA_EXT.
+	 * Otherwise the helper thread isn't used. The value must be
+	 * 0 or LZMA_MF_THREADS_MAX. lzma_lzma_preset() sets this to zero.
+	 *
+	 * \since       5.9.0
+	 */
+	uint32_t mf_threads;
+#	define LZMA_MF_THREADS_MAX  1
+
+	/**
+	 * \brief       Hash function of the match finder
+	 *
+	 * LZMA_MF_HASH_TABLE is the traditional hash function which
+	 * needs two dependent lookups from a 1 KiB table per byte.
+	 * LZMA_MF_HASH_MUL multiplies the next bytes by a constant
+	 * instead, which is usually a little faster with the hash chain
+	 * and binary tree match finders. The compressed output is
+	 * different but the compression ratio is about the same.
+	 *
+	 * Both hash functions give the same output on all processors.
+	 * The hash function is selected when the encoder is initialized
+	 * and it's used for the whole stream. This is ignored by the
+	 * decoder and by LZMA_MF_BT2 and LZMA_MF_SA which don't hash.
+	 *
+	 * This is read only if ext_enable is LZMA_OPTIONS_LZMA_EXT.
+	 * Otherwise LZMA_MF_HASH_TABLE is used. lzma_lzma_preset() sets
+	 * this to LZMA_MF_HASH_TABLE.
+	 *
+	 * \since       5.9.0
+	 */
+	uint32_t mf_hash;
+#	define LZMA_MF_HASH_TABLE  0
+#	define LZMA_MF_HASH_MUL    1
+
+	/**
+	 * \brief       Target encoding speed in MiB/s per CPU core
+	 *
+	 * If this is non-zero, the LZMA2 encoder measures how fast each
+	 * LZMA2 chunk is encoded and adapts the compression settings to
+	 * keep the speed near this target. The speed is measured using
+	 * the CPU time of the encoding thread when the operating system
+	 * supports it, so the target is a budget for one CPU core that
+	 * doesn't depend on how busy the rest of the system is.
+	 *
+	 * The settings in this structure are the slowest and strongest
+	 * ones that are used. When the encoder is too slow, it moves
+	 * one step towards faster settings. Each step halves nice_len
+	 * and depth, and after a few steps LZMA_MODE_NORMAL is replaced
+	 * by LZMA_MODE_LAZY and then by LZMA_MODE_FAST. When the encoder
+	 * is clearly faster than the target, it moves one step back.
+	 * nice_len and depth aren't changed with LZMA_MF_SA or with
+	 * the match finder helper thread (see mf_threads). The output
+	 * can be decoded normally but it isn't reproducible since it
+	 * depends on the timing.
+	 *
+	 * This is ignored by the LZMA1 encoder and by the decoder.
+	 *
+	 * This is read only if ext_enable is LZMA_OPTIONS_LZMA_EXT.
+	 * Otherwise the speed isn't controlled. The value must not
+	 * exceed LZMA_SPEED_TARGET_MAX. lzma_lzma_preset() sets this
+	 * to zero.
+	 *
+	 * \since       5.9.0
+	 */
+	uint32_t speed_target;
+#	define LZMA_SPEED_TARGET_MAX  UINT32_C(1048576)
+
+	/**
+	 * \brief       Enable the members added in liblzma 5.9.0
+	 *
+	 * Some members of this structure, for example long_len, used to
+	 * be reserved and it was documented that they may be left
+	 * uninitialized. To keep the applications that fill this structure
+	 * by hand from enabling new features by accident, those members
+	 * are read only if this is set to LZMA_OPTIONS_LZMA_EXT. With any
+	 * other value they are ignored and the encoder works like in
+	 * liblzma versions that didn't have them. The documentation of
+	 * each member tells if this applies to it.
+	 *
+	 * lzma_lzma_preset() sets this to LZMA_OPTIONS_LZMA_EXT.
+	 *
+	 * \since       5.9.0
+	 */
+	uint32_t ext_enable;
+#	define LZMA_OPTIONS_LZMA_EXT  UINT32_C(0x4C5A4558)
+
 	/*
 	 * Reserved space to allow possible future extensions without
 	 * breaking the ABI. You should not touch these, because the names
@@ -489,21 +676,6 @@ typedef struct {
 	 * uninitialized.
 	 */
 
-	/** \private     Reserved member. */
-	uint32_t reserved_int4;
-
-	/** \private     Reserved member. */
-	uint32_t reserved_int5;
-
-	/** \private     Reserved member. */
-	uint32_t reserved_int6;
-
-	/** \private     Reserved member. */
-	uint32_t reserved_int7;
-
-	/** \private     Reserved member. */
-	uint32_t reserved_int8;
-
 	/** \private     Reserved member. */
 	lzma_reserved_enum reserved_enum1;
 
@@ -566,3 +738,46 @@ do { \
  */
 extern LZMA_API(lzma_bool) lzma_lzma_preset(
 		lzma_options_lzma *options, uint32_t preset) lzma_nothrow;
+
+
+/**
+ * \brief       Build a preset dictionary from sample data
+ *
+ * Small pieces of data like records of a few hundred bytes compress
+ * poorly one by one because the dictionary is empty at the beginning.
+ * This builds a preset dictionary (see lzma_options_lzma.preset_dict)
+ * of strings that are common in the samples. The samples should be
+ * typical pieces of the data that will be compressed with the
+ * dictionary, and their total size should be at least ten times
+ * the size of the dictionary.
+ *
+ * The same dictionary must be given to the encoder and the decoder.
+ * This works only with raw encoding and decoding.
+ * When many small buffers are compressed with the same dictionary,
+ * initialize the encoder again with the same lzma_stream: with small
+ * dictionaries the state of the match finder after loading the preset
+ * dictionary is saved and restored instead of processing the preset
+ * dictionary again.
+ *
+ * \param       samples         The samples one after another
+ * \param       sample_sizes    Array of the sizes of the samples
+ * \param       sample_count    Number of elements in sample_sizes
+ * \param[out]  dict            Buffer for the dictionary
+ * \param[in,out] dict_size     The size of the dict buffer. The size of
+ *                              the dictionary is stored here on success.
+ *                              It can be less than the buffer size.
+ * \param       allocator       lzma_allocator for custom allocator
+ *                              functions. Set to NULL to use malloc()
+ *                              and free().
+ *
+ * \return      Possible lzma_ret values:
+ *              - LZMA_OK
+ *              - LZMA_MEM_ERROR
+ *              - LZMA_PROG_ERROR
+ *
+ * \since       5.9.0
+ */
+extern LZMA_API(lzma_ret) lzma_dict_train(
+		const uint8_t *samples, const size_t *sample_sizes,
+		size_t sample_count, uint8_t *dict, size_t *dict_size,
+		const lzma_allocator *allocator) lzma_nothrow;
@@ -127,6 +127,12 @@ alone_decode(void *coder_ptr, const lzma_allocator *allocator,
 		coder->options.ext_flags = LZMA_LZMA1EXT_ALLOW_EOPM;
 		lzma_set_ext_size(coder->options, coder->uncompressed_size);
 
+		// A dictionary bigger than the uncompressed data would
+		// never be filled. LZ decoder rounds too small sizes up.
+		if (coder->uncompressed_size < coder->options.dict_size)
+			coder->options.dict_size
+				= (uint32_t)(coder->uncompressed_size);
+
 		// Calculate the memory usage so that it is ready
 		// for SEQ_CODER_INIT. We know that lc/lp/pb are valid
 		// so we can use the _nocheck variant.
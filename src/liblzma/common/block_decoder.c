@@ -209,6 +209,18 @@ block_decoder_end(void *coder_ptr, const lzma_allocator *allocator)
 }
 
 
+static void
+block_decoder_set_batch(void *coder_ptr, lzma_batch *batch)
+{
+	lzma_block_coder *coder = coder_ptr;
+
+	if (coder->next.set_batch != NULL)
+		coder->next.set_batch(coder->next.coder, batch);
+
+	return;
+}
+
+
 extern lzma_ret
 lzma_block_decoder_init(lzma_next_coder *next, const lzma_allocator *allocator,
 		lzma_block *block)
@@ -232,6 +244,7 @@ lzma_block_decoder_init(lzma_next_coder *next, const lzma_allocator *allocator,
 		next->coder = coder;
 		next->code = &block_decode;
 		next->end = &block_decoder_end;
+		next->set_batch = &block_decoder_set_batch;
 		coder->next = LZMA_NEXT_CODER_INIT;
 	}
 
@@ -274,6 +287,33 @@ lzma_block_decoder_init(lzma_next_coder *next, const lzma_allocator *allocator,
 }
 
 
+extern void
+lzma_block_decoder_limit_dict(lzma_block *block)
+{
+	if (block->uncompressed_size == LZMA_VLI_UNKNOWN)
+		return;
+
+	// Matches cannot refer to data before the beginning of the Block,
+	// so a dictionary bigger than the Block would never be filled.
+	// The filters before LZMA2 don't change the size of the data.
+	const uint32_t dict_max = my_max(LZMA_DICT_SIZE_MIN,
+			(uint32_t)my_min(block->uncompressed_size,
+				UINT32_MAX));
+
+	for (size_t i = 0; block->filters[i].id != LZMA_VLI_UNKNOWN; ++i) {
+		const lzma_vli id = block->filters[i].id;
+		lzma_options_lzma *opt = block->filters[i].options;
+
+		if ((id == LZMA_FILTER_LZMA1 || id == LZMA_FILTER_LZMA1EXT
+				|| id == LZMA_FILTER_LZMA2)
+				&& opt != NULL && opt->dict_size > dict_max)
+			opt->dict_size = dict_max;
+	}
+
+	return;
+}
+
+
 extern LZMA_API(lzma_ret)
 lzma_block_decoder(lzma_stream *strm, lzma_block *block)
 {
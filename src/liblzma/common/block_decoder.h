@@ -18,4 +18,11 @@
 extern lzma_ret lzma_block_decoder_init(lzma_next_coder *next,
 		const lzma_allocator *allocator, lzma_block *block);
 
+/// Lowers the dictionary size of the LZMA1 and LZMA2 filters in
+/// block->filters to the Uncompressed Size of the Block if it is known.
+/// This reduces the memory usage when decoding small Blocks. The filter
+/// options must have been allocated by the caller, for example, by
+/// lzma_block_header_decode().
+extern void lzma_block_decoder_limit_dict(lzma_block *block);
+
 #endif
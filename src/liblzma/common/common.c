@@ -11,6 +11,13 @@
 
 #include "common.h"
 
+#ifdef HAVE_MADV_HUGEPAGE
+#	include <sys/mman.h>
+
+/// Size of a transparent huge page on x86-64 and on most arm64 systems
+#	define HUGE_PAGE_SIZE (UINT32_C(2) << 20)
+#endif
+
 
 /////////////
 // Version //
@@ -87,6 +94,65 @@ lzma_free(void *ptr, const lzma_allocator *allocator)
 }
 
 
+const lzma_allocator lzma_allocator_no_huge = { NULL, NULL, NULL };
+
+
+/// Asks the kernel to use transparent huge pages for the part of the
+/// buffer that covers whole huge pages. The buffer comes from malloc()
+/// so it usually isn't aligned to HUGE_PAGE_SIZE. Aligning it would
+/// need a different free function, and the unaligned ends are small
+/// compared to the buffers for which this matters.
+///
+/// Failure is ignored: THP may be disabled or the kernel may be too old.
+static void
+advise_huge(void *ptr, size_t size, const lzma_allocator *allocator)
+{
+#ifdef HAVE_MADV_HUGEPAGE
+	// Custom allocators may return memory that must not be touched
+	// this way, and lzma_allocator_no_huge means that the application
+	// has disabled huge pages.
+	if (ptr == NULL || allocator != NULL)
+		return;
+
+	const uintptr_t begin = ((uintptr_t)ptr + HUGE_PAGE_SIZE - 1)
+			& ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+	const uintptr_t end = ((uintptr_t)ptr + size)
+			& ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+
+	if (end > begin)
+		(void)madvise((void *)begin, end - begin, MADV_HUGEPAGE);
+#else
+	(void)ptr;
+	(void)size;
+	(void)allocator;
+#endif
+
+	return;
+}
+
+
+lzma_attr_alloc_size(1)
+extern void *
+lzma_alloc_huge(size_t size, const lzma_allocator *allocator)
+{
+	void *ptr = lzma_alloc(size, allocator);
+	advise_huge(ptr, size, allocator);
+	return ptr;
+}
+
+
+lzma_attr_alloc_size(1)
+extern void *
+lzma_alloc_zero_huge(size_t size, const lzma_allocator *allocator)
+{
+	// calloc() gets big buffers with mmap() and doesn't touch them,
+	// so the pages can still be huge when they are first used.
+	void *ptr = lzma_alloc_zero(size, allocator);
+	advise_huge(ptr, size, allocator);
+	return ptr;
+}
+
+
 //////////
 // Misc //
 //////////
@@ -221,7 +287,8 @@ lzma_code(lzma_stream *strm, lzma_action action)
 			|| strm->reserved_int2 != 0
 			|| strm->reserved_int3 != 0
 			|| strm->reserved_int4 != 0
-			|| strm->reserved_enum1 != LZMA_RESERVED_ENUM
+			|| (unsigned int)(strm->huge_pages)
+				> LZMA_HUGE_PAGES_DISABLED
 			|| strm->reserved_enum2 != LZMA_RESERVED_ENUM)
 		return LZMA_OPTIONS_ERROR;
 
@@ -291,7 +358,7 @@ lzma_code(lzma_stream *strm, lzma_action action)
 	size_t in_pos = 0;
 	size_t out_pos = 0;
 	lzma_ret ret = strm->internal->next.code(
-			strm->internal->next.coder, strm->allocator,
+			strm->internal->next.coder, lzma_strm_allocator(strm),
 			strm->next_in, &in_pos, strm->avail_in,
 			strm->next_out, &out_pos, strm->avail_out, action);
 
@@ -376,11 +443,86 @@ lzma_code(lzma_stream *strm, lzma_action action)
 }
 
 
+extern bool
+lzma_batch_run_partner(lzma_batch *batch)
+{
+	if (batch->partner == batch->count)
+		return false;
+
+	const size_t i = batch->partner;
+	batch->yielded = false;
+
+	const lzma_ret ret = lzma_code(batch->strms[i], batch->action);
+
+	// If the partner returned early, it is continued later. Otherwise
+	// this was the only lzma_code() call that the application asked
+	// for, and the next stream becomes the partner.
+	if (!batch->yielded || ret != LZMA_OK) {
+		batch->rets[i] = ret;
+		++batch->partner;
+	}
+
+	return true;
+}
+
+
+static void
+batch_set(lzma_stream *strm, lzma_batch *batch)
+{
+	if (strm->internal != NULL && strm->internal->next.set_batch != NULL)
+		strm->internal->next.set_batch(
+				strm->internal->next.coder, batch);
+
+	return;
+}
+
+
+extern LZMA_API(lzma_ret)
+lzma_code_batch(lzma_stream *const *strms, lzma_ret *rets, size_t count,
+		lzma_action action)
+{
+	if (strms == NULL || rets == NULL)
+		return LZMA_PROG_ERROR;
+
+	for (size_t i = 0; i < count; ++i)
+		if (strms[i] == NULL)
+			return LZMA_PROG_ERROR;
+
+	lzma_batch batch = {
+		.strms = strms,
+		.rets = rets,
+		.count = count,
+		.action = action,
+		.partner = 0,
+		.waiting = NULL,
+		.yielded = false,
+	};
+
+	for (size_t i = 0; i < count; ++i)
+		batch_set(strms[i], &batch);
+
+	// Each stream is either called here or by the LZMA decoder of
+	// the previous stream via lzma_batch_run_partner(). In the latter
+	// case the stream may have returned early, and the call here
+	// continues it.
+	while (batch.partner < count) {
+		const size_t i = batch.partner++;
+		rets[i] = lzma_code(strms[i], action);
+	}
+
+	for (size_t i = 0; i < count; ++i)
+		batch_set(strms[i], NULL);
+
+	return LZMA_OK;
+}
+
+
 extern LZMA_API(void)
 lzma_end(lzma_stream *strm)
 {
 	if (strm != NULL && strm->internal != NULL) {
-		lzma_next_end(&strm->internal->next, strm->allocator);
+		lzma_next_end(&strm->internal->next,
+				lzma_strm_allocator(strm));
 		lzma_free(strm->internal, strm->allocator);
 		strm->internal = NULL;
 	}
@@ -389,6 +531,27 @@ lzma_end(lzma_stream *strm)
 }
 
 
+extern LZMA_API(lzma_ret)
+lzma_stream_reset(lzma_stream *strm)
+{
+	if (strm == NULL || strm->internal == NULL
+			|| strm->internal->next.reset == NULL)
+		return LZMA_PROG_ERROR;
+
+	return_if_error(strm->internal->next.reset(
+			strm->internal->next.coder,
+			lzma_strm_allocator(strm)));
+
+	strm->internal->sequence = ISEQ_RUN;
+	strm->internal->allow_buf_error = false;
+
+	strm->total_in = 0;
+	strm->total_out = 0;
+
+	return LZMA_OK;
+}
+
+
 #ifdef HAVE_SYMBOL_VERSIONS_LINUX
 // This is for compatibility with binaries linked against liblzma that
 // has been patched with xz-5.2.2-compat-libs.patch from RHEL/CentOS 7.
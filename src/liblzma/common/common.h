@@ -176,6 +176,8 @@ typedef struct lzma_next_coder_s lzma_next_coder;
 
 typedef struct lzma_filter_info_s lzma_filter_info;
 
+typedef struct lzma_batch_s lzma_batch;
+
 
 /// Type of a function used to initialize a filter encoder or decoder
 typedef lzma_ret (*lzma_init_function)(
@@ -270,6 +272,16 @@ struct lzma_next_coder_s {
 	/// seen, LZMA_OK is allowed too.
 	lzma_ret (*set_out_limit)(void *coder, uint64_t *uncomp_size,
 			uint64_t out_limit);
+
+	/// Reset the coder to the state it had right after its
+	/// initialization without freeing the allocated memory.
+	/// This is NULL if the coder doesn't support lzma_stream_reset().
+	lzma_ret (*reset)(void *coder, const lzma_allocator *allocator);
+
+	/// Tell the LZMA decoder of the chain which lzma_code_batch() call
+	/// the coder belongs to. batch is NULL outside lzma_code_batch().
+	/// This is NULL if the coder cannot take part in interleaving.
+	void (*set_batch)(void *coder, lzma_batch *batch);
 };
 
 
@@ -286,9 +298,41 @@ struct lzma_next_coder_s {
 		.memconfig = NULL, \
 		.update = NULL, \
 		.set_out_limit = NULL, \
+		.reset = NULL, \
+		.set_batch = NULL, \
 	}
 
 
+/// State of lzma_code_batch(). When an LZMA decoder of the batch is ready
+/// to decode, it becomes the waiting decoder and runs the next stream of
+/// the batch with lzma_batch_run_partner(). When the LZMA decoder of that
+/// stream finds the waiting decoder, it decodes both at the same time.
+struct lzma_batch_s {
+	/// The streams given to lzma_code_batch()
+	lzma_stream *const *strms;
+
+	/// Return values of the lzma_code() calls of the streams
+	lzma_ret *rets;
+
+	/// Number of streams in the batch
+	size_t count;
+
+	/// Action that is passed to lzma_code()
+	lzma_action action;
+
+	/// Index of the stream that is run by lzma_batch_run_partner()
+	size_t partner;
+
+	/// The waiting LZMA decoder or NULL. This points to a structure
+	/// in the stack of the waiting decoder.
+	void *waiting;
+
+	/// Set by the LZMA decoder of the partner when it returned early
+	/// because the waiting decoder cannot continue.
+	bool yielded;
+};
+
+
 /// Internal data for lzma_strm_init, lzma_code, and lzma_end. A pointer to
 /// this is stored in lzma_stream.
 struct lzma_internal_s {
@@ -336,6 +380,32 @@ extern void *lzma_alloc_zero(size_t size, const lzma_allocator *allocator);
 /// Frees memory
 extern void lzma_free(void *ptr, const lzma_allocator *allocator);
 
+/// Like lzma_alloc() but for big buffers that should be backed by huge
+/// pages if possible. The memory is freed with lzma_free().
+lzma_attr_alloc_size(1)
+extern void *lzma_alloc_huge(size_t size, const lzma_allocator *allocator);
+
+/// Like lzma_alloc_zero() but for big buffers like lzma_alloc_huge().
+lzma_attr_alloc_size(1)
+extern void *lzma_alloc_zero_huge(
+		size_t size, const lzma_allocator *allocator);
+
+/// The default allocator for streams that have huge pages disabled.
+/// It makes lzma_alloc() use malloc() like a NULL allocator does, but
+/// lzma_alloc_huge() doesn't request huge pages with it.
+extern const lzma_allocator lzma_allocator_no_huge;
+
+/// Returns the allocator that is passed to the coders of strm
+static inline const lzma_allocator *
+lzma_strm_allocator(const lzma_stream *strm)
+{
+	if (strm->allocator == NULL
+			&& strm->huge_pages == LZMA_HUGE_PAGES_DISABLED)
+		return &lzma_allocator_no_huge;
+
+	return strm->allocator;
+}
+
 
 /// Allocates strm->internal if it is NULL, and initializes *strm and
 /// strm->internal. This function is only called via lzma_next_strm_init macro.
@@ -361,6 +431,11 @@ extern void lzma_next_end(lzma_next_coder *next,
 		const lzma_allocator *allocator);
 
 
+/// Calls lzma_code() once for the current partner stream of the batch.
+/// Returns false if all streams of the batch have been finished.
+extern bool lzma_batch_run_partner(lzma_batch *batch);
+
+
 /// Copy as much data as possible from in[] to out[] and update *in_pos
 /// and *out_pos accordingly. Returns the number of bytes copied.
 extern size_t lzma_bufcpy(const uint8_t *restrict in, size_t *restrict in_pos,
@@ -402,7 +477,7 @@ do { \
 do { \
 	return_if_error(lzma_strm_init(strm)); \
 	const lzma_ret ret_ = func(&(strm)->internal->next, \
-			(strm)->allocator, __VA_ARGS__); \
+			lzma_strm_allocator(strm), __VA_ARGS__); \
 	if (ret_ != LZMA_OK) { \
 		lzma_end(strm); \
 		return ret_; \
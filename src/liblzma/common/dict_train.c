@@ -0,0 +1,211 @@
+// SPDX-License-Identifier: 0BSD
+
+///////////////////////////////////////////////////////////////////////////////
+//
+/// \file       dict_train.c
+/// \brief      Builds a preset dictionary from sample data
+///
+/// The samples are split into as many epochs as there are segments in
+/// the dictionary. From each epoch, the segment whose 8-byte substrings
+/// occur in the most samples is picked. The substrings of a picked segment
+/// don't count for the later segments, so the same strings don't end up
+/// in the dictionary many times. The segments with the highest scores are
+/// put at the end of the dictionary where the distances are the shortest.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "common.h"
+
+
+/// Length of the substrings that are counted
+#define TRAIN_KMER 8
+
+/// Size of the segments that the dictionary is made of
+#define TRAIN_SEGMENT 256
+
+/// Limits of the size of the table of substring counts as a power of two
+#define TRAIN_HASH_BITS_MIN 12
+#define TRAIN_HASH_BITS_MAX 22
+
+
+typedef struct {
+	/// Number of samples in which the substrings of this slot occur.
+	/// This is zeroed when a segment containing them is picked.
+	uint32_t count;
+
+	/// Index of the last sample that was counted plus one
+	uint32_t sample;
+} train_slot;
+
+
+typedef struct {
+	/// Position of the segment in the samples
+	size_t pos;
+
+	/// Sum of the counts of the substrings of the segment
+	uint64_t score;
+} train_segment;
+
+
+static inline uint32_t
+kmer_hash(const uint8_t *buf, uint32_t bits)
+{
+	return (uint32_t)((read64le(buf) * UINT64_C(0x9E3779B97F4A7C15))
+			>> (64 - bits));
+}
+
+
+/// Sort the segments by the score in ascending order. This is insertion
+/// sort of at most a few thousand elements.
+static void
+sort_segments(train_segment *segs, size_t count)
+{
+	for (size_t i = 1; i < count; ++i) {
+		const train_segment seg = segs[i];
+		size_t j = i;
+
+		while (j > 0 && segs[j - 1].score > seg.score) {
+			segs[j] = segs[j - 1];
+			--j;
+		}
+
+		segs[j] = seg;
+	}
+
+	return;
+}
+
+
+extern LZMA_API(lzma_ret)
+lzma_dict_train(const uint8_t *samples, const size_t *sample_sizes,
+		size_t sample_count, uint8_t *dict, size_t *dict_size,
+		const lzma_allocator *allocator)
+{
+	if ((samples == NULL && sample_count != 0)
+			|| (sample_sizes == NULL && sample_count != 0)
+			|| dict == NULL || dict_size == NULL
+			|| sample_count > UINT32_MAX - 1)
+		return LZMA_PROG_ERROR;
+
+	size_t total = 0;
+	for (size_t i = 0; i < sample_count; ++i) {
+		if (sample_sizes[i] > SIZE_MAX - total)
+			return LZMA_PROG_ERROR;
+
+		total += sample_sizes[i];
+	}
+
+	// If all the samples fit, they are the best dictionary.
+	if (total <= *dict_size) {
+		if (total > 0)
+			memcpy(dict, samples, total);
+
+		*dict_size = total;
+		return LZMA_OK;
+	}
+
+	const size_t seg_max = *dict_size / TRAIN_SEGMENT;
+	if (seg_max == 0) {
+		*dict_size = 0;
+		return LZMA_OK;
+	}
+
+	// Use one or two slots per byte of the samples.
+	uint32_t bits = TRAIN_HASH_BITS_MIN;
+	while (bits < TRAIN_HASH_BITS_MAX && (total >> bits) != 0)
+		++bits;
+
+	train_slot *slots = lzma_alloc_zero(
+			sizeof(train_slot) << bits, allocator);
+	train_segment *segs = lzma_alloc(
+			seg_max * sizeof(train_segment), allocator);
+	if (slots == NULL || segs == NULL) {
+		lzma_free(slots, allocator);
+		lzma_free(segs, allocator);
+		return LZMA_MEM_ERROR;
+	}
+
+	// Count in how many samples each substring occurs. The substrings
+	// don't cross the boundaries of the samples.
+	size_t pos = 0;
+	for (size_t i = 0; i < sample_count; ++i) {
+		const size_t end = pos + sample_sizes[i];
+
+		for (; pos + TRAIN_KMER <= end; ++pos) {
+			train_slot *slot = &slots[kmer_hash(
+					samples + pos, bits)];
+			if (slot->sample != i + 1) {
+				slot->sample = (uint32_t)(i + 1);
+				++slot->count;
+			}
+		}
+
+		pos = end;
+	}
+
+	// Pick the best segment of each epoch with a sliding window.
+	// A substring that occurs in only one sample doesn't help.
+	const size_t epoch_size = total / seg_max;
+	size_t seg_count = 0;
+
+	for (size_t epoch = 0; epoch < seg_max; ++epoch) {
+		const size_t epoch_start = epoch * epoch_size;
+		const size_t epoch_end = epoch_start + epoch_size;
+		if (epoch_end - epoch_start < TRAIN_SEGMENT)
+			break;
+
+		uint64_t score = 0;
+		uint64_t best_score = 0;
+		size_t best_pos = epoch_start;
+
+		for (size_t p = epoch_start;
+				p + TRAIN_KMER <= epoch_end; ++p) {
+			const uint32_t c = slots[kmer_hash(
+					samples + p, bits)].count;
+			score += c > 1 ? c : 0;
+
+			// Remove the substring that left the window.
+			if (p >= epoch_start + TRAIN_SEGMENT
+					- TRAIN_KMER + 1) {
+				const size_t old = p - (TRAIN_SEGMENT
+						- TRAIN_KMER + 1);
+				const uint32_t oc = slots[kmer_hash(
+						samples + old, bits)].count;
+				score -= oc > 1 ? oc : 0;
+
+				if (score > best_score) {
+					best_score = score;
+					best_pos = old + 1;
+				}
+			} else if (p == epoch_start + TRAIN_SEGMENT
+					- TRAIN_KMER && score > best_score) {
+				best_score = score;
+				best_pos = epoch_start;
+			}
+		}
+
+		if (best_score == 0)
+			continue;
+
+		// The substrings of the picked segment don't count anymore.
+		for (size_t p = best_pos; p <= best_pos + TRAIN_SEGMENT
+				- TRAIN_KMER; ++p)
+			slots[kmer_hash(samples + p, bits)].count = 0;
+
+		segs[seg_count].pos = best_pos;
+		segs[seg_count].score = best_score;
+		++seg_count;
+	}
+
+	sort_segments(segs, seg_count);
+
+	for (size_t i = 0; i < seg_count; ++i)
+		memcpy(dict + i * TRAIN_SEGMENT, samples + segs[i].pos,
+				TRAIN_SEGMENT);
+
+	*dict_size = seg_count * TRAIN_SEGMENT;
+
+	lzma_free(slots, allocator);
+	lzma_free(segs, allocator);
+	return LZMA_OK;
+}
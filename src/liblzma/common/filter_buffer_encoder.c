@@ -3,7 +3,7 @@
 ///////////////////////////////////////////////////////////////////////////////
 //
 /// \file       filter_buffer_encoder.c
-/// \brief      Single-call raw encoding
+/// \brief      Single-call raw encoding and compressed size calculation
 //
 //  Author:     Lasse Collin
 //
@@ -52,3 +52,38 @@ lzma_raw_buffer_encode(
 
 	return ret;
 }
+
+
+extern LZMA_API(lzma_ret)
+lzma_raw_encoded_size(
+		const lzma_filter *filters, const lzma_allocator *allocator,
+		const uint8_t *in, size_t in_size, uint64_t *out_size)
+{
+	if ((in == NULL && in_size != 0) || out_size == NULL)
+		return LZMA_PROG_ERROR;
+
+	lzma_next_coder next = LZMA_NEXT_CODER_INIT;
+	return_if_error(lzma_raw_encoder_init(&next, allocator, filters));
+
+	// The encoded data is written to a small buffer that is reused
+	// until the end of the input. Only the amount is kept.
+	uint8_t buf[4096];
+	uint64_t total = 0;
+	size_t in_pos = 0;
+	lzma_ret ret;
+
+	do {
+		size_t buf_pos = 0;
+		ret = next.code(next.coder, allocator, in, &in_pos, in_size,
+				buf, &buf_pos, sizeof(buf), LZMA_FINISH);
+		total += buf_pos;
+	} while (ret == LZMA_OK);
+
+	lzma_next_end(&next, allocator);
+
+	if (ret != LZMA_STREAM_END)
+		return ret;
+
+	*out_size = total;
+	return LZMA_OK;
+}
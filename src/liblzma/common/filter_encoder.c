@@ -233,7 +233,7 @@ lzma_filters_update(lzma_stream *strm, const lzma_filter *filters)
 	reversed_filters[count].id = LZMA_VLI_UNKNOWN;
 
 	return strm->internal->next.update(strm->internal->next.coder,
-			strm->allocator, filters, reversed_filters);
+			lzma_strm_allocator(strm), filters, reversed_filters);
 }
 
 
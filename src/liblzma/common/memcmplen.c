@@ -0,0 +1,188 @@
+// SPDX-License-Identifier: 0BSD
+
+///////////////////////////////////////////////////////////////////////////////
+//
+/// \file       memcmplen.c
+/// \brief      Runtime-selected kernels for extending long matches
+///
+/// lzma_memcmplen() compares the first 16 bytes inline. If the match is
+/// longer than that, the rest is compared by one of the kernels in this
+/// file. The kernel is chosen once, based on CPUID, using the same
+/// dispatch methods as crc32_fast.c.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "memcmplen.h"
+
+#ifdef LZMA_MEMCMPLEN_DISPATCH
+
+#include <cpuid.h>
+
+
+#define memcmplen_attr_avx2 __attribute__((__target__("avx2")))
+#define memcmplen_attr_avx512 \
+	__attribute__((__target__("avx2,avx512f,avx512bw")))
+
+
+/// Portable fallback: the same 64-bit word loop as in lzma_memcmplen().
+static uint32_t
+memcmplen_generic(const uint8_t *buf1, const uint8_t *buf2,
+		uint32_t len, uint32_t limit)
+{
+	while (len < limit) {
+		const uint64_t x = read64ne(buf1 + len) - read64ne(buf2 + len);
+		if (x != 0) {
+			len += (uint32_t)__builtin_ctzll(x) >> 3;
+			return my_min(len, limit);
+		}
+
+		len += 8;
+	}
+
+	return limit;
+}
+
+
+memcmplen_attr_avx2
+static uint32_t
+memcmplen_avx2(const uint8_t *buf1, const uint8_t *buf2,
+		uint32_t len, uint32_t limit)
+{
+	while (len < limit) {
+		const uint32_t x = ~(uint32_t)_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(
+			_mm256_loadu_si256((const __m256i *)(buf1 + len)),
+			_mm256_loadu_si256((const __m256i *)(buf2 + len))));
+
+		if (x != 0) {
+			len += ctz32(x);
+			return my_min(len, limit);
+		}
+
+		len += 32;
+	}
+
+	return limit;
+}
+
+
+memcmplen_attr_avx512
+static uint32_t
+memcmplen_avx512(const uint8_t *buf1, const uint8_t *buf2,
+		uint32_t len, uint32_t limit)
+{
+	// A 64-byte load is done only if more than 32 bytes are left so
+	// that at most LZMA_MEMCMPLEN_EXTRA bytes are read past the limit.
+	// The tail is handled with one 32-byte compare.
+	while (limit > len && limit - len > 32) {
+		const uint64_t x = _mm512_cmpneq_epi8_mask(
+			_mm512_loadu_si512((const void *)(buf1 + len)),
+			_mm512_loadu_si512((const void *)(buf2 + len)));
+
+		if (x != 0) {
+			len += (uint32_t)__builtin_ctzll(x);
+			return my_min(len, limit);
+		}
+
+		len += 64;
+	}
+
+	if (len >= limit)
+		return limit;
+
+	const uint32_t x = ~(uint32_t)_mm256_movemask_epi8(
+		_mm256_cmpeq_epi8(
+		_mm256_loadu_si256((const __m256i *)(buf1 + len)),
+		_mm256_loadu_si256((const __m256i *)(buf2 + len))));
+
+	if (x != 0)
+		len += ctz32(x);
+	else
+		len += 32;
+
+	return my_min(len, limit);
+}
+
+
+typedef uint32_t (*memcmplen_func_type)(const uint8_t *buf1,
+		const uint8_t *buf2, uint32_t len, uint32_t limit);
+
+
+static memcmplen_func_type
+memcmplen_resolve(void)
+{
+	uint32_t r[4]; // eax, ebx, ecx, edx
+
+	// OSXSAVE (bit 27) and AVX (bit 28) in ecx. Without OSXSAVE
+	// the XGETBV instruction isn't available.
+	const uint32_t ecx_mask = (UINT32_C(1) << 27) | (UINT32_C(1) << 28);
+	if (!__get_cpuid(1, &r[0], &r[1], &r[2], &r[3])
+			|| (r[2] & ecx_mask) != ecx_mask
+			|| __get_cpuid_max(0, NULL) < 7)
+		return &memcmplen_generic;
+
+	// The operating system must save the YMM (and for AVX-512 also
+	// the opmask and ZMM) registers on context switches. XGETBV is
+	// written as bytes so that old assemblers don't need to know it.
+	uint32_t xcr0;
+	uint32_t xcr0_high;
+	__asm__(".byte 0x0f, 0x01, 0xd0"
+			: "=a"(xcr0), "=d"(xcr0_high) : "c"(0));
+	(void)xcr0_high;
+
+	if ((xcr0 & 0x06) != 0x06)
+		return &memcmplen_generic;
+
+	__cpuid_count(7, 0, r[0], r[1], r[2], r[3]);
+
+	// AVX-512F (bit 16) and AVX-512BW (bit 30) in ebx
+	const uint32_t avx512_mask = (UINT32_C(1) << 16) | (UINT32_C(1) << 30);
+	if ((r[1] & avx512_mask) == avx512_mask && (xcr0 & 0xE6) == 0xE6)
+		return &memcmplen_avx512;
+
+	// AVX2 (bit 5) in ebx
+	if (r[1] & (UINT32_C(1) << 5))
+		return &memcmplen_avx2;
+
+	return &memcmplen_generic;
+}
+
+
+#ifdef HAVE_FUNC_ATTRIBUTE_CONSTRUCTOR
+// Constructor method. Until the constructor has run, the generic
+// version is used, so the pointer is always valid.
+#	define MEMCMPLEN_SET_FUNC_ATTR __attribute__((__constructor__))
+uint32_t (*lzma_memcmplen_long)(const uint8_t *buf1,
+		const uint8_t *buf2, uint32_t len, uint32_t limit)
+		= &memcmplen_generic;
+#else
+// First Call Resolution method. See crc32_dispatch() in crc32_fast.c.
+#	define MEMCMPLEN_SET_FUNC_ATTR
+static uint32_t memcmplen_dispatch(const uint8_t *buf1,
+		const uint8_t *buf2, uint32_t len, uint32_t limit);
+uint32_t (*lzma_memcmplen_long)(const uint8_t *buf1,
+		const uint8_t *buf2, uint32_t len, uint32_t limit)
+		= &memcmplen_dispatch;
+#endif
+
+
+MEMCMPLEN_SET_FUNC_ATTR
+static void
+memcmplen_set_func(void)
+{
+	lzma_memcmplen_long = memcmplen_resolve();
+	return;
+}
+
+
+#ifndef HAVE_FUNC_ATTRIBUTE_CONSTRUCTOR
+static uint32_t
+memcmplen_dispatch(const uint8_t *buf1, const uint8_t *buf2,
+		uint32_t len, uint32_t limit)
+{
+	memcmplen_set_func();
+	return lzma_memcmplen_long(buf1, buf2, len, limit);
+}
+#endif
+
+#endif
@@ -30,6 +30,32 @@
 #endif
 
 
+// On x86-64 with GCC or Clang, long matches are extended with AVX2 or
+// AVX-512BW when the processor supports them. The kernels live in
+// memcmplen.c and one of them is selected at runtime via CPUID in the
+// same way as the CLMUL CRC code in crc32_fast.c. The first 16 bytes are
+// always compared inline because most matches are short and the call
+// through a function pointer would cost more than it saves.
+//
+// EDG-based compilers are excluded for the same reason as in
+// crc_x86_clmul.h. HAVE_SMALL builds stay with the plain inline loop.
+#if defined(TUKLIB_FAST_UNALIGNED_ACCESS) \
+		&& defined(HAVE_IMMINTRIN_H) && defined(HAVE_CPUID_H) \
+		&& defined(__x86_64__) && !defined(__EDG__) \
+		&& (TUKLIB_GNUC_REQ(5, 0) || defined(__clang__)) \
+		&& !defined(HAVE_SMALL)
+#	define LZMA_MEMCMPLEN_DISPATCH 1
+
+/// Compare the rest of a match that is already known to be at least
+/// 16 bytes long. This points to the fastest kernel supported by the
+/// processor. It has the same semantics as lzma_memcmplen() except that
+/// it may read up to LZMA_MEMCMPLEN_EXTRA (32) bytes past the limit.
+lzma_attr_visibility_hidden
+extern uint32_t (*lzma_memcmplen_long)(const uint8_t *buf1,
+		const uint8_t *buf2, uint32_t len, uint32_t limit);
+#endif
+
+
 /// Find out how many equal bytes the two buffers have.
 ///
 /// \param      buf1    First buffer
@@ -78,7 +104,14 @@ lzma_memcmplen(const uint8_t *buf1, const uint8_t *buf2,
 	//
 	// The processor info is based on Agner Fog's microarchitecture.pdf
 	// version 2023-05-26. https://www.agner.org/optimize/
-#define LZMA_MEMCMPLEN_EXTRA 8
+#	ifdef LZMA_MEMCMPLEN_DISPATCH
+	// The AVX2 kernel does 32-byte loads. The AVX-512BW kernel does
+	// 64-byte loads only when they end within 32 bytes of the limit.
+#		define LZMA_MEMCMPLEN_EXTRA 32
+	const uint32_t inline_end = len + 16;
+#	else
+#		define LZMA_MEMCMPLEN_EXTRA 8
+#	endif
 	while (len < limit) {
 #	ifdef WORDS_BIGENDIAN
 		const uint64_t x = read64ne(buf1 + len) ^ read64ne(buf2 + len);
@@ -101,6 +134,11 @@ lzma_memcmplen(const uint8_t *buf1, const uint8_t *buf2,
 		}
 
 		len += 8;
+
+#	ifdef LZMA_MEMCMPLEN_DISPATCH
+		if (len == inline_end && len < limit)
+			return lzma_memcmplen_long(buf1, buf2, len, limit);
+#	endif
 	}
 
 	return limit;
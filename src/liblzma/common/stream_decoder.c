@@ -28,6 +28,10 @@ typedef struct {
 	/// Block decoder
 	lzma_next_coder block_decoder;
 
+	/// lzma_code_batch() that this decoder is part of or NULL.
+	/// This is passed to each new Block decoder.
+	lzma_batch *batch;
+
 	/// Block options decoded by the Block Header decoder and used by
 	/// the Block decoder.
 	lzma_block block_options;
@@ -213,6 +217,9 @@ stream_decode(void *coder_ptr, const lzma_allocator *allocator,
 		// it always resets this to false.
 		coder->block_options.ignore_check = coder->ignore_check;
 
+		// A small Block doesn't need the whole dictionary.
+		lzma_block_decoder_limit_dict(&coder->block_options);
+
 		// Check the memory usage limit.
 		const uint64_t memusage = lzma_raw_decoder_memusage(filters);
 		lzma_ret ret;
@@ -237,6 +244,13 @@ stream_decode(void *coder_ptr, const lzma_allocator *allocator,
 						&coder->block_decoder,
 						allocator,
 						&coder->block_options);
+
+				if (ret == LZMA_OK && coder->batch != NULL
+						&& coder->block_decoder
+							.set_batch != NULL)
+					coder->block_decoder.set_batch(
+						coder->block_decoder.coder,
+						coder->batch);
 			}
 		}
 
@@ -417,6 +431,33 @@ stream_decoder_memconfig(void *coder_ptr, uint64_t *memusage,
 }
 
 
+/// This is for lzma_stream_reset(). Unlike stream_decoder_reset() which is
+/// also used between concatenated Streams, this forgets the earlier
+/// Streams. The Block decoder is initialized again for the next Block
+/// and it keeps its dictionary buffer if the size doesn't change.
+static lzma_ret
+stream_decoder_restart(void *coder_ptr, const lzma_allocator *allocator)
+{
+	lzma_stream_coder *coder = coder_ptr;
+	coder->first_stream = true;
+	return stream_decoder_reset(coder, allocator);
+}
+
+
+static void
+stream_decoder_set_batch(void *coder_ptr, lzma_batch *batch)
+{
+	lzma_stream_coder *coder = coder_ptr;
+	coder->batch = batch;
+
+	if (coder->block_decoder.set_batch != NULL)
+		coder->block_decoder.set_batch(
+				coder->block_decoder.coder, batch);
+
+	return;
+}
+
+
 extern lzma_ret
 lzma_stream_decoder_init(
 		lzma_next_coder *next, const lzma_allocator *allocator,
@@ -438,8 +479,11 @@ lzma_stream_decoder_init(
 		next->end = &stream_decoder_end;
 		next->get_check = &stream_decoder_get_check;
 		next->memconfig = &stream_decoder_memconfig;
+		next->reset = &stream_decoder_restart;
+		next->set_batch = &stream_decoder_set_batch;
 
 		coder->block_decoder = LZMA_NEXT_CODER_INIT;
+		coder->batch = NULL;
 		coder->index_hash = NULL;
 	}
 
@@ -906,6 +906,9 @@ decode_block_header(struct lzma_stream_coder *coder,
 	// it always resets this to false.
 	coder->block_options.ignore_check = coder->ignore_check;
 
+	// A small Block doesn't need the whole dictionary.
+	lzma_block_decoder_limit_dict(&coder->block_options);
+
 	// coder->block_options is ready now.
 	return LZMA_STREAM_END;
 }
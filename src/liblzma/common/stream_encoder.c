@@ -282,6 +282,49 @@ error:
 }
 
 
+/// Start a new Stream: reset the Index and put the Stream Header into
+/// the buffer. block_options.check must have been set.
+static lzma_ret
+stream_encoder_start(lzma_stream_coder *coder,
+		const lzma_allocator *allocator)
+{
+	coder->sequence = SEQ_STREAM_HEADER;
+
+	// Initialize the Index
+	lzma_index_end(coder->index, allocator);
+	coder->index = lzma_index_init(allocator);
+	if (coder->index == NULL)
+		return LZMA_MEM_ERROR;
+
+	// Encode the Stream Header
+	lzma_stream_flags stream_flags = {
+		.version = 0,
+		.check = coder->block_options.check,
+	};
+	return_if_error(lzma_stream_header_encode(
+			&stream_flags, coder->buffer));
+
+	coder->buffer_pos = 0;
+	coder->buffer_size = LZMA_STREAM_HEADER_SIZE;
+	return LZMA_OK;
+}
+
+
+static lzma_ret
+stream_encoder_reset(void *coder_ptr, const lzma_allocator *allocator)
+{
+	lzma_stream_coder *coder = coder_ptr;
+
+	// The Block encoder is initialized again with the same filter
+	// chain at the beginning of the first Block. Its LZ encoder
+	// keeps the history buffer and the match finder arrays.
+	coder->block_encoder_is_initialized = false;
+	coder->block_options.version = 0;
+
+	return stream_encoder_start(coder, allocator);
+}
+
+
 static lzma_ret
 stream_encoder_init(lzma_next_coder *next, const lzma_allocator *allocator,
 		const lzma_filter *filters, lzma_check check)
@@ -302,6 +345,7 @@ stream_encoder_init(lzma_next_coder *next, const lzma_allocator *allocator,
 		next->code = &stream_encode;
 		next->end = &stream_encoder_end;
 		next->update = &stream_encoder_update;
+		next->reset = &stream_encoder_reset;
 
 		coder->filters[0].id = LZMA_VLI_UNKNOWN;
 		coder->block_encoder = LZMA_NEXT_CODER_INIT;
@@ -310,26 +354,10 @@ stream_encoder_init(lzma_next_coder *next, const lzma_allocator *allocator,
 	}
 
 	// Basic initializations
-	coder->sequence = SEQ_STREAM_HEADER;
 	coder->block_options.version = 0;
 	coder->block_options.check = check;
 
-	// Initialize the Index
-	lzma_index_end(coder->index, allocator);
-	coder->index = lzma_index_init(allocator);
-	if (coder->index == NULL)
-		return LZMA_MEM_ERROR;
-
-	// Encode the Stream Header
-	lzma_stream_flags stream_flags = {
-		.version = 0,
-		.check = check,
-	};
-	return_if_error(lzma_stream_header_encode(
-			&stream_flags, coder->buffer));
-
-	coder->buffer_pos = 0;
-	coder->buffer_size = LZMA_STREAM_HEADER_SIZE;
+	return_if_error(stream_encoder_start(coder, allocator));
 
 	// Initialize the Block encoder. This way we detect unsupported
 	// filter chains when initializing the Stream encoder instead of
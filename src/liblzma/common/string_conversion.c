@@ -158,6 +158,12 @@ str_append_u32(lzma_str *str, uint32_t v, bool use_byte_suffix)
 /// BCJ filter start offset which usually is zero.
 #define OPTMAP_NO_STRFY_ZERO 0x04
 
+/// For option_map.flags: The option is a member of lzma_options_lzma that
+/// used to be reserved. It won't be included in the stringified output
+/// unless lzma_options_lzma.ext_enable is LZMA_OPTIONS_LZMA_EXT because
+/// otherwise the member may be uninitialized.
+#define OPTMAP_LZMA12_EXT 0x08
+
 /// Possible values for option_map.type. Since OPTMAP_TYPE_UINT32 is 0,
 /// it doesn't need to be specified in the initializers as it is
 /// the implicit value.
@@ -207,6 +213,9 @@ typedef struct {
 /// If the integer is zero and .flags has OPTMAP_NO_STRFY_ZERO then the
 /// option is skipped.
 ///
+/// If .flags has OPTMAP_LZMA12_EXT and lzma_options_lzma.ext_enable isn't
+/// LZMA_OPTIONS_LZMA_EXT then the option is skipped.
+///
 /// If .flags has OPTMAP_USE_NAME_VALUE_MAP set then .u.map will be used
 /// to convert the option to a string. If the map doesn't contain a string
 /// for the integer value then "UNKNOWN" is used.
@@ -364,6 +373,7 @@ set_lzma12_preset(const char **const str, const char *str_end,
 static const name_value_map lzma12_mode_map[] = {
 	{ "fast",   LZMA_MODE_FAST },
 	{ "normal", LZMA_MODE_NORMAL },
+	{ "lazy",   LZMA_MODE_LAZY },
 	{ "",       0 }
 };
 
@@ -374,10 +384,19 @@ static const name_value_map lzma12_mf_map[] = {
 	{ "bt2", LZMA_MF_BT2 },
 	{ "bt3", LZMA_MF_BT3 },
 	{ "bt4", LZMA_MF_BT4 },
+	{ "hr4", LZMA_MF_HR4 },
+	{ "sa",  LZMA_MF_SA },
 	{ "",    0 }
 };
 
 
+static const name_value_map lzma12_hash_map[] = {
+	{ "table", LZMA_MF_HASH_TABLE },
+	{ "mul",   LZMA_MF_HASH_MUL },
+	{ "",      0 }
+};
+
+
 static const option_map lzma12_optmap[] = {
 	{
 		.name = "preset",
@@ -427,6 +446,30 @@ static const option_map lzma12_optmap[] = {
 		.offset = offsetof(lzma_options_lzma, depth),
 		.u.range.min = 0,
 		.u.range.max = UINT32_MAX,
+	}, {
+		.name = "long",
+		.flags = OPTMAP_NO_STRFY_ZERO | OPTMAP_LZMA12_EXT,
+		.offset = offsetof(lzma_options_lzma, long_len),
+		.u.range.min = LZMA_LONG_LEN_MIN,
+		.u.range.max = LZMA_LONG_LEN_MAX,
+	}, {
+		.name = "mft",
+		.flags = OPTMAP_NO_STRFY_ZERO | OPTMAP_LZMA12_EXT,
+		.offset = offsetof(lzma_options_lzma, mf_threads),
+		.u.range.min = 0,
+		.u.range.max = LZMA_MF_THREADS_MAX,
+	}, {
+		.name = "hash",
+		.flags = OPTMAP_USE_NAME_VALUE_MAP | OPTMAP_NO_STRFY_ZERO
+				| OPTMAP_LZMA12_EXT,
+		.offset = offsetof(lzma_options_lzma, mf_hash),
+		.u.map = lzma12_hash_map,
+	}, {
+		.name = "speed",
+		.flags = OPTMAP_NO_STRFY_ZERO | OPTMAP_LZMA12_EXT,
+		.offset = offsetof(lzma_options_lzma, speed_target),
+		.u.range.min = 0,
+		.u.range.max = LZMA_SPEED_TARGET_MAX,
 	}
 };
 
@@ -493,12 +536,12 @@ static const struct {
 } filter_name_map[] = {
 #if defined (HAVE_ENCODER_LZMA1) || defined(HAVE_DECODER_LZMA1)
 	{ "lzma1",        sizeof(lzma_options_lzma),  LZMA_FILTER_LZMA1,
-	  &parse_lzma12,  lzma12_optmap, 9, 5, false },
+	  &parse_lzma12,  lzma12_optmap, 12, 5, false },
 #endif
 
 #if defined(HAVE_ENCODER_LZMA2) || defined(HAVE_DECODER_LZMA2)
 	{ "lzma2",        sizeof(lzma_options_lzma),  LZMA_FILTER_LZMA2,
-	  &parse_lzma12,  lzma12_optmap, 9, 2, false },
+	  &parse_lzma12,  lzma12_optmap, 13, 2, false },
 #endif
 
 #if defined(HAVE_ENCODER_X86) || defined(HAVE_DECODER_X86)
@@ -1073,6 +1116,11 @@ strfy_filter(lzma_str *dest, const char *delimiter,
 		if (optmap[i].type == OPTMAP_TYPE_LZMA_PRESET)
 			continue;
 
+		if ((optmap[i].flags & OPTMAP_LZMA12_EXT)
+				&& ((const lzma_options_lzma *)(filter_options))
+					->ext_enable != LZMA_OPTIONS_LZMA_EXT)
+			continue;
+
 		// All options have integer values, some just are mapped
 		// to a string with a name_value_map. LZMA1/2 preset
 		// isn't reversed back to preset=PRESET form.
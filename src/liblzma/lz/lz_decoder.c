@@ -19,10 +19,21 @@
 #include "lz_decoder.h"
 
 
+/// Initial size of the dictionary buffer. The buffer is doubled each time
+/// it becomes full until it has the full size of the dictionary.
+#define LZ_DICT_INIT_SIZE (UINT32_C(64) << 10)
+
+
 typedef struct {
 	/// Dictionary (history buffer)
 	lzma_dict dict;
 
+	/// Size of the dictionary buffer when it has grown to its full
+	/// size. This is 2 * LZ_DICT_REPEAT_MAX bytes larger than the
+	/// dictionary size. The dictionary wraps only after dict.size
+	/// has reached this.
+	size_t dict_max;
+
 	/// The actual LZ-based decoder e.g. LZMA
 	lzma_lz_decoder lz;
 
@@ -55,20 +66,201 @@ lz_decoder_reset(lzma_coder *coder)
 {
 	coder->dict.pos = LZ_DICT_INIT_POS;
 	coder->dict.full = 0;
-	coder->dict.buf[LZ_DICT_INIT_POS - 1] = '\0';
+	coder->dict.init_pos = LZ_DICT_INIT_POS;
 	coder->dict.has_wrapped = false;
 	coder->dict.need_reset = false;
 	return;
 }
 
 
+/// Makes the dictionary buffer at least needed bytes. The dictionary buffer
+/// is allocated when it is first needed. It isn't needed at all if every
+/// call decodes from an empty dictionary to the end of the data. It starts
+/// small and grows geometrically so that a small file doesn't make
+/// the decoder allocate the whole dictionary. The buffer can only grow
+/// before the dictionary has wrapped.
+static lzma_ret
+dict_alloc(lzma_coder *coder, const lzma_allocator *allocator,
+		size_t needed)
+{
+	assert(needed <= coder->dict_max);
+
+	if (coder->dict.buf != NULL && coder->dict.size >= needed)
+		return LZMA_OK;
+
+	assert(!coder->dict.has_wrapped);
+
+	size_t new_size = coder->dict.size > coder->dict_max / 2
+			? coder->dict_max : coder->dict.size * 2;
+	new_size = my_max(new_size, LZ_DICT_INIT_SIZE);
+	new_size = my_max(new_size, needed);
+
+	// Keep the size a multiple of 16 like dict_max is.
+	new_size = my_min((new_size + 15) & ~(size_t)(15), coder->dict_max);
+
+	// The LZ_DICT_EXTRA bytes at the end of the buffer aren't
+	// included in coder->dict.size. These extra bytes allow
+	// dict_repeat() to read and write more data than requested.
+	// Otherwise this extra space is ignored.
+	//
+	// Matches are copied from random places in the dictionary,
+	// so it's backed by huge pages if possible.
+	uint8_t *buf = lzma_alloc_huge(new_size + LZ_DICT_EXTRA, allocator);
+	if (buf == NULL)
+		return LZMA_MEM_ERROR;
+
+	// The data is at the same position in the new buffer so that
+	// the lowest bits of dict.pos stay the same.
+	if (coder->dict.buf != NULL) {
+		memcpy(buf + coder->dict.init_pos,
+				coder->dict.buf + coder->dict.init_pos,
+				coder->dict.pos - coder->dict.init_pos);
+		lzma_free(coder->dict.buf, allocator);
+	}
+
+	coder->dict.buf = buf;
+	coder->dict.size = new_size;
+	return LZMA_OK;
+}
+
+
+/// Copies the history from the output buffer to the dictionary buffer
+/// after decode_direct() so that decoding can continue with another
+/// output buffer.
+static lzma_ret
+direct_to_dict(lzma_coder *coder, const lzma_allocator *allocator,
+		const lzma_dict *direct)
+{
+	lz_decoder_reset(coder);
+
+	if (direct->pos == 0)
+		return LZMA_OK;
+
+	if (!direct->has_wrapped) {
+		return_if_error(dict_alloc(coder, allocator,
+				coder->dict.pos + direct->pos));
+		memcpy(coder->dict.buf + coder->dict.pos, direct->buf,
+				direct->pos);
+		coder->dict.pos += direct->pos;
+		coder->dict.full = direct->pos;
+	} else {
+		// The dictionary is full. Put the data right before
+		// the end of the buffer. The lowest four bits of pos
+		// must be kept because LZMA uses them.
+		return_if_error(dict_alloc(coder, allocator,
+				coder->dict_max));
+
+		const size_t full = direct->full;
+		coder->dict.pos = coder->dict.size - 16 + (direct->pos & 15);
+		memcpy(coder->dict.buf + coder->dict.pos - full,
+				direct->buf + direct->pos - full, full);
+		coder->dict.full = full;
+		coder->dict.has_wrapped = true;
+	}
+
+	return LZMA_OK;
+}
+
+
+/// Decodes to out[] without copying when the dictionary is empty.
+/// The output buffer is used as the dictionary until the end of this
+/// call. If the data doesn't end in this call, the history is copied
+/// to the dictionary buffer at the end.
+static lzma_ret
+decode_direct(lzma_coder *coder, const lzma_allocator *allocator,
+		const uint8_t *restrict in, size_t *restrict in_pos,
+		size_t in_size, uint8_t *restrict out,
+		size_t *restrict out_pos, size_t out_size)
+{
+	// Like with the dictionary buffer, the match distances are limited
+	// to what fits into the dictionary even if more history is
+	// available. Then the same files decode in both modes.
+	const size_t full_max = coder->dict_max - 2 * LZ_DICT_REPEAT_MAX;
+
+	// Position of dict.buf in out[]
+	size_t base = *out_pos;
+
+	lzma_dict dict = {
+		.buf = out + base,
+		.pos = 0,
+		.full = 0,
+		.init_pos = 0,
+		.has_wrapped = false,
+		.need_reset = false,
+		.batch = coder->dict.batch,
+	};
+
+	lzma_ret ret;
+
+	while (true) {
+		const size_t avail = out_size - base;
+		dict.size = avail > LZ_DICT_EXTRA ? avail - LZ_DICT_EXTRA : 0;
+		dict.limit = dict.has_wrapped ? avail
+				: my_min(avail, full_max);
+
+		ret = coder->lz.code(coder->lz.coder, &dict,
+				in, in_pos, in_size);
+
+		*out_pos = base + dict.pos;
+
+		if (dict.need_reset) {
+			// Start a new dictionary after the decoded data.
+			base = *out_pos;
+			dict.buf = out + base;
+			dict.pos = 0;
+			dict.full = 0;
+			dict.has_wrapped = false;
+			dict.need_reset = false;
+
+			if (ret != LZMA_OK || *out_pos == out_size)
+				break;
+
+		} else {
+			// Continue only if the decoder stopped because
+			// the dictionary became full.
+			if (ret != LZMA_OK || dict.pos < dict.limit
+					|| *out_pos == out_size)
+				break;
+
+			dict.has_wrapped = true;
+		}
+	}
+
+	// At the end of the data there is no need to keep the history.
+	// The dictionary is left empty. If a decoder is called after an
+	// error, it might still continue an earlier match, so then the
+	// history is kept too.
+	if (ret == LZMA_STREAM_END) {
+		lz_decoder_reset(coder);
+		return ret;
+	}
+
+	return_if_error(direct_to_dict(coder, allocator, &dict));
+	return ret;
+}
+
+
 static lzma_ret
-decode_buffer(lzma_coder *coder,
+decode_buffer(lzma_coder *coder, const lzma_allocator *allocator,
 		const uint8_t *restrict in, size_t *restrict in_pos,
 		size_t in_size, uint8_t *restrict out,
 		size_t *restrict out_pos, size_t out_size)
 {
 	while (true) {
+		// After a reset the output buffer can be used as
+		// the dictionary.
+		if (dict_is_empty(&coder->dict) && out != NULL)
+			return decode_direct(coder, allocator, in, in_pos,
+					in_size, out, out_pos, out_size);
+
+		// Grow the dictionary buffer if it is full but still
+		// smaller than the whole dictionary. This also allocates
+		// the buffer on the first call.
+		if (coder->dict.pos >= coder->dict.size
+				&& coder->dict.pos < coder->dict_max)
+			return_if_error(dict_alloc(coder, allocator,
+					coder->dict.pos + 1));
+
 		// Wrap the dictionary if needed.
 		if (coder->dict.pos == coder->dict.size) {
 			// See the comment of #define LZ_DICT_REPEAT_MAX.
@@ -147,7 +339,7 @@ lz_decode(void *coder_ptr, const lzma_allocator *allocator,
 	lzma_coder *coder = coder_ptr;
 
 	if (coder->next.code == NULL)
-		return decode_buffer(coder, in, in_pos, in_size,
+		return decode_buffer(coder, allocator, in, in_pos, in_size,
 				out, out_pos, out_size);
 
 	// We aren't the last coder in the chain, we need to decode
@@ -181,7 +373,8 @@ lz_decode(void *coder_ptr, const lzma_allocator *allocator,
 			return LZMA_OK;
 		}
 
-		const lzma_ret ret = decode_buffer(coder, coder->temp.buffer,
+		const lzma_ret ret = decode_buffer(coder, allocator,
+				coder->temp.buffer,
 				&coder->temp.pos, coder->temp.size,
 				out, out_pos, out_size);
 
@@ -215,6 +408,20 @@ lz_decoder_end(void *coder_ptr, const lzma_allocator *allocator)
 }
 
 
+static void
+lz_decoder_set_batch(void *coder_ptr, lzma_batch *batch)
+{
+	lzma_coder *coder = coder_ptr;
+
+	// Returning early to the batch is only safe when the output
+	// goes straight to the application.
+	if (coder->next.code == NULL)
+		coder->dict.batch = batch;
+
+	return;
+}
+
+
 extern lzma_ret
 lzma_lz_decoder_init(lzma_next_coder *next, const lzma_allocator *allocator,
 		const lzma_filter_info *filters,
@@ -233,9 +440,12 @@ lzma_lz_decoder_init(lzma_next_coder *next, const lzma_allocator *allocator,
 		next->coder = coder;
 		next->code = &lz_decode;
 		next->end = &lz_decoder_end;
+		next->set_batch = &lz_decoder_set_batch;
 
 		coder->dict.buf = NULL;
 		coder->dict.size = 0;
+		coder->dict_max = 0;
+		coder->dict.batch = NULL;
 		coder->lz = LZMA_LZ_DECODER_INIT;
 		coder->next = LZMA_NEXT_CODER_INIT;
 	}
@@ -276,25 +486,20 @@ lzma_lz_decoder_init(lzma_next_coder *next, const lzma_allocator *allocator,
 	const size_t alloc_size
 			= lz_options.dict_size + 2 * LZ_DICT_REPEAT_MAX;
 
-	// Allocate and initialize the dictionary.
-	if (coder->dict.size != alloc_size) {
+	// Initialize the dictionary. The buffer is allocated and grown in
+	// dict_alloc() when it is needed. A buffer from an earlier
+	// initialization is kept unless it is too big.
+	if (coder->dict.size > alloc_size) {
 		lzma_free(coder->dict.buf, allocator);
-
-		// The LZ_DICT_EXTRA bytes at the end of the buffer aren't
-		// included in alloc_size. These extra bytes allow
-		// dict_repeat() to read and write more data than requested.
-		// Otherwise this extra space is ignored.
-		coder->dict.buf = lzma_alloc(alloc_size + LZ_DICT_EXTRA,
-				allocator);
-		if (coder->dict.buf == NULL)
-			return LZMA_MEM_ERROR;
-
-		// NOTE: Yes, alloc_size, not lz_options.dict_size. The way
-		// coder->dict.full is updated will take care that we will
-		// still reject distances larger than lz_options.dict_size.
-		coder->dict.size = alloc_size;
+		coder->dict.buf = NULL;
+		coder->dict.size = 0;
 	}
 
+	// NOTE: Yes, alloc_size, not lz_options.dict_size. The way
+	// coder->dict.full is updated will take care that we will
+	// still reject distances larger than lz_options.dict_size.
+	coder->dict_max = alloc_size;
+
 	lz_decoder_reset(next->coder);
 
 	// Use the preset dictionary if it was given to us.
@@ -304,6 +509,9 @@ lzma_lz_decoder_init(lzma_next_coder *next, const lzma_allocator *allocator,
 		// dictionary, copy only the tail.
 		const size_t copy_size = my_min(lz_options.preset_dict_size,
 				lz_options.dict_size);
+		return_if_error(dict_alloc(coder, allocator,
+				coder->dict.pos + copy_size));
+
 		const size_t offset = lz_options.preset_dict_size - copy_size;
 		memcpy(coder->dict.buf + coder->dict.pos,
 				lz_options.preset_dict + offset,
@@ -24,8 +24,16 @@
 // 0 = Byte-by-byte copying only.
 // 1 = Use memcpy() for non-overlapping copies.
 // 2 = Use x86 SSE2 for non-overlapping copies.
+// 3 = Use x86 AVX2 for non-overlapping copies.
+//
+// AVX2 is used only if the compiler may use it everywhere (for example,
+// -march=x86-64-v3). dict_repeat() is inlined into the decoder loops,
+// so selecting the code at runtime would cost more than it saves.
 #ifndef LZMA_LZ_DECODER_CONFIG
 #	if defined(TUKLIB_FAST_UNALIGNED_ACCESS) \
+		&& defined(HAVE_IMMINTRIN_H) && defined(__AVX2__)
+#		define LZMA_LZ_DECODER_CONFIG 3
+#	elif defined(TUKLIB_FAST_UNALIGNED_ACCESS) \
 		&& defined(HAVE_IMMINTRIN_H) \
 		&& (defined(__SSE2__) || defined(_M_X64) \
 			|| (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
@@ -78,6 +86,14 @@
 #define LZ_DICT_INIT_POS (2 * LZ_DICT_REPEAT_MAX)
 
 
+/// The dictionary is the history buffer of the LZ decoder. Normally buf is
+/// the allocated dictionary buffer and the decoded data is copied from it
+/// to the output buffer. When nothing has been decoded since the last
+/// reset, lz_decoder.c may instead point buf to the output buffer of
+/// the application and decode straight into it. Then init_pos is zero,
+/// size is the amount of output space minus LZ_DICT_EXTRA bytes, and
+/// the data is never moved. has_wrapped only tells that "full" has
+/// reached the size of the dictionary.
 typedef struct {
 	/// Pointer to the dictionary buffer.
 	uint8_t *buf;
@@ -94,12 +110,23 @@ typedef struct {
 	/// Write limit
 	size_t limit;
 
-	/// Allocated size of buf. This is 2 * LZ_DICT_REPEAT_MAX bytes
-	/// larger than the actual dictionary size. This is enforced by
-	/// how the value for "full" is set; it can be at most
-	/// "size - 2 * LZ_DICT_REPEAT_MAX".
+	/// Allocated size of buf. Once the buffer has grown to its full
+	/// size, this is 2 * LZ_DICT_REPEAT_MAX bytes larger than the
+	/// actual dictionary size. This is enforced by how the value for
+	/// "full" is set; it can be at most "size - 2 * LZ_DICT_REPEAT_MAX".
+	/// The buffer is only grown before the dictionary has wrapped,
+	/// so size is the full size whenever has_wrapped is true.
+	///
+	/// When decoding directly to the output buffer, limit may be
+	/// bigger than size. dict_repeat() must then copy exactly the
+	/// requested amount if it would write past buf[size].
 	size_t size;
 
+	/// The value of pos when the dictionary is empty. This is
+	/// LZ_DICT_INIT_POS except when decoding directly to the output
+	/// buffer.
+	size_t init_pos;
+
 	/// True once the dictionary has become full and the writing position
 	/// has been wrapped in decode_buffer() in lz_decoder.c.
 	bool has_wrapped;
@@ -107,6 +134,11 @@ typedef struct {
 	/// True when dictionary should be reset before decoding more data.
 	bool need_reset;
 
+	/// lzma_code_batch() that the decoder is part of or NULL.
+	/// The LZ-based decoder may decode together with the other
+	/// decoders of the batch.
+	lzma_batch *batch;
+
 } lzma_dict;
 
 
@@ -174,11 +206,13 @@ dict_get(const lzma_dict *const dict, const uint32_t distance)
 }
 
 
-/// Optimized version of dict_get(dict, 0)
+/// Optimized version of dict_get(dict, 0). If the dictionary is empty,
+/// this returns zero without reading buf, which may be the beginning of
+/// the output buffer.
 static inline uint8_t
 dict_get0(const lzma_dict *const dict)
 {
-	return dict->buf[dict->pos - 1];
+	return dict->full == 0 ? 0 : dict->buf[dict->pos - 1];
 }
 
 
@@ -198,6 +232,32 @@ dict_is_distance_valid(const lzma_dict *const dict, const size_t distance)
 }
 
 
+/// Hints the processor to start loading the byte at distance. The LZMA
+/// decoder calls this when all but the lowest bits of a long distance
+/// are known so that the load done by dict_repeat() is less likely to
+/// miss the caches. Nothing is done if the distance is invalid.
+static inline void
+dict_prefetch(const lzma_dict *dict, uint32_t distance)
+{
+	if (distance >= dict->full)
+		return;
+
+	size_t back = dict->pos - distance - 1;
+	if (distance >= dict->pos)
+		back += dict->size - LZ_DICT_REPEAT_MAX;
+
+#if defined(__GNUC__) || defined(__clang__)
+	__builtin_prefetch(dict->buf + back);
+#elif defined(HAVE_IMMINTRIN_H) && (defined(_M_X64) || defined(_M_IX86))
+	_mm_prefetch((const char *)(dict->buf + back), _MM_HINT_T0);
+#else
+	(void)back;
+#endif
+
+	return;
+}
+
+
 /// Repeat *len bytes at distance.
 static inline bool
 dict_repeat(lzma_dict *restrict dict,
@@ -223,12 +283,15 @@ dict_repeat(lzma_dict *restrict dict,
 	// Because memcpy() or a similar method can be faster than copying
 	// byte by byte in a loop, the copying process is split into
 	// two cases.
-	if (distance < left) {
+	if (distance < left || unlikely(dict->pos + left > dict->size)) {
 		// Source and target areas overlap, thus we can't use
-		// memcpy() nor even memmove() safely.
-		do {
+		// memcpy() nor even memmove() safely. When decoding
+		// directly to the output buffer, there may be no room
+		// after the end of the match for the extra bytes that
+		// the other methods can write. Then left may be zero.
+		while (left-- > 0) {
 			dict->buf[dict->pos++] = dict->buf[back++];
-		} while (--left > 0);
+		}
 	} else {
 #	if LZMA_LZ_DECODER_CONFIG == 1
 		memcpy(dict->buf + dict->pos, dict->buf + back, left);
@@ -252,6 +315,20 @@ dict_repeat(lzma_dict *restrict dict,
 			pos += 32;
 		} while (pos < dict->pos);
 
+#	elif LZMA_LZ_DECODER_CONFIG == 3
+		// Like the SSE2 version but with one 32-byte load and store
+		// per loop iteration.
+		size_t pos = dict->pos;
+		dict->pos += left;
+		do {
+			const __m256i x = _mm256_loadu_si256(
+					(__m256i *)(dict->buf + back));
+			back += 32;
+			_mm256_storeu_si256(
+					(__m256i *)(dict->buf + pos), x);
+			pos += 32;
+		} while (pos < dict->pos);
+
 #	else
 #		error "Invalid LZMA_LZ_DECODER_CONFIG value"
 #	endif
@@ -260,7 +337,7 @@ dict_repeat(lzma_dict *restrict dict,
 
 	// Update how full the dictionary is.
 	if (!dict->has_wrapped)
-		dict->full = dict->pos - LZ_DICT_INIT_POS;
+		dict->full = dict->pos - dict->init_pos;
 
 	return *len != 0;
 }
@@ -272,7 +349,7 @@ dict_put(lzma_dict *restrict dict, uint8_t byte)
 	dict->buf[dict->pos++] = byte;
 
 	if (!dict->has_wrapped)
-		dict->full = dict->pos - LZ_DICT_INIT_POS;
+		dict->full = dict->pos - dict->init_pos;
 }
 
 
@@ -309,7 +386,7 @@ dict_write(lzma_dict *restrict dict, const uint8_t *restrict in,
 			dict->buf, &dict->pos, dict->limit);
 
 	if (!dict->has_wrapped)
-		dict->full = dict->pos - LZ_DICT_INIT_POS;
+		dict->full = dict->pos - dict->init_pos;
 
 	return;
 }
@@ -21,6 +21,26 @@
 
 #include "memcmplen.h"
 
+// The double-mapped ring needs MADV_DONTFORK to be safe with fork().
+#ifdef HAVE_MEMFD_CREATE
+#	include <sys/mman.h>
+#	include <unistd.h>
+#	ifdef MADV_DONTFORK
+#		define USE_RING 1
+#	endif
+#endif
+
+/// A snapshot of the match finder after loading a preset dictionary is
+/// taken only if its size is at most this many times the size of the
+/// preset dictionary. Bigger ones would be slower to copy than it is to
+/// run the preset dictionary through the match finder.
+#define SNAP_RATIO 64
+
+/// The history buffer is mapped as a ring only if it is at least this big.
+/// With smaller buffers memmove() is cheap compared to the memfd and
+/// the three mappings that the ring needs for every initialization.
+#define RING_SIZE_MIN (UINT32_C(8) << 20)
+
 
 typedef struct {
 	/// LZ-based encoder e.g. LZMA
@@ -34,6 +54,133 @@ typedef struct {
 } lzma_coder;
 
 
+#ifdef USE_RING
+/// \brief      Allocates the history buffer as a double-mapped ring
+///
+/// A memfd of ring_size bytes is mapped twice to consecutive addresses.
+/// Then the same bytes are visible at buffer[i] and buffer[i + ring_size],
+/// so that the window can be moved without copying any data: when the
+/// oldest byte that must be kept is in the second mapping, all positions
+/// are simply decremented by ring_size (see fill_window()).
+///
+/// The mappings are shared, so a child process created with fork() would
+/// write to the same memory as the parent. To keep the encoders of the
+/// two processes from corrupting each other's output, the mappings are
+/// marked with MADV_DONTFORK and thus don't exist in the child at all.
+/// The child cannot continue using the encoder then, but that is better
+/// than silently corrupted output.
+///
+/// If the ring cannot be created, mf->buffer is left to NULL and
+/// the caller falls back to a normal buffer from lzma_alloc().
+static void
+ring_alloc(lzma_mf *mf)
+{
+	if (mf->size < RING_SIZE_MIN)
+		return;
+
+	const long page_size = sysconf(_SC_PAGESIZE);
+	if (page_size <= 0 || page_size > (1L << 24)
+			|| (page_size & (page_size - 1)) != 0)
+		return;
+
+	// Both mappings have to fit in the 32-bit positions of lzma_mf.
+	const uint32_t page_mask = (uint32_t)page_size - 1;
+	if (mf->size > (UINT32_C(1) << 31) - LZMA_MEMCMPLEN_EXTRA
+			- (uint32_t)page_size)
+		return;
+
+	// Reserve LZMA_MEMCMPLEN_EXTRA bytes like with the normal buffer.
+	// This way the initial write limit is never smaller than mf->size,
+	// which matters with a preset dictionary.
+	const uint32_t ring_size = (mf->size + LZMA_MEMCMPLEN_EXTRA
+			+ page_mask) & ~page_mask;
+#if UINT32_MAX >= SIZE_MAX / 2
+	if (ring_size > SIZE_MAX / 2)
+		return;
+#endif
+
+	const int fd = memfd_create("liblzma", MFD_CLOEXEC);
+	if (fd == -1)
+		return;
+
+	uint8_t *buf = MAP_FAILED;
+
+	if (ftruncate(fd, (off_t)(ring_size)) == 0) {
+		// Reserve the address space for both mappings first so that
+		// nothing else can get mapped between them.
+		buf = mmap(NULL, 2 * (size_t)(ring_size), PROT_NONE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (buf != MAP_FAILED && (
+				mmap(buf, ring_size, PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_FIXED, fd, 0)
+					== MAP_FAILED
+				|| mmap(buf + ring_size, ring_size,
+					PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_FIXED, fd, 0)
+					== MAP_FAILED)) {
+			(void)munmap(buf, 2 * (size_t)(ring_size));
+			buf = MAP_FAILED;
+		}
+
+		// Without MADV_DONTFORK the ring isn't safe with fork().
+		if (buf != MAP_FAILED && madvise(buf, 2 * (size_t)(ring_size),
+				MADV_DONTFORK) != 0) {
+			(void)munmap(buf, 2 * (size_t)(ring_size));
+			buf = MAP_FAILED;
+		}
+	}
+
+	// The mappings keep the memory referenced.
+	(void)close(fd);
+
+	if (buf == MAP_FAILED)
+		return;
+
+	mf->buffer = buf;
+	mf->ring_size = ring_size;
+	return;
+}
+#endif
+
+
+/// Frees the history buffer allocated by lz_encoder_init().
+static void
+window_free(lzma_mf *mf, const lzma_allocator *allocator)
+{
+#ifdef USE_RING
+	if (mf->ring_size != 0) {
+		(void)munmap(mf->buffer, 2 * (size_t)(mf->ring_size));
+		mf->ring_size = 0;
+	} else
+#endif
+	lzma_free(mf->buffer, allocator);
+
+	mf->buffer = NULL;
+	return;
+}
+
+
+/// Gets the position in mf->buffer up to which new input can be written.
+/// With a normal buffer it is simply mf->size. With a ring the bytes from
+/// the oldest one that must be kept (see keep_size_before) must not be
+/// overwritten via the other mapping. This includes the
+/// LZMA_MEMCMPLEN_EXTRA bytes which are cleared after the new data.
+static inline uint32_t
+window_limit(const lzma_mf *mf)
+{
+	if (mf->ring_size == 0)
+		return mf->size;
+
+	uint32_t limit = mf->ring_size;
+	if (mf->read_pos > mf->keep_size_before)
+		limit += my_min(mf->read_pos - mf->keep_size_before,
+				mf->ring_size);
+
+	return limit - LZMA_MEMCMPLEN_EXTRA;
+}
+
+
 /// \brief      Moves the data in the input window to free space for new data
 ///
 /// mf->buffer is a sliding input window, which keeps mf->keep_size_before
@@ -41,6 +188,8 @@ typedef struct {
 /// "slide" the buffer to make space for the new data to the end of the
 /// buffer. At the same time, data older than keep_size_before is dropped.
 ///
+/// This is used only when the buffer isn't a ring.
+///
 static void
 move_window(lzma_mf *mf)
 {
@@ -83,9 +232,37 @@ fill_window(lzma_coder *coder, const lzma_allocator *allocator,
 {
 	assert(coder->mf.read_pos <= coder->mf.write_pos);
 
-	// Move the sliding window if needed.
-	if (coder->mf.read_pos >= coder->mf.size - coder->mf.keep_size_after)
+#ifdef MYTHREAD_ENABLED
+	// The helper thread of the match finder must not read the window
+	// while it is being modified.
+	const uint32_t old_offset = coder->mf.offset;
+	if (coder->mf.helper != NULL)
+		lzma_mf_helper_pause(&coder->mf);
+#endif
+
+	// Move the sliding window if needed. With a ring, once all the
+	// bytes that must be kept are in the second mapping, they are
+	// available in the first mapping too and only the positions need
+	// to be moved. ring_size is a multiple of 16 so the lowest bits of
+	// read_pos are not modified (see mf_position()). The sum of offset
+	// and read_pos stays the same so the match finder sees exactly the
+	// same positions as with move_window().
+	if (coder->mf.ring_size != 0) {
+		if (coder->mf.read_pos >= coder->mf.ring_size
+				&& coder->mf.read_pos - coder->mf.ring_size
+					>= coder->mf.keep_size_before) {
+			coder->mf.offset += coder->mf.ring_size;
+			coder->mf.read_pos -= coder->mf.ring_size;
+			coder->mf.read_limit -= coder->mf.ring_size;
+			coder->mf.write_pos -= coder->mf.ring_size;
+		}
+	} else if (coder->mf.read_pos
+			>= coder->mf.size - coder->mf.keep_size_after) {
 		move_window(&coder->mf);
+	}
+
+	const uint32_t limit = window_limit(&coder->mf);
+	assert(coder->mf.write_pos <= limit);
 
 	// Maybe this is ugly, but lzma_mf uses uint32_t for most things
 	// (which I find cleanest), but we need size_t here when filling
@@ -95,7 +272,7 @@ fill_window(lzma_coder *coder, const lzma_allocator *allocator,
 	if (coder->next.code == NULL) {
 		// Not using a filter, simply memcpy() as much as possible.
 		lzma_bufcpy(in, in_pos, in_size, coder->mf.buffer,
-				&write_pos, coder->mf.size);
+				&write_pos, limit);
 
 		ret = action != LZMA_RUN && *in_pos == in_size
 				? LZMA_STREAM_END : LZMA_OK;
@@ -104,7 +281,7 @@ fill_window(lzma_coder *coder, const lzma_allocator *allocator,
 		ret = coder->next.code(coder->next.coder, allocator,
 				in, in_pos, in_size,
 				coder->mf.buffer, &write_pos,
-				coder->mf.size, action);
+				limit, action);
 	}
 
 	coder->mf.write_pos = write_pos;
@@ -151,6 +328,12 @@ fill_window(lzma_coder *coder, const lzma_allocator *allocator,
 		coder->mf.skip(&coder->mf, pending);
 	}
 
+#ifdef MYTHREAD_ENABLED
+	if (coder->mf.helper != NULL)
+		lzma_mf_helper_resume(&coder->mf,
+				coder->mf.offset - old_offset);
+#endif
+
 	return ret;
 }
 
@@ -188,6 +371,146 @@ lz_encode(void *coder_ptr, const lzma_allocator *allocator,
 }
 
 
+/// Returns true if the match finder should be run in a helper thread.
+/// See lz_encoder_mt.c.
+static bool
+use_helper(const lzma_lz_options *lz_options)
+{
+#ifdef MYTHREAD_ENABLED
+	// The results of the long-distance matcher depend on which bytes
+	// the encoder runs through lzma_mf_find(), so it cannot be run
+	// ahead in the helper thread.
+	return lz_options->mf_threads != 0 && lz_options->long_len == 0
+			&& (lz_options->match_finder & 0x10) != 0;
+#else
+	(void)lz_options;
+	return false;
+#endif
+}
+
+
+/// Returns the number of elements in the snapshot of the match finder
+/// after loading the preset dictionary (see lzma_mf.snap) or zero if no
+/// snapshot should be taken. A snapshot is taken only if copying it is
+/// clearly faster than running the preset dictionary through the match
+/// finder. The hash row and suffix array match finders, the long-distance
+/// matcher, and the helper thread have more state, so they aren't
+/// supported.
+static size_t
+snap_count(const lzma_mf *mf, const lzma_lz_options *lz_options)
+{
+	if (lz_options->preset_dict == NULL
+			|| lz_options->preset_dict_size == 0
+			|| mf->row_count != 0 || mf->sa_size != 0
+			|| mf->long_len != 0 || use_helper(lz_options))
+		return 0;
+
+	const uint32_t dict_size = my_min(
+			lz_options->preset_dict_size, mf->size);
+	const size_t count = (size_t)(mf->hash_count)
+			+ (size_t)(mf->sons_count / mf->cyclic_size)
+				* my_min(dict_size, mf->cyclic_size);
+
+	if (count > (size_t)(dict_size) * SNAP_RATIO / sizeof(uint32_t))
+		return 0;
+
+	return count;
+}
+
+
+static void
+snap_free(lzma_mf *mf, const lzma_allocator *allocator)
+{
+	lzma_free(mf->snap, allocator);
+	mf->snap = NULL;
+
+	lzma_free(mf->snap_dict, allocator);
+	mf->snap_dict = NULL;
+
+	return;
+}
+
+
+/// Returns true if the snapshot was taken after loading the given preset
+/// dictionary with the current settings.
+static bool
+snap_matches(const lzma_mf *mf, const uint8_t *dict, uint32_t dict_size)
+{
+	return mf->snap != NULL
+			&& mf->snap_dict_size == dict_size
+			&& mf->snap_skip == mf->skip
+			&& mf->snap_nice_len == mf->nice_len
+			&& mf->snap_depth == mf->depth
+			&& mf->snap_hash_mul == mf->hash_mul
+			&& memcmp(mf->snap_dict, dict, dict_size) == 0;
+}
+
+
+/// Takes a snapshot of the match finder after the preset dictionary has
+/// been loaded. If memory cannot be allocated, there just is no snapshot.
+static void
+snap_save(lzma_mf *mf, const lzma_allocator *allocator,
+		const lzma_lz_options *lz_options,
+		const uint8_t *dict, uint32_t dict_size)
+{
+	snap_free(mf, allocator);
+
+	const size_t count = snap_count(mf, lz_options);
+	if (count == 0)
+		return;
+
+	mf->snap = lzma_alloc(count * sizeof(uint32_t), allocator);
+	mf->snap_dict = lzma_alloc(dict_size, allocator);
+	if (mf->snap == NULL || mf->snap_dict == NULL) {
+		snap_free(mf, allocator);
+		return;
+	}
+
+	mf->snap_sons = (uint32_t)(count - mf->hash_count);
+	memcpy(mf->snap, mf->hash, mf->hash_count * sizeof(uint32_t));
+	memcpy(mf->snap + mf->hash_count, mf->son,
+			mf->snap_sons * sizeof(uint32_t));
+
+	memcpy(mf->snap_dict, dict, dict_size);
+	mf->snap_dict_size = dict_size;
+
+	mf->snap_skip = mf->skip;
+	mf->snap_nice_len = mf->nice_len;
+	mf->snap_depth = mf->depth;
+	mf->snap_hash_mul = mf->hash_mul;
+
+	mf->snap_offset = mf->offset;
+	mf->snap_pending = mf->pending;
+	mf->snap_cyclic_pos = mf->cyclic_pos;
+	mf->snap_norm_pos = mf->norm_pos;
+	mf->snap_norm_index = mf->norm_index;
+	return;
+}
+
+
+/// Restores the state of the match finder from the snapshot. The preset
+/// dictionary has already been copied to the beginning of the buffer.
+/// The positions in the snapshot are relative to snap_offset, so that is
+/// taken back too. The elements of son[] after snap_sons are written
+/// before they are read, and the positions of the earlier streams in
+/// them cannot be reached from hash[].
+static void
+snap_restore(lzma_mf *mf)
+{
+	memcpy(mf->hash, mf->snap, mf->hash_count * sizeof(uint32_t));
+	memcpy(mf->son, mf->snap + mf->hash_count,
+			mf->snap_sons * sizeof(uint32_t));
+
+	mf->offset = mf->snap_offset;
+	mf->read_pos = mf->write_pos;
+	mf->pending = mf->snap_pending;
+	mf->cyclic_pos = mf->snap_cyclic_pos;
+	mf->norm_pos = mf->snap_norm_pos;
+	mf->norm_index = mf->snap_norm_index;
+	return;
+}
+
+
 static bool
 lz_encoder_prepare(lzma_mf *mf, const lzma_allocator *allocator,
 		const lzma_lz_options *lz_options)
@@ -199,11 +522,27 @@ lz_encoder_prepare(lzma_mf *mf, const lzma_allocator *allocator,
 			|| lz_options->nice_len > lz_options->match_len_max)
 		return true;
 
+	if (lz_options->long_len != 0
+			&& (lz_options->long_len < LZMA_LONG_LEN_MIN
+			|| lz_options->long_len > LZMA_LONG_LEN_MAX))
+		return true;
+
+	if (lz_options->mf_threads > LZMA_MF_THREADS_MAX
+			|| lz_options->mf_hash > LZMA_MF_HASH_MUL)
+		return true;
+
 	mf->keep_size_before = lz_options->before_size + lz_options->dict_size;
 
 	mf->keep_size_after = lz_options->after_size
 			+ lz_options->match_len_max;
 
+	// The suffix array match finder needs a lot of input ahead of
+	// read_pos so that it can build its suffix arrays for big
+	// segments at a time (see lz_encoder_sa.c).
+	if (lz_options->match_finder == LZMA_MF_SA)
+		mf->keep_size_after += my_max(lz_options->dict_size / 2,
+				SA_AHEAD_MIN);
+
 	// To avoid constant memmove()s, allocate some extra space. Since
 	// memmove()s become more expensive when the size of the buffer
 	// increases, we reserve more space when a large dictionary is
@@ -227,10 +566,8 @@ lz_encoder_prepare(lzma_mf *mf, const lzma_allocator *allocator,
 
 	// Deallocate the old history buffer if it exists but has different
 	// size than what is needed now.
-	if (mf->buffer != NULL && old_size != mf->size) {
-		lzma_free(mf->buffer, allocator);
-		mf->buffer = NULL;
-	}
+	if (mf->buffer != NULL && old_size != mf->size)
+		window_free(mf, allocator);
 
 	// Match finder options
 	mf->match_len_max = lz_options->match_len_max;
@@ -251,6 +588,7 @@ lz_encoder_prepare(lzma_mf *mf, const lzma_allocator *allocator,
 	// memory to keep the code simpler. The current way is simple and
 	// still allows pretty big dictionaries, so I don't expect these
 	// limits to change.
+	const uint32_t old_cyclic_size = mf->cyclic_size;
 	mf->cyclic_size = lz_options->dict_size + 1;
 
 	// Validate the match finder ID and setup the function pointers.
@@ -285,6 +623,18 @@ lz_encoder_prepare(lzma_mf *mf, const lzma_allocator *allocator,
 		mf->skip = &lzma_mf_bt4_skip;
 		break;
 #endif
+#ifdef HAVE_MF_HR4
+	case LZMA_MF_HR4:
+		mf->find = &lzma_mf_hr4_find;
+		mf->skip = &lzma_mf_hr4_skip;
+		break;
+#endif
+#ifdef HAVE_MF_SA
+	case LZMA_MF_SA:
+		mf->find = &lzma_mf_sa_find;
+		mf->skip = &lzma_mf_sa_skip;
+		break;
+#endif
 
 	default:
 		return true;
@@ -301,9 +651,26 @@ lz_encoder_prepare(lzma_mf *mf, const lzma_allocator *allocator,
 	assert(hash_bytes <= mf->nice_len);
 
 	const bool is_bt = (lz_options->match_finder & 0x10) != 0;
+	const bool is_row = (lz_options->match_finder & 0x20) != 0;
+	const bool is_sa = (lz_options->match_finder & 0x40) != 0;
 	uint32_t hs;
 
-	if (hash_bytes == 2) {
+	if (is_row) {
+		// One row for every HASH_ROW_SIZE bytes of the dictionary
+		// rounded up to 2^n. The row index is taken from 24 bits
+		// of the hash, so that is the maximum.
+		hs = lz_options->dict_size - 1;
+		hs |= hs >> 1;
+		hs |= hs >> 2;
+		hs |= hs >> 4;
+		hs |= hs >> 8;
+		hs |= hs >> 16;
+		hs >>= 4;
+
+		if (hs > (UINT32_C(1) << 24) - 1)
+			hs = (UINT32_C(1) << 24) - 1;
+
+	} else if (hash_bytes == 2) {
 		hs = 0xFFFF;
 	} else {
 		// Round dictionary size up to the next 2^n - 1 so it can
@@ -325,8 +692,34 @@ lz_encoder_prepare(lzma_mf *mf, const lzma_allocator *allocator,
 	}
 
 	mf->hash_mask = hs;
+	mf->hash_mul = lz_options->mf_hash == LZMA_MF_HASH_MUL;
 
 	++hs;
+	mf->row_count = 0;
+
+	if (is_row) {
+		// The rows are aligned to 64 bytes inside mf->hash so
+		// reserve one row extra.
+		mf->row_count = hs;
+		hs = (hs + 1) * HASH_ROW_SIZE;
+	}
+
+	// The suffix array match finder has no hash tables. Its own
+	// arrays are allocated separately so that lzma_mf_normalize() in
+	// lz_encoder_mf.c doesn't touch them.
+	const uint32_t old_sa_size = mf->sa_size;
+	mf->sa_size = 0;
+
+	if (is_sa) {
+		hs = 0;
+		mf->sa_size = lz_options->dict_size + mf->keep_size_after;
+	}
+
+	if (old_sa_size != mf->sa_size) {
+		lzma_free(mf->sa_leaf, allocator);
+		mf->sa_leaf = NULL;
+	}
+
 	if (hash_bytes > 2)
 		hs += HASH_2_SIZE;
 	if (hash_bytes > 3)
@@ -337,22 +730,58 @@ lz_encoder_prepare(lzma_mf *mf, const lzma_allocator *allocator,
 		hs += HASH_4_SIZE;
 */
 
+	// The table of the long-distance matcher is put after the tables
+	// of the match finder.
+	mf->long_len = lz_options->long_len;
+	mf->long_count = 0;
+
+	if (mf->long_len != 0) {
+		uint32_t ls = (lz_options->dict_size - 1) >> LONG_STRIDE_BITS;
+		ls |= ls >> 1;
+		ls |= ls >> 2;
+		ls |= ls >> 4;
+		ls |= ls >> 8;
+		ls |= ls >> 16;
+		++ls;
+
+		if (ls < LONG_COUNT_MIN)
+			ls = LONG_COUNT_MIN;
+		else if (ls > LONG_COUNT_MAX)
+			ls = LONG_COUNT_MAX;
+
+		mf->long_count = ls;
+		hs += ls;
+
+		mf->long_pow = 1;
+		for (uint32_t i = 0; i < mf->long_len; ++i)
+			mf->long_pow *= LONG_ROLL_MUL;
+	}
+
 	const uint32_t old_hash_count = mf->hash_count;
 	const uint32_t old_sons_count = mf->sons_count;
 	mf->hash_count = hs;
 	mf->sons_count = mf->cyclic_size;
 	if (is_bt)
 		mf->sons_count *= 2;
+	else if (is_row)
+		mf->sons_count = (mf->row_count * (HASH_ROW_SIZE + 1) + 3) / 4;
+	else if (is_sa)
+		mf->sons_count = 0;
 
 	// Deallocate the old hash array if it exists and has different size
-	// than what is needed now.
+	// than what is needed now. The positions in the old array are
+	// normalized for the old cyclic_size (see lzma_mf_normalize()) so
+	// the array isn't reused with a different dictionary size either.
 	if (old_hash_count != mf->hash_count
-			|| old_sons_count != mf->sons_count) {
+			|| old_sons_count != mf->sons_count
+			|| old_cyclic_size != mf->cyclic_size) {
 		lzma_free(mf->hash, allocator);
 		mf->hash = NULL;
 
 		lzma_free(mf->son, allocator);
 		mf->son = NULL;
+
+		snap_free(mf, allocator);
 	}
 
 	// Maximum number of match finder cycles
@@ -372,6 +801,16 @@ static bool
 lz_encoder_init(lzma_mf *mf, const lzma_allocator *allocator,
 		const lzma_lz_options *lz_options)
 {
+#ifdef USE_RING
+	// Use a double-mapped ring for a big history buffer if possible.
+	// It's skipped with a custom allocator because then the application
+	// wants to control where the memory comes from. The new mappings
+	// are zero-filled so there's nothing to initialize.
+	if (mf->buffer == NULL
+			&& (allocator == NULL || allocator->alloc == NULL))
+		ring_alloc(mf);
+#endif
+
 	// Allocate the history buffer.
 	if (mf->buffer == NULL) {
 		// lzma_memcmplen() is used for the dictionary buffer
@@ -388,17 +827,6 @@ lz_encoder_init(lzma_mf *mf, const lzma_allocator *allocator,
 		memzero(mf->buffer + mf->size, LZMA_MEMCMPLEN_EXTRA);
 	}
 
-	// Use cyclic_size as initial mf->offset. This allows
-	// avoiding a few branches in the match finders. The downside is
-	// that match finder needs to be normalized more often, which may
-	// hurt performance with huge dictionaries.
-	mf->offset = mf->cyclic_size;
-	mf->read_pos = 0;
-	mf->read_ahead = 0;
-	mf->read_limit = 0;
-	mf->write_pos = 0;
-	mf->pending = 0;
-
 #if UINT32_MAX >= SIZE_MAX / 4
 	// Check for integer overflow. (Huge dictionaries are not
 	// possible on 32-bit CPU.)
@@ -407,20 +835,29 @@ lz_encoder_init(lzma_mf *mf, const lzma_allocator *allocator,
 		return true;
 #endif
 
+	// Use cyclic_size as initial mf->offset so that EMPTY_HASH_VALUE
+	// is too far away. This allows avoiding a few branches in
+	// the match finders.
+	uint32_t offset = mf->cyclic_size;
+
 	// Allocate and initialize the hash table. Since EMPTY_HASH_VALUE
-	// is zero, we can use lzma_alloc_zero() or memzero() for mf->hash.
+	// is zero, we can use lzma_alloc_zero() for mf->hash.
 	//
-	// We don't need to initialize mf->son, but not doing that may
-	// make Valgrind complain in normalization (see normalize() in
-	// lz_encoder_mf.c). Skipping the initialization is *very* good
+	// We don't need to initialize mf->son since its elements are
+	// read only after they have been written and lzma_mf_normalize()
+	// doesn't touch them. Skipping the initialization is *very* good
 	// when big dictionary is used but only small amount of data gets
 	// actually compressed: most of the mf->son won't get actually
 	// allocated by the kernel, so we avoid wasting RAM and improve
 	// initialization speed a lot.
-	if (mf->hash == NULL) {
-		mf->hash = lzma_alloc_zero(mf->hash_count * sizeof(uint32_t),
-				allocator);
-		mf->son = lzma_alloc(mf->sons_count * sizeof(uint32_t),
+	//
+	// The arrays are accessed randomly so they are backed by huge pages
+	// if possible to reduce TLB misses (see lzma_alloc_huge()).
+	const bool reuse = mf->hash != NULL;
+	if (!reuse) {
+		mf->hash = lzma_alloc_zero_huge(
+				mf->hash_count * sizeof(uint32_t), allocator);
+		mf->son = lzma_alloc_huge(mf->sons_count * sizeof(uint32_t),
 				allocator);
 
 		if (mf->hash == NULL || mf->son == NULL) {
@@ -432,16 +869,85 @@ lz_encoder_init(lzma_mf *mf, const lzma_allocator *allocator,
 
 			return true;
 		}
+
+		// The tags and insertion indexes of the hash row match
+		// finder are read before the positions, so unlike the hash
+		// chains and binary trees they are initialized. The old
+		// values don't matter when the arrays are reused.
+		if (mf->row_count != 0)
+			memzero(mf->son, mf->sons_count * sizeof(uint32_t));
+
+	}
+
+	// Each step of lzma_mf_normalize() checks norm_count elements of
+	// mf->hash. There must be so many that every element is checked
+	// at least once before 2^32 - 2 * cyclic_size bytes have been
+	// processed. Two steps are left as a safety margin because a step
+	// may be done a little late when the skip functions jump over
+	// norm_pos.
+	const uint32_t norm_steps = (UINT32_MAX - 2 * mf->cyclic_size)
+			/ MF_NORM_STEP - 2;
+	mf->norm_count = (mf->hash_count + norm_steps - 1) / norm_steps;
+
+	if (!reuse) {
+		mf->norm_pos = offset + MF_NORM_STEP;
+		mf->norm_index = 0;
 	} else {
-/*
-		for (uint32_t i = 0; i < mf->hash_count; ++i)
-			mf->hash[i] = EMPTY_HASH_VALUE;
-*/
-		memzero(mf->hash, mf->hash_count * sizeof(uint32_t));
+		// The old hash table is reused. Clearing it would be slow
+		// with big dictionaries (64 MiB with preset 9), which is
+		// bad when many small streams are compressed one after
+		// another. Instead, the positions of the new stream start
+		// cyclic_size positions after the end of the previous
+		// stream, so each position of an older stream is too far
+		// away and is ignored the same way as EMPTY_HASH_VALUE.
+		//
+		// The skipped positions count towards the normalization
+		// like the processed ones, so do the missed steps now.
+		offset = mf->read_pos + mf->offset + mf->cyclic_size;
+		mf->read_pos = 0;
+		mf->offset = offset;
+		lzma_mf_normalize_skipped(mf);
 	}
 
+	// Allocate the arrays of the suffix array match finder. They are
+	// filled when the first segment is built, so nothing needs to
+	// be initialized here.
+	if (mf->sa_size != 0) {
+#if UINT32_MAX >= SIZE_MAX / 16
+		if (mf->sa_size > SIZE_MAX / SA_BYTES_PER_POS)
+			return true;
+#endif
+
+		if (mf->sa_leaf == NULL) {
+			mf->sa_leaf = lzma_alloc_huge((size_t)(mf->sa_size)
+					* SA_BYTES_PER_POS, allocator);
+			if (mf->sa_leaf == NULL)
+				return true;
+		}
+
+		mf->sa_parent = mf->sa_leaf + mf->sa_size;
+		mf->sa_last = mf->sa_parent + mf->sa_size;
+		mf->sa_depth = (uint16_t *)(mf->sa_last + mf->sa_size);
+	}
+
+	mf->sa_count = 0;
+	mf->sa_base = 0;
+
+	mf->offset = offset;
+	mf->read_pos = 0;
+	mf->read_ahead = 0;
+	mf->read_limit = 0;
+	mf->write_pos = 0;
+	mf->pending = 0;
 	mf->cyclic_pos = 0;
 
+	mf->long_roll = 0;
+	mf->long_scan = offset;
+	mf->long_fill = 0;
+	mf->long_dist = 0;
+	mf->long_start = 0;
+	mf->long_misses = 0;
+
 	// Handle preset dictionary.
 	if (lz_options->preset_dict != NULL
 			&& lz_options->preset_dict_size > 0) {
@@ -452,7 +958,16 @@ lz_encoder_init(lzma_mf *mf, const lzma_allocator *allocator,
 				+ lz_options->preset_dict_size - mf->write_pos,
 				mf->write_pos);
 		mf->action = LZMA_SYNC_FLUSH;
-		mf->skip(mf, mf->write_pos);
+
+		// If the same preset dictionary is used again, the state
+		// of the match finder is copied from the snapshot.
+		if (snap_matches(mf, mf->buffer, mf->write_pos)) {
+			snap_restore(mf);
+		} else {
+			mf->skip(mf, mf->write_pos);
+			snap_save(mf, allocator, lz_options,
+					mf->buffer, mf->write_pos);
+		}
 	}
 
 	mf->action = LZMA_RUN;
@@ -467,10 +982,13 @@ lzma_lz_encoder_memusage(const lzma_lz_options *lz_options)
 	// Old buffers must not exist when calling lz_encoder_prepare().
 	lzma_mf mf = {
 		.buffer = NULL,
+		.ring_size = 0,
 		.hash = NULL,
 		.son = NULL,
 		.hash_count = 0,
 		.sons_count = 0,
+		.sa_size = 0,
+		.sa_leaf = NULL,
 	};
 
 	// Setup the size information into mf.
@@ -478,8 +996,23 @@ lzma_lz_encoder_memusage(const lzma_lz_options *lz_options)
 		return UINT64_MAX;
 
 	// Calculate the memory usage.
-	return ((uint64_t)(mf.hash_count) + mf.sons_count) * sizeof(uint32_t)
+	uint64_t memusage = ((uint64_t)(mf.hash_count) + mf.sons_count)
+				* sizeof(uint32_t)
+			+ (uint64_t)(mf.sa_size) * SA_BYTES_PER_POS
 			+ mf.size + sizeof(lzma_coder);
+
+#ifdef MYTHREAD_ENABLED
+	if (use_helper(lz_options))
+		memusage += lzma_mf_helper_memusage();
+#endif
+
+	// The snapshot of the preset dictionary
+	const size_t snap = snap_count(&mf, lz_options);
+	if (snap != 0)
+		memusage += (uint64_t)(snap) * sizeof(uint32_t)
+				+ my_min(lz_options->preset_dict_size, mf.size);
+
+	return memusage;
 }
 
 
@@ -490,9 +1023,16 @@ lz_encoder_end(void *coder_ptr, const lzma_allocator *allocator)
 
 	lzma_next_end(&coder->next, allocator);
 
+#ifdef MYTHREAD_ENABLED
+	if (coder->mf.helper != NULL)
+		lzma_mf_helper_end(&coder->mf, allocator);
+#endif
+
 	lzma_free(coder->mf.son, allocator);
 	lzma_free(coder->mf.hash, allocator);
-	lzma_free(coder->mf.buffer, allocator);
+	lzma_free(coder->mf.sa_leaf, allocator);
+	snap_free(&coder->mf, allocator);
+	window_free(&coder->mf, allocator);
 
 	if (coder->lz.end != NULL)
 		coder->lz.end(coder->lz.coder, allocator);
@@ -574,10 +1114,17 @@ lzma_lz_encoder_init(lzma_next_coder *next, const lzma_allocator *allocator,
 		// code in a way that Valgrind gets unhappy).
 		coder->mf.buffer = NULL;
 		coder->mf.size = 0;
+		coder->mf.ring_size = 0;
 		coder->mf.hash = NULL;
 		coder->mf.son = NULL;
+		coder->mf.cyclic_size = 0;
 		coder->mf.hash_count = 0;
 		coder->mf.sons_count = 0;
+		coder->mf.sa_size = 0;
+		coder->mf.sa_leaf = NULL;
+		coder->mf.helper = NULL;
+		coder->mf.snap = NULL;
+		coder->mf.snap_dict = NULL;
 
 		coder->next = LZMA_NEXT_CODER_INIT;
 	}
@@ -587,6 +1134,17 @@ lzma_lz_encoder_init(lzma_next_coder *next, const lzma_allocator *allocator,
 	return_if_error(lz_init(&coder->lz, allocator,
 			filters[0].id, filters[0].options, &lz_options));
 
+#ifdef MYTHREAD_ENABLED
+	// Take the match finder back from the helper thread. The thread
+	// is kept if it will be needed again.
+	if (coder->mf.helper != NULL) {
+		if (use_helper(&lz_options))
+			lzma_mf_helper_stop(&coder->mf);
+		else
+			lzma_mf_helper_end(&coder->mf, allocator);
+	}
+#endif
+
 	// Setup the size information into coder->mf and deallocate
 	// old buffers if they have wrong size.
 	if (lz_encoder_prepare(&coder->mf, allocator, &lz_options))
@@ -597,6 +1155,11 @@ lzma_lz_encoder_init(lzma_next_coder *next, const lzma_allocator *allocator,
 	if (lz_encoder_init(&coder->mf, allocator, &lz_options))
 		return LZMA_MEM_ERROR;
 
+#ifdef MYTHREAD_ENABLED
+	if (use_helper(&lz_options))
+		return_if_error(lzma_mf_helper_start(&coder->mf, allocator));
+#endif
+
 	// Initialize the next filter in the chain, if any.
 	return lzma_next_filter_init(&coder->next, allocator, filters + 1);
 }
@@ -625,6 +1188,14 @@ lzma_mf_is_supported(lzma_match_finder mf)
 #ifdef HAVE_MF_BT4
 	case LZMA_MF_BT4:
 		return true;
+#endif
+#ifdef HAVE_MF_HR4
+	case LZMA_MF_HR4:
+		return true;
+#endif
+#ifdef HAVE_MF_SA
+	case LZMA_MF_SA:
+		return true;
 #endif
 	default:
 		return false;
@@ -24,6 +24,19 @@
 		&& (size) <= (UINT32_C(1) << 30) + (UINT32_C(1) << 29))
 
 
+/// The suffix array match finder (LZMA_MF_SA) keeps at least this many
+/// bytes of input available after read_pos. See lz_encoder_sa.c.
+#define SA_AHEAD_MIN (UINT32_C(1) << 20)
+
+/// Memory needed by the suffix array match finder for each byte of
+/// the maximum segment size (sa_leaf, sa_parent, sa_last, and sa_depth)
+#define SA_BYTES_PER_POS (3 * sizeof(uint32_t) + sizeof(uint16_t))
+
+/// The positions in the match finder arrays are normalized a little
+/// every this many bytes. See lzma_mf_normalize() in lz_encoder_mf.c.
+#define MF_NORM_STEP (UINT32_C(1) << 16)
+
+
 /// A table of these is used by the LZ-based encoder to hold
 /// the length-distance pairs found by the match finder.
 typedef struct {
@@ -33,6 +46,10 @@ typedef struct {
 
 
 typedef struct lzma_mf_s lzma_mf;
+
+/// Helper thread of the binary tree match finders (see lz_encoder_mt.c)
+typedef struct lzma_mf_helper_s lzma_mf_helper;
+
 struct lzma_mf_s {
 	///////////////
 	// In Window //
@@ -90,6 +107,14 @@ struct lzma_mf_s {
 	/// restart the match finder after LZMA_SYNC_FLUSH.
 	uint32_t pending;
 
+	/// If nonzero, buffer is a ring of ring_size bytes which has been
+	/// mapped twice back to back, that is, buffer[i] and
+	/// buffer[i + ring_size] are the same byte. Then the window is
+	/// moved by subtracting ring_size from the positions instead of
+	/// copying the data with memmove(). If zero, buffer was allocated
+	/// with lzma_alloc() and holds size bytes.
+	uint32_t ring_size;
+
 	//////////////////
 	// Match Finder //
 	//////////////////
@@ -109,6 +134,24 @@ struct lzma_mf_s {
 	uint32_t cyclic_size; // Must be dictionary size + 1.
 	uint32_t hash_mask;
 
+	/// Position (like read_pos + offset) at which the next step of
+	/// lzma_mf_normalize() is done
+	uint32_t norm_pos;
+
+	/// Index of the first element of hash[] to check in the next step
+	uint32_t norm_index;
+
+	/// Number of elements of hash[] to check in each step
+	uint32_t norm_count;
+
+	/// True if the hash values are calculated with multiplication
+	/// instead of the table lookups (LZMA_MF_HASH_MUL). This is set
+	/// when the encoder is initialized and doesn't change during
+	/// the stream. The hash table may still have positions from
+	/// the earlier streams that used the other hash function, but
+	/// those are in the older epochs and thus ignored.
+	bool hash_mul;
+
 	/// Maximum number of loops in the match finder
 	uint32_t depth;
 
@@ -130,6 +173,129 @@ struct lzma_mf_s {
 
 	/// Number of elements in son[]
 	uint32_t sons_count;
+
+	/// Number of rows in the hash row match finder (LZMA_MF_HR4) or
+	/// zero with the other match finders. With LZMA_MF_HR4, hash[]
+	/// holds the rows of positions after the 2- and 3-byte hash tables
+	/// and son[] holds the 8-bit tags of the rows followed by one
+	/// insertion index byte per row.
+	uint32_t row_count;
+
+	///////////////////////////
+	// Long-distance Matcher //
+	///////////////////////////
+
+	/// Length of the rolling hash window and the minimum length of
+	/// long-distance matches. Zero if the long-distance matcher
+	/// is disabled.
+	uint32_t long_len;
+
+	/// Number of elements in the table of the long-distance matcher.
+	/// The table is the last long_count elements of hash[] so that
+	/// lzma_mf_normalize() handles it like the other hash tables.
+	uint32_t long_count;
+
+	/// Multiplier of the rolling hash raised to the power of long_len.
+	/// This is used to remove the oldest byte from long_roll.
+	uint64_t long_pow;
+
+	/// Rolling hash of the long_fill bytes before long_scan
+	uint64_t long_roll;
+
+	/// Position (like read_pos + offset) of the next byte to add
+	/// to the rolling hash
+	uint32_t long_scan;
+
+	/// Number of bytes in long_roll, at most long_len
+	uint32_t long_fill;
+
+	/// Distance of the current long-distance match candidate
+	/// (zero based like lzma_match.dist plus one) or zero if there
+	/// is no candidate
+	uint32_t long_dist;
+
+	/// Position (like read_pos + offset) from which long_dist is used
+	uint32_t long_start;
+
+	/// Number of lzma_mf_find() calls in a row where long_dist
+	/// didn't give a match
+	uint32_t long_misses;
+
+	///////////////////////////////
+	// Suffix Array Match Finder //
+	///////////////////////////////
+
+	/// Maximum number of bytes in a segment of the suffix array match
+	/// finder (LZMA_MF_SA) or zero with the other match finders.
+	/// The arrays below have this many elements.
+	uint32_t sa_size;
+
+	/// Number of bytes in the current segment or zero if there is
+	/// no segment yet. See lz_encoder_sa.c.
+	uint32_t sa_count;
+
+	/// Position (like read_pos + offset) of the first byte of
+	/// the current segment
+	uint32_t sa_base;
+
+	/// The deepest node of the LCP interval tree that contains
+	/// each suffix of the segment. The first byte of the segment
+	/// is at index zero.
+	uint32_t *sa_leaf;
+
+	/// Parent of each node of the LCP interval tree. Node zero is
+	/// the root.
+	uint32_t *sa_parent;
+
+	/// For each node, the position of the most recent byte that has
+	/// been run through the match finder and whose suffix is in
+	/// the node, as an index in the segment plus one. Zero means
+	/// that there is no such byte yet.
+	uint32_t *sa_last;
+
+	/// Length of the common prefix of the suffixes of each node,
+	/// at most nice_len
+	uint16_t *sa_depth;
+
+	/// If non-NULL, the match finder runs in a helper thread and
+	/// find and skip point to the functions in lz_encoder_mt.c which
+	/// take the results from the helper. Then the hash tables and
+	/// the binary tree are owned by the helper (see lz_encoder_mt.c).
+	lzma_mf_helper *helper;
+
+	////////////////////////////////
+	// Preset Dictionary Snapshot //
+	////////////////////////////////
+
+	/// If non-NULL, a copy of hash[] followed by the first snap_sons
+	/// elements of son[] taken right after the preset dictionary
+	/// snap_dict was run through the match finder. When the encoder
+	/// is initialized again with the same preset dictionary and
+	/// settings, this is copied back instead of running the preset
+	/// dictionary through the match finder again.
+	uint32_t *snap;
+
+	/// Copy of the preset dictionary of the snapshot
+	uint8_t *snap_dict;
+
+	/// Size of snap_dict
+	uint32_t snap_dict_size;
+
+	/// Number of elements of son[] in the snapshot
+	uint32_t snap_sons;
+
+	/// The settings of the match finder when the snapshot was taken
+	void (*snap_skip)(lzma_mf *mf, uint32_t num);
+	uint32_t snap_nice_len;
+	uint32_t snap_depth;
+	bool snap_hash_mul;
+
+	/// The state of the match finder when the snapshot was taken
+	uint32_t snap_offset;
+	uint32_t snap_pending;
+	uint32_t snap_cyclic_pos;
+	uint32_t snap_norm_pos;
+	uint32_t snap_norm_index;
 };
 
 
@@ -169,6 +335,18 @@ typedef struct {
 	/// the dict_size sized tail of the preset_dict will be used.
 	uint32_t preset_dict_size;
 
+	/// Minimum length of the matches of the long-distance matcher
+	/// or zero to disable it.
+	uint32_t long_len;
+
+	/// Number of helper threads for the match finder. This can be
+	/// zero or one; see lz_encoder_mt.c.
+	uint32_t mf_threads;
+
+	/// Hash function of the match finder, LZMA_MF_HASH_TABLE or
+	/// LZMA_MF_HASH_MUL
+	uint32_t mf_hash;
+
 } lzma_lz_options;
 
 
@@ -334,6 +512,9 @@ extern uint64_t lzma_lz_encoder_memusage(const lzma_lz_options *lz_options);
 extern uint32_t lzma_mf_find(
 		lzma_mf *mf, uint32_t *count, lzma_match *matches);
 
+extern void lzma_mf_normalize(lzma_mf *mf);
+extern void lzma_mf_normalize_skipped(lzma_mf *mf);
+
 extern uint32_t lzma_mf_hc3_find(lzma_mf *dict, lzma_match *matches);
 extern void lzma_mf_hc3_skip(lzma_mf *dict, uint32_t amount);
 
@@ -349,4 +530,27 @@ extern void lzma_mf_bt3_skip(lzma_mf *dict, uint32_t amount);
 extern uint32_t lzma_mf_bt4_find(lzma_mf *dict, lzma_match *matches);
 extern void lzma_mf_bt4_skip(lzma_mf *dict, uint32_t amount);
 
+extern uint32_t lzma_mf_hr4_find(lzma_mf *dict, lzma_match *matches);
+extern void lzma_mf_hr4_skip(lzma_mf *dict, uint32_t amount);
+
+extern uint32_t lzma_mf_sa_find(lzma_mf *dict, lzma_match *matches);
+extern void lzma_mf_sa_skip(lzma_mf *dict, uint32_t amount);
+extern void lzma_mf_sa_build(lzma_mf *mf);
+
+#ifdef MYTHREAD_ENABLED
+extern uint64_t lzma_mf_helper_memusage(void);
+
+extern lzma_ret lzma_mf_helper_start(
+		lzma_mf *mf, const lzma_allocator *allocator);
+
+extern void lzma_mf_helper_pause(lzma_mf *mf);
+
+extern void lzma_mf_helper_resume(lzma_mf *mf, uint32_t moved);
+
+extern void lzma_mf_helper_stop(lzma_mf *mf);
+
+extern void lzma_mf_helper_end(
+		lzma_mf *mf, const lzma_allocator *allocator);
+#endif
+
 #endif
@@ -46,6 +46,25 @@
 #define HASH_3_MASK (HASH_3_SIZE - 1)
 #define HASH_4_MASK (HASH_4_SIZE - 1)
 
+// Number of candidates in one row of the hash row match finder. One row
+// of positions is 64 bytes (one cache line) and the tags of a row are
+// compared with a single 16-byte SIMD compare.
+#define HASH_ROW_SIZE 16
+
+// The long-distance matcher remembers on average one position in
+// 2^LONG_STRIDE_BITS. The size of its table is one element for every
+// 2^LONG_STRIDE_BITS bytes of the dictionary rounded up to 2^n and
+// limited to [LONG_COUNT_MIN, LONG_COUNT_MAX].
+#define LONG_STRIDE_BITS 6
+#define LONG_COUNT_MIN (UINT32_C(1) << 10)
+#define LONG_COUNT_MAX (UINT32_C(1) << 26)
+
+// Multiplier of the rolling hash of the long-distance matcher (odd so that
+// no input bits are lost) and the constant used to mix the hash before
+// the sampling decision and the table index are taken from its high bits.
+#define LONG_ROLL_MUL UINT64_C(0x100000001B3)
+#define LONG_MIX_MUL UINT64_C(0x9E3779B97F4A7C15)
+
 #define FIX_3_HASH_SIZE (HASH_2_SIZE)
 #define FIX_4_HASH_SIZE (HASH_2_SIZE + HASH_3_SIZE)
 #define FIX_5_HASH_SIZE (HASH_2_SIZE + HASH_3_SIZE + HASH_4_SIZE)
@@ -60,20 +79,40 @@
 			= (uint32_t)(cur[0]) | ((uint32_t)(cur[1]) << 8)
 #endif
 
+// Multiplier of the multiplicative hash functions (LZMA_MF_HASH_MUL).
+// The hash values are taken from the high 32 bits of the 64-bit product
+// since all of them depend on all input bits.
+#define HASH_MUL UINT64_C(0xCF1BBCDCB7A56463)
+
+#define hash_mul_calc(value) \
+	((uint32_t)(((uint64_t)(value) * HASH_MUL) >> 32))
+
+// The 2- and 3-byte hashes XOR the second and third bytes to a hash of
+// the first byte. The match finders rely on this: if the first bytes
+// are equal, equal 2- or 3-byte hashes mean that the first two or three
+// bytes are equal. With LZMA_MF_HASH_MUL the table lookup of the first
+// byte is replaced with a multiplication, and the 4-byte hash, which
+// doesn't need the property, is a multiplicative hash of all four bytes.
+// read32le() keeps the output independent of the processor endianness.
+#define hash_temp_calc() \
+	const uint32_t temp = (mf->hash_mul \
+			? hash_mul_calc(cur[0]) : hash_table[cur[0]]) ^ cur[1]
+
 #define hash_3_calc() \
-	const uint32_t temp = hash_table[cur[0]] ^ cur[1]; \
+	hash_temp_calc(); \
 	const uint32_t hash_2_value = temp & HASH_2_MASK; \
 	const uint32_t hash_value \
 			= (temp ^ ((uint32_t)(cur[2]) << 8)) & mf->hash_mask
 
 #define hash_4_calc() \
-	const uint32_t temp = hash_table[cur[0]] ^ cur[1]; \
+	hash_temp_calc(); \
 	const uint32_t hash_2_value = temp & HASH_2_MASK; \
 	const uint32_t hash_3_value \
 			= (temp ^ ((uint32_t)(cur[2]) << 8)) & HASH_3_MASK; \
-	const uint32_t hash_value = (temp ^ ((uint32_t)(cur[2]) << 8) \
-			^ (hash_table[cur[3]] << 5)) & mf->hash_mask
-
+	const uint32_t hash_value = (mf->hash_mul \
+			? hash_mul_calc(read32le(cur)) \
+			: temp ^ ((uint32_t)(cur[2]) << 8) \
+				^ (hash_table[cur[3]] << 5)) & mf->hash_mask
 
 // The following are not currently used.
 
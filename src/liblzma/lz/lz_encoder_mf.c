@@ -15,16 +15,172 @@
 #include "memcmplen.h"
 
 
+///////////////////////////
+// Long-distance Matcher //
+///////////////////////////
+
+/// Once the long-distance match candidate has given a shorter match than
+/// this in more than LONG_MISSES_MAX calls of lzma_mf_find() in a row,
+/// it's dropped and the rolling hash scanning is resumed. A few misses
+/// are allowed so that a single changed byte in a long repeated region
+/// doesn't make the rest of the region to be missed.
+#define LONG_CONTINUE_MIN 4
+#define LONG_MISSES_MAX 16
+
+
+/// \brief      Scans the window for a long-distance match candidate
+///
+/// The bytes from mf->long_scan up to mf->write_pos are run through
+/// the rolling hash. A window of mf->long_len bytes is sampled if the
+/// highest LONG_STRIDE_BITS bits of the mixed hash are zero. Then the
+/// window is stored in the table and compared to the window that was
+/// previously stored in the same table element. If they are equal,
+/// the match is extended backwards, but not past the current byte,
+/// and the scanning is stopped until the candidate is no longer useful.
+///
+/// \param      read_pos    Current value of mf->read_pos, that is,
+///                         the position of the byte that is being
+///                         given to the match finder
+static void
+long_scan(lzma_mf *mf, uint32_t read_pos)
+{
+	const uint32_t long_len = mf->long_len;
+	const uint8_t *buf = mf->buffer;
+	uint32_t *table = mf->hash + mf->hash_count - mf->long_count;
+	const uint32_t mask = mf->long_count - 1;
+
+	// If the scanning has fallen behind (a long match was being
+	// used), restart the rolling hash from the current byte.
+	uint32_t i = mf->long_scan - mf->offset;
+	uint32_t fill = mf->long_fill;
+	uint64_t roll = mf->long_roll;
+
+	if ((int32_t)(mf->long_scan - (read_pos + mf->offset)) < 0) {
+		i = read_pos;
+		fill = 0;
+		roll = 0;
+	}
+
+	while (i < mf->write_pos) {
+		roll = roll * LONG_ROLL_MUL + buf[i];
+		if (fill == long_len)
+			roll -= buf[i - long_len] * mf->long_pow;
+		else
+			++fill;
+
+		++i;
+
+		if (fill < long_len)
+			continue;
+
+		const uint64_t mix = roll * LONG_MIX_MUL;
+		if ((mix >> (64 - LONG_STRIDE_BITS)) != 0)
+			continue;
+
+		// The window is buf[start .. i - 1].
+		const uint32_t start = i - long_len;
+		const uint32_t pos = start + mf->offset;
+		uint32_t *slot = &table[(uint32_t)(mix >> 32) & mask];
+		const uint32_t delta = pos - *slot;
+		*slot = pos;
+
+		// Like with the match finders, old positions including
+		// EMPTY_HASH_VALUE are too far away. The comparison catches
+		// hash collisions.
+		if (delta == 0 || delta >= mf->cyclic_size
+				|| memcmp(buf + start, buf + start - delta,
+					long_len) != 0)
+			continue;
+
+		// The extension must stop at the beginning of the buffer too.
+		uint32_t match_start = start;
+		while (match_start > read_pos && match_start > delta
+				&& buf[match_start - 1]
+					== buf[match_start - 1 - delta])
+			--match_start;
+
+		mf->long_dist = delta;
+		mf->long_start = match_start + mf->offset;
+		mf->long_misses = 0;
+		break;
+	}
+
+	mf->long_scan = i + mf->offset;
+	mf->long_fill = fill;
+	mf->long_roll = roll;
+	return;
+}
+
+
+/// \brief      Adds the long-distance match candidate to matches[]
+///
+/// This is called by lzma_mf_find() after the match finder has been run
+/// for the byte at read_pos. If the candidate gives a longer match than
+/// the longest one found by the match finder, it's added to matches[]
+/// so that the lengths still increase. If the match finder found a match
+/// of nice_len bytes, the candidate replaces it instead.
+///
+/// \return     The length of the longest match
+static uint32_t
+long_find(lzma_mf *mf, uint32_t read_pos, uint32_t *count_ptr,
+		lzma_match *matches, uint32_t len_best)
+{
+	if (mf->long_dist == 0)
+		long_scan(mf, read_pos);
+
+	if (mf->long_dist == 0
+			|| (int32_t)(read_pos + mf->offset - mf->long_start) < 0)
+		return len_best;
+
+	// The same limit as with match finder matches that have
+	// reached nice_len.
+	uint32_t limit = mf->write_pos - read_pos;
+	if (limit > mf->match_len_max)
+		limit = mf->match_len_max;
+
+	const uint8_t *cur = mf->buffer + read_pos;
+	const uint32_t len = lzma_memcmplen(cur, cur - mf->long_dist,
+			0, limit);
+
+	if (len < LONG_CONTINUE_MIN) {
+		if (++mf->long_misses > LONG_MISSES_MAX)
+			mf->long_dist = 0;
+
+		return len_best;
+	}
+
+	mf->long_misses = 0;
+
+	if (len <= len_best)
+		return len_best;
+
+	uint32_t count = *count_ptr;
+	const uint32_t len_clamped = my_min(len, mf->nice_len);
+
+	if (count == 0 || matches[count - 1].len < len_clamped)
+		matches[count++].len = len_clamped;
+
+	matches[count - 1].dist = mf->long_dist - 1;
+	*count_ptr = count;
+
+	return len;
+}
+
+
 /// \brief      Find matches starting from the current byte
 ///
 /// \return     The length of the longest match found
 extern uint32_t
 lzma_mf_find(lzma_mf *mf, uint32_t *count_ptr, lzma_match *matches)
 {
+	// The match finder increments read_pos, so remember the position
+	// of the current byte for the long-distance matcher.
+	const uint32_t read_pos = mf->read_pos;
+
 	// Call the match finder. It returns the number of length-distance
 	// pairs found.
 	// FIXME: Minimum count is zero, what _exactly_ is the maximum?
-	const uint32_t count = mf->find(mf, matches);
+	uint32_t count = mf->find(mf, matches);
 
 	// Length of the longest match; assume that no matches were found
 	// and thus the maximum length is zero.
@@ -69,6 +225,9 @@ lzma_mf_find(lzma_mf *mf, uint32_t *count_ptr, lzma_match *matches)
 		}
 	}
 
+	if (mf->long_len != 0)
+		len_best = long_find(mf, read_pos, &count, matches, len_best);
+
 	*count_ptr = count;
 
 	// Finally update the read position to indicate that match finder was
@@ -85,12 +244,7 @@ lzma_mf_find(lzma_mf *mf, uint32_t *count_ptr, lzma_match *matches)
 #define EMPTY_HASH_VALUE 0
 
 
-/// Normalization must be done when lzma_mf.offset + lzma_mf.read_pos
-/// reaches MUST_NORMALIZE_POS.
-#define MUST_NORMALIZE_POS UINT32_MAX
-
-
-/// \brief      Normalizes hash values
+/// \brief      Normalizes a part of the hash values
 ///
 /// The hash arrays store positions of match candidates. The positions are
 /// relative to an arbitrary offset that is not the same as the absolute
@@ -99,47 +253,118 @@ lzma_mf_find(lzma_mf *mf, uint32_t *count_ptr, lzma_match *matches)
 /// the differences of the current read position and the position found from
 /// the hash.
 ///
-/// To prevent integer overflows of the offsets stored in the hash arrays,
-/// we need to "normalize" the stored values now and then. During the
-/// normalization, we drop values that indicate distance greater than the
-/// dictionary size, thus making space for new values.
+/// The positions are never rebased. They wrap around at UINT32_MAX and
+/// since the distances are calculated with unsigned 32-bit arithmetic,
+/// the wrapping doesn't matter as long as no stored position gets
+/// older than 2^32 bytes; an older position would alias with a recent
+/// one. To prevent that, each step checks norm_count elements of
+/// mf->hash (wrapping around at the end of the array) and replaces
+/// the positions that are too far to be used by pos - cyclic_size,
+/// which is exactly too far. Replacing the positions with a fixed value
+/// like EMPTY_HASH_VALUE would not work since its distance grows too.
+///
+/// One step is done every MF_NORM_STEP bytes. lz_encoder_init() sets
+/// norm_count so that the steps go through the whole mf->hash well
+/// before 2^32 - 2 * cyclic_size bytes have been processed. Thus no
+/// position in mf->hash gets older than 2^32 - cyclic_size. mf->son
+/// doesn't need to be touched: a node of the hash chain or binary tree
+/// is read only while its own position is within cyclic_size, and
+/// the values stored in it were either copied from mf->hash or are
+/// positions newer than that. The binary tree match finders terminate
+/// the trees with pos - cyclic_size for the same reason.
+///
+/// Earlier all of mf->hash and mf->son were normalized at once when
+/// the position reached UINT32_MAX. With big dictionaries that took
+/// hundreds of milliseconds at once which was bad for latency.
+/// The loop is simple enough to be vectorized with SSE2: the unsigned
+/// comparison is done with the signed one by flipping the highest bits.
 static void
-normalize(lzma_mf *mf)
+normalize(lzma_mf *mf, uint32_t left)
 {
-	assert(mf->read_pos + mf->offset == MUST_NORMALIZE_POS);
-
-	// In future we may not want to touch the lowest bits, because there
-	// may be match finders that use larger resolution than one byte.
-	const uint32_t subvalue
-			= (MUST_NORMALIZE_POS - mf->cyclic_size);
-				// & ~((UINT32_C(1) << 10) - 1);
-
-	for (uint32_t i = 0; i < mf->hash_count; ++i) {
-		// If the distance is greater than the dictionary size,
-		// we can simply mark the hash element as empty.
-		if (mf->hash[i] <= subvalue)
-			mf->hash[i] = EMPTY_HASH_VALUE;
-		else
-			mf->hash[i] -= subvalue;
+	const uint32_t pos = mf->read_pos + mf->offset;
+	const uint32_t far = pos - mf->cyclic_size;
+	uint32_t *const hash = mf->hash;
+	uint32_t i = mf->norm_index;
+
+	while (left > 0) {
+		const uint32_t end = my_min(mf->hash_count, i + left);
+		left -= end - i;
+
+#if defined(HAVE__MM_MOVEMASK_EPI8) \
+		&& (defined(__SSE2__) || (defined(_MSC_VER) \
+			&& (defined(_M_X64) || (defined(_M_IX86_FP) \
+				&& _M_IX86_FP >= 2))))
+		const __m128i sign = _mm_set1_epi32(INT32_MIN);
+		const __m128i pos_v = _mm_set1_epi32((int32_t)pos);
+		const __m128i far_v = _mm_set1_epi32((int32_t)far);
+		const __m128i limit_v = _mm_set1_epi32(
+				(int32_t)(mf->cyclic_size - 1) ^ INT32_MIN);
+
+		for (; i + 4 <= end; i += 4) {
+			__m128i *const p = (__m128i *)(hash + i);
+			const __m128i x = _mm_loadu_si128(p);
+			const __m128i old = _mm_cmpgt_epi32(_mm_xor_si128(
+					_mm_sub_epi32(pos_v, x), sign),
+					limit_v);
+			_mm_storeu_si128(p, _mm_or_si128(
+					_mm_and_si128(old, far_v),
+					_mm_andnot_si128(old, x)));
+		}
+#endif
+
+		for (; i < end; ++i)
+			if (pos - hash[i] >= mf->cyclic_size)
+				hash[i] = far;
+
+		if (i == mf->hash_count)
+			i = 0;
 	}
 
-	for (uint32_t i = 0; i < mf->sons_count; ++i) {
-		// Do the same for mf->son.
-		//
-		// NOTE: There may be uninitialized elements in mf->son.
-		// Valgrind may complain that the "if" below depends on
-		// an uninitialized value. In this case it is safe to ignore
-		// the warning. See also the comments in lz_encoder_init()
-		// in lz_encoder.c.
-		if (mf->son[i] <= subvalue)
-			mf->son[i] = EMPTY_HASH_VALUE;
-		else
-			mf->son[i] -= subvalue;
+	mf->norm_index = i;
+
+	// The positions of the long-distance matcher are compared to
+	// the current position by the sign of the difference so they
+	// must not fall far behind. If long_scan is behind, long_scan()
+	// would restart the rolling hash anyway.
+	if ((int32_t)(pos - mf->long_scan) > 0) {
+		mf->long_scan = pos;
+		mf->long_fill = 0;
+		mf->long_roll = 0;
 	}
 
-	// Update offset to match the new locations.
-	mf->offset -= subvalue;
+	if ((int32_t)(pos - mf->long_start) > 0)
+		mf->long_start = pos;
+
+	return;
+}
+
+
+/// Does one step. This is called every MF_NORM_STEP bytes.
+extern void
+lzma_mf_normalize(lzma_mf *mf)
+{
+	normalize(mf, mf->norm_count);
+	mf->norm_pos += MF_NORM_STEP;
+	return;
+}
+
+
+/// When the position has jumped far ahead (the reused hash arrays in
+/// lz_encoder_init()), all the steps that were jumped over are done in
+/// one pass. At most all of mf->hash is checked once since that makes
+/// every element as fresh as the steps would.
+extern void
+lzma_mf_normalize_skipped(lzma_mf *mf)
+{
+	const uint32_t pos = mf->read_pos + mf->offset;
+	if ((int32_t)(pos - mf->norm_pos) < 0)
+		return;
 
+	const uint32_t steps = (pos - mf->norm_pos) / MF_NORM_STEP + 1;
+	const uint64_t left = (uint64_t)(steps) * mf->norm_count;
+
+	normalize(mf, (uint32_t)my_min(left, mf->hash_count));
+	mf->norm_pos += steps * MF_NORM_STEP;
 	return;
 }
 
@@ -154,8 +379,11 @@ move_pos(lzma_mf *mf)
 	++mf->read_pos;
 	assert(mf->read_pos <= mf->write_pos);
 
-	if (unlikely(mf->read_pos + mf->offset == UINT32_MAX))
-		normalize(mf);
+	// The skip functions may jump over norm_pos so check if it
+	// has been reached or passed.
+	if (unlikely((int32_t)(mf->read_pos + mf->offset - mf->norm_pos)
+			>= 0))
+		lzma_mf_normalize(mf);
 }
 
 
@@ -468,8 +696,8 @@ bt_find_func(
 	while (true) {
 		const uint32_t delta = pos - cur_match;
 		if (depth-- == 0 || delta >= cyclic_size) {
-			*ptr0 = EMPTY_HASH_VALUE;
-			*ptr1 = EMPTY_HASH_VALUE;
+			*ptr0 = pos - cyclic_size;
+			*ptr1 = pos - cyclic_size;
 			return matches;
 		}
 
@@ -532,8 +760,8 @@ bt_skip_func(
 	while (true) {
 		const uint32_t delta = pos - cur_match;
 		if (depth-- == 0 || delta >= cyclic_size) {
-			*ptr0 = EMPTY_HASH_VALUE;
-			*ptr1 = EMPTY_HASH_VALUE;
+			*ptr0 = pos - cyclic_size;
+			*ptr1 = pos - cyclic_size;
 			return;
 		}
 
@@ -582,6 +810,134 @@ do { \
 #endif
 
 
+#if defined(HAVE_MF_BT3) || defined(HAVE_MF_BT4)
+/// Longest period of repeating data that bt_skip_run() handles
+#define RUN_PERIOD_MAX 16
+
+
+/// Calculates the indexes of the hash table elements that
+/// lzma_mf_bt3_skip() or lzma_mf_bt4_skip() updates for the byte at cur.
+/// idx[1] isn't used by BT3.
+static inline void
+bt_run_hash(const lzma_mf *mf, const uint8_t *cur, bool is_bt4,
+		uint32_t idx[3])
+{
+	if (is_bt4) {
+		hash_4_calc();
+		idx[0] = hash_2_value;
+		idx[1] = FIX_3_HASH_SIZE + hash_3_value;
+		idx[2] = FIX_4_HASH_SIZE + hash_value;
+	} else {
+		hash_3_calc();
+		idx[0] = hash_2_value;
+		idx[2] = FIX_3_HASH_SIZE + hash_value;
+	}
+
+	return;
+}
+
+
+/// \brief      Skips repeating data without walking the binary tree
+///
+/// In a run of identical bytes or of a short repeating pattern, like in
+/// zero-filled database pages or sparse disk images, the first candidate
+/// of bt_skip_func() is always the position one period back, and it
+/// matches nice_len bytes. The node of the new position then takes over
+/// the children of the old node, and the old node becomes unreachable.
+/// Only the nodes of the last period of the run remain in the tree, so
+/// this creates just those by copying the children from the nodes of
+/// the period before the run. The result is identical to calling
+/// bt_skip_func() for every position.
+///
+/// This must be called before the hash table has been updated for the
+/// current byte, and only when mf_avail(mf) >= mf->nice_len.
+///
+/// \param      amount  Maximum number of bytes to skip
+/// \param      period  Distance of the first match candidate
+///
+/// \return     Number of bytes skipped, or zero if the current byte
+///             isn't at a run of repeating data
+static uint32_t
+bt_skip_run(lzma_mf *mf, uint32_t amount, uint32_t period, bool is_bt4)
+{
+	if (amount <= period)
+		return 0;
+
+	const uint8_t *const start = mf_ptr(mf);
+	const uint32_t pos = mf->read_pos + mf->offset;
+
+	// Every skipped byte needs a match of nice_len bytes at the
+	// distance of one period.
+	uint32_t limit = amount - 1 + mf->nice_len;
+	if (limit > mf_avail(mf))
+		limit = mf_avail(mf);
+
+	const uint32_t run = lzma_memcmplen(start, start - period, 0, limit);
+	if (run < mf->nice_len + period)
+		return 0;
+
+	const uint32_t count = run - mf->nice_len + 1;
+	if (count <= period || count + period >= mf->cyclic_size)
+		return 0;
+
+	// The byte at start + i is skipped without the tree only if its
+	// first candidate would be the position one period back. This is
+	// true if the hash table has that position for the first period,
+	// and the indexes are different within the period so that no other
+	// byte of the run takes the place of the candidate.
+	uint32_t heads[RUN_PERIOD_MAX];
+	for (uint32_t i = 0; i < period; ++i) {
+		uint32_t idx[3];
+		bt_run_hash(mf, start + i, is_bt4, idx);
+
+		if (mf->hash[idx[2]] != pos + i - period)
+			return 0;
+
+		for (uint32_t j = 0; j < i; ++j)
+			if (heads[j] == idx[2])
+				return 0;
+
+		heads[i] = idx[2];
+	}
+
+	// Create the nodes of the last period in the same order as
+	// the skip function would have done. The nodes of the skipped
+	// bytes before them would be unreachable so they aren't touched.
+	for (uint32_t i = count - period; i < count; ++i) {
+		const uint32_t i_mod = i % period;
+
+		uint32_t idx[3];
+		bt_run_hash(mf, start + i, is_bt4, idx);
+
+		mf->hash[idx[0]] = pos + i;
+		if (is_bt4)
+			mf->hash[idx[1]] = pos + i;
+
+		mf->hash[idx[2]] = pos + i;
+
+		uint32_t from = mf->cyclic_pos + i_mod - period;
+		if (mf->cyclic_pos + i_mod < period)
+			from += mf->cyclic_size;
+
+		uint32_t to = mf->cyclic_pos + i;
+		if (to >= mf->cyclic_size)
+			to -= mf->cyclic_size;
+
+		mf->son[to << 1] = mf->son[from << 1];
+		mf->son[(to << 1) + 1] = mf->son[(from << 1) + 1];
+	}
+
+	mf->read_pos += count - 1;
+	mf->cyclic_pos += count - 1;
+	if (mf->cyclic_pos >= mf->cyclic_size)
+		mf->cyclic_pos -= mf->cyclic_size;
+
+	move_pos(mf);
+	return count;
+}
+#endif
+
+
 #ifdef HAVE_MF_BT2
 extern uint32_t
 lzma_mf_bt2_find(lzma_mf *mf, lzma_match *matches)
@@ -660,6 +1016,16 @@ lzma_mf_bt3_skip(lzma_mf *mf, uint32_t amount)
 		const uint32_t cur_match
 				= mf->hash[FIX_3_HASH_SIZE + hash_value];
 
+		if (pos - cur_match <= RUN_PERIOD_MAX
+				&& len_limit == mf->nice_len) {
+			const uint32_t skipped = bt_skip_run(mf, amount,
+					pos - cur_match, false);
+			if (skipped != 0) {
+				amount -= skipped - 1;
+				continue;
+			}
+		}
+
 		mf->hash[hash_2_value] = pos;
 		mf->hash[FIX_3_HASH_SIZE + hash_value] = pos;
 
@@ -733,6 +1099,17 @@ lzma_mf_bt4_skip(lzma_mf *mf, uint32_t amount)
 		const uint32_t cur_match
 				= mf->hash[FIX_4_HASH_SIZE + hash_value];
 
+		// Repeating data is skipped without walking the tree.
+		if (pos - cur_match <= RUN_PERIOD_MAX
+				&& len_limit == mf->nice_len) {
+			const uint32_t skipped = bt_skip_run(mf, amount,
+					pos - cur_match, true);
+			if (skipped != 0) {
+				amount -= skipped - 1;
+				continue;
+			}
+		}
+
 		mf->hash[hash_2_value] = pos;
 		mf->hash[FIX_3_HASH_SIZE + hash_3_value] = pos;
 		mf->hash[FIX_4_HASH_SIZE + hash_value] = pos;
@@ -742,3 +1119,319 @@ lzma_mf_bt4_skip(lzma_mf *mf, uint32_t amount)
 	} while (--amount != 0);
 }
 #endif
+
+
+///////////////
+// Hash Rows //
+///////////////
+
+#ifdef HAVE_MF_HR4
+
+/// Multiplier for the 4-byte hash. The row index is taken from bits
+/// [40, 63] and the tag from bits [32, 39] of the 64-bit product.
+/// All these bits depend on all four input bytes.
+#define HR_HASH_MUL UINT64_C(0x9E3779B97F4A7C15)
+
+
+/// Calculate the 2- and 3-byte hashes like hash_4_calc() does, and
+/// the row index and the tag for the 4-byte hash. read32le() keeps
+/// the output independent of the processor endianness.
+#define hr_hash_4_calc() \
+	hash_temp_calc(); \
+	const uint32_t hash_2_value = temp & HASH_2_MASK; \
+	const uint32_t hash_3_value \
+			= (temp ^ ((uint32_t)(cur[2]) << 8)) & HASH_3_MASK; \
+	const uint64_t hash_product = (uint64_t)read32le(cur) * HR_HASH_MUL; \
+	const uint32_t row_index \
+			= (uint32_t)(hash_product >> 40) & mf->hash_mask; \
+	const uint8_t tag = (uint8_t)(hash_product >> 32)
+
+
+/// Get a pointer to the first row of positions. The rows are after
+/// the 2- and 3-byte hash tables and are aligned to 64 bytes so that
+/// each row is exactly one cache line.
+static inline uint32_t *
+hr_rows(const lzma_mf *mf)
+{
+	const uintptr_t p = (uintptr_t)(mf->hash + FIX_4_HASH_SIZE);
+	return (uint32_t *)((p + 63) & ~(uintptr_t)63);
+}
+
+
+/// Get a bitmask of the tags in the row that are equal to tag.
+/// Bit n is set if tags[n] == tag.
+static inline uint32_t
+hr_tag_mask(const uint8_t *tags, uint8_t tag)
+{
+#if defined(HAVE__MM_MOVEMASK_EPI8) \
+		&& (defined(__SSE2__) || (defined(_MSC_VER) \
+			&& (defined(_M_X64) || (defined(_M_IX86_FP) \
+				&& _M_IX86_FP >= 2))))
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)tags),
+			_mm_set1_epi8((char)tag)));
+#else
+	uint32_t mask = 0;
+	for (uint32_t i = 0; i < HASH_ROW_SIZE; ++i)
+		mask |= (uint32_t)(tags[i] == tag) << i;
+
+	return mask;
+#endif
+}
+
+
+/// Search the candidates of one row. The newest candidate is at
+/// index *head and the indexes grow towards older candidates.
+static lzma_match *
+hr_find_func(
+		const uint32_t len_limit,
+		const uint32_t pos,
+		const uint8_t *const cur,
+		const uint32_t *const row,
+		const uint8_t *const tags,
+		const uint32_t head,
+		const uint8_t tag,
+		uint32_t depth,
+		const uint32_t cyclic_size,
+		lzma_match *matches,
+		uint32_t len_best)
+{
+	// Rotate the mask so that bit 0 is the newest candidate.
+	uint32_t mask = hr_tag_mask(tags, tag);
+	mask = ((mask >> head) | (mask << (HASH_ROW_SIZE - head)))
+			& ((UINT32_C(1) << HASH_ROW_SIZE) - 1);
+
+	while (mask != 0 && depth-- != 0) {
+		const uint32_t i = (head + ctz32(mask)) & (HASH_ROW_SIZE - 1);
+		mask &= mask - 1;
+
+		// The candidates are in the order they were inserted so
+		// the rest of them are too far away too.
+		const uint32_t delta = pos - row[i];
+		if (delta >= cyclic_size)
+			break;
+
+		const uint8_t *const pb = cur - delta;
+		if (pb[len_best] == cur[len_best] && pb[0] == cur[0]) {
+			const uint32_t len = lzma_memcmplen(pb, cur, 1, len_limit);
+
+			if (len_best < len) {
+				len_best = len;
+				matches->len = len;
+				matches->dist = delta - 1;
+				++matches;
+
+				if (len == len_limit)
+					break;
+			}
+		}
+	}
+
+	return matches;
+}
+
+
+/// Insert the current position as the newest candidate in its row.
+/// This overwrites the oldest candidate.
+#define hr_insert() \
+do { \
+	const uint32_t new_head = (head - 1) & (HASH_ROW_SIZE - 1); \
+	row[new_head] = pos; \
+	tags[new_head] = tag; \
+	heads[row_index] = (uint8_t)new_head; \
+} while (0)
+
+
+/// Set up pointers to the row, tags, and insertion index of the row.
+#define hr_row_setup() \
+	uint32_t *const row = hr_rows(mf) + row_index * HASH_ROW_SIZE; \
+	uint8_t *const tags = (uint8_t *)(mf->son) \
+			+ row_index * HASH_ROW_SIZE; \
+	uint8_t *const heads = (uint8_t *)(mf->son) \
+			+ mf->row_count * HASH_ROW_SIZE; \
+	const uint32_t head = heads[row_index] & (HASH_ROW_SIZE - 1)
+
+
+extern uint32_t
+lzma_mf_hr4_find(lzma_mf *mf, lzma_match *matches)
+{
+	header_find(false, 4);
+
+	hr_hash_4_calc();
+	hr_row_setup();
+
+	uint32_t delta2 = pos - mf->hash[hash_2_value];
+	const uint32_t delta3
+			= pos - mf->hash[FIX_3_HASH_SIZE + hash_3_value];
+
+	mf->hash[hash_2_value] = pos;
+	mf->hash[FIX_3_HASH_SIZE + hash_3_value] = pos;
+
+	uint32_t len_best = 1;
+
+	if (delta2 < mf->cyclic_size && *(cur - delta2) == *cur) {
+		len_best = 2;
+		matches[0].len = 2;
+		matches[0].dist = delta2 - 1;
+		matches_count = 1;
+	}
+
+	if (delta2 != delta3 && delta3 < mf->cyclic_size
+			&& *(cur - delta3) == *cur) {
+		len_best = 3;
+		matches[matches_count++].dist = delta3 - 1;
+		delta2 = delta3;
+	}
+
+	if (matches_count != 0) {
+		len_best = lzma_memcmplen(cur - delta2, cur,
+				len_best, len_limit);
+
+		matches[matches_count - 1].len = len_best;
+
+		if (len_best == len_limit) {
+			hr_insert();
+			move_pos(mf);
+			return matches_count;
+		}
+	}
+
+	if (len_best < 3)
+		len_best = 3;
+
+	matches_count = (uint32_t)(hr_find_func(len_limit, pos, cur,
+			row, tags, head, tag, mf->depth, mf->cyclic_size,
+			matches + matches_count, len_best) - matches);
+
+	hr_insert();
+	move_pos(mf);
+	return matches_count;
+}
+
+
+extern void
+lzma_mf_hr4_skip(lzma_mf *mf, uint32_t amount)
+{
+	do {
+		if (mf_avail(mf) < 4) {
+			move_pending(mf);
+			continue;
+		}
+
+		const uint8_t *cur = mf_ptr(mf);
+		const uint32_t pos = mf->read_pos + mf->offset;
+
+		hr_hash_4_calc();
+		hr_row_setup();
+
+		mf->hash[hash_2_value] = pos;
+		mf->hash[FIX_3_HASH_SIZE + hash_3_value] = pos;
+
+		hr_insert();
+		move_pos(mf);
+
+	} while (--amount != 0);
+}
+#endif
+
+
+//////////////////
+// Suffix Array //
+//////////////////
+
+#ifdef HAVE_MF_SA
+
+/// Get the index of the current byte in the segment of the suffix array
+/// match finder (see lz_encoder_sa.c). A new segment is built if the
+/// current one doesn't contain all the len_limit bytes from the current
+/// byte, that is, if more input has been added after the current segment
+/// was built and the matches could be longer now.
+static inline uint32_t
+sa_index(lzma_mf *mf, uint32_t pos, uint32_t len_limit)
+{
+	if (mf->sa_count == 0 || pos - mf->sa_base + len_limit > mf->sa_count)
+		lzma_mf_sa_build(mf);
+
+	assert(pos - mf->sa_base + len_limit <= mf->sa_count);
+	return pos - mf->sa_base;
+}
+
+
+extern uint32_t
+lzma_mf_sa_find(lzma_mf *mf, lzma_match *matches)
+{
+	header_find(true, 2);
+	(void)cur;
+
+	const uint32_t i = sa_index(mf, pos, len_limit);
+	const uint32_t dict_size = mf->cyclic_size - 1;
+	uint32_t prev = 0;
+
+	// The nodes from the leaf towards the root have decreasing depths.
+	// The nearest earlier byte in a node is never farther away than
+	// in its child, so the node gives a match only if the byte is
+	// nearer than the one of the previous match.
+	for (uint32_t node = mf->sa_leaf[i]; node != 0;
+			node = mf->sa_parent[node]) {
+		const uint32_t last = mf->sa_last[node];
+		mf->sa_last[node] = i + 1;
+
+		if (last > prev && i + 1 - last <= dict_size) {
+			matches[matches_count].len = mf->sa_depth[node];
+			matches[matches_count].dist = i - last;
+			++matches_count;
+			prev = last;
+		}
+	}
+
+	// The LZ-based encoder wants the shortest match first.
+	for (uint32_t a = 0, b = matches_count; a + 1 < b; ++a, --b) {
+		const lzma_match tmp = matches[a];
+		matches[a] = matches[b - 1];
+		matches[b - 1] = tmp;
+	}
+
+	move_pos(mf);
+	return matches_count;
+}
+
+
+extern void
+lzma_mf_sa_skip(lzma_mf *mf, uint32_t amount)
+{
+	do {
+		header_skip(true, 2);
+		(void)cur;
+
+		const uint32_t i = sa_index(mf, pos, len_limit);
+
+		// The following bytes can be inserted at the same time if
+		// they have nice_len bytes after them both in the window
+		// and in the segment.
+		uint32_t count = 1;
+		if (len_limit == mf->nice_len)
+			count = my_min(amount, my_min(
+				mf_avail(mf) - mf->nice_len + 1,
+				mf->sa_count - mf->nice_len + 1 - i));
+
+		// Insert the bytes starting from the last one. The walk
+		// towards the root can stop at a node that already has
+		// a later byte of this batch because its ancestors have
+		// one too. With repeating data the paths have many nodes
+		// in common, so this is much faster than inserting the
+		// bytes one by one.
+		for (uint32_t j = i + count; j-- > i; )
+			for (uint32_t node = mf->sa_leaf[j];
+					node != 0 && mf->sa_last[node] <= i;
+					node = mf->sa_parent[node])
+				mf->sa_last[node] = j + 1;
+
+		amount -= count - 1;
+
+		do {
+			move_pos(mf);
+		} while (--count != 0);
+
+	} while (--amount != 0);
+}
+#endif
@@ -0,0 +1,511 @@
+// SPDX-License-Identifier: 0BSD
+
+///////////////////////////////////////////////////////////////////////////////
+//
+/// \file       lz_encoder_mt.c
+/// \brief      Binary tree match finder in a helper thread
+///
+/// The helper thread runs the match finder ahead of the LZ-based encoder
+/// for every byte in the window and puts the matches into a queue. The
+/// find and skip functions of the encoder's lzma_mf take the results from
+/// the queue. This way the match finder and the encoder, which both need
+/// about the same amount of time with the binary trees, run in parallel.
+///
+/// The find and skip functions of the binary trees update the tree in
+/// exactly the same way, so it doesn't matter which one the helper uses
+/// for a byte. Once the encoder has skipped a byte, the helper uses the
+/// skip function for it since its matches aren't needed anymore.
+///
+/// The matches of a byte don't depend on the input that comes later as
+/// long as nice_len bytes are available after the byte. The helper runs
+/// only that far. The last bytes of the input, which are encoded when
+/// flushing or finishing, are run through the match finder in the
+/// encoder's thread after the helper has stopped. Thus the output is
+/// identical to the output without the helper thread.
+///
+/// The helper has its own copy of lzma_mf: its read_pos is the position
+/// of the next byte to run through the match finder, and it owns the hash
+/// tables and the tree. The encoder's lzma_mf only tracks the position
+/// of the encoder. fill_window() in lz_encoder.c pauses the helper while
+/// it modifies the window.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "lz_encoder.h"
+
+
+/// Maximum number of bytes whose results can be in the queue at a time
+#define QUEUE_SIZE (UINT32_C(1) << 14)
+
+/// Number of lzma_match structures available for the results in the queue
+#define ARENA_SIZE (UINT32_C(1) << 16)
+
+/// The helper makes its results available to the encoder after at most
+/// this many bytes. Locking the mutex once per byte would be too slow.
+#define PUBLISH_INTERVAL 256
+
+
+typedef struct {
+	/// Index of the first match in arena[]
+	uint32_t start;
+
+	/// Number of matches
+	uint32_t count;
+} queue_entry;
+
+
+typedef enum {
+	/// Waiting for lzma_mf_helper_resume()
+	HELPER_IDLE,
+
+	/// Running the match finder up to end
+	HELPER_RUN,
+
+	/// The encoder wants the helper to stop as soon as possible.
+	/// Then the helper sets the state to HELPER_IDLE.
+	HELPER_PAUSE,
+
+	/// The thread should exit.
+	HELPER_EXIT,
+} helper_state;
+
+
+struct lzma_mf_helper_s {
+	/// Match finder of the helper thread. The encoder's thread may
+	/// use this only when state is HELPER_IDLE.
+	lzma_mf mf;
+
+	mythread thread;
+	mythread_mutex mutex;
+	mythread_cond cond;
+
+	// The following four are protected by the mutex.
+
+	helper_state state;
+
+	/// The helper runs the match finder for the bytes before
+	/// buffer[end]. This is modified only by the encoder's thread.
+	uint32_t end;
+
+	/// Number of the result that the helper writes next. The results
+	/// are numbered sequentially; head and tail wrap around.
+	uint32_t head;
+
+	/// Number of the result that the encoder needs next as it was
+	/// when the encoder last locked the mutex. Results before this
+	/// are no longer needed.
+	uint32_t tail;
+
+	// The following three are used only by the encoder's thread.
+
+	/// Value of head when the encoder last locked the mutex
+	uint32_t enc_head;
+
+	/// Number of the result that the encoder needs next. This can be
+	/// ahead of head if the encoder has skipped bytes that the helper
+	/// hasn't processed yet.
+	uint32_t enc_tail;
+
+	/// Value of tail that was last given to the helper
+	uint32_t enc_published;
+
+	/// Index in arena[] where the helper writes the next matches.
+	/// This is used only by the helper thread.
+	uint32_t arena_pos;
+
+	/// Results of the bytes from tail to head
+	queue_entry queue[QUEUE_SIZE];
+
+	/// Matches of the results in the queue
+	lzma_match arena[ARENA_SIZE];
+};
+
+
+/// Gets the index in arena[] where the matches of the next result can be
+/// written. A find function writes at most nice_len matches. Returns
+/// UINT32_MAX if the queue or the arena is full.
+static uint32_t
+arena_get(const lzma_mf_helper *h, uint32_t head, uint32_t tail)
+{
+	if (head - tail >= QUEUE_SIZE)
+		return UINT32_MAX;
+
+	const uint32_t need = h->mf.nice_len;
+	uint32_t pos = h->arena_pos;
+	if (pos + need > ARENA_SIZE)
+		pos = 0;
+
+	if (head == tail)
+		return pos;
+
+	// The matches in use are from the start of the oldest result up
+	// to arena_pos, possibly wrapping around. The new matches must
+	// not reach the old ones; otherwise a full arena would look empty.
+	const uint32_t start = h->queue[tail & (QUEUE_SIZE - 1)].start;
+
+	if (start <= h->arena_pos) {
+		if (pos == 0 && start != h->arena_pos && need >= start)
+			return UINT32_MAX;
+	} else if (pos == 0 || pos + need >= start) {
+		return UINT32_MAX;
+	}
+
+	return pos;
+}
+
+
+static MYTHREAD_RET_TYPE
+helper_main(void *helper_ptr)
+{
+	lzma_mf_helper *h = helper_ptr;
+	lzma_mf *mf = &h->mf;
+
+	mythread_mutex_lock(&h->mutex);
+
+	while (true) {
+		if (h->state == HELPER_EXIT)
+			break;
+
+		if (h->state == HELPER_PAUSE || (h->state == HELPER_RUN
+				&& mf->read_pos >= h->end)) {
+			h->state = HELPER_IDLE;
+			mythread_cond_signal(&h->cond);
+		}
+
+		if (h->state == HELPER_IDLE) {
+			mythread_cond_wait(&h->cond, &h->mutex);
+			continue;
+		}
+
+		const uint32_t end = h->end;
+		const uint32_t tail = h->tail;
+		uint32_t head = h->head;
+
+		// If the queue is full, wait for the encoder to take results.
+		if ((int32_t)(tail - head) <= 0
+				&& arena_get(h, head, tail) == UINT32_MAX) {
+			mythread_cond_wait(&h->cond, &h->mutex);
+			continue;
+		}
+
+		mythread_mutex_unlock(&h->mutex);
+
+		uint32_t loops = PUBLISH_INTERVAL;
+		do {
+			if ((int32_t)(tail - head) > 0) {
+				// The encoder has already skipped these.
+				const uint32_t amount = my_min(tail - head,
+						end - mf->read_pos);
+				mf->skip(mf, amount);
+				head += amount;
+				continue;
+			}
+
+			const uint32_t start = arena_get(h, head, tail);
+			if (start == UINT32_MAX)
+				break;
+
+			queue_entry *e = &h->queue[head & (QUEUE_SIZE - 1)];
+			e->start = start;
+			e->count = mf->find(mf, h->arena + start);
+			assert(e->count <= mf->nice_len);
+
+			h->arena_pos = start + e->count;
+			++head;
+
+		} while (--loops != 0 && mf->read_pos < end);
+
+		mythread_mutex_lock(&h->mutex);
+		h->head = head;
+		mythread_cond_signal(&h->cond);
+	}
+
+	mythread_mutex_unlock(&h->mutex);
+
+	return MYTHREAD_RET_VALUE;
+}
+
+
+/// Gives enc_tail to the helper. The mutex must be locked.
+static void
+publish_tail(lzma_mf_helper *h)
+{
+	h->tail = h->enc_tail;
+	h->enc_published = h->enc_tail;
+	h->enc_head = h->head;
+	mythread_cond_signal(&h->cond);
+	return;
+}
+
+
+/// Lets the helper continue early if the encoder is far behind. Otherwise
+/// the helper would wait until the encoder has taken all results.
+static inline void
+maybe_publish_tail(lzma_mf_helper *h)
+{
+	if (h->enc_tail - h->enc_published >= QUEUE_SIZE / 4) {
+		mythread_sync(h->mutex) {
+			publish_tail(h);
+		}
+	}
+
+	return;
+}
+
+
+/// Waits until the helper has stopped. Then the encoder's thread may
+/// use h->mf.
+static void
+wait_idle(lzma_mf_helper *h)
+{
+	mythread_sync(h->mutex) {
+		publish_tail(h);
+
+		while (h->state != HELPER_IDLE)
+			mythread_cond_wait(&h->cond, &h->mutex);
+	}
+
+	return;
+}
+
+
+/// Used as lzma_mf.find of the encoder. The results of the bytes before
+/// h->end come from the helper; the rest are found in this thread.
+static uint32_t
+helper_find(lzma_mf *mf, lzma_match *matches)
+{
+	lzma_mf_helper *h = mf->helper;
+
+	if (mf->read_pos >= h->end) {
+		wait_idle(h);
+		assert(h->mf.read_pos == mf->read_pos);
+
+		const uint32_t count = h->mf.find(&h->mf, matches);
+		mf->read_pos = h->mf.read_pos;
+		return count;
+	}
+
+	if ((int32_t)(h->enc_head - h->enc_tail) <= 0) {
+		mythread_sync(h->mutex) {
+			publish_tail(h);
+
+			while ((int32_t)(h->head - h->enc_tail) <= 0) {
+				assert(h->state == HELPER_RUN);
+				mythread_cond_wait(&h->cond, &h->mutex);
+			}
+
+			h->enc_head = h->head;
+		}
+	}
+
+	const queue_entry *e = &h->queue[h->enc_tail & (QUEUE_SIZE - 1)];
+	const uint32_t count = e->count;
+	memcpy(matches, h->arena + e->start, count * sizeof(lzma_match));
+
+	++h->enc_tail;
+	++mf->read_pos;
+	maybe_publish_tail(h);
+
+	return count;
+}
+
+
+/// Used as lzma_mf.skip of the encoder
+static void
+helper_skip(lzma_mf *mf, uint32_t amount)
+{
+	lzma_mf_helper *h = mf->helper;
+
+	if (mf->read_pos < h->end) {
+		const uint32_t n = my_min(amount, h->end - mf->read_pos);
+		h->enc_tail += n;
+		mf->read_pos += n;
+		amount -= n;
+		maybe_publish_tail(h);
+	}
+
+	if (amount > 0) {
+		wait_idle(h);
+		assert(h->mf.read_pos == mf->read_pos);
+
+		h->mf.skip(&h->mf, amount);
+		mf->read_pos = h->mf.read_pos;
+	}
+
+	return;
+}
+
+
+extern uint64_t
+lzma_mf_helper_memusage(void)
+{
+	return sizeof(lzma_mf_helper);
+}
+
+
+extern lzma_ret
+lzma_mf_helper_start(lzma_mf *mf, const lzma_allocator *allocator)
+{
+	lzma_mf_helper *h = mf->helper;
+
+	if (h == NULL) {
+		h = lzma_alloc(sizeof(lzma_mf_helper), allocator);
+		if (h == NULL)
+			return LZMA_MEM_ERROR;
+
+		if (mythread_mutex_init(&h->mutex))
+			goto error_mutex;
+
+		if (mythread_cond_init(&h->cond))
+			goto error_cond;
+
+		h->state = HELPER_IDLE;
+
+		if (mythread_create(&h->thread, &helper_main, h))
+			goto error_thread;
+
+		mf->helper = h;
+	}
+
+	// The helper is idle so no locking is needed. The match finder
+	// state, including the bytes that are pending after the preset
+	// dictionary, now belongs to the helper.
+	h->mf = *mf;
+	h->mf.helper = NULL;
+	mf->pending = 0;
+	mf->find = &helper_find;
+	mf->skip = &helper_skip;
+
+	h->end = 0;
+	h->head = 0;
+	h->tail = 0;
+	h->enc_head = 0;
+	h->enc_tail = 0;
+	h->enc_published = 0;
+	h->arena_pos = 0;
+
+	return LZMA_OK;
+
+error_thread:
+	mythread_cond_destroy(&h->cond);
+
+error_cond:
+	mythread_mutex_destroy(&h->mutex);
+
+error_mutex:
+	lzma_free(h, allocator);
+	return LZMA_MEM_ERROR;
+}
+
+
+extern void
+lzma_mf_helper_pause(lzma_mf *mf)
+{
+	lzma_mf_helper *h = mf->helper;
+
+	mythread_sync(h->mutex) {
+		publish_tail(h);
+
+		if (h->state == HELPER_RUN) {
+			h->state = HELPER_PAUSE;
+			mythread_cond_signal(&h->cond);
+
+			while (h->state != HELPER_IDLE)
+				mythread_cond_wait(&h->cond, &h->mutex);
+		}
+
+		h->enc_head = h->head;
+	}
+
+	return;
+}
+
+
+extern void
+lzma_mf_helper_resume(lzma_mf *mf, uint32_t moved)
+{
+	lzma_mf_helper *h = mf->helper;
+	lzma_mf *hmf = &h->mf;
+
+	// Apply the changes that fill_window() made to the encoder's
+	// lzma_mf. The window was moved by "moved" bytes.
+	hmf->offset += moved;
+	hmf->read_pos -= moved;
+	hmf->read_limit = mf->read_limit;
+	hmf->write_pos = mf->write_pos;
+	hmf->action = mf->action;
+
+	// Restart the match finder after finished LZMA_SYNC_FLUSH like
+	// fill_window() does without the helper.
+	if (hmf->pending > 0 && hmf->read_pos < hmf->read_limit) {
+		const uint32_t pending = hmf->pending;
+		hmf->pending = 0;
+
+		assert(hmf->read_pos >= pending);
+		hmf->read_pos -= pending;
+		hmf->skip(hmf, pending);
+	}
+
+	const uint32_t end = hmf->write_pos >= hmf->nice_len
+			? hmf->write_pos - hmf->nice_len + 1 : 0;
+
+	mythread_sync(h->mutex) {
+		h->end = end;
+
+		if (hmf->read_pos < end) {
+			h->state = HELPER_RUN;
+			mythread_cond_signal(&h->cond);
+		}
+	}
+
+	return;
+}
+
+
+extern void
+lzma_mf_helper_stop(lzma_mf *mf)
+{
+	lzma_mf_helper *h = mf->helper;
+
+	// Do nothing if the helper has already been stopped.
+	if (mf->find != &helper_find)
+		return;
+
+	lzma_mf_helper_pause(mf);
+
+	// Copy the match finder state back. read_pos is set to the
+	// position of the helper so that read_pos + offset covers every
+	// position in the hash tables (see lz_encoder_init()).
+	mf->offset = h->mf.offset;
+	mf->read_pos = h->mf.read_pos;
+	mf->pending = h->mf.pending;
+	mf->cyclic_pos = h->mf.cyclic_pos;
+	mf->norm_pos = h->mf.norm_pos;
+	mf->norm_index = h->mf.norm_index;
+	mf->find = h->mf.find;
+	mf->skip = h->mf.skip;
+
+	return;
+}
+
+
+extern void
+lzma_mf_helper_end(lzma_mf *mf, const lzma_allocator *allocator)
+{
+	lzma_mf_helper *h = mf->helper;
+
+	lzma_mf_helper_stop(mf);
+
+	mythread_sync(h->mutex) {
+		h->state = HELPER_EXIT;
+		mythread_cond_signal(&h->cond);
+	}
+
+	mythread_join(h->thread);
+	mythread_cond_destroy(&h->cond);
+	mythread_mutex_destroy(&h->mutex);
+	lzma_free(h, allocator);
+
+	mf->helper = NULL;
+	return;
+}
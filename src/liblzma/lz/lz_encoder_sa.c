@@ -0,0 +1,438 @@
+// SPDX-License-Identifier: 0BSD
+
+///////////////////////////////////////////////////////////////////////////////
+//
+/// \file       lz_encoder_sa.c
+/// \brief      Segments of the suffix array match finder
+///
+/// The suffix array match finder (LZMA_MF_SA) processes the input in
+/// segments. A segment contains the dict_size bytes before read_pos,
+/// which are the only bytes that matches may refer to, and up to
+/// keep_size_after bytes from read_pos onwards. For each segment:
+///
+///   1. The suffix array of the segment is built with SA-IS.
+///
+///   2. The LCP array is calculated with the permuted LCP (Phi)
+///      algorithm. The lengths are capped to nice_len because the
+///      match finder doesn't need to know about longer matches, and
+///      lengths of one are set to zero because they aren't matches.
+///
+///   3. The LCP interval tree is built from the LCP array. A node of
+///      the tree is a range of the suffix array whose suffixes have
+///      a common prefix of sa_depth bytes. For each suffix, sa_leaf
+///      gives the deepest node that contains it.
+///
+///   4. The bytes before read_pos are inserted into the tree.
+///
+/// A byte is inserted by walking from its sa_leaf node to the root and
+/// setting sa_last of each node to the position of the byte. Before the
+/// byte is inserted, sa_last of a node is thus the nearest earlier
+/// position whose suffix has at least sa_depth bytes in common with the
+/// suffix of the current byte. Nothing is missed, so for every length,
+/// lzma_mf_sa_find() in lz_encoder_mf.c finds the nearest match that is
+/// at least that long.
+///
+/// The depth of the tree is at most nice_len. It is usually small, but
+/// with repeating data the paths can have nearly nice_len nodes. Such
+/// data gives long matches, so lzma_mf_sa_find() is called rarely, and
+/// lzma_mf_sa_skip() inserts many bytes at once so that the common parts
+/// of their paths are walked only once. Building a segment is slow, but
+/// since the LZ encoder keeps at least keep_size_after bytes of input
+/// after read_pos when it isn't flushing or finishing, a new segment
+/// is built only after about keep_size_after bytes.
+///
+/// The arrays of the tree are used for the arrays of the construction
+/// too: sa_last holds the suffix array, sa_parent the LCP array,
+/// sa_leaf the buckets of SA-IS and the permuted LCP array, and sa_depth
+/// the suffix types of SA-IS.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "lz_encoder.h"
+#include "memcmplen.h"
+
+/// Marks an unused element in the suffix array during SA-IS
+#define SA_EMPTY UINT32_MAX
+
+/// The depths of the nodes on the stack are increasing and at most
+/// nice_len, so this is enough for the stack of build_tree().
+#define SA_STACK_SIZE 274
+
+
+/// Gets a character of the text. The text is the segment of the
+/// window (bytes) on the first level of the SA-IS recursion and an
+/// array of names (uint32_t) on the other levels.
+static inline uint32_t
+text_get(const void *text, bool wide, uint32_t i)
+{
+	return wide ? ((const uint32_t *)text)[i] : ((const uint8_t *)text)[i];
+}
+
+
+/// Returns true if the suffix at i is S-type.
+static inline bool
+is_s(const uint8_t *types, uint32_t i)
+{
+	return (types[i >> 3] >> (i & 7)) & 1;
+}
+
+
+/// Returns true if the suffix at i is the leftmost S-type suffix of
+/// a run of S-type suffixes.
+static inline bool
+is_lms(const uint8_t *types, uint32_t i)
+{
+	return i > 0 && is_s(types, i) && !is_s(types, i - 1);
+}
+
+
+/// Sets bkt[c] to the index of the first (end == false) or one past
+/// the last (end == true) element of the bucket of the character c.
+static void
+get_buckets(const void *text, bool wide, uint32_t n, uint32_t k,
+		uint32_t *bkt, bool end)
+{
+	memzero(bkt, k * sizeof(uint32_t));
+
+	for (uint32_t i = 0; i < n; ++i)
+		++bkt[text_get(text, wide, i)];
+
+	uint32_t sum = 0;
+	for (uint32_t c = 0; c < k; ++c) {
+		const uint32_t count = bkt[c];
+		sum += count;
+		bkt[c] = end ? sum : sum - count;
+	}
+
+	return;
+}
+
+
+/// Induces the order of the L-type suffixes from the sorted LMS suffixes
+/// and then the order of the S-type suffixes from the L-type suffixes.
+/// The end of the text is a virtual sentinel that is smaller than every
+/// character, so the last suffix is L-type and it's induced first.
+static void
+induce(const void *text, bool wide, uint32_t *sa, uint32_t n, uint32_t k,
+		uint32_t *bkt, const uint8_t *types)
+{
+	get_buckets(text, wide, n, k, bkt, false);
+	sa[bkt[text_get(text, wide, n - 1)]++] = n - 1;
+
+	for (uint32_t i = 0; i < n; ++i) {
+		const uint32_t j = sa[i];
+		if (j != SA_EMPTY && j > 0 && !is_s(types, j - 1))
+			sa[bkt[text_get(text, wide, j - 1)]++] = j - 1;
+	}
+
+	get_buckets(text, wide, n, k, bkt, true);
+
+	for (uint32_t i = n; i-- > 0; ) {
+		const uint32_t j = sa[i];
+		if (j != SA_EMPTY && j > 0 && is_s(types, j - 1))
+			sa[--bkt[text_get(text, wide, j - 1)]] = j - 1;
+	}
+
+	return;
+}
+
+
+/// \brief      Builds the suffix array with SA-IS
+///
+/// \param      text    Text of n characters in the range [0, k)
+/// \param      wide    True if the characters are uint32_t, false if
+///                     they are uint8_t
+/// \param      sa      Suffix array of n elements
+/// \param      n       Length of the text, at least one
+/// \param      k       Size of the alphabet
+/// \param      bkt     Room for max(k, n / 2) buckets. The buckets
+///                     are shared by all levels of the recursion.
+/// \param      types   Room for the type bits of this level and the
+///                     deeper levels of the recursion, that is,
+///                     2 * n bits
+static void
+sais(const void *text, bool wide, uint32_t *sa, uint32_t n, uint32_t k,
+		uint32_t *bkt, uint8_t *types)
+{
+	if (n == 1) {
+		sa[0] = 0;
+		return;
+	}
+
+	// Classify the suffixes. The last one is L-type because of
+	// the virtual sentinel.
+	memzero(types, (n + 7) / 8);
+
+	for (uint32_t i = n - 1; i-- > 0; ) {
+		const uint32_t c0 = text_get(text, wide, i);
+		const uint32_t c1 = text_get(text, wide, i + 1);
+
+		if (c0 < c1 || (c0 == c1 && is_s(types, i + 1)))
+			types[i >> 3] |= (uint8_t)(1U << (i & 7));
+	}
+
+	// Sort the LMS substrings by putting the LMS suffixes to the ends
+	// of their buckets and inducing the rest.
+	for (uint32_t i = 0; i < n; ++i)
+		sa[i] = SA_EMPTY;
+
+	get_buckets(text, wide, n, k, bkt, true);
+
+	for (uint32_t i = 1; i < n; ++i)
+		if (is_lms(types, i))
+			sa[--bkt[text_get(text, wide, i)]] = i;
+
+	induce(text, wide, sa, n, k, bkt, types);
+
+	// Move the sorted LMS substrings to the beginning of sa[]. No two
+	// LMS positions are adjacent so there are at most n / 2 of them.
+	uint32_t m = 0;
+	for (uint32_t i = 0; i < n; ++i) {
+		assert(sa[i] != SA_EMPTY);
+		if (is_lms(types, sa[i]))
+			sa[m++] = sa[i];
+	}
+
+	// Name the LMS substrings. Equal substrings get the same name.
+	// The name of the substring at position j is stored temporarily
+	// in sa[m + j / 2], which doesn't overlap with the names of the
+	// other LMS substrings or with sa[0 .. m - 1].
+	for (uint32_t i = m; i < n; ++i)
+		sa[i] = SA_EMPTY;
+
+	uint32_t names = 0;
+	uint32_t prev = SA_EMPTY;
+
+	for (uint32_t i = 0; i < m; ++i) {
+		const uint32_t pos = sa[i];
+		bool diff = false;
+
+		for (uint32_t d = 0; ; ++d) {
+			if (prev == SA_EMPTY || pos + d == n || prev + d == n
+					|| text_get(text, wide, pos + d)
+						!= text_get(text, wide,
+							prev + d)
+					|| is_s(types, pos + d)
+						!= is_s(types, prev + d)) {
+				diff = true;
+				break;
+			}
+
+			// The types before these are equal, so if one
+			// of them is an LMS position, both are and the
+			// substrings end here.
+			if (d > 0 && is_lms(types, pos + d))
+				break;
+		}
+
+		if (diff) {
+			++names;
+			prev = pos;
+		}
+
+		sa[m + pos / 2] = names - 1;
+	}
+
+	// Gather the names in text order to the end of sa[]. This is
+	// the reduced text.
+	uint32_t *reduced = sa + n - m;
+	{
+		uint32_t j = n;
+		for (uint32_t i = n; i-- > m; )
+			if (sa[i] != SA_EMPTY)
+				sa[--j] = sa[i];
+
+		assert(j == n - m);
+	}
+
+	// Sort the suffixes of the reduced text. If all names are
+	// different, the names give the order directly.
+	if (names < m) {
+		sais(reduced, true, sa, m, names, bkt,
+				types + (n + 7) / 8);
+	} else {
+		for (uint32_t i = 0; i < m; ++i)
+			sa[reduced[i]] = i;
+	}
+
+	// Replace the reduced text with the LMS positions so that
+	// the suffix array of the reduced text can be mapped to the
+	// positions in the text.
+	{
+		uint32_t j = m;
+		for (uint32_t i = n; i-- > 1; )
+			if (is_lms(types, i))
+				reduced[--j] = i;
+
+		assert(j == 0);
+	}
+
+	for (uint32_t i = 0; i < m; ++i)
+		sa[i] = reduced[sa[i]];
+
+	for (uint32_t i = m; i < n; ++i)
+		sa[i] = SA_EMPTY;
+
+	// Put the sorted LMS suffixes to the ends of their buckets,
+	// keeping their order, and induce the final suffix array.
+	get_buckets(text, wide, n, k, bkt, true);
+
+	for (uint32_t i = m; i-- > 0; ) {
+		const uint32_t j = sa[i];
+		sa[i] = SA_EMPTY;
+		sa[--bkt[text_get(text, wide, j)]] = j;
+	}
+
+	induce(text, wide, sa, n, k, bkt, types);
+	return;
+}
+
+
+/// \brief      Calculates the LCP array
+///
+/// lcp[r] is the length of the common prefix of the suffixes sa[r - 1]
+/// and sa[r] capped to cap, except that lengths below two are zero.
+/// lcp[0] is zero. plcp[] is the LCP array in text order; the values
+/// decrease by at most one from a position to the next, which makes
+/// the calculation linear.
+static void
+build_lcp(const uint8_t *text, uint32_t n, uint32_t cap,
+		const uint32_t *sa, uint32_t *plcp, uint32_t *lcp)
+{
+	// First store the previous suffix in the suffix array order.
+	plcp[sa[0]] = SA_EMPTY;
+	for (uint32_t r = 1; r < n; ++r)
+		plcp[sa[r]] = sa[r - 1];
+
+	uint32_t len = 0;
+	for (uint32_t i = 0; i < n; ++i) {
+		const uint32_t j = plcp[i];
+		if (j == SA_EMPTY) {
+			plcp[i] = 0;
+			len = 0;
+			continue;
+		}
+
+		const uint32_t limit = my_min(cap, n - my_max(i, j));
+		len = lzma_memcmplen(text + i, text + j, my_min(len, limit),
+				limit);
+		plcp[i] = len;
+
+		if (len > 0)
+			--len;
+	}
+
+	lcp[0] = 0;
+	for (uint32_t r = 1; r < n; ++r) {
+		const uint32_t len_r = plcp[sa[r]];
+		lcp[r] = len_r < 2 ? 0 : len_r;
+	}
+
+	return;
+}
+
+
+/// \brief      Builds the LCP interval tree
+///
+/// The suffix array is scanned from the beginning. The stack contains
+/// the nodes whose range hasn't ended yet; their depths are increasing.
+/// A node ends when the next LCP value is smaller than its depth.
+///
+/// parent[] may be the same array as lcp[]: the node created while
+/// handling lcp[r] gets an index at most r, so the parents are written
+/// only to the elements that have already been read.
+///
+/// \return     Number of nodes including the root
+static uint32_t
+build_tree(const uint32_t *sa, const uint32_t *lcp, uint32_t n,
+		uint32_t *leaf, uint32_t *parent, uint16_t *depth)
+{
+	uint32_t stack[SA_STACK_SIZE];
+	uint32_t top = 0;
+	uint32_t nodes = 1;
+
+	stack[0] = 0;
+	depth[0] = 0;
+
+	for (uint32_t r = 0; r < n; ++r) {
+		const uint32_t h = r + 1 < n ? lcp[r + 1] : 0;
+		const uint32_t cur = stack[top];
+
+		if (h > depth[cur]) {
+			// The suffixes sa[r] and sa[r + 1] have a longer
+			// common prefix than sa[r - 1] and sa[r].
+			assert(top + 1 < SA_STACK_SIZE);
+			const uint32_t node = nodes++;
+			depth[node] = (uint16_t)h;
+			stack[++top] = node;
+			leaf[sa[r]] = node;
+			continue;
+		}
+
+		leaf[sa[r]] = cur;
+
+		while (depth[stack[top]] > h) {
+			const uint32_t node = stack[top--];
+
+			if (depth[stack[top]] >= h) {
+				parent[node] = stack[top];
+			} else {
+				const uint32_t new_node = nodes++;
+				depth[new_node] = (uint16_t)h;
+				parent[node] = new_node;
+				stack[++top] = new_node;
+			}
+		}
+	}
+
+	assert(top == 0);
+	assert(nodes <= n);
+	return nodes;
+}
+
+
+extern void
+lzma_mf_sa_build(lzma_mf *mf)
+{
+	// Matches may refer to at most dict_size bytes before read_pos.
+	// The bytes after read_pos are needed for the match lengths.
+	const uint32_t dict_size = mf->cyclic_size - 1;
+	const uint32_t begin = mf->read_pos > dict_size
+			? mf->read_pos - dict_size : 0;
+	const uint32_t end = my_min(mf->write_pos,
+			mf->read_pos + mf->keep_size_after);
+	const uint32_t n = end - begin;
+	const uint8_t *text = mf->buffer + begin;
+
+	assert(mf->read_pos < end);
+	assert(n <= mf->sa_size);
+
+	// sa_size is at least dict_size + keep_size_after, which is over
+	// 256, and at least n, so sa_leaf has room for the buckets of
+	// every level of SA-IS. sa_depth has 2 * sa_size bytes, which is
+	// more than enough for the type bits.
+	uint32_t *sa = mf->sa_last;
+	sais(text, false, sa, n, 256, mf->sa_leaf, (uint8_t *)mf->sa_depth);
+
+	build_lcp(text, n, mf->nice_len, sa, mf->sa_leaf, mf->sa_parent);
+
+	const uint32_t nodes = build_tree(sa, mf->sa_parent, n,
+			mf->sa_leaf, mf->sa_parent, mf->sa_depth);
+
+	// The suffix array isn't needed anymore.
+	memzero(mf->sa_last, nodes * sizeof(uint32_t));
+
+	mf->sa_base = begin + mf->offset;
+	mf->sa_count = n;
+
+	// Insert the bytes before read_pos. Like in lzma_mf_sa_skip(),
+	// the last byte is inserted first so that the walk can stop at
+	// the first node that already has a position.
+	for (uint32_t i = mf->read_pos - begin; i-- > 0; )
+		for (uint32_t node = mf->sa_leaf[i];
+				node != 0 && mf->sa_last[node] == 0;
+				node = mf->sa_parent[node])
+			mf->sa_last[node] = i + 1;
+
+	return;
+}
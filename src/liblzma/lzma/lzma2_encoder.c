@@ -14,6 +14,52 @@
 #include "lzma_encoder.h"
 #include "fastpos.h"
 #include "lzma2_encoder.h"
+#include <time.h>
+
+
+/// Number of steps in the speed-target rate control. See speed_apply().
+#define SPEED_LEVELS 8
+
+/// Level from which on LZMA_MODE_LAZY is used instead of LZMA_MODE_NORMAL
+#define SPEED_LEVEL_LAZY 3
+
+/// Level from which on LZMA_MODE_FAST is used
+#define SPEED_LEVEL_FAST 5
+
+/// nice_len isn't lowered below this. This is at least the number of bytes
+/// that any match finder hashes.
+#define SPEED_NICE_LEN_MIN 8
+
+/// The speed is checked after at least this many uncompressed bytes so
+/// that short chunks don't make the measurements too noisy.
+#define SPEED_INTERVAL (UINT32_C(1) << 20)
+
+/// After a chunk that didn't compress, the next bytes are checked in blocks
+/// of this size to see if they look incompressible. A block is checked
+/// only when all of it is in the buffer so that the result doesn't depend
+/// on how the input is split into lzma_code() calls. The match finder
+/// keeps more than this many bytes after read_limit (see
+/// lzma_mf.keep_size_after), so the blocks that have been checked always
+/// reach read_limit.
+#define BYPASS_BLOCK (UINT32_C(1) << 12)
+
+/// A block looks random if the chi-squared statistic of its byte counts
+/// is between these. For random data it is about 255.
+#define BYPASS_CHI2_MIN 128
+#define BYPASS_CHI2_MAX 512
+
+/// A block looks random only if fewer than this many of its four-byte
+/// sequences are found in bypass_hash[]. For random data there are
+/// practically none.
+#define BYPASS_REPEATS_MAX 16
+
+/// Size of bypass_hash[] as a power of two
+#define BYPASS_HASH_BITS 12
+
+/// After this many chunks that were stored without trying to compress
+/// them, the next one is compressed normally to see if the data has
+/// become compressible in a way that the sampling doesn't see.
+#define BYPASS_PROBE 16
 
 
 typedef struct {
@@ -23,6 +69,7 @@ typedef struct {
 		SEQ_LZMA_COPY,
 		SEQ_UNCOMPRESSED_HEADER,
 		SEQ_UNCOMPRESSED_COPY,
+		SEQ_BYPASS,
 	} sequence;
 
 	/// LZMA encoder
@@ -45,6 +92,49 @@ typedef struct {
 	/// Read position in buf[]
 	size_t buf_pos;
 
+	/// True if the previous chunk was tried to compress and it didn't
+	/// get smaller
+	bool incompressible;
+
+	/// Number of chunks in a row that were stored without trying
+	/// to compress them
+	uint32_t bypass_count;
+
+	/// Number of bytes from the beginning of the current chunk that
+	/// have been checked to look random in SEQ_BYPASS
+	uint32_t bypass_size;
+
+	/// True when SEQ_BYPASS has found a block that doesn't look random
+	/// or the end of the input
+	bool bypass_done;
+
+	/// The latest four-byte sequences checked in SEQ_BYPASS, indexed
+	/// by their hash
+	uint32_t bypass_hash[UINT32_C(1) << BYPASS_HASH_BITS];
+
+	/// Target speed in MiB/s or zero if the rate control is disabled
+	uint32_t speed_target;
+
+	/// Current step of the rate control; zero means the settings in
+	/// opt_cur. A bigger number is faster.
+	uint32_t speed_level;
+
+	/// Compression mode that the LZMA encoder currently uses
+	lzma_mode speed_mode;
+
+	/// nice_len and depth of the match finder at level zero. These are
+	/// zero until the first call to lzma2_encode().
+	uint32_t speed_nice_len;
+	uint32_t speed_depth;
+
+	/// True if nice_len and depth of the match finder may be changed
+	bool speed_mf_adjust;
+
+	/// Microseconds spent in lzma_lzma_encode() and the number of
+	/// uncompressed bytes encoded since the speed was last checked
+	uint64_t speed_time;
+	uint64_t speed_bytes;
+
 	/// Buffer to hold the chunk header and LZMA compressed data
 	uint8_t buf[LZMA2_HEADER_MAX + LZMA2_CHUNK_MAX];
 } lzma_lzma2_coder;
@@ -131,6 +221,123 @@ lzma2_header_uncompressed(lzma_lzma2_coder *coder)
 }
 
 
+/// Check if a block of BYPASS_BLOCK bytes looks like random data, which
+/// compressed or encrypted data does. The byte counts must be close to
+/// even like they are with random data. Text and executable code are far
+/// above BYPASS_CHI2_MAX and tables of counters far below BYPASS_CHI2_MIN.
+/// Also, few of the four-byte sequences may repeat since LZMA would find
+/// matches in such data. This catches, for example, tables of pointers
+/// whose byte counts look random.
+static bool
+bypass_is_random(lzma_lzma2_coder *coder, const uint8_t *buf)
+{
+	uint32_t counts[256];
+	memzero(counts, sizeof(counts));
+
+	for (uint32_t i = 0; i < BYPASS_BLOCK; ++i)
+		++counts[buf[i]];
+
+	uint64_t sum = 0;
+	for (uint32_t i = 0; i < 256; ++i)
+		sum += (uint64_t)(counts[i]) * counts[i];
+
+	// chi2 = 256 * sum / n - n
+	const uint64_t n = BYPASS_BLOCK;
+	if (256 * sum <= n * (n + BYPASS_CHI2_MIN)
+			|| 256 * sum >= n * (n + BYPASS_CHI2_MAX))
+		return false;
+
+	uint32_t repeats = 0;
+	for (uint32_t i = 0; i + 4 <= BYPASS_BLOCK; ++i) {
+		const uint32_t value = read32le(buf + i);
+		const uint32_t hash = (value * UINT32_C(0x9E3779B1))
+				>> (32 - BYPASS_HASH_BITS);
+		repeats += coder->bypass_hash[hash] == value;
+		coder->bypass_hash[hash] = value;
+	}
+
+	return repeats < BYPASS_REPEATS_MAX;
+}
+
+
+/// Get the CPU time used by the calling thread in microseconds. If that
+/// isn't available, the time from clock() is used.
+static uint64_t
+speed_clock(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_THREAD_CPUTIME_ID) \
+		&& !defined(_WIN32)
+	struct timespec tv;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tv) == 0)
+		return (uint64_t)tv.tv_sec * 1000000
+				+ (uint64_t)tv.tv_nsec / 1000;
+#endif
+
+	return (uint64_t)clock() * 1000000 / CLOCKS_PER_SEC;
+}
+
+
+/// Make the LZMA encoder and the match finder use the settings of
+/// coder->speed_level. Each level halves nice_len and depth of the level
+/// below it. The mode changes from normal to lazy at SPEED_LEVEL_LAZY and
+/// to fast at SPEED_LEVEL_FAST, but never to a slower mode than the one
+/// in opt_cur.
+static void
+speed_apply(lzma_lzma2_coder *coder, lzma_mf *mf)
+{
+	const uint32_t level = coder->speed_level;
+
+	lzma_mode mode = coder->opt_cur.mode;
+	if (level >= SPEED_LEVEL_FAST)
+		mode = LZMA_MODE_FAST;
+	else if (level >= SPEED_LEVEL_LAZY && mode == LZMA_MODE_NORMAL)
+		mode = LZMA_MODE_LAZY;
+
+	// If the LZMA encoder has pending symbols, the mode is changed
+	// at the beginning of some later chunk.
+	if (mode != coder->speed_mode
+			&& !lzma_lzma_encoder_set_mode(coder->lzma, mode))
+		coder->speed_mode = mode;
+
+	if (coder->speed_mf_adjust) {
+		mf->nice_len = my_max(coder->speed_nice_len >> level,
+				my_min(coder->speed_nice_len,
+					SPEED_NICE_LEN_MIN));
+		mf->depth = my_max(coder->speed_depth >> level, 1);
+	}
+
+	return;
+}
+
+
+/// Compare the speed since the previous check to the target and move
+/// one level up or down if needed. The hysteresis of 25 % keeps the level
+/// from flipping between two levels when the speed is near the target.
+static void
+speed_update(lzma_lzma2_coder *coder)
+{
+	if (coder->speed_bytes < SPEED_INTERVAL)
+		return;
+
+	// Both speeds are in bytes per second.
+	const uint64_t target = (uint64_t)(coder->speed_target) << 20;
+	const uint64_t speed = coder->speed_bytes * 1000000
+			/ my_max(coder->speed_time, 1);
+
+	if (speed < target) {
+		if (coder->speed_level < SPEED_LEVELS - 1)
+			++coder->speed_level;
+	} else if (speed / 5 > target / 4) {
+		if (coder->speed_level > 0)
+			--coder->speed_level;
+	}
+
+	coder->speed_time = 0;
+	coder->speed_bytes = 0;
+	return;
+}
+
+
 static lzma_ret
 lzma2_encode(void *coder_ptr, lzma_mf *restrict mf,
 		uint8_t *restrict out, size_t *restrict out_pos,
@@ -152,12 +359,45 @@ lzma2_encode(void *coder_ptr, lzma_mf *restrict mf,
 					? LZMA_OK : LZMA_STREAM_END;
 		}
 
+		coder->uncompressed_size = 0;
+		coder->compressed_size = 0;
+
+		// If the previous chunk didn't compress, store the next
+		// bytes without running the LZMA encoder as long as they
+		// look random. If the previous chunk was stored, there's
+		// no pending data in the match finder.
+		if (coder->incompressible
+				&& coder->bypass_count < BYPASS_PROBE) {
+			assert(mf->read_ahead == 0);
+			++coder->bypass_count;
+			coder->bypass_size = 0;
+			coder->bypass_done = false;
+			memzero(coder->bypass_hash,
+					sizeof(coder->bypass_hash));
+			coder->sequence = SEQ_BYPASS;
+			break;
+		}
+
+		coder->bypass_count = 0;
+
 		if (coder->need_state_reset)
 			return_if_error(lzma_lzma_encoder_reset(
 					coder->lzma, &coder->opt_cur));
 
-		coder->uncompressed_size = 0;
-		coder->compressed_size = 0;
+		if (coder->speed_target != 0) {
+			// The match finder with the suffix array or
+			// the helper thread needs a fixed nice_len.
+			if (coder->speed_nice_len == 0) {
+				coder->speed_nice_len = mf->nice_len;
+				coder->speed_depth = mf->depth;
+				coder->speed_mf_adjust = mf->sa_size == 0
+						&& mf->helper == NULL;
+			}
+
+			speed_update(coder);
+			speed_apply(coder, mf);
+		}
+
 		coder->sequence = SEQ_LZMA_ENCODE;
 		FALLTHROUGH;
 
@@ -185,6 +425,9 @@ lzma2_encode(void *coder_ptr, lzma_mf *restrict mf,
 		const uint32_t read_start = mf->read_pos - mf->read_ahead;
 
 		// Call the LZMA encoder until the chunk is finished.
+		const uint64_t time_start = coder->speed_target != 0
+				? speed_clock() : 0;
+
 		const lzma_ret ret = lzma_lzma_encode(coder->lzma, mf,
 				coder->buf + LZMA2_HEADER_MAX,
 				&coder->compressed_size,
@@ -193,6 +436,12 @@ lzma2_encode(void *coder_ptr, lzma_mf *restrict mf,
 		coder->uncompressed_size += mf->read_pos - mf->read_ahead
 				- read_start;
 
+		if (coder->speed_target != 0) {
+			coder->speed_time += speed_clock() - time_start;
+			coder->speed_bytes += mf->read_pos - mf->read_ahead
+					- read_start;
+		}
+
 		assert(coder->compressed_size <= LZMA2_CHUNK_MAX);
 		assert(coder->uncompressed_size <= LZMA2_UNCOMPRESSED_MAX);
 
@@ -209,12 +458,14 @@ lzma2_encode(void *coder_ptr, lzma_mf *restrict mf,
 			mf->read_ahead = 0;
 			lzma2_header_uncompressed(coder);
 			coder->need_state_reset = true;
+			coder->incompressible = true;
 			coder->sequence = SEQ_UNCOMPRESSED_HEADER;
 			break;
 		}
 
 		// The chunk did compress at least by one byte, so we store
 		// the chunk as LZMA.
+		coder->incompressible = false;
 		lzma2_header_lzma(coder);
 
 		coder->sequence = SEQ_LZMA_COPY;
@@ -253,6 +504,71 @@ lzma2_encode(void *coder_ptr, lzma_mf *restrict mf,
 
 		coder->sequence = SEQ_INIT;
 		break;
+
+	case SEQ_BYPASS: {
+		assert(mf->keep_size_after >= BYPASS_BLOCK);
+
+		// Check the blocks of the chunk whose bytes are all in
+		// the buffer. Without LZMA_RUN no more input is coming, so
+		// the chunk ends at the first block that cannot be checked.
+		const uint8_t *chunk = mf->buffer + mf->read_pos
+				- coder->uncompressed_size;
+		const uint32_t avail = mf_avail(mf) + coder->uncompressed_size;
+
+		while (!coder->bypass_done
+				&& coder->bypass_size < LZMA2_CHUNK_MAX) {
+			if (avail - coder->bypass_size < BYPASS_BLOCK) {
+				if (mf->action != LZMA_RUN)
+					coder->bypass_done = true;
+
+				break;
+			}
+
+			if (!bypass_is_random(coder,
+					chunk + coder->bypass_size)) {
+				coder->bypass_done = true;
+				break;
+			}
+
+			coder->bypass_size += BYPASS_BLOCK;
+		}
+
+		// Run the checked bytes through the match finder so that
+		// they can be referred to from the later chunks.
+		uint32_t amount = 0;
+		if (mf->read_limit > mf->read_pos)
+			amount = my_min(coder->bypass_size
+					- coder->uncompressed_size,
+					mf->read_limit - mf->read_pos);
+
+		if (amount > 0) {
+			mf_skip(mf, amount);
+			mf->read_ahead = 0;
+			coder->uncompressed_size += amount;
+		}
+
+		// Wait for more input until all the checked bytes have
+		// been skipped and the end of the chunk is known.
+		if (coder->uncompressed_size < coder->bypass_size
+				|| (!coder->bypass_done && coder->bypass_size
+					< LZMA2_CHUNK_MAX))
+			return LZMA_OK;
+
+		if (coder->bypass_done) {
+			// Compress the next chunk normally.
+			coder->incompressible = false;
+
+			if (coder->uncompressed_size == 0) {
+				coder->sequence = SEQ_INIT;
+				break;
+			}
+		}
+
+		lzma2_header_uncompressed(coder);
+		coder->need_state_reset = true;
+		coder->sequence = SEQ_UNCOMPRESSED_HEADER;
+		break;
+	}
 	}
 
 	return LZMA_OK;
@@ -328,6 +644,30 @@ lzma2_encoder_init(lzma_lz_encoder *lz, const lzma_allocator *allocator,
 
 	coder->opt_cur = *(const lzma_options_lzma *)(options);
 
+	// speed_target used to be a reserved member which applications were
+	// allowed to leave uninitialized. It is read only if the application
+	// has said so with ext_enable.
+	coder->speed_target = 0;
+	if (coder->opt_cur.ext_enable == LZMA_OPTIONS_LZMA_EXT) {
+		if (coder->opt_cur.speed_target > LZMA_SPEED_TARGET_MAX)
+			return LZMA_OPTIONS_ERROR;
+
+		coder->speed_target = coder->opt_cur.speed_target;
+	}
+
+	coder->speed_level = 0;
+	coder->speed_mode = coder->opt_cur.mode;
+	coder->speed_nice_len = 0;
+	coder->speed_depth = 0;
+	coder->speed_mf_adjust = false;
+	coder->speed_time = 0;
+	coder->speed_bytes = 0;
+
+	coder->incompressible = false;
+	coder->bypass_count = 0;
+	coder->bypass_size = 0;
+	coder->bypass_done = false;
+
 	coder->sequence = SEQ_INIT;
 	coder->need_properties = true;
 	coder->need_state_reset = false;
@@ -231,13 +231,332 @@ typedef struct {
 } lzma_lzma1_decoder;
 
 
+#ifndef HAVE_SMALL
+/// Return values of decode_match()
+typedef enum {
+	/// The symbol was decoded and written to the dictionary.
+	MATCH_OK,
+
+	/// The dictionary became full in the middle of the match.
+	/// The rest of it must be copied later (SEQ_COPY).
+	MATCH_COPY,
+
+	/// The end of payload marker was decoded.
+	MATCH_EOPM,
+
+	/// The distance was invalid.
+	MATCH_ERROR,
+} match_ret;
+
+
+/// Decodes a match or a repeated match in the Non-resumable Mode after
+/// the is_match bit has been decoded as 1. The match is also copied to
+/// the dictionary. This is used by decode_impl() and by the interleaved
+/// mode for batch decoding. The variables of the caller are updated
+/// via the pointers; with MATCH_COPY, *len_ptr is the number of bytes
+/// left to copy.
+static lzma_always_inline match_ret
+decode_match(lzma_lzma1_decoder *restrict coder, lzma_dict *restrict dict,
+		lzma_range_decoder *restrict rc_ptr,
+		const uint8_t **restrict rc_in_ptr_ptr,
+		const uint32_t pos_state, uint32_t *restrict state_ptr,
+		uint32_t *restrict rep0_ptr, uint32_t *restrict rep1_ptr,
+		uint32_t *restrict rep2_ptr, uint32_t *restrict rep3_ptr,
+		uint32_t *restrict len_ptr)
+{
+	// Local copies like in decode_impl() so that the range decoder
+	// macros can be used.
+	lzma_range_decoder rc = *rc_ptr;
+	const uint8_t *rc_in_ptr = *rc_in_ptr_ptr;
+	uint32_t rc_bound;
+
+	uint32_t state = *state_ptr;
+	uint32_t rep0 = *rep0_ptr;
+	uint32_t rep1 = *rep1_ptr;
+	uint32_t rep2 = *rep2_ptr;
+	uint32_t rep3 = *rep3_ptr;
+
+	probability *probs;
+	uint32_t symbol;
+	uint32_t limit;
+	uint32_t offset;
+	uint32_t len = *len_ptr;
+
+	match_ret ret = MATCH_OK;
+
+	// Instead of a new byte we are going to decode a
+	// distance-length pair. The distance represents how far
+	// back in the dictionary to begin copying. The length
+	// represents how many bytes to copy.
+
+	rc_if_0(coder->is_rep[state]) {
+		///////////////////
+		// Simple match. //
+		///////////////////
+
+		// Not a repeated match. In this case,
+		// the length (how many bytes to copy) must be
+		// decoded first. Then, the distance (where to
+		// start copying) is decoded.
+		//
+		// This is also how we know when we are done
+		// decoding. If the distance decodes to UINT32_MAX,
+		// then we know to stop decoding (end of payload
+		// marker).
+
+		rc_update_0(coder->is_rep[state]);
+		update_match(state);
+
+		// The latest three match distances are kept in
+		// memory in case there are repeated matches.
+		rep3 = rep2;
+		rep2 = rep1;
+		rep1 = rep0;
+
+		// Decode the length of the match.
+		len_decode_fast(len, coder->match_len_decoder,
+				pos_state);
+
+		// Next, decode the distance into rep0.
+
+		// The next 6 bits determine how to decode the
+		// rest of the distance.
+		probs = coder->dist_slot[get_dist_state(len)];
+
+		rc_bittree6(probs, -DIST_SLOTS);
+		assert(symbol <= 63);
+
+		if (symbol < DIST_MODEL_START) {
+			// If the decoded symbol is < DIST_MODEL_START
+			// then we use its value directly as the
+			// match distance. No other bits are needed.
+			// The only possible distance values
+			// are [0, 3].
+			rep0 = symbol;
+		} else {
+			// Use the first two bits of symbol as the
+			// highest bits of the match distance.
+
+			// "limit" represents the number of low bits
+			// to decode.
+			limit = (symbol >> 1) - 1;
+			assert(limit >= 1 && limit <= 30);
+			rep0 = 2 + (symbol & 1);
+
+			if (symbol < DIST_MODEL_END) {
+				// When symbol is > DIST_MODEL_START,
+				// but symbol < DIST_MODEL_END, then
+				// it can decode distances between
+				// [4, 127].
+				assert(limit <= 5);
+				rep0 <<= limit;
+				assert(rep0 <= 96);
+
+				// -1 is fine, because we start
+				// decoding at probs[1], not probs[0].
+				// NOTE: This violates the C standard,
+				// since we are doing pointer
+				// arithmetic past the beginning of
+				// the array.
+				assert((int32_t)(rep0 - symbol - 1)
+						>= -1);
+				assert((int32_t)(rep0 - symbol - 1)
+						<= 82);
+				probs = coder->pos_special + rep0
+						- symbol - 1;
+				symbol = 1;
+				offset = 1;
+
+				// Variable number (1-5) of bits
+				// from a reverse bittree. This
+				// isn't worth manual unrolling.
+				do {
+					rc_bit_add_if_1(probs,
+							rep0, offset);
+					offset <<= 1;
+				} while (--limit > 0);
+			} else {
+				// The distance is >= 128. Decode the
+				// lower bits without probabilities
+				// except the lowest four bits.
+				assert(symbol >= 14);
+				assert(limit >= 6);
+
+				limit -= ALIGN_BITS;
+				assert(limit >= 2);
+
+				rc_direct(rep0, limit);
+
+				// Decode the lowest four bits using
+				// probabilities. The match may be
+				// far back in the dictionary, so
+				// start loading the first possible
+				// byte of it already.
+				rep0 <<= ALIGN_BITS;
+				dict_prefetch(dict,
+						rep0 + ALIGN_SIZE - 1);
+				rc_bittree_rev4(coder->pos_align);
+				rep0 += symbol;
+
+				// If the end of payload marker (EOPM)
+				// is detected, the caller continues in
+				// the safe code. The EOPM handling
+				// isn't speed critical at all.
+				//
+				// A final normalization is needed
+				// after the EOPM (there can be a
+				// dummy byte to read in some cases).
+				// If the normalization was done here
+				// in the fast code, it would need to
+				// be taken into account in the value
+				// of LZMA_IN_REQUIRED. Using the
+				// safe code allows keeping
+				// LZMA_IN_REQUIRED as 20 instead of
+				// 21.
+				if (rep0 == UINT32_MAX) {
+					ret = MATCH_EOPM;
+					goto out;
+				}
+			}
+		}
+
+		// Validate the distance we just decoded.
+		if (unlikely(!dict_is_distance_valid(dict, rep0))) {
+			ret = MATCH_ERROR;
+			goto out;
+		}
+
+	} else {
+		rc_update_1(coder->is_rep[state]);
+
+		/////////////////////
+		// Repeated match. //
+		/////////////////////
+
+		// The match distance is a value that we have decoded
+		// recently. The latest four match distances are
+		// available as rep0, rep1, rep2 and rep3. We will
+		// now decode which of them is the new distance.
+		//
+		// There cannot be a match if we haven't produced
+		// any output, so check that first.
+		if (unlikely(!dict_is_distance_valid(dict, 0))) {
+			ret = MATCH_ERROR;
+			goto out;
+		}
+
+		rc_if_0(coder->is_rep0[state]) {
+			rc_update_0(coder->is_rep0[state]);
+			// The distance is rep0.
+
+			// Decode the next bit to determine if 1 byte
+			// should be copied from rep0 distance or
+			// if the number of bytes needs to be decoded.
+
+			// If the next bit is 0, then it is a
+			// "Short Rep Match" and only 1 bit is copied.
+			// Otherwise, the length of the match is
+			// decoded after the "else" statement.
+			rc_if_0(coder->is_rep0_long[state][pos_state]) {
+				rc_update_0(coder->is_rep0_long[
+						state][pos_state]);
+
+				update_short_rep(state);
+				dict_put(dict, dict_get(dict, rep0));
+				goto out;
+			}
+
+			// Repeating more than one byte at
+			// distance of rep0.
+			rc_update_1(coder->is_rep0_long[
+					state][pos_state]);
+
+		} else {
+			rc_update_1(coder->is_rep0[state]);
+
+			// The distance is rep1, rep2 or rep3. Once
+			// we find out which one of these three, it
+			// is stored to rep0 and rep1, rep2 and rep3
+			// are updated accordingly. There is no
+			// "Short Rep Match" option, so the length
+			// of the match must always be decoded next.
+			rc_if_0(coder->is_rep1[state]) {
+				// The distance is rep1.
+				rc_update_0(coder->is_rep1[state]);
+
+				const uint32_t distance = rep1;
+				rep1 = rep0;
+				rep0 = distance;
+
+			} else {
+				rc_update_1(coder->is_rep1[state]);
+
+				rc_if_0(coder->is_rep2[state]) {
+					// The distance is rep2.
+					rc_update_0(coder->is_rep2[
+							state]);
+
+					const uint32_t distance = rep2;
+					rep2 = rep1;
+					rep1 = rep0;
+					rep0 = distance;
+
+				} else {
+					// The distance is rep3.
+					rc_update_1(coder->is_rep2[
+							state]);
+
+					const uint32_t distance = rep3;
+					rep3 = rep2;
+					rep2 = rep1;
+					rep1 = rep0;
+					rep0 = distance;
+				}
+			}
+		}
+
+		update_long_rep(state);
+
+		// Decode the length of the repeated match.
+		len_decode_fast(len, coder->rep_len_decoder,
+				pos_state);
+	}
+
+	/////////////////////////////////
+	// Repeat from history buffer. //
+	/////////////////////////////////
+
+	// The length is always between these limits. There is no way
+	// to trigger the algorithm to set len outside this range.
+	assert(len >= MATCH_LEN_MIN);
+	assert(len <= MATCH_LEN_MAX);
+
+	// Repeat len bytes from distance of rep0.
+	if (unlikely(dict_repeat(dict, rep0, &len))) {
+		ret = MATCH_COPY;
+	}
+
+out:
+	*rc_ptr = rc;
+	*rc_in_ptr_ptr = rc_in_ptr;
+	*state_ptr = state;
+	*rep0_ptr = rep0;
+	*rep1_ptr = rep1;
+	*rep2_ptr = rep2;
+	*rep3_ptr = rep3;
+	*len_ptr = len;
+	return ret;
+}
+#endif
+
+
+/// The decoder loop. lzma_decode() calls this unless the decoder is
+/// part of a batch that decodes further in the interleaved mode.
 static lzma_ret
-lzma_decode(void *coder_ptr, lzma_dict *restrict dictptr,
+decode_impl(lzma_lzma1_decoder *restrict coder, lzma_dict *restrict dictptr,
 		const uint8_t *restrict in,
 		size_t *restrict in_pos, size_t in_size)
 {
-	lzma_lzma1_decoder *restrict coder = coder_ptr;
-
 	////////////////////
 	// Initialization //
 	////////////////////
@@ -386,264 +705,27 @@ lzma_decode(void *coder_ptr, lzma_dict *restrict dictptr,
 		// Decode match. //
 		///////////////////
 
-		// Instead of a new byte we are going to decode a
-		// distance-length pair. The distance represents how far
-		// back in the dictionary to begin copying. The length
-		// represents how many bytes to copy.
-
 		rc_update_1(coder->is_match[state][pos_state]);
 
-		rc_if_0(coder->is_rep[state]) {
-			///////////////////
-			// Simple match. //
-			///////////////////
-
-			// Not a repeated match. In this case,
-			// the length (how many bytes to copy) must be
-			// decoded first. Then, the distance (where to
-			// start copying) is decoded.
-			//
-			// This is also how we know when we are done
-			// decoding. If the distance decodes to UINT32_MAX,
-			// then we know to stop decoding (end of payload
-			// marker).
-
-			rc_update_0(coder->is_rep[state]);
-			update_match(state);
-
-			// The latest three match distances are kept in
-			// memory in case there are repeated matches.
-			rep3 = rep2;
-			rep2 = rep1;
-			rep1 = rep0;
-
-			// Decode the length of the match.
-			len_decode_fast(len, coder->match_len_decoder,
-					pos_state);
-
-			// Next, decode the distance into rep0.
-
-			// The next 6 bits determine how to decode the
-			// rest of the distance.
-			probs = coder->dist_slot[get_dist_state(len)];
-
-			rc_bittree6(probs, -DIST_SLOTS);
-			assert(symbol <= 63);
-
-			if (symbol < DIST_MODEL_START) {
-				// If the decoded symbol is < DIST_MODEL_START
-				// then we use its value directly as the
-				// match distance. No other bits are needed.
-				// The only possible distance values
-				// are [0, 3].
-				rep0 = symbol;
-			} else {
-				// Use the first two bits of symbol as the
-				// highest bits of the match distance.
-
-				// "limit" represents the number of low bits
-				// to decode.
-				limit = (symbol >> 1) - 1;
-				assert(limit >= 1 && limit <= 30);
-				rep0 = 2 + (symbol & 1);
-
-				if (symbol < DIST_MODEL_END) {
-					// When symbol is > DIST_MODEL_START,
-					// but symbol < DIST_MODEL_END, then
-					// it can decode distances between
-					// [4, 127].
-					assert(limit <= 5);
-					rep0 <<= limit;
-					assert(rep0 <= 96);
-
-					// -1 is fine, because we start
-					// decoding at probs[1], not probs[0].
-					// NOTE: This violates the C standard,
-					// since we are doing pointer
-					// arithmetic past the beginning of
-					// the array.
-					assert((int32_t)(rep0 - symbol - 1)
-							>= -1);
-					assert((int32_t)(rep0 - symbol - 1)
-							<= 82);
-					probs = coder->pos_special + rep0
-							- symbol - 1;
-					symbol = 1;
-					offset = 1;
-
-					// Variable number (1-5) of bits
-					// from a reverse bittree. This
-					// isn't worth manual unrolling.
-					//
-					// NOTE: Making one or many of the
-					// variables (probs, symbol, offset,
-					// or limit) local here (instead of
-					// using those declared outside the
-					// main loop) can affect code size
-					// and performance which isn't a
-					// surprise but it's not so clear
-					// what is the best.
-					do {
-						rc_bit_add_if_1(probs,
-								rep0, offset);
-						offset <<= 1;
-					} while (--limit > 0);
-				} else {
-					// The distance is >= 128. Decode the
-					// lower bits without probabilities
-					// except the lowest four bits.
-					assert(symbol >= 14);
-					assert(limit >= 6);
-
-					limit -= ALIGN_BITS;
-					assert(limit >= 2);
-
-					rc_direct(rep0, limit);
-
-					// Decode the lowest four bits using
-					// probabilities.
-					rep0 <<= ALIGN_BITS;
-					rc_bittree_rev4(coder->pos_align);
-					rep0 += symbol;
-
-					// If the end of payload marker (EOPM)
-					// is detected, jump to the safe code.
-					// The EOPM handling isn't speed
-					// critical at all.
-					//
-					// A final normalization is needed
-					// after the EOPM (there can be a
-					// dummy byte to read in some cases).
-					// If the normalization was done here
-					// in the fast code, it would need to
-					// be taken into account in the value
-					// of LZMA_IN_REQUIRED. Using the
-					// safe code allows keeping
-					// LZMA_IN_REQUIRED as 20 instead of
-					// 21.
-					if (rep0 == UINT32_MAX)
-						goto eopm;
-				}
-			}
-
-			// Validate the distance we just decoded.
-			if (unlikely(!dict_is_distance_valid(&dict, rep0))) {
-				ret = LZMA_DATA_ERROR;
-				goto out;
-			}
-
-		} else {
-			rc_update_1(coder->is_rep[state]);
-
-			/////////////////////
-			// Repeated match. //
-			/////////////////////
-
-			// The match distance is a value that we have decoded
-			// recently. The latest four match distances are
-			// available as rep0, rep1, rep2 and rep3. We will
-			// now decode which of them is the new distance.
-			//
-			// There cannot be a match if we haven't produced
-			// any output, so check that first.
-			if (unlikely(!dict_is_distance_valid(&dict, 0))) {
-				ret = LZMA_DATA_ERROR;
-				goto out;
-			}
-
-			rc_if_0(coder->is_rep0[state]) {
-				rc_update_0(coder->is_rep0[state]);
-				// The distance is rep0.
-
-				// Decode the next bit to determine if 1 byte
-				// should be copied from rep0 distance or
-				// if the number of bytes needs to be decoded.
-
-				// If the next bit is 0, then it is a
-				// "Short Rep Match" and only 1 bit is copied.
-				// Otherwise, the length of the match is
-				// decoded after the "else" statement.
-				rc_if_0(coder->is_rep0_long[state][pos_state]) {
-					rc_update_0(coder->is_rep0_long[
-							state][pos_state]);
-
-					update_short_rep(state);
-					dict_put(&dict, dict_get(&dict, rep0));
-					continue;
-				}
-
-				// Repeating more than one byte at
-				// distance of rep0.
-				rc_update_1(coder->is_rep0_long[
-						state][pos_state]);
-
-			} else {
-				rc_update_1(coder->is_rep0[state]);
-
-				// The distance is rep1, rep2 or rep3. Once
-				// we find out which one of these three, it
-				// is stored to rep0 and rep1, rep2 and rep3
-				// are updated accordingly. There is no
-				// "Short Rep Match" option, so the length
-				// of the match must always be decoded next.
-				rc_if_0(coder->is_rep1[state]) {
-					// The distance is rep1.
-					rc_update_0(coder->is_rep1[state]);
-
-					const uint32_t distance = rep1;
-					rep1 = rep0;
-					rep0 = distance;
-
-				} else {
-					rc_update_1(coder->is_rep1[state]);
-
-					rc_if_0(coder->is_rep2[state]) {
-						// The distance is rep2.
-						rc_update_0(coder->is_rep2[
-								state]);
-
-						const uint32_t distance = rep2;
-						rep2 = rep1;
-						rep1 = rep0;
-						rep0 = distance;
-
-					} else {
-						// The distance is rep3.
-						rc_update_1(coder->is_rep2[
-								state]);
-
-						const uint32_t distance = rep3;
-						rep3 = rep2;
-						rep2 = rep1;
-						rep1 = rep0;
-						rep0 = distance;
-					}
-				}
-			}
-
-			update_long_rep(state);
-
-			// Decode the length of the repeated match.
-			len_decode_fast(len, coder->rep_len_decoder,
-					pos_state);
-		}
+		switch (decode_match(coder, &dict, &rc, &rc_in_ptr,
+				pos_state, &state, &rep0, &rep1, &rep2, &rep3,
+				&len)) {
+		case MATCH_OK:
+			continue;
 
-		/////////////////////////////////
-		// Repeat from history buffer. //
-		/////////////////////////////////
+		case MATCH_COPY:
+			coder->sequence = SEQ_COPY;
+			break;
 
-		// The length is always between these limits. There is no way
-		// to trigger the algorithm to set len outside this range.
-		assert(len >= MATCH_LEN_MIN);
-		assert(len <= MATCH_LEN_MAX);
+		case MATCH_EOPM:
+			goto eopm;
 
-		// Repeat len bytes from distance of rep0.
-		if (unlikely(dict_repeat(&dict, rep0, &len))) {
-			coder->sequence = SEQ_COPY;
-			goto out;
+		case MATCH_ERROR:
+			ret = LZMA_DATA_ERROR;
+			break;
 		}
 
-		continue;
+		goto out;
 
 slow:
 #endif
@@ -1021,6 +1103,426 @@ out:
 }
 
 
+#ifndef HAVE_SMALL
+/////////////////////////////////////////
+// Interleaved mode for batch decoding //
+/////////////////////////////////////////
+
+// A single LZMA decoder is a long chain of dependent operations: each
+// bit needs the range decoder state from the previous bit. With
+// lzma_code_batch(), two decoders are advanced one symbol at a time
+// in the same loop. The two chains are independent, so the processor
+// can execute them in parallel. This helps mostly with literals which
+// are decoded without branches. Matches have so many hard-to-predict
+// branches that the two decoders don't overlap much.
+//
+// The decoders of the batch are in different call stacks: the waiting
+// decoder calls lzma_code() for the partner stream via
+// lzma_batch_run_partner(). When the LZMA decoder of the partner is
+// called, it decodes both. This way all the layers above the LZMA
+// decoders do their normal work for both streams.
+
+/// Arguments of lzma_decode() of a decoder in the batch
+typedef struct {
+	lzma_lzma1_decoder *coder;
+	lzma_dict *dictptr;
+	const uint8_t *in;
+	size_t *in_pos;
+	size_t in_size;
+
+	/// Error from decode_pair()
+	lzma_ret ret;
+} batch_args;
+
+
+/// The variables of decode_impl() for one decoder of the pair
+typedef struct {
+	lzma_lzma1_decoder *coder;
+	lzma_dict dict;
+	size_t dict_start;
+	lzma_range_decoder rc;
+	const uint8_t *rc_in_ptr;
+	const uint8_t *rc_in_fast_end;
+	uint32_t state;
+	uint32_t rep0;
+	uint32_t rep1;
+	uint32_t rep2;
+	uint32_t rep3;
+	uint32_t len;
+	uint32_t sequence;
+	lzma_ret ret;
+} batch_lane;
+
+
+/// Makes local copies of the decoder state. If a symbol was decoded but
+/// there was no room to write it, it is written now if possible.
+static lzma_always_inline void
+lane_load(batch_lane *lane, const batch_args *args)
+{
+	lzma_lzma1_decoder *coder = args->coder;
+
+	lane->coder = coder;
+	lane->dict = *args->dictptr;
+	lane->dict_start = lane->dict.pos;
+	lane->rc = coder->rc;
+	lane->rc_in_ptr = args->in + *args->in_pos;
+	lane->rc_in_fast_end = args->in_size - *args->in_pos
+				<= LZMA_IN_REQUIRED
+			? lane->rc_in_ptr
+			: args->in + args->in_size - LZMA_IN_REQUIRED;
+	lane->state = coder->state;
+	lane->rep0 = coder->rep0;
+	lane->rep1 = coder->rep1;
+	lane->rep2 = coder->rep2;
+	lane->rep3 = coder->rep3;
+	lane->len = coder->len;
+	lane->sequence = coder->sequence;
+	lane->ret = LZMA_OK;
+
+	// Like in decode_impl()
+	if (coder->uncompressed_size != LZMA_VLI_UNKNOWN
+			&& coder->uncompressed_size
+				<= lane->dict.limit - lane->dict.pos)
+		lane->dict.limit = lane->dict.pos
+				+ (size_t)(coder->uncompressed_size);
+
+	if (lane->dict.pos == lane->dict.limit)
+		return;
+
+	switch (lane->sequence) {
+	case SEQ_LITERAL_WRITE:
+		dict_put(&lane->dict, (uint8_t)(coder->symbol));
+		lane->sequence = SEQ_IS_MATCH;
+		break;
+
+	case SEQ_SHORTREP:
+		dict_put(&lane->dict, dict_get(&lane->dict, lane->rep0));
+		lane->sequence = SEQ_IS_MATCH;
+		break;
+
+	case SEQ_COPY:
+		if (!dict_repeat(&lane->dict, lane->rep0, &lane->len))
+			lane->sequence = SEQ_IS_MATCH;
+
+		break;
+
+	default:
+		break;
+	}
+
+	return;
+}
+
+
+/// Stores the local copies back like the end of decode_impl() does.
+static lzma_always_inline void
+lane_store(const batch_lane *lane, batch_args *args)
+{
+	lzma_lzma1_decoder *coder = args->coder;
+
+	args->dictptr->pos = lane->dict.pos;
+	args->dictptr->full = lane->dict.full;
+
+	coder->rc = lane->rc;
+	*args->in_pos = (size_t)(lane->rc_in_ptr - args->in);
+
+	coder->state = lane->state;
+	coder->rep0 = lane->rep0;
+	coder->rep1 = lane->rep1;
+	coder->rep2 = lane->rep2;
+	coder->rep3 = lane->rep3;
+	coder->len = lane->len;
+	coder->sequence = lane->sequence;
+
+	if (coder->uncompressed_size != LZMA_VLI_UNKNOWN)
+		coder->uncompressed_size -= lane->dict.pos - lane->dict_start;
+
+	if (lane->ret != LZMA_OK)
+		args->ret = lane->ret;
+
+	return;
+}
+
+
+/// Returns true if the next symbol can be decoded in the fast mode.
+static lzma_always_inline bool
+lane_is_ready(const batch_lane *lane)
+{
+	return lane->sequence == SEQ_IS_MATCH && lane->ret == LZMA_OK
+			&& lane->rc_in_ptr < lane->rc_in_fast_end
+			&& lane->dict.pos < lane->dict.limit;
+}
+
+
+/// Decodes the is_match bit of the next symbol. Returns true if the
+/// symbol is a literal.
+static lzma_always_inline bool
+lane_is_literal(batch_lane *restrict lane, const uint32_t pos_mask)
+{
+	lzma_lzma1_decoder *restrict coder = lane->coder;
+	lzma_range_decoder rc = lane->rc;
+	const uint8_t *rc_in_ptr = lane->rc_in_ptr;
+	uint32_t rc_bound;
+
+	const uint32_t pos_state = lane->dict.pos & pos_mask;
+	bool literal = false;
+
+	rc_if_0(coder->is_match[lane->state][pos_state]) {
+		rc_update_0(coder->is_match[lane->state][pos_state]);
+		literal = true;
+	} else {
+		rc_update_1(coder->is_match[lane->state][pos_state]);
+	}
+
+	lane->rc = rc;
+	lane->rc_in_ptr = rc_in_ptr;
+	return literal;
+}
+
+
+/// Decodes a literal after lane_is_literal() has returned true.
+static lzma_always_inline void
+lane_literal(batch_lane *restrict lane, const uint32_t literal_context_bits,
+		const uint32_t literal_mask)
+{
+	lzma_lzma1_decoder *restrict coder = lane->coder;
+	lzma_range_decoder rc = lane->rc;
+	const uint8_t *rc_in_ptr = lane->rc_in_ptr;
+	uint32_t rc_bound;
+	(void)rc_bound; // Unused with some range decoder variants.
+	uint32_t state = lane->state;
+	uint32_t symbol;
+
+	probability *probs = literal_subcoder(coder->literal,
+			literal_context_bits, literal_mask,
+			lane->dict.pos, dict_get0(&lane->dict));
+
+	if (is_literal_state(state)) {
+		update_literal_normal(state);
+		rc_bittree8(probs, 0);
+	} else {
+		update_literal_matched(state);
+		rc_matched_literal(probs, dict_get(&lane->dict, lane->rep0));
+	}
+
+	dict_put(&lane->dict, symbol);
+
+	lane->rc = rc;
+	lane->rc_in_ptr = rc_in_ptr;
+	lane->state = state;
+	return;
+}
+
+
+/// Decodes a match or a repeated match after lane_is_literal() has
+/// returned false. Returns true if the loop must stop. The end of
+/// payload marker is left to decode_impl().
+///
+/// This isn't inline because keeping the pair loop small is faster.
+static bool
+lane_match(batch_lane *restrict lane, const uint32_t pos_mask)
+{
+	const uint32_t pos_state = lane->dict.pos & pos_mask;
+
+	switch (decode_match(lane->coder, &lane->dict, &lane->rc,
+			&lane->rc_in_ptr, pos_state, &lane->state,
+			&lane->rep0, &lane->rep1, &lane->rep2, &lane->rep3,
+			&lane->len)) {
+	case MATCH_OK:
+		return false;
+
+	case MATCH_COPY:
+		lane->sequence = SEQ_COPY;
+		break;
+
+	case MATCH_EOPM:
+		// In the fast mode EOPM is valid only if the uncompressed
+		// size is unknown.
+		if (lane->coder->uncompressed_size != LZMA_VLI_UNKNOWN)
+			lane->ret = LZMA_DATA_ERROR;
+		else
+			lane->sequence = SEQ_EOPM;
+
+		break;
+
+	case MATCH_ERROR:
+		lane->ret = LZMA_DATA_ERROR;
+		break;
+	}
+
+	return true;
+}
+
+
+/// Interleaving pays off only when both decoders decode literals. When
+/// fewer than BATCH_LITERALS_MIN of the last BATCH_WINDOW symbol pairs
+/// were literal pairs, the decoders continue one at a time.
+#define BATCH_WINDOW 256
+#define BATCH_LITERALS_MIN (BATCH_WINDOW * 3 / 4)
+
+
+/// Decodes the waiting decoder (a) and the calling decoder (b) together
+/// as far as both can be decoded in the fast mode.
+static void
+decode_pair(batch_args *a_args, batch_args *b_args,
+		bool *a_ready, bool *b_ready)
+{
+	const uint32_t a_pos_mask = a_args->coder->pos_mask;
+	const uint32_t a_lc = a_args->coder->literal_context_bits;
+	const uint32_t a_literal_mask = a_args->coder->literal_mask;
+	const uint32_t b_pos_mask = b_args->coder->pos_mask;
+	const uint32_t b_lc = b_args->coder->literal_context_bits;
+	const uint32_t b_literal_mask = b_args->coder->literal_mask;
+
+	batch_lane a;
+	batch_lane b;
+	lane_load(&a, a_args);
+	lane_load(&b, b_args);
+
+	uint32_t count = 0;
+	uint32_t literals = 0;
+
+	if (lane_is_ready(&a) && lane_is_ready(&b)) {
+		do {
+			// Decode the is_match bits first and then the
+			// literals of both. The literals are decoded
+			// without branches (at least with the x86-64
+			// assembly) so the two can run in parallel.
+			const bool a_literal = lane_is_literal(&a, a_pos_mask);
+			const bool b_literal = lane_is_literal(&b, b_pos_mask);
+
+			if (a_literal)
+				lane_literal(&a, a_lc, a_literal_mask);
+
+			if (b_literal)
+				lane_literal(&b, b_lc, b_literal_mask);
+
+			// Both symbols are finished even if the first
+			// one stops the loop.
+			const bool a_stop = !a_literal
+					&& lane_match(&a, a_pos_mask);
+			const bool b_stop = !b_literal
+					&& lane_match(&b, b_pos_mask);
+			if (a_stop || b_stop)
+				break;
+
+			literals += a_literal & b_literal;
+			if (++count == BATCH_WINDOW) {
+				if (literals < BATCH_LITERALS_MIN)
+					break;
+
+				count = 0;
+				literals = 0;
+			}
+		} while (a.rc_in_ptr < a.rc_in_fast_end
+				&& a.dict.pos < a.dict.limit
+				&& b.rc_in_ptr < b.rc_in_fast_end
+				&& b.dict.pos < b.dict.limit);
+	}
+
+	lane_store(&a, a_args);
+	lane_store(&b, b_args);
+
+	*a_ready = lane_is_ready(&a);
+	*b_ready = lane_is_ready(&b);
+	return;
+}
+
+
+/// Returns true if the decoder can decode in the fast mode.
+static bool
+batch_is_ready(batch_args *args)
+{
+	batch_lane lane;
+	lane_load(&lane, args);
+	lane_store(&lane, args);
+	return lane_is_ready(&lane);
+}
+
+
+/// Takes part in lzma_code_batch(). Returns true if lzma_decode() must
+/// return *ret without decoding more.
+static bool
+decode_batch(lzma_lzma1_decoder *coder, lzma_dict *restrict dictptr,
+		const uint8_t *restrict in,
+		size_t *restrict in_pos, size_t in_size, lzma_ret *ret)
+{
+	lzma_batch *batch = dictptr->batch;
+
+	*ret = rc_read_init(&coder->rc, in, in_pos, in_size);
+	if (*ret != LZMA_STREAM_END)
+		return *ret != LZMA_OK;
+
+	batch_args self = {
+		.coder = coder,
+		.dictptr = dictptr,
+		.in = in,
+		.in_pos = in_pos,
+		.in_size = in_size,
+		.ret = LZMA_OK,
+	};
+
+	*ret = LZMA_OK;
+
+	if (batch->waiting == NULL) {
+		// Let the next streams of the batch decode together
+		// with this one as long as this one can continue.
+		batch->waiting = &self;
+
+		while (self.ret == LZMA_OK && batch_is_ready(&self)
+				&& lzma_batch_run_partner(batch)) ;
+
+		batch->waiting = NULL;
+		*ret = self.ret;
+		return *ret != LZMA_OK;
+	}
+
+	batch_args *waiting = batch->waiting;
+	bool waiting_ready = false;
+	bool self_ready = false;
+
+	if (waiting->ret == LZMA_OK)
+		decode_pair(waiting, &self, &waiting_ready, &self_ready);
+	else
+		self_ready = batch_is_ready(&self);
+
+	if (self.ret != LZMA_OK) {
+		*ret = self.ret;
+		return true;
+	}
+
+	// If the waiting decoder cannot continue, return to it. This
+	// stream continues later. If this one cannot continue in the
+	// fast mode either, decode_impl() finishes the current call.
+	if (!waiting_ready && self_ready) {
+		batch->yielded = true;
+		return true;
+	}
+
+	return false;
+}
+#endif
+
+
+static lzma_ret
+lzma_decode(void *coder_ptr, lzma_dict *restrict dictptr,
+		const uint8_t *restrict in,
+		size_t *restrict in_pos, size_t in_size)
+{
+	lzma_lzma1_decoder *restrict coder = coder_ptr;
+
+#ifndef HAVE_SMALL
+	if (dictptr->batch != NULL) {
+		lzma_ret ret;
+		if (decode_batch(coder, dictptr, in, in_pos, in_size, &ret))
+			return ret;
+	}
+#endif
+
+	return decode_impl(coder, dictptr, in, in_pos, in_size);
+}
+
+
 static void
 lzma_decoder_uncompressed(void *coder_ptr, lzma_vli uncompressed_size,
 		bool allow_eopm)
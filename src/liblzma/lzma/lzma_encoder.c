@@ -151,6 +151,7 @@ match(lzma_lzma1_encoder *coder, const uint32_t pos_state,
 	const uint32_t dist_state = get_dist_state(len);
 	rc_bittree(&coder->rc, coder->dist_slot[dist_state],
 			DIST_SLOT_BITS, dist_slot);
+	coder->dist_slot_dirty |= UINT32_C(1) << dist_state;
 
 	if (dist_slot >= DIST_MODEL_START) {
 		const uint32_t footer_bits = (dist_slot >> 1) - 1;
@@ -163,6 +164,7 @@ match(lzma_lzma1_encoder *coder, const uint32_t pos_state,
 			rc_bittree_reverse(&coder->rc,
 				coder->dist_special + base - dist_slot - 1,
 				footer_bits, dist_reduced);
+			coder->dist_special_dirty |= UINT32_C(1) << dist_slot;
 		} else {
 			rc_direct(&coder->rc, dist_reduced >> ALIGN_BITS,
 					footer_bits - ALIGN_BITS);
@@ -372,6 +374,9 @@ lzma_lzma_encode(lzma_lzma1_encoder *restrict coder, lzma_mf *restrict mf,
 
 		if (coder->fast_mode)
 			lzma_lzma_optimum_fast(coder, mf, &back, &len);
+		else if (coder->lazy_mode)
+			lzma_lzma_optimum_lazy(coder, mf, &back, &len,
+					(uint32_t)(coder->uncomp_size));
 		else
 			lzma_lzma_optimum_normal(coder, mf, &back, &len,
 					(uint32_t)(coder->uncomp_size));
@@ -478,8 +483,7 @@ is_options_valid(const lzma_options_lzma *options)
 	return is_lclppb_valid(options)
 			&& options->nice_len >= MATCH_LEN_MIN
 			&& options->nice_len <= MATCH_LEN_MAX
-			&& (options->mode == LZMA_MODE_FAST
-				|| options->mode == LZMA_MODE_NORMAL);
+			&& lzma_mode_is_supported(options->mode);
 }
 
 
@@ -498,6 +502,19 @@ set_lz_options(lzma_lz_options *lz_options, const lzma_options_lzma *options)
 	lz_options->depth = options->depth;
 	lz_options->preset_dict = options->preset_dict;
 	lz_options->preset_dict_size = options->preset_dict_size;
+
+	// long_len used to be a reserved member which applications were
+	// allowed to leave uninitialized. It is read only if the
+	// application has said so with ext_enable. The LZ encoder
+	// validates the value.
+	const bool ext = options->ext_enable == LZMA_OPTIONS_LZMA_EXT;
+	lz_options->long_len = ext ? options->long_len : 0;
+
+	// The same applies to mf_threads.
+	lz_options->mf_threads = ext ? options->mf_threads : 0;
+
+	// And to mf_hash.
+	lz_options->mf_hash = ext ? options->mf_hash : LZMA_MF_HASH_TABLE;
 	return;
 }
 
@@ -516,10 +533,20 @@ length_encoder_reset(lzma_length_encoder *lencoder,
 
 	bittree_reset(lencoder->high, LEN_HIGH_BITS);
 
-	if (!fast_mode)
-		for (uint32_t pos_state = 0; pos_state < num_pos_states;
-				++pos_state)
-			length_update_prices(lencoder, pos_state);
+	// All pos_states have the same probabilities now, so the prices
+	// are calculated once and copied.
+	if (!fast_mode) {
+		length_update_prices(lencoder, 0);
+
+		for (uint32_t pos_state = 1; pos_state < num_pos_states;
+				++pos_state) {
+			lencoder->counters[pos_state] = lencoder->counters[0];
+			memcpy(lencoder->prices[pos_state],
+					lencoder->prices[0],
+					lencoder->table_size
+						* sizeof(lencoder->prices[0][0]));
+		}
+	}
 
 	return;
 }
@@ -591,13 +618,55 @@ lzma_lzma_encoder_reset(lzma_lzma1_encoder *coder,
 	coder->match_price_count = UINT32_MAX / 2;
 	coder->align_price_count = UINT32_MAX / 2;
 
+	// All probabilities were reset so all distance prices need to be
+	// calculated. See fill_dist_prices() in
+	// lzma_encoder_optimum_normal.c.
+	coder->dist_slot_dirty = (UINT32_C(1) << DIST_STATES) - 1;
+	coder->dist_special_dirty = UINT32_MAX;
+
 	coder->opts_end_index = 0;
 	coder->opts_current_index = 0;
+	coder->lazy_literal = false;
 
 	return LZMA_OK;
 }
 
 
+extern bool
+lzma_lzma_encoder_set_mode(lzma_lzma1_encoder *coder, lzma_mode mode)
+{
+	// The pending symbols of the normal and lazy modes would be lost.
+	// The fast mode has none.
+	if (coder->opts_end_index != coder->opts_current_index
+			|| coder->lazy_literal)
+		return true;
+
+	const bool was_fast = coder->fast_mode;
+	coder->fast_mode = mode == LZMA_MODE_FAST;
+	coder->lazy_mode = mode == LZMA_MODE_LAZY;
+
+	// The price tables aren't updated in the fast mode. If leaving
+	// the fast mode, calculate all of them again like
+	// lzma_lzma_encoder_reset() does.
+	if (was_fast && !coder->fast_mode) {
+		for (uint32_t pos_state = 0; pos_state <= coder->pos_mask;
+				++pos_state) {
+			length_update_prices(&coder->match_len_encoder,
+					pos_state);
+			length_update_prices(&coder->rep_len_encoder,
+					pos_state);
+		}
+
+		coder->match_price_count = UINT32_MAX / 2;
+		coder->align_price_count = UINT32_MAX / 2;
+		coder->dist_slot_dirty = (UINT32_C(1) << DIST_STATES) - 1;
+		coder->dist_special_dirty = UINT32_MAX;
+	}
+
+	return false;
+}
+
+
 extern lzma_ret
 lzma_lzma_encoder_create(void **coder_ptr, const lzma_allocator *allocator,
 		lzma_vli id, const lzma_options_lzma *options,
@@ -621,10 +690,15 @@ lzma_lzma_encoder_create(void **coder_ptr, const lzma_allocator *allocator,
 	switch (options->mode) {
 		case LZMA_MODE_FAST:
 			coder->fast_mode = true;
+			coder->lazy_mode = false;
 			break;
 
+		case LZMA_MODE_LAZY:
 		case LZMA_MODE_NORMAL: {
+			// The lazy mode uses the same price tables as
+			// the normal mode.
 			coder->fast_mode = false;
+			coder->lazy_mode = options->mode == LZMA_MODE_LAZY;
 
 			// Set dist_table_size.
 			// Round the dictionary size up to next 2^n.
@@ -782,5 +856,6 @@ lzma_lzma_props_encode(const void *options, uint8_t *out)
 extern LZMA_API(lzma_bool)
 lzma_mode_is_supported(lzma_mode mode)
 {
-	return mode == LZMA_MODE_FAST || mode == LZMA_MODE_NORMAL;
+	return mode == LZMA_MODE_FAST || mode == LZMA_MODE_NORMAL
+			|| mode == LZMA_MODE_LAZY;
 }
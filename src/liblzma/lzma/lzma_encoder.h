@@ -48,6 +48,14 @@ extern lzma_ret lzma_lzma_encoder_reset(
 		lzma_lzma1_encoder *coder, const lzma_options_lzma *options);
 
 
+/// Changes the compression mode of an LZMA encoder that was initialized
+/// with LZMA_MODE_NORMAL or LZMA_MODE_LAZY, or sets it back to that; this
+/// is used by LZMA2. Returns false on success and true if the encoder has
+/// pending symbols so that the mode cannot be changed now.
+extern bool lzma_lzma_encoder_set_mode(
+		lzma_lzma1_encoder *coder, lzma_mode mode);
+
+
 extern lzma_ret lzma_lzma_encode(lzma_lzma1_encoder *restrict coder,
 		lzma_mf *restrict mf, uint8_t *restrict out,
 		size_t *restrict out_pos, size_t out_size,
@@ -107,41 +107,89 @@ get_rep_price(const lzma_lzma1_encoder *const coder, const uint32_t rep_index,
 }
 
 
+static inline uint32_t
+get_dist_price(const lzma_lzma1_encoder *const coder, const uint32_t dist,
+		const uint32_t dist_state)
+{
+	if (dist < FULL_DISTANCES)
+		return coder->dist_prices[dist_state][dist];
+
+	const uint32_t dist_slot = get_dist_slot_2(dist);
+	return coder->dist_slot_prices[dist_state][dist_slot]
+			+ coder->align_prices[dist & ALIGN_MASK];
+}
+
+
 static inline uint32_t
 get_dist_len_price(const lzma_lzma1_encoder *const coder, const uint32_t dist,
 		const uint32_t len, const uint32_t pos_state)
 {
-	const uint32_t dist_state = get_dist_state(len);
-	uint32_t price;
+	return get_dist_price(coder, dist, get_dist_state(len))
+		+ get_len_price(&coder->match_len_encoder, len, pos_state);
+}
 
-	if (dist < FULL_DISTANCES) {
-		price = coder->dist_prices[dist_state][dist];
-	} else {
-		const uint32_t dist_slot = get_dist_slot_2(dist);
-		price = coder->dist_slot_prices[dist_state][dist_slot]
-				+ coder->align_prices[dist & ALIGN_MASK];
+
+/// Calculates the prices of all 2^bit_levels symbols of a bittree.
+/// Every node is visited once, so this needs far fewer price lookups
+/// than calling rc_bittree_price() for every symbol. The sums are the
+/// same. If reverse is true, the prices are for rc_bittree_reverse().
+static void
+bittree_prices(uint32_t *prices, const probability *probs,
+		const uint32_t bit_levels, const bool reverse)
+{
+	// node[i] is the price of the path from the root to the node i.
+	// The symbols are at the leaves, from 1 << bit_levels upwards.
+	uint32_t node[2 * DIST_SLOTS];
+	assert(bit_levels <= DIST_SLOT_BITS);
+
+	const uint32_t count = UINT32_C(1) << bit_levels;
+	node[1] = 0;
+
+	for (uint32_t i = 1; i < count; ++i) {
+		node[2 * i] = node[i] + rc_bit_0_price(probs[i]);
+		node[2 * i + 1] = node[i] + rc_bit_1_price(probs[i]);
+	}
+
+	if (!reverse) {
+		memcpy(prices, node + count, count * sizeof(prices[0]));
+		return;
 	}
 
-	price += get_len_price(&coder->match_len_encoder, len, pos_state);
+	// rc_bittree_reverse() encodes the lowest bit first, so the path
+	// to the symbol has its bits in the reverse order.
+	for (uint32_t symbol = 0; symbol < count; ++symbol) {
+		uint32_t leaf = 1;
+		for (uint32_t bit = 0; bit < bit_levels; ++bit)
+			leaf = (leaf << 1) | ((symbol >> bit) & 1);
 
-	return price;
+		prices[symbol] = node[leaf];
+	}
+
+	return;
 }
 
 
 static void
 fill_dist_prices(lzma_lzma1_encoder *coder)
 {
+	// Only the prices that depend on probabilities that have changed
+	// since the previous call are calculated. The rest would get the
+	// same values again. The prices are still snapshots taken here,
+	// so the encoded output doesn't depend on which parts were skipped.
+	const uint32_t slot_dirty = coder->dist_slot_dirty;
+	const uint32_t special_dirty = coder->dist_special_dirty;
+
 	for (uint32_t dist_state = 0; dist_state < DIST_STATES; ++dist_state) {
+		if (!(slot_dirty & (UINT32_C(1) << dist_state)))
+			continue;
 
 		uint32_t *const dist_slot_prices
 				= coder->dist_slot_prices[dist_state];
 
-		// Price to encode the dist_slot.
-		for (uint32_t dist_slot = 0;
-				dist_slot < coder->dist_table_size; ++dist_slot)
-			dist_slot_prices[dist_slot] = rc_bittree_price(
-					coder->dist_slot[dist_state],
-					DIST_SLOT_BITS, dist_slot);
+		// Price to encode the dist_slot. This calculates all
+		// DIST_SLOTS prices even if dist_table_size is smaller.
+		bittree_prices(dist_slot_prices, coder->dist_slot[dist_state],
+				DIST_SLOT_BITS, false);
 
 		// For matches with distance >= FULL_DISTANCES, add the price
 		// of the direct bits part of the match distance. (Align bits
@@ -161,23 +209,48 @@ fill_dist_prices(lzma_lzma1_encoder *coder)
 	}
 
 	// Distances in the range [4, 127] depend on dist_slot and
-	// dist_special. We do this in a loop separate from the above
-	// loop to avoid redundant calls to get_dist_slot().
-	for (uint32_t i = DIST_MODEL_START; i < FULL_DISTANCES; ++i) {
-		const uint32_t dist_slot = get_dist_slot(i);
-		const uint32_t footer_bits = ((dist_slot >> 1) - 1);
+	// dist_special. Each dist_slot in [DIST_MODEL_START, DIST_MODEL_END)
+	// covers the distances [base, base + (1 << footer_bits)).
+	for (uint32_t dist_slot = DIST_MODEL_START;
+			dist_slot < DIST_MODEL_END; ++dist_slot) {
+		const bool special = (special_dirty
+				& (UINT32_C(1) << dist_slot)) != 0;
+		if (!special && slot_dirty == 0)
+			continue;
+
+		const uint32_t footer_bits = (dist_slot >> 1) - 1;
 		const uint32_t base = (2 | (dist_slot & 1)) << footer_bits;
-		const uint32_t price = rc_bittree_reverse_price(
-				coder->dist_special + base - dist_slot - 1,
-				footer_bits, i - base);
+		const uint32_t *const special_prices
+				= coder->dist_special_prices
+					+ base - DIST_MODEL_START;
+
+		if (special)
+			bittree_prices(coder->dist_special_prices
+						+ base - DIST_MODEL_START,
+					coder->dist_special + base
+						- dist_slot - 1,
+					footer_bits, true);
 
 		for (uint32_t dist_state = 0; dist_state < DIST_STATES;
-				++dist_state)
-			coder->dist_prices[dist_state][i]
-					= price + coder->dist_slot_prices[
-						dist_state][dist_slot];
+				++dist_state) {
+			if (!special && !(slot_dirty
+					& (UINT32_C(1) << dist_state)))
+				continue;
+
+			const uint32_t slot_price = coder->dist_slot_prices[
+					dist_state][dist_slot];
+			uint32_t *const dist_prices
+					= coder->dist_prices[dist_state] + base;
+
+			for (uint32_t i = 0; i < (UINT32_C(1) << footer_bits);
+					++i)
+				dist_prices[i] = special_prices[i]
+						+ slot_price;
+		}
 	}
 
+	coder->dist_slot_dirty = 0;
+	coder->dist_special_dirty = 0;
 	coder->match_price_count = 0;
 	return;
 }
@@ -186,10 +259,8 @@ fill_dist_prices(lzma_lzma1_encoder *coder)
 static void
 fill_align_prices(lzma_lzma1_encoder *coder)
 {
-	for (uint32_t i = 0; i < ALIGN_SIZE; ++i)
-		coder->align_prices[i] = rc_bittree_reverse_price(
-				coder->dist_align, ALIGN_BITS, i);
-
+	bittree_prices(coder->align_prices, coder->dist_align,
+			ALIGN_BITS, true);
 	coder->align_price_count = 0;
 	return;
 }
@@ -200,23 +271,127 @@ fill_align_prices(lzma_lzma1_encoder *coder)
 /////////////
 
 static inline void
-make_literal(lzma_optimal *optimal)
+make_literal(lzma_lzma1_encoder *coder, uint32_t index)
+{
+	coder->opts_back_prev[index] = UINT32_MAX;
+	coder->opts_prev_1_is_literal[index] = false;
+}
+
+
+static inline void
+make_short_rep(lzma_lzma1_encoder *coder, uint32_t index)
 {
-	optimal->back_prev = UINT32_MAX;
-	optimal->prev_1_is_literal = false;
+	coder->opts_back_prev[index] = 0;
+	coder->opts_prev_1_is_literal[index] = false;
 }
 
 
+#define is_short_rep(coder, index) \
+	((coder)->opts_back_prev[index] == 0)
+
+
+/// \brief      Updates the prices of a range of lengths from cur
+///
+/// For every len in [len, len_max], if base + len_prices[len - 2] is
+/// cheaper than the current price of cur + len, the position is set to
+/// be reached from cur with back_prev = back. The lengths are independent
+/// of each other so four are done at a time with SSE2. The prices are
+/// below 2^31 so the signed comparison of SSE2 works.
 static inline void
-make_short_rep(lzma_optimal *optimal)
+relax(lzma_lzma1_encoder *coder, const uint32_t cur, uint32_t len,
+		const uint32_t len_max, const uint32_t base,
+		const uint32_t *len_prices, const uint32_t back)
 {
-	optimal->back_prev = 0;
-	optimal->prev_1_is_literal = false;
+#if defined(HAVE__MM_MOVEMASK_EPI8) \
+		&& (defined(__SSE2__) || (defined(_MSC_VER) \
+			&& (defined(_M_X64) || (defined(_M_IX86_FP) \
+				&& _M_IX86_FP >= 2))))
+	const __m128i base_v = _mm_set1_epi32((int32_t)base);
+	const __m128i cur_v = _mm_set1_epi32((int32_t)cur);
+	const __m128i back_v = _mm_set1_epi32((int32_t)back);
+
+	for (; len + 3 <= len_max; len += 4) {
+		const uint32_t i = cur + len;
+
+		__m128i *const price_p = (__m128i *)(coder->opts_price + i);
+		const __m128i old = _mm_loadu_si128(price_p);
+		const __m128i price = _mm_add_epi32(base_v, _mm_loadu_si128(
+				(const __m128i *)(len_prices
+					+ len - MATCH_LEN_MIN)));
+		const __m128i better = _mm_cmplt_epi32(price, old);
+
+		if (_mm_movemask_epi8(better) == 0)
+			continue;
+
+		_mm_storeu_si128(price_p, _mm_or_si128(
+				_mm_and_si128(better, price),
+				_mm_andnot_si128(better, old)));
+
+		__m128i *const pos_prev_p
+				= (__m128i *)(coder->opts_pos_prev + i);
+		_mm_storeu_si128(pos_prev_p, _mm_or_si128(
+				_mm_and_si128(better, cur_v),
+				_mm_andnot_si128(better,
+					_mm_loadu_si128(pos_prev_p))));
+
+		__m128i *const back_prev_p
+				= (__m128i *)(coder->opts_back_prev + i);
+		_mm_storeu_si128(back_prev_p, _mm_or_si128(
+				_mm_and_si128(better, back_v),
+				_mm_andnot_si128(better,
+					_mm_loadu_si128(back_prev_p))));
+
+		// Clear prev_1_is_literal of the updated positions. The
+		// comparison results are packed to one byte per length.
+		__m128i mask = _mm_packs_epi32(better, better);
+		mask = _mm_packs_epi16(mask, mask);
+
+		uint32_t flags;
+		memcpy(&flags, coder->opts_prev_1_is_literal + i, 4);
+		flags &= ~(uint32_t)_mm_cvtsi128_si32(mask);
+		memcpy(coder->opts_prev_1_is_literal + i, &flags, 4);
+	}
+#endif
+
+	for (; len <= len_max; ++len) {
+		const uint32_t price = base + len_prices[len - MATCH_LEN_MIN];
+		const uint32_t i = cur + len;
+
+		if (price < coder->opts_price[i]) {
+			coder->opts_price[i] = price;
+			coder->opts_pos_prev[i] = cur;
+			coder->opts_back_prev[i] = back;
+			coder->opts_prev_1_is_literal[i] = false;
+		}
+	}
+
+	return;
 }
 
 
-#define is_short_rep(optimal) \
-	((optimal).back_prev == 0)
+/// Like relax() for a normal match with the distance dist. With lengths
+/// below DIST_STATES + MATCH_LEN_MIN the distance price depends on the
+/// length so those are done one at a time.
+static inline void
+relax_match(lzma_lzma1_encoder *coder, const uint32_t cur, uint32_t len,
+		const uint32_t len_max, const uint32_t base,
+		const uint32_t dist, const uint32_t pos_state)
+{
+	const uint32_t *const len_prices
+			= coder->match_len_encoder.prices[pos_state];
+
+	for (; len <= len_max && len < DIST_STATES + MATCH_LEN_MIN; ++len)
+		relax(coder, cur, len, len, base + get_dist_price(coder,
+				dist, get_dist_state(len)),
+				len_prices, dist + REPS);
+
+	if (len <= len_max)
+		relax(coder, cur, len, len_max, base + get_dist_price(coder,
+				dist, DIST_STATES - 1),
+				len_prices, dist + REPS);
+
+	return;
+}
 
 
 static void
@@ -225,20 +400,20 @@ backward(lzma_lzma1_encoder *restrict coder, uint32_t *restrict len_res,
 {
 	coder->opts_end_index = cur;
 
-	uint32_t pos_mem = coder->opts[cur].pos_prev;
-	uint32_t back_mem = coder->opts[cur].back_prev;
+	uint32_t pos_mem = coder->opts_pos_prev[cur];
+	uint32_t back_mem = coder->opts_back_prev[cur];
 
 	do {
-		if (coder->opts[cur].prev_1_is_literal) {
-			make_literal(&coder->opts[pos_mem]);
-			coder->opts[pos_mem].pos_prev = pos_mem - 1;
+		if (coder->opts_prev_1_is_literal[cur]) {
+			make_literal(coder, pos_mem);
+			coder->opts_pos_prev[pos_mem] = pos_mem - 1;
 
 			if (coder->opts[cur].prev_2) {
-				coder->opts[pos_mem - 1].prev_1_is_literal
+				coder->opts_prev_1_is_literal[pos_mem - 1]
 						= false;
-				coder->opts[pos_mem - 1].pos_prev
+				coder->opts_pos_prev[pos_mem - 1]
 						= coder->opts[cur].pos_prev_2;
-				coder->opts[pos_mem - 1].back_prev
+				coder->opts_back_prev[pos_mem - 1]
 						= coder->opts[cur].back_prev_2;
 			}
 		}
@@ -246,18 +421,18 @@ backward(lzma_lzma1_encoder *restrict coder, uint32_t *restrict len_res,
 		const uint32_t pos_prev = pos_mem;
 		const uint32_t back_cur = back_mem;
 
-		back_mem = coder->opts[pos_prev].back_prev;
-		pos_mem = coder->opts[pos_prev].pos_prev;
+		back_mem = coder->opts_back_prev[pos_prev];
+		pos_mem = coder->opts_pos_prev[pos_prev];
 
-		coder->opts[pos_prev].back_prev = back_cur;
-		coder->opts[pos_prev].pos_prev = cur;
+		coder->opts_back_prev[pos_prev] = back_cur;
+		coder->opts_pos_prev[pos_prev] = cur;
 		cur = pos_prev;
 
 	} while (cur != 0);
 
-	coder->opts_current_index = coder->opts[0].pos_prev;
-	*len_res = coder->opts[0].pos_prev;
-	*back_res = coder->opts[0].back_prev;
+	coder->opts_current_index = coder->opts_pos_prev[0];
+	*len_res = coder->opts_pos_prev[0];
+	*back_res = coder->opts_back_prev[0];
 
 	return;
 }
@@ -340,13 +515,13 @@ helper1(lzma_lzma1_encoder *restrict coder, lzma_mf *restrict mf,
 
 	const uint32_t pos_state = position & coder->pos_mask;
 
-	coder->opts[1].price = rc_bit_0_price(
+	coder->opts_price[1] = rc_bit_0_price(
 				coder->is_match[coder->state][pos_state])
 			+ get_literal_price(coder, position, buf[-1],
 				!is_literal_state(coder->state),
 				match_byte, current_byte);
 
-	make_literal(&coder->opts[1]);
+	make_literal(coder, 1);
 
 	const uint32_t match_price = rc_bit_1_price(
 			coder->is_match[coder->state][pos_state]);
@@ -358,52 +533,41 @@ helper1(lzma_lzma1_encoder *restrict coder, lzma_mf *restrict mf,
 				+ get_short_rep_price(
 					coder, coder->state, pos_state);
 
-		if (short_rep_price < coder->opts[1].price) {
-			coder->opts[1].price = short_rep_price;
-			make_short_rep(&coder->opts[1]);
+		if (short_rep_price < coder->opts_price[1]) {
+			coder->opts_price[1] = short_rep_price;
+			make_short_rep(coder, 1);
 		}
 	}
 
 	const uint32_t len_end = my_max(len_main, rep_lens[rep_max_index]);
 
 	if (len_end < 2) {
-		*back_res = coder->opts[1].back_prev;
+		*back_res = coder->opts_back_prev[1];
 		*len_res = 1;
 		return UINT32_MAX;
 	}
 
-	coder->opts[1].pos_prev = 0;
+	coder->opts_pos_prev[1] = 0;
 
 	for (uint32_t i = 0; i < REPS; ++i)
 		coder->opts[0].backs[i] = coder->reps[i];
 
 	uint32_t len = len_end;
 	do {
-		coder->opts[len].price = RC_INFINITY_PRICE;
+		coder->opts_price[len] = RC_INFINITY_PRICE;
 	} while (--len >= 2);
 
 
 	for (uint32_t i = 0; i < REPS; ++i) {
-		uint32_t rep_len = rep_lens[i];
+		const uint32_t rep_len = rep_lens[i];
 		if (rep_len < 2)
 			continue;
 
 		const uint32_t price = rep_match_price + get_pure_rep_price(
 				coder, i, coder->state, pos_state);
 
-		do {
-			const uint32_t cur_and_len_price = price
-					+ get_len_price(
-						&coder->rep_len_encoder,
-						rep_len, pos_state);
-
-			if (cur_and_len_price < coder->opts[rep_len].price) {
-				coder->opts[rep_len].price = cur_and_len_price;
-				coder->opts[rep_len].pos_prev = 0;
-				coder->opts[rep_len].back_prev = i;
-				coder->opts[rep_len].prev_1_is_literal = false;
-			}
-		} while (--rep_len >= 2);
+		relax(coder, 0, 2, rep_len, price,
+				coder->rep_len_encoder.prices[pos_state], i);
 	}
 
 
@@ -416,22 +580,11 @@ helper1(lzma_lzma1_encoder *restrict coder, lzma_mf *restrict mf,
 		while (len > coder->matches[i].len)
 			++i;
 
-		for(; ; ++len) {
-			const uint32_t dist = coder->matches[i].dist;
-			const uint32_t cur_and_len_price = normal_match_price
-					+ get_dist_len_price(coder,
-						dist, len, pos_state);
-
-			if (cur_and_len_price < coder->opts[len].price) {
-				coder->opts[len].price = cur_and_len_price;
-				coder->opts[len].pos_prev = 0;
-				coder->opts[len].back_prev = dist + REPS;
-				coder->opts[len].prev_1_is_literal = false;
-			}
-
-			if (len == coder->matches[i].len)
-				if (++i == matches_count)
-					break;
+		for (; i < matches_count; ++i) {
+			relax_match(coder, 0, len, coder->matches[i].len,
+					normal_match_price,
+					coder->matches[i].dist, pos_state);
+			len = coder->matches[i].len + 1;
 		}
 	}
 
@@ -446,10 +599,10 @@ helper2(lzma_lzma1_encoder *coder, uint32_t *reps, const uint8_t *buf,
 {
 	uint32_t matches_count = coder->matches_count;
 	uint32_t new_len = coder->longest_match_length;
-	uint32_t pos_prev = coder->opts[cur].pos_prev;
+	uint32_t pos_prev = coder->opts_pos_prev[cur];
 	lzma_lzma_state state;
 
-	if (coder->opts[cur].prev_1_is_literal) {
+	if (coder->opts_prev_1_is_literal[cur]) {
 		--pos_prev;
 
 		if (coder->opts[cur].prev_2) {
@@ -471,19 +624,19 @@ helper2(lzma_lzma1_encoder *coder, uint32_t *reps, const uint8_t *buf,
 	}
 
 	if (pos_prev == cur - 1) {
-		if (is_short_rep(coder->opts[cur]))
+		if (is_short_rep(coder, cur))
 			update_short_rep(state);
 		else
 			update_literal(state);
 	} else {
 		uint32_t pos;
-		if (coder->opts[cur].prev_1_is_literal
+		if (coder->opts_prev_1_is_literal[cur]
 				&& coder->opts[cur].prev_2) {
 			pos_prev = coder->opts[cur].pos_prev_2;
 			pos = coder->opts[cur].back_prev_2;
 			update_long_rep(state);
 		} else {
-			pos = coder->opts[cur].back_prev;
+			pos = coder->opts_back_prev[cur];
 			if (pos < REPS)
 				update_long_rep(state);
 			else
@@ -513,7 +666,7 @@ helper2(lzma_lzma1_encoder *coder, uint32_t *reps, const uint8_t *buf,
 	for (uint32_t i = 0; i < REPS; ++i)
 		coder->opts[cur].backs[i] = reps[i];
 
-	const uint32_t cur_price = coder->opts[cur].price;
+	const uint32_t cur_price = coder->opts_price[cur];
 
 	const uint8_t current_byte = *buf;
 	const uint8_t match_byte = *(buf - reps[0] - 1);
@@ -527,10 +680,10 @@ helper2(lzma_lzma1_encoder *coder, uint32_t *reps, const uint8_t *buf,
 
 	bool next_is_literal = false;
 
-	if (cur_and_1_price < coder->opts[cur + 1].price) {
-		coder->opts[cur + 1].price = cur_and_1_price;
-		coder->opts[cur + 1].pos_prev = cur;
-		make_literal(&coder->opts[cur + 1]);
+	if (cur_and_1_price < coder->opts_price[cur + 1]) {
+		coder->opts_price[cur + 1] = cur_and_1_price;
+		coder->opts_pos_prev[cur + 1] = cur;
+		make_literal(coder, cur + 1);
 		next_is_literal = true;
 	}
 
@@ -540,16 +693,16 @@ helper2(lzma_lzma1_encoder *coder, uint32_t *reps, const uint8_t *buf,
 			+ rc_bit_1_price(coder->is_rep[state]);
 
 	if (match_byte == current_byte
-			&& !(coder->opts[cur + 1].pos_prev < cur
-				&& coder->opts[cur + 1].back_prev == 0)) {
+			&& !(coder->opts_pos_prev[cur + 1] < cur
+				&& coder->opts_back_prev[cur + 1] == 0)) {
 
 		const uint32_t short_rep_price = rep_match_price
 				+ get_short_rep_price(coder, state, pos_state);
 
-		if (short_rep_price <= coder->opts[cur + 1].price) {
-			coder->opts[cur + 1].price = short_rep_price;
-			coder->opts[cur + 1].pos_prev = cur;
-			make_short_rep(&coder->opts[cur + 1]);
+		if (short_rep_price <= coder->opts_price[cur + 1]) {
+			coder->opts_price[cur + 1] = short_rep_price;
+			coder->opts_pos_prev[cur + 1] = cur;
+			make_short_rep(coder, cur + 1);
 			next_is_literal = true;
 		}
 	}
@@ -579,17 +732,17 @@ helper2(lzma_lzma1_encoder *coder, uint32_t *reps, const uint8_t *buf,
 			const uint32_t offset = cur + 1 + len_test;
 
 			while (len_end < offset)
-				coder->opts[++len_end].price = RC_INFINITY_PRICE;
+				coder->opts_price[++len_end] = RC_INFINITY_PRICE;
 
 			const uint32_t cur_and_len_price = next_rep_match_price
 					+ get_rep_price(coder, 0, len_test,
 						state_2, pos_state_next);
 
-			if (cur_and_len_price < coder->opts[offset].price) {
-				coder->opts[offset].price = cur_and_len_price;
-				coder->opts[offset].pos_prev = cur + 1;
-				coder->opts[offset].back_prev = 0;
-				coder->opts[offset].prev_1_is_literal = true;
+			if (cur_and_len_price < coder->opts_price[offset]) {
+				coder->opts_price[offset] = cur_and_len_price;
+				coder->opts_pos_prev[offset] = cur + 1;
+				coder->opts_back_prev[offset] = 0;
+				coder->opts_prev_1_is_literal[offset] = true;
 				coder->opts[offset].prev_2 = false;
 			}
 			//}
@@ -607,26 +760,14 @@ helper2(lzma_lzma1_encoder *coder, uint32_t *reps, const uint8_t *buf,
 		uint32_t len_test = lzma_memcmplen(buf, buf_back, 2, buf_avail);
 
 		while (len_end < cur + len_test)
-			coder->opts[++len_end].price = RC_INFINITY_PRICE;
+			coder->opts_price[++len_end] = RC_INFINITY_PRICE;
 
-		const uint32_t len_test_temp = len_test;
 		const uint32_t price = rep_match_price + get_pure_rep_price(
 				coder, rep_index, state, pos_state);
 
-		do {
-			const uint32_t cur_and_len_price = price
-					+ get_len_price(&coder->rep_len_encoder,
-							len_test, pos_state);
-
-			if (cur_and_len_price < coder->opts[cur + len_test].price) {
-				coder->opts[cur + len_test].price = cur_and_len_price;
-				coder->opts[cur + len_test].pos_prev = cur;
-				coder->opts[cur + len_test].back_prev = rep_index;
-				coder->opts[cur + len_test].prev_1_is_literal = false;
-			}
-		} while (--len_test >= 2);
-
-		len_test = len_test_temp;
+		relax(coder, cur, 2, len_test, price,
+				coder->rep_len_encoder.prices[pos_state],
+				rep_index);
 
 		if (rep_index == 0)
 			start_len = len_test + 1;
@@ -668,17 +809,17 @@ helper2(lzma_lzma1_encoder *coder, uint32_t *reps, const uint8_t *buf,
 			const uint32_t offset = cur + len_test + 1 + len_test_2;
 
 			while (len_end < offset)
-				coder->opts[++len_end].price = RC_INFINITY_PRICE;
+				coder->opts_price[++len_end] = RC_INFINITY_PRICE;
 
 			const uint32_t cur_and_len_price = next_rep_match_price
 					+ get_rep_price(coder, 0, len_test_2,
 						state_2, pos_state_next);
 
-			if (cur_and_len_price < coder->opts[offset].price) {
-				coder->opts[offset].price = cur_and_len_price;
-				coder->opts[offset].pos_prev = cur + len_test + 1;
-				coder->opts[offset].back_prev = 0;
-				coder->opts[offset].prev_1_is_literal = true;
+			if (cur_and_len_price < coder->opts_price[offset]) {
+				coder->opts_price[offset] = cur_and_len_price;
+				coder->opts_pos_prev[offset] = cur + len_test + 1;
+				coder->opts_back_prev[offset] = 0;
+				coder->opts_prev_1_is_literal[offset] = true;
 				coder->opts[offset].prev_2 = true;
 				coder->opts[offset].pos_prev_2 = cur;
 				coder->opts[offset].back_prev_2 = rep_index;
@@ -705,93 +846,87 @@ helper2(lzma_lzma1_encoder *coder, uint32_t *reps, const uint8_t *buf,
 				+ rc_bit_0_price(coder->is_rep[state]);
 
 		while (len_end < cur + new_len)
-			coder->opts[++len_end].price = RC_INFINITY_PRICE;
+			coder->opts_price[++len_end] = RC_INFINITY_PRICE;
 
 		uint32_t i = 0;
 		while (start_len > coder->matches[i].len)
 			++i;
 
-		for (uint32_t len_test = start_len; ; ++len_test) {
+		for (uint32_t len_test = start_len; i < matches_count; ++i) {
 			const uint32_t cur_back = coder->matches[i].dist;
+			relax_match(coder, cur, len_test, coder->matches[i].len,
+					normal_match_price, cur_back,
+					pos_state);
+
+			len_test = coder->matches[i].len;
 			uint32_t cur_and_len_price = normal_match_price
 					+ get_dist_len_price(coder,
 						cur_back, len_test, pos_state);
 
-			if (cur_and_len_price < coder->opts[cur + len_test].price) {
-				coder->opts[cur + len_test].price = cur_and_len_price;
-				coder->opts[cur + len_test].pos_prev = cur;
-				coder->opts[cur + len_test].back_prev
-						= cur_back + REPS;
-				coder->opts[cur + len_test].prev_1_is_literal = false;
-			}
-
-			if (len_test == coder->matches[i].len) {
-				// Try Match + Literal + Rep0
-				const uint8_t *const buf_back = buf - cur_back - 1;
-				uint32_t len_test_2 = len_test + 1;
-				const uint32_t limit = my_min(buf_avail_full,
-						len_test_2 + nice_len);
-
-				// NOTE: len_test_2 may be greater than limit
-				// so the call to lzma_memcmplen() must be
-				// done conditionally.
-				if (len_test_2 < limit)
-					len_test_2 = lzma_memcmplen(buf, buf_back,
-							len_test_2, limit);
-
-				len_test_2 -= len_test + 1;
-
-				if (len_test_2 >= 2) {
-					lzma_lzma_state state_2 = state;
-					update_match(state_2);
-					uint32_t pos_state_next
-							= (position + len_test) & coder->pos_mask;
-
-					const uint32_t cur_and_len_literal_price = cur_and_len_price
-							+ rc_bit_0_price(
-								coder->is_match[state_2][pos_state_next])
-							+ get_literal_price(coder,
-								position + len_test,
-								buf[len_test - 1],
-								true,
-								buf_back[len_test],
-								buf[len_test]);
-
-					update_literal(state_2);
-					pos_state_next = (pos_state_next + 1) & coder->pos_mask;
-
-					const uint32_t next_rep_match_price
-							= cur_and_len_literal_price
-							+ rc_bit_1_price(
-								coder->is_match[state_2][pos_state_next])
-							+ rc_bit_1_price(coder->is_rep[state_2]);
-
-					// for(; len_test_2 >= 2; --len_test_2) {
-					const uint32_t offset = cur + len_test + 1 + len_test_2;
-
-					while (len_end < offset)
-						coder->opts[++len_end].price = RC_INFINITY_PRICE;
-
-					cur_and_len_price = next_rep_match_price
-							+ get_rep_price(coder, 0, len_test_2,
-								state_2, pos_state_next);
-
-					if (cur_and_len_price < coder->opts[offset].price) {
-						coder->opts[offset].price = cur_and_len_price;
-						coder->opts[offset].pos_prev = cur + len_test + 1;
-						coder->opts[offset].back_prev = 0;
-						coder->opts[offset].prev_1_is_literal = true;
-						coder->opts[offset].prev_2 = true;
-						coder->opts[offset].pos_prev_2 = cur;
-						coder->opts[offset].back_prev_2
-								= cur_back + REPS;
-					}
-					//}
+			// Try Match + Literal + Rep0
+			const uint8_t *const buf_back = buf - cur_back - 1;
+			uint32_t len_test_2 = len_test + 1;
+			const uint32_t limit = my_min(buf_avail_full,
+					len_test_2 + nice_len);
+
+			// NOTE: len_test_2 may be greater than limit
+			// so the call to lzma_memcmplen() must be
+			// done conditionally.
+			if (len_test_2 < limit)
+				len_test_2 = lzma_memcmplen(buf, buf_back,
+						len_test_2, limit);
+
+			len_test_2 -= len_test + 1;
+
+			if (len_test_2 >= 2) {
+				lzma_lzma_state state_2 = state;
+				update_match(state_2);
+				uint32_t pos_state_next
+						= (position + len_test) & coder->pos_mask;
+
+				const uint32_t cur_and_len_literal_price = cur_and_len_price
+						+ rc_bit_0_price(
+							coder->is_match[state_2][pos_state_next])
+						+ get_literal_price(coder,
+							position + len_test,
+							buf[len_test - 1],
+							true,
+							buf_back[len_test],
+							buf[len_test]);
+
+				update_literal(state_2);
+				pos_state_next = (pos_state_next + 1) & coder->pos_mask;
+
+				const uint32_t next_rep_match_price
+						= cur_and_len_literal_price
+						+ rc_bit_1_price(
+							coder->is_match[state_2][pos_state_next])
+						+ rc_bit_1_price(coder->is_rep[state_2]);
+
+				// for(; len_test_2 >= 2; --len_test_2) {
+				const uint32_t offset = cur + len_test + 1 + len_test_2;
+
+				while (len_end < offset)
+					coder->opts_price[++len_end] = RC_INFINITY_PRICE;
+
+				cur_and_len_price = next_rep_match_price
+						+ get_rep_price(coder, 0, len_test_2,
+							state_2, pos_state_next);
+
+				if (cur_and_len_price < coder->opts_price[offset]) {
+					coder->opts_price[offset] = cur_and_len_price;
+					coder->opts_pos_prev[offset] = cur + len_test + 1;
+					coder->opts_back_prev[offset] = 0;
+					coder->opts_prev_1_is_literal[offset] = true;
+					coder->opts[offset].prev_2 = true;
+					coder->opts[offset].pos_prev_2 = cur;
+					coder->opts[offset].back_prev_2
+							= cur_back + REPS;
 				}
-
-				if (++i == matches_count)
-					break;
+				//}
 			}
+
+			++len_test;
 		}
 	}
 
@@ -808,11 +943,11 @@ lzma_lzma_optimum_normal(lzma_lzma1_encoder *restrict coder,
 	// If we have symbols pending, return the next pending symbol.
 	if (coder->opts_end_index != coder->opts_current_index) {
 		assert(mf->read_ahead > 0);
-		*len_res = coder->opts[coder->opts_current_index].pos_prev
+		*len_res = coder->opts_pos_prev[coder->opts_current_index]
 				- coder->opts_current_index;
-		*back_res = coder->opts[coder->opts_current_index].back_prev;
-		coder->opts_current_index = coder->opts[
-				coder->opts_current_index].pos_prev;
+		*back_res = coder->opts_back_prev[coder->opts_current_index];
+		coder->opts_current_index = coder->opts_pos_prev[
+				coder->opts_current_index];
 		return;
 	}
 
@@ -856,3 +991,301 @@ lzma_lzma_optimum_normal(lzma_lzma1_encoder *restrict coder,
 	backward(coder, len_res, back_res, cur);
 	return;
 }
+
+
+//////////
+// Lazy //
+//////////
+
+/// \brief      Finds the cheapest way to encode a single byte
+///
+/// The byte at buf[0] is encoded either as a literal or as a short rep.
+///
+/// \return     The price; *back_res is set to UINT32_MAX (literal)
+///             or zero (short rep).
+static uint32_t
+lazy_single_price(const lzma_lzma1_encoder *coder, const uint8_t *buf,
+		const uint32_t *reps, lzma_lzma_state state,
+		uint32_t position, uint32_t *back_res)
+{
+	const uint32_t pos_state = position & coder->pos_mask;
+	const uint8_t match_byte = *(buf - reps[0] - 1);
+
+	uint32_t price = rc_bit_0_price(coder->is_match[state][pos_state])
+			+ get_literal_price(coder, position, buf[-1],
+				!is_literal_state(state), match_byte, buf[0]);
+	*back_res = UINT32_MAX;
+
+	if (match_byte == buf[0]) {
+		const uint32_t short_rep_price = rc_bit_1_price(
+				coder->is_match[state][pos_state])
+				+ rc_bit_1_price(coder->is_rep[state])
+				+ get_short_rep_price(coder, state, pos_state);
+
+		if (short_rep_price < price) {
+			price = short_rep_price;
+			*back_res = 0;
+		}
+	}
+
+	return price;
+}
+
+
+/// Returns true if encoding len_a bytes with price_a is cheaper per byte
+/// than encoding len_b bytes with price_b.
+static inline bool
+lazy_is_cheaper(uint32_t price_a, uint32_t len_a,
+		uint32_t price_b, uint32_t len_b)
+{
+	return price_a * len_b < price_b * len_a;
+}
+
+
+/// \brief      Finds the match that is cheapest per byte
+///
+/// The repeated matches and the matches in coder->matches are compared
+/// at their full lengths. Lengths are capped to nice_len since
+/// the length price tables don't go further.
+///
+/// \return     Length of the chosen match or zero if there is no match
+///             of at least two bytes. *back_res and *price_res are set
+///             only when the return value is nonzero.
+static uint32_t
+lazy_match(const lzma_lzma1_encoder *coder, const uint8_t *buf,
+		uint32_t buf_avail, lzma_lzma_state state, uint32_t position,
+		uint32_t nice_len, uint32_t *back_res, uint32_t *price_res)
+{
+	const uint32_t pos_state = position & coder->pos_mask;
+	const uint32_t match_price = rc_bit_1_price(
+			coder->is_match[state][pos_state]);
+	const uint32_t rep_match_price = match_price
+			+ rc_bit_1_price(coder->is_rep[state]);
+	const uint32_t normal_match_price = match_price
+			+ rc_bit_0_price(coder->is_rep[state]);
+
+	buf_avail = my_min(buf_avail, nice_len);
+
+	uint32_t best_len = 0;
+	uint32_t best_back = 0;
+	uint32_t best_price = 0;
+
+	for (uint32_t i = 0; i < REPS; ++i) {
+		const uint8_t *const buf_back = buf - coder->reps[i] - 1;
+		if (buf_avail < 2 || not_equal_16(buf, buf_back))
+			continue;
+
+		const uint32_t len = lzma_memcmplen(
+				buf, buf_back, 2, buf_avail);
+		const uint32_t price = rep_match_price + get_rep_price(
+				coder, i, len, state, pos_state);
+
+		if (best_len == 0 || lazy_is_cheaper(
+				price, len, best_price, best_len)) {
+			best_len = len;
+			best_back = i;
+			best_price = price;
+		}
+	}
+
+	for (uint32_t i = 0; i < coder->matches_count; ++i) {
+		const uint32_t len = my_min(coder->matches[i].len, nice_len);
+		const uint32_t dist = coder->matches[i].dist;
+
+		// A match of two bytes at a long distance is never cheaper
+		// than two literals.
+		if (len == 2 && dist >= 0x80)
+			continue;
+
+		const uint32_t price = normal_match_price
+				+ get_dist_len_price(coder, dist, len,
+					pos_state);
+
+		if (best_len == 0 || lazy_is_cheaper(
+				price, len, best_price, best_len)) {
+			best_len = len;
+			best_back = dist + REPS;
+			best_price = price;
+		}
+	}
+
+	*back_res = best_back;
+	*price_res = best_price;
+	return best_len;
+}
+
+
+/// \brief      Lazy parsing
+///
+/// This sits between lzma_lzma_optimum_fast() and
+/// lzma_lzma_optimum_normal(). The best match of the current byte is
+/// chosen with the price tables like in the normal mode, but instead
+/// of searching for the optimal sequence of symbols over up to OPTS
+/// bytes, only the next two bytes are checked: if encoding the current
+/// byte as a literal and then using the best match of the next byte is
+/// cheaper per byte, the literal is encoded. If the next byte doesn't
+/// win, the byte after it is tried with two literals in front.
+///
+/// Matches of the next byte are stored in coder->matches so that
+/// the next call can use them (mf->read_ahead is then one). When two
+/// literals are chosen, coder->lazy_literal tells the next call to
+/// encode the second one without looking at the matches.
+extern void
+lzma_lzma_optimum_lazy(lzma_lzma1_encoder *restrict coder,
+		lzma_mf *restrict mf,
+		uint32_t *restrict back_res, uint32_t *restrict len_res,
+		uint32_t position)
+{
+	if (coder->lazy_literal) {
+		assert(mf->read_ahead == 2);
+		coder->lazy_literal = false;
+		lazy_single_price(coder, mf_ptr(mf) - 2, coder->reps,
+				coder->state, position, back_res);
+		*len_res = 1;
+		return;
+	}
+
+	// Unlike in the normal mode, there are no pending symbols that
+	// would use the old prices so the tables can be updated even
+	// when read_ahead isn't zero.
+	if (coder->match_price_count >= (1 << 7))
+		fill_dist_prices(coder);
+
+	if (coder->align_price_count >= ALIGN_SIZE)
+		fill_align_prices(coder);
+
+	const uint32_t nice_len = mf->nice_len;
+
+	uint32_t len_main;
+	if (mf->read_ahead == 0) {
+		len_main = mf_find(mf, &coder->matches_count, coder->matches);
+	} else {
+		assert(mf->read_ahead == 1);
+		len_main = coder->longest_match_length;
+	}
+
+	const uint8_t *buf = mf_ptr(mf) - 1;
+	const uint32_t buf_avail = my_min(mf_avail(mf) + 1, MATCH_LEN_MAX);
+
+	if (buf_avail < 2) {
+		*back_res = UINT32_MAX;
+		*len_res = 1;
+		return;
+	}
+
+	// Take a long repeated match or a long normal match immediately
+	// like the other modes do.
+	uint32_t rep_len = 0;
+	uint32_t rep_index = 0;
+
+	for (uint32_t i = 0; i < REPS; ++i) {
+		const uint8_t *const buf_back = buf - coder->reps[i] - 1;
+		if (not_equal_16(buf, buf_back))
+			continue;
+
+		const uint32_t len = lzma_memcmplen(
+				buf, buf_back, 2, buf_avail);
+		if (len > rep_len) {
+			rep_index = i;
+			rep_len = len;
+		}
+	}
+
+	if (rep_len >= nice_len) {
+		*back_res = rep_index;
+		*len_res = rep_len;
+		mf_skip(mf, rep_len - 1);
+		return;
+	}
+
+	if (len_main >= nice_len) {
+		*back_res = coder->matches[coder->matches_count - 1].dist
+				+ REPS;
+		*len_res = len_main;
+		mf_skip(mf, len_main - 1);
+		return;
+	}
+
+	uint32_t back_main;
+	uint32_t price_main;
+	const uint32_t len = lazy_match(coder, buf, buf_avail,
+			coder->state, position, nice_len,
+			&back_main, &price_main);
+
+	uint32_t back_single;
+	const uint32_t price_single = lazy_single_price(coder, buf,
+			coder->reps, coder->state, position, &back_single);
+
+	if (len < 2 || buf_avail <= 2) {
+		*back_res = len < 2 ? back_single : back_main;
+		*len_res = len < 2 ? 1 : len;
+		if (len >= 2)
+			mf_skip(mf, len - 1);
+
+		return;
+	}
+
+	// The state after encoding the current byte alone
+	lzma_lzma_state state = coder->state;
+	if (back_single == 0)
+		update_short_rep(state);
+	else
+		update_literal(state);
+
+	// Try the next byte. Its matches are kept in coder->matches for
+	// the next call.
+	coder->longest_match_length = mf_find(mf,
+			&coder->matches_count, coder->matches);
+
+	uint32_t back_next;
+	uint32_t price_next;
+	uint32_t len_next = lazy_match(coder, buf + 1, buf_avail - 1,
+			state, position + 1, nice_len,
+			&back_next, &price_next);
+
+	if (len_next >= 2 && lazy_is_cheaper(price_single + price_next,
+			len_next + 1, price_main, len)) {
+		*back_res = back_single;
+		*len_res = 1;
+		return;
+	}
+
+	// Try the byte after that with two single-byte symbols in front.
+	// If the match of the current byte is only two bytes, the byte
+	// after it will be tried in the next call anyway.
+	if (len > 2 && buf_avail > 3) {
+		uint32_t back_unused;
+		const uint32_t price_single2 = lazy_single_price(coder,
+				buf + 1, coder->reps, state, position + 1,
+				&back_unused);
+
+		if (back_unused == 0)
+			update_short_rep(state);
+		else
+			update_literal(state);
+
+		coder->longest_match_length = mf_find(mf,
+				&coder->matches_count, coder->matches);
+
+		len_next = lazy_match(coder, buf + 2, buf_avail - 2,
+				state, position + 2, nice_len,
+				&back_next, &price_next);
+
+		if (len_next >= 2 && lazy_is_cheaper(
+				price_single + price_single2 + price_next,
+				len_next + 2, price_main, len)) {
+			coder->lazy_literal = true;
+			*back_res = back_single;
+			*len_res = 1;
+			return;
+		}
+
+		mf_skip(mf, len - 3);
+	} else {
+		mf_skip(mf, len - 2);
+	}
+
+	*back_res = back_main;
+	*len_res = len;
+	return;
+}
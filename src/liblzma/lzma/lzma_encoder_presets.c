@@ -25,6 +25,11 @@ lzma_lzma_preset(lzma_options_lzma *options, uint32_t preset)
 
 	options->preset_dict = NULL;
 	options->preset_dict_size = 0;
+	options->ext_enable = LZMA_OPTIONS_LZMA_EXT;
+	options->long_len = 0;
+	options->mf_threads = 0;
+	options->mf_hash = LZMA_MF_HASH_TABLE;
+	options->speed_target = 0;
 
 	options->lc = LZMA_LC_DEFAULT;
 	options->lp = LZMA_LP_DEFAULT;
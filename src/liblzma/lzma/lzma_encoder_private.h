@@ -49,19 +49,17 @@ typedef struct {
 } lzma_length_encoder;
 
 
+/// The part of the optimum parser's state of a position that is needed
+/// only when the parser gets to that position. The price and how the
+/// position is reached are in the opts_* arrays of lzma_lzma1_encoder.
 typedef struct {
 	lzma_lzma_state state;
 
-	bool prev_1_is_literal;
 	bool prev_2;
 
 	uint32_t pos_prev_2;
 	uint32_t back_prev_2;
 
-	uint32_t price;
-	uint32_t pos_prev;  // pos_next;
-	uint32_t back_prev;
-
 	uint32_t backs[REPS];
 
 } lzma_optimal;
@@ -102,6 +100,14 @@ struct lzma_lzma1_encoder_s {
 	/// True if using getoptimumfast
 	bool fast_mode;
 
+	/// True if using lzma_lzma_optimum_lazy(). fast_mode is false
+	/// then since the price tables are needed.
+	bool lazy_mode;
+
+	/// True if lzma_lzma_optimum_lazy() has decided that the next
+	/// byte is encoded as a literal or a short rep.
+	bool lazy_literal;
+
 	/// True if the encoder has been initialized by encoding the first
 	/// byte as a literal.
 	bool is_initialized;
@@ -136,16 +142,37 @@ struct lzma_lzma1_encoder_s {
 
 	// Price tables
 	uint32_t dist_slot_prices[DIST_STATES][DIST_SLOTS];
+	uint32_t dist_special_prices[FULL_DISTANCES - DIST_MODEL_START];
 	uint32_t dist_prices[DIST_STATES][FULL_DISTANCES];
 	uint32_t dist_table_size;
 	uint32_t match_price_count;
 
+	/// Bit dist_state is set when dist_slot[dist_state] has changed
+	/// since the distance prices were last calculated.
+	uint32_t dist_slot_dirty;
+
+	/// Bit dist_slot is set when the dist_special probabilities of
+	/// that dist_slot have changed since the distance prices were
+	/// last calculated.
+	uint32_t dist_special_dirty;
+
 	uint32_t align_prices[ALIGN_SIZE];
 	uint32_t align_price_count;
 
 	// Optimal
 	uint32_t opts_end_index;
 	uint32_t opts_current_index;
+
+	// The price of the cheapest known way to get to each position
+	// and how that is done. The price relaxation loops touch only
+	// these, so they are kept in separate arrays instead of in
+	// lzma_optimal. That way the loops can handle several lengths
+	// at once.
+	uint32_t opts_price[OPTS];
+	uint32_t opts_pos_prev[OPTS];  // pos_next;
+	uint32_t opts_back_prev[OPTS];
+	bool opts_prev_1_is_literal[OPTS];
+
 	lzma_optimal opts[OPTS];
 };
 
@@ -158,4 +185,8 @@ extern void lzma_lzma_optimum_normal(lzma_lzma1_encoder *restrict coder,
 		lzma_mf *restrict mf, uint32_t *restrict back_res,
 		uint32_t *restrict len_res, uint32_t position);
 
+extern void lzma_lzma_optimum_lazy(lzma_lzma1_encoder *restrict coder,
+		lzma_mf *restrict mf, uint32_t *restrict back_res,
+		uint32_t *restrict len_res, uint32_t position);
+
 #endif
@@ -187,12 +187,142 @@ rc_shift_low_dummy(uint64_t *low, uint64_t *cache_size, uint8_t *cache,
 }
 
 
+/// Like rc_shift_low() but the caller has checked that there is enough
+/// output space. A run of 0xFF bytes that was waiting for a possible carry
+/// is written with one memset().
+static inline void
+rc_shift_low_fast(uint64_t *low, uint64_t *cache_size, uint8_t *cache,
+		uint8_t **out_ptr)
+{
+	if ((uint32_t)(*low) < (uint32_t)(0xFF000000)
+			|| (uint32_t)(*low >> 32) != 0) {
+		const uint8_t carry = (uint8_t)(*low >> 32);
+		*(*out_ptr)++ = *cache + carry;
+
+		if (--*cache_size != 0) {
+			memset(*out_ptr, (uint8_t)(0xFF + carry),
+					(size_t)(*cache_size));
+			*out_ptr += *cache_size;
+			*cache_size = 0;
+		}
+
+		*cache = (*low >> 24) & 0xFF;
+	}
+
+	++*cache_size;
+	*low = (*low & 0x00FFFFFF) << RC_SHIFT_BITS;
+	return;
+}
+
+
+/// Encodes the rest of the symbols when there is enough output space for
+/// all the bytes that they can produce. Each symbol normalizes at most once
+/// and each normalization adds one byte to the cache, so this needs at
+/// most cache_size + count - pos bytes. The coder state is kept in local
+/// variables because the stores to out[] could otherwise make the compiler
+/// reload it after every byte.
+static inline void
+rc_encode_fast(lzma_range_encoder *rc, uint8_t *out, size_t *out_pos)
+{
+	uint64_t low = rc->low;
+	uint64_t cache_size = rc->cache_size;
+	uint32_t range = rc->range;
+	uint8_t cache = rc->cache;
+
+	uint8_t *out_ptr = out + *out_pos;
+	size_t pos = rc->pos;
+	const size_t count = rc->count;
+
+	for (; pos < count; ++pos) {
+		// Normalize
+		if (range < RC_TOP_VALUE) {
+			rc_shift_low_fast(&low, &cache_size, &cache, &out_ptr);
+			range <<= RC_SHIFT_BITS;
+		}
+
+		// Encode a bit
+		switch (rc->symbols[pos]) {
+		case RC_BIT_0:
+		case RC_BIT_1: {
+			// The bits are hard to predict with data that doesn't
+			// compress well, so both results are calculated and
+			// the right ones are selected without branching.
+			const uint32_t bit = rc->symbols[pos] - RC_BIT_0;
+			const probability prob = *rc->probs[pos];
+			const uint32_t bound = prob * (range
+					>> RC_BIT_MODEL_TOTAL_BITS);
+			const probability prob_0 = prob
+					+ ((RC_BIT_MODEL_TOTAL - prob)
+						>> RC_MOVE_BITS);
+			const probability prob_1 = prob
+					- (prob >> RC_MOVE_BITS);
+
+			low += bit != 0 ? bound : 0;
+			range = bit != 0 ? range - bound : bound;
+			*rc->probs[pos] = bit != 0 ? prob_1 : prob_0;
+			break;
+		}
+
+		case RC_DIRECT_0:
+			range >>= 1;
+			break;
+
+		case RC_DIRECT_1:
+			range >>= 1;
+			low += range;
+			break;
+
+		case RC_FLUSH: {
+			// Flush the last five bytes (see rc_flush()).
+			do {
+				rc_shift_low_fast(&low, &cache_size, &cache,
+						&out_ptr);
+			} while (++pos < count);
+
+			const size_t written = (size_t)(out_ptr - out)
+					- *out_pos;
+			*out_pos += written;
+			rc->out_total += written;
+
+			// Reset the range encoder so we are ready to continue
+			// encoding if we weren't finishing the stream.
+			rc_reset(rc);
+			return;
+		}
+
+		default:
+			assert(0);
+			break;
+		}
+	}
+
+	const size_t written = (size_t)(out_ptr - out) - *out_pos;
+	*out_pos += written;
+	rc->out_total += written;
+
+	rc->low = low;
+	rc->cache_size = cache_size;
+	rc->range = range;
+	rc->cache = cache;
+	rc->count = 0;
+	rc->pos = 0;
+	return;
+}
+
+
 static inline bool
 rc_encode(lzma_range_encoder *rc,
 		uint8_t *out, size_t *out_pos, size_t out_size)
 {
 	assert(rc->count <= RC_SYMBOLS_MAX);
 
+	// LZMA2 always has enough output space. LZMA1 does too except
+	// near the end of the caller's buffer.
+	if (out_size - *out_pos >= rc->cache_size + (rc->count - rc->pos)) {
+		rc_encode_fast(rc, out, out_pos);
+		return false;
+	}
+
 	while (rc->pos < rc->count) {
 		// Normalize
 		if (rc->range < RC_TOP_VALUE) {
@@ -233,6 +233,10 @@ parse_real(args_info *args, int argc, char **argv)
 		OPT_ROBOT,
 		OPT_FLUSH_TIMEOUT,
 		OPT_IGNORE_CHECK,
+		OPT_LONG,
+		OPT_SPEED_TARGET,
+		OPT_TRAIN,
+		OPT_DICT_FILE,
 	};
 
 	static const char short_opts[]
@@ -245,6 +249,7 @@ parse_real(args_info *args, int argc, char **argv)
 		{ "uncompress",   no_argument,       NULL,  'd' },
 		{ "test",         no_argument,       NULL,  't' },
 		{ "list",         no_argument,       NULL,  'l' },
+		{ "train",        optional_argument, NULL,  OPT_TRAIN },
 
 		// Operation modifiers
 		{ "keep",         no_argument,       NULL,  'k' },
@@ -274,6 +279,9 @@ parse_real(args_info *args, int argc, char **argv)
 		{ "flush-timeout", required_argument, NULL, OPT_FLUSH_TIMEOUT },
 
 		{ "extreme",      no_argument,       NULL,  'e' },
+		{ "long",         optional_argument, NULL,  OPT_LONG },
+		{ "speed-target", required_argument, NULL,  OPT_SPEED_TARGET },
+		{ "dict-file",    required_argument, NULL,  OPT_DICT_FILE },
 		{ "fast",         no_argument,       NULL,  '0' },
 		{ "best",         no_argument,       NULL,  '9' },
 
@@ -421,6 +429,17 @@ parse_real(args_info *args, int argc, char **argv)
 			opt_mode = MODE_LIST;
 			break;
 
+		// --train
+		case OPT_TRAIN:
+#ifdef HAVE_ENCODERS
+			if (optarg != NULL)
+				train_set_size((size_t)str_to_uint64("train",
+						optarg, 1, UINT32_MAX));
+#endif
+
+			opt_mode = MODE_TRAIN;
+			break;
+
 		// --keep
 		case 'k':
 			opt_keep_original = true;
@@ -660,6 +679,23 @@ parse_real(args_info *args, int argc, char **argv)
 					optarg, 0, UINT64_MAX);
 			break;
 
+		case OPT_LONG:
+			coder_set_long(optarg == NULL ? LONG_LEN_DEFAULT
+					: (uint32_t)str_to_uint64("long", optarg,
+						LZMA_LONG_LEN_MIN,
+						LZMA_LONG_LEN_MAX));
+			break;
+
+		case OPT_SPEED_TARGET:
+			coder_set_speed_target((uint32_t)str_to_uint64(
+					"speed-target", optarg,
+					1, LZMA_SPEED_TARGET_MAX));
+			break;
+
+		case OPT_DICT_FILE:
+			coder_set_dict_file(optarg);
+			break;
+
 		case OPT_NO_SYNC:
 			opt_synchronous = false;
 			break;
@@ -806,14 +842,14 @@ args_parse(args_info *args, int argc, char **argv)
 	// show an error now so that the rest of the code can rely on
 	// that whatever is in opt_mode is also supported.
 #ifndef HAVE_ENCODERS
-	if (opt_mode == MODE_COMPRESS)
+	if (opt_mode == MODE_COMPRESS || opt_mode == MODE_TRAIN)
 		message_fatal(_("Compression support was disabled "
 				"at build time"));
 #endif
 #ifndef HAVE_DECODERS
 	// Even MODE_LIST cannot work without decoder support so MODE_COMPRESS
-	// is the only valid choice.
-	if (opt_mode != MODE_COMPRESS)
+	// and MODE_TRAIN are the only valid choices.
+	if (opt_mode != MODE_COMPRESS && opt_mode != MODE_TRAIN)
 		message_fatal(_("Decompression support was disabled "
 				"at build time"));
 #endif
@@ -883,7 +919,7 @@ args_parse(args_info *args, int argc, char **argv)
 	// the options given on the command line are used to know what kind
 	// of raw data we are supposed to decode.
 	if (opt_mode == MODE_COMPRESS || (opt_format == FORMAT_RAW
-			&& opt_mode != MODE_LIST))
+			&& opt_mode != MODE_LIST && opt_mode != MODE_TRAIN))
 		coder_set_compression_settings();
 
 	// If no filenames are given, use stdin.
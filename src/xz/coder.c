@@ -63,6 +63,19 @@ static uint32_t filters_count = 0;
 /// Number of the preset (0-9)
 static uint32_t preset_number = LZMA_PRESET_DEFAULT;
 
+/// Minimum length of long-distance matches set with --long or zero
+static uint32_t long_len = 0;
+
+/// Target speed in MiB/s set with --speed-target or zero
+static uint32_t speed_target = 0;
+
+/// Name of the preset dictionary file set with --dict-file or NULL
+static const char *dict_filename = NULL;
+
+/// Contents of the preset dictionary file
+static uint8_t *dict_buf = NULL;
+static uint32_t dict_buf_size = 0;
+
 /// True if the current default filter chain was set using the --filters
 /// option. The filter chain is reset if a preset option (like -9) or an
 /// old-style filter option (like --lzma2) is used after a --filters option.
@@ -130,6 +143,69 @@ coder_set_extreme(void)
 }
 
 
+extern void
+coder_set_long(uint32_t new_long_len)
+{
+	long_len = new_long_len;
+	return;
+}
+
+
+extern void
+coder_set_speed_target(uint32_t new_speed_target)
+{
+	speed_target = new_speed_target;
+	return;
+}
+
+
+extern void
+coder_set_dict_file(const char *filename)
+{
+	dict_filename = filename;
+	return;
+}
+
+
+/// Read the file given with --dict-file into dict_buf. This is done
+/// while parsing the command line, so before the sandbox is enabled.
+static void
+read_dict_file(void)
+{
+	FILE *file = fopen(dict_filename, "rb");
+	if (file == NULL)
+		message_fatal(_("%s: %s"), tuklib_mask_nonprint(dict_filename),
+				strerror(errno));
+
+	size_t alloc = 0;
+	size_t size = 0;
+
+	do {
+		if (size == alloc) {
+			// The preset dictionary size is 32 bits.
+			if (alloc > UINT32_MAX / 2)
+				message_fatal(_("%s: File is too big"),
+					tuklib_mask_nonprint(dict_filename));
+
+			alloc = alloc == 0 ? (64 << 10) : 2 * alloc;
+			dict_buf = xrealloc(dict_buf, alloc);
+		}
+
+		size += fread(dict_buf + size, 1, alloc - size, file);
+
+		if (ferror(file))
+			message_fatal(_("%s: %s"),
+					tuklib_mask_nonprint(dict_filename),
+					strerror(errno));
+	} while (!feof(file));
+
+	(void)fclose(file);
+
+	dict_buf_size = (uint32_t)(size);
+	return;
+}
+
+
 extern void
 coder_add_filter(lzma_vli id, void *options)
 {
@@ -384,6 +460,56 @@ coder_set_compression_settings(void)
 		default_filters[1].id = LZMA_VLI_UNKNOWN;
 	}
 
+	// Apply --long to the LZMA1 and LZMA2 filters and --speed-target
+	// to the LZMA2 filters. The options given in the filter chain take
+	// precedence.
+	if (opt_mode == MODE_COMPRESS && (long_len != 0
+			|| speed_target != 0)) {
+		for (unsigned i = 0; i < ARRAY_SIZE(chains); ++i) {
+			if (!(chains_used_mask & (1U << i)))
+				continue;
+
+			lzma_filter *fc = chains[i];
+			for (size_t j = 0; fc[j].id != LZMA_VLI_UNKNOWN; ++j) {
+				if (fc[j].id != LZMA_FILTER_LZMA1
+						&& fc[j].id != LZMA_FILTER_LZMA2)
+					continue;
+
+				lzma_options_lzma *opt = fc[j].options;
+				if (opt->long_len == 0)
+					opt->long_len = long_len;
+
+				if (fc[j].id == LZMA_FILTER_LZMA2
+						&& opt->speed_target == 0)
+					opt->speed_target = speed_target;
+			}
+		}
+	}
+
+	// Apply --dict-file to the LZMA1 and LZMA2 filters. The .xz and
+	// .lzma formats have no way to tell which preset dictionary was
+	// used, so it's supported only with the raw format.
+	if (dict_filename != NULL) {
+		if (opt_format != FORMAT_RAW)
+			message_fatal(_("--dict-file is supported only "
+					"with --format=raw"));
+
+		if (dict_buf == NULL)
+			read_dict_file();
+
+		lzma_filter *fc = chains[0];
+		for (size_t j = 0; fc[j].id != LZMA_VLI_UNKNOWN; ++j) {
+			if (fc[j].id != LZMA_FILTER_LZMA1
+					&& fc[j].id != LZMA_FILTER_LZMA1EXT
+					&& fc[j].id != LZMA_FILTER_LZMA2)
+				continue;
+
+			lzma_options_lzma *opt = fc[j].options;
+			opt->preset_dict = dict_buf;
+			opt->preset_dict_size = dict_buf_size;
+		}
+	}
+
 	// If we are using the .lzma format, allow exactly one filter
 	// which has to be LZMA1. There is no need to check if the default
 	// filter chain is being used since it can only be disabled if
@@ -15,6 +15,7 @@ enum operation_mode {
 	MODE_DECOMPRESS,
 	MODE_TEST,
 	MODE_LIST,
+	MODE_TRAIN,
 };
 
 
@@ -85,6 +86,21 @@ extern void coder_set_preset(uint32_t new_preset);
 /// Enable extreme mode
 extern void coder_set_extreme(void);
 
+/// Default minimum length of long-distance matches with --long
+#define LONG_LEN_DEFAULT 64
+
+/// Enable the long-distance matcher in the LZMA1 and LZMA2 filters
+/// whose options don't set it already
+extern void coder_set_long(uint32_t long_len);
+
+/// Set the target speed in MiB/s of the LZMA2 filters whose options
+/// don't set it already
+extern void coder_set_speed_target(uint32_t speed_target);
+
+/// Set the file whose contents are used as the preset dictionary
+/// of the LZMA1 and LZMA2 filters with --format=raw
+extern void coder_set_dict_file(const char *filename);
+
 /// Add a filter to the custom filter chain
 extern void coder_add_filter(lzma_vli id, void *options);
 
@@ -203,7 +203,12 @@ main(int argc, char **argv)
 		message_set_files(args.arg_count);
 
 	// Refuse to write compressed data to standard output if it is
-	// a terminal.
+	// a terminal. The same goes for the dictionary from --train.
+	if (opt_mode == MODE_TRAIN && is_tty_stdout()) {
+		message_try_help();
+		tuklib_exit(E_ERROR, E_ERROR, false);
+	}
+
 	if (opt_mode == MODE_COMPRESS) {
 		if (opt_stdout || (args.arg_count == 1
 				&& strcmp(args.arg_names[0], "-") == 0)) {
@@ -215,28 +220,30 @@ main(int argc, char **argv)
 	}
 
 	// Set up the signal handlers. We don't need these before we
-	// start the actual action and not in --list mode, so this is
-	// done after parsing the command line arguments.
+	// start the actual action and not in --list or --train mode, so
+	// this is done after parsing the command line arguments.
 	//
 	// It's good to keep signal handlers in normal compression and
 	// decompression modes even when only writing to stdout, because
 	// we might need to restore O_APPEND flag on stdout before exiting.
 	// In --test mode, signal handlers aren't really needed, but let's
 	// keep them there for consistency with normal decompression.
-	if (opt_mode != MODE_LIST)
+	if (opt_mode != MODE_LIST && opt_mode != MODE_TRAIN)
 		signals_init();
 
 #ifdef ENABLE_SANDBOX
 	// Read-only sandbox can be enabled if we won't create or delete
 	// any files:
 	//
-	//   - --stdout, --test, or --list was used. Note that --test
-	//     implies opt_stdout = true but --list doesn't.
+	//   - --stdout, --test, --list, or --train was used. Note that
+	//     --test implies opt_stdout = true but --list and --train
+	//     don't.
 	//
 	//   - Output goes to stdout because --files or --files0 wasn't used
 	//     and no arguments were given on the command line or the
 	//     arguments are all "-" (indicating standard input).
-	bool to_stdout_only = opt_stdout || opt_mode == MODE_LIST;
+	bool to_stdout_only = opt_stdout || opt_mode == MODE_LIST
+			|| opt_mode == MODE_TRAIN;
 	if (!to_stdout_only && args.files_name == NULL) {
 		// If all of the filenames provided are "-" (more than one
 		// "-" could be specified), then we are only going to be
@@ -265,8 +272,12 @@ main(int argc, char **argv)
 #endif
 
 	// coder_run() handles compression, decompression, and testing.
-	// list_file() is for --list.
+	// list_file() is for --list and train_file() for --train.
 	void (*run)(const char *filename) = &coder_run;
+#ifdef HAVE_ENCODERS
+	if (opt_mode == MODE_TRAIN)
+		run = &train_file;
+#endif
 #ifdef HAVE_DECODERS
 	if (opt_mode == MODE_LIST)
 		run = &list_file;
@@ -339,6 +350,12 @@ main(int argc, char **argv)
 	}
 #endif
 
+#ifdef HAVE_ENCODERS
+	// With --train the dictionary is built from all the files.
+	if (opt_mode == MODE_TRAIN)
+		train_totals();
+#endif
+
 #ifndef NDEBUG
 	coder_free();
 	args_free();
@@ -992,6 +992,14 @@ message_help(bool long_help)
 			W_("test compressed file integrity"),
 			W_("list information about .xz files"));
 
+	if (long_help)
+		e |= tuklib_wrapf(stdout, &wrap2,
+			"    --train[=%s]\v%s",
+			_("SIZE"),
+			W_("build a preset dictionary of at most SIZE bytes "
+				"(64 KiB) from the files and write it to "
+				"standard output"));
+
 	if (long_help) {
 		putchar('\n');
 		e |= tuklib_wraps(stdout, &wrap1, W_("Operation modifiers:"));
@@ -1069,6 +1077,25 @@ message_help(bool long_help)
 			"as many threads as there are processor cores"));
 
 	if (long_help) {
+		e |= tuklib_wrapf(stdout, &wrap2,
+			"    --long[=%s]\v%s",
+			_("NUM"),
+			W_("find long repeats from the whole dictionary; "
+				"NUM is the minimum length of such repeats "
+				"(32-1024; 64)"));
+
+		e |= tuklib_wrapf(stdout, &wrap2,
+			"    --speed-target=%s\v%s",
+			_("NUM"),
+			W_("adapt the LZMA2 settings to compress about "
+				"NUM MiB/s per thread"));
+
+		e |= tuklib_wrapf(stdout, &wrap2,
+			"    --dict-file=%s\v%s",
+			_("FILE"),
+			W_("use the contents of FILE as the preset dictionary "
+				"of LZMA1 and LZMA2; needs --format=raw"));
+
 		e |= tuklib_wrapf(stdout, &wrap2,
 			"    --block-size=%s\v%s\r"
 			"    --block-list=%s\v%s\r"
@@ -1158,10 +1185,14 @@ message_help(bool long_help)
 			"lc=%s\v%s \b(0-4; 3)\b\r"
 			"lp=%s\v%s \b(0-4; 0)\b\r"
 			"pb=%s\v%s \b(0-4; 2)\b\r"
-			"mode=%s\v%s (fast, normal; normal)\r"
+			"mode=%s\v%s (fast, lazy, normal; normal)\r"
 			"nice=%s\v%s \b(2-273; 64)\b\r"
-			"mf=%s\v%s (hc3, hc4, bt2, bt3, bt4; bt4)\r"
-			"depth=%s\v%s",
+			"mf=%s\v%s (hc3, hc4, bt2, bt3, bt4, hr4, sa; bt4)\r"
+			"depth=%s\v%s\r"
+			"long=%s\v%s \b(32-1024)\b\r"
+			"mft=%s\v%s \b(0-1; 0)\b\r"
+			"hash=%s\v%s (table, mul; table)\r"
+			"speed=%s\v%s",
 			// TRANSLATORS: Short for PRESET. A longer string is
 			// fine but wider than 4 columns makes --long-help
 			// one line longer.
@@ -1180,7 +1211,14 @@ message_help(bool long_help)
 			_("NUM"), W_("nice length of a match"),
 			_("NAME"), W_("match finder"),
 			_("NUM"), W_("maximum search depth; "
-				"0=automatic (default)"));
+				"0=automatic (default)"),
+			_("NUM"), W_("minimum length of long-distance "
+				"matches; disabled by default"),
+			_("NUM"), W_("number of match finder helper "
+				"threads"),
+			_("NAME"), W_("hash function of the match finder"),
+			_("NUM"), W_("target speed in MiB/s; "
+				"disabled by default"));
 #endif
 
 		e |= tuklib_wrapf(stdout, &wrap2,
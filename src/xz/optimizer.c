@@ -24,48 +24,38 @@ void optimizer_init(void) {
 
 static double test_preset_compression(const uint8_t *data, size_t size,
                                      uint32_t preset, size_t *compressed_size) {
-	lzma_stream strm = LZMA_STREAM_INIT;
-	lzma_ret ret = lzma_easy_encoder(&strm, preset, LZMA_CHECK_CRC32);
-	
-	if (ret != LZMA_OK) {
-		lzma_end(&strm);
+	lzma_options_lzma opt_lzma;
+	if (lzma_lzma_preset(&opt_lzma, preset)) {
 		return -1.0;
 	}
 	
+	const lzma_filter filters[] = {
+		{ .id = LZMA_FILTER_LZMA2, .options = &opt_lzma },
+		{ .id = LZMA_VLI_UNKNOWN, .options = NULL },
+	};
+	
 	// Use sample if size is large
 	size_t test_size = size;
 	if (size > 1024 * 1024) { // > 1 MB, use 1 MB sample
 		test_size = 1024 * 1024;
 	}
 	
-	uint8_t *out = malloc(test_size * 2);
-	if (out == NULL) {
-		lzma_end(&strm);
-		return -1.0;
-	}
-	
-	strm.next_in = data;
-	strm.avail_in = test_size;
-	strm.next_out = out;
-	strm.avail_out = test_size * 2;
-	
+	// Only the size of the compressed data is needed, so it isn't stored.
+	uint64_t out_size;
 	uint64_t start_time = mytime_get_elapsed();
-	ret = lzma_code(&strm, LZMA_FINISH);
+	lzma_ret ret = lzma_raw_encoded_size(filters, NULL, data, test_size,
+	                                     &out_size);
 	uint64_t end_time = mytime_get_elapsed();
 	
 	double elapsed = (end_time > start_time) ? 
 	                (double)(end_time - start_time) / 1000.0 : 0.0;
 	
-	if (ret == LZMA_STREAM_END) {
-		*compressed_size = (test_size * 2) - strm.avail_out;
+	if (ret == LZMA_OK) {
+		*compressed_size = (size_t)out_size;
 		double ratio = (double)*compressed_size / (double)test_size;
-		free(out);
-		lzma_end(&strm);
 		return ratio;
 	}
 	
-	free(out);
-	lzma_end(&strm);
 	return -1.0;
 }
 
@@ -239,6 +239,10 @@ enum {
 	OPT_NICE,
 	OPT_MF,
 	OPT_DEPTH,
+	OPT_LONG,
+	OPT_MFT,
+	OPT_HASH,
+	OPT_SPEED,
 };
 
 
@@ -312,6 +316,22 @@ set_lzma(void *options, unsigned key, uint64_t value, const char *valuestr)
 	case OPT_DEPTH:
 		opt->depth = value;
 		break;
+
+	case OPT_LONG:
+		opt->long_len = value;
+		break;
+
+	case OPT_MFT:
+		opt->mf_threads = value;
+		break;
+
+	case OPT_HASH:
+		opt->mf_hash = value;
+		break;
+
+	case OPT_SPEED:
+		opt->speed_target = value;
+		break;
 	}
 }
 
@@ -322,6 +342,7 @@ options_lzma(const char *str)
 	static const name_id_map modes[] = {
 		{ "fast",   LZMA_MODE_FAST },
 		{ "normal", LZMA_MODE_NORMAL },
+		{ "lazy",   LZMA_MODE_LAZY },
 		{ NULL,     0 }
 	};
 
@@ -331,9 +352,17 @@ options_lzma(const char *str)
 		{ "bt2", LZMA_MF_BT2 },
 		{ "bt3", LZMA_MF_BT3 },
 		{ "bt4", LZMA_MF_BT4 },
+		{ "hr4", LZMA_MF_HR4 },
+		{ "sa",  LZMA_MF_SA },
 		{ NULL,  0 }
 	};
 
+	static const name_id_map hashes[] = {
+		{ "table", LZMA_MF_HASH_TABLE },
+		{ "mul",   LZMA_MF_HASH_MUL },
+		{ NULL,    0 }
+	};
+
 	static const option_map opts[] = {
 		{ "preset", NULL,   UINT64_MAX, 0 },
 		{ "dict",   NULL,   LZMA_DICT_SIZE_MIN,
@@ -345,6 +374,10 @@ options_lzma(const char *str)
 		{ "nice",   NULL,   2, 273 },
 		{ "mf",     mfs,    0, 0 },
 		{ "depth",  NULL,   0, UINT32_MAX },
+		{ "long",   NULL,   LZMA_LONG_LEN_MIN, LZMA_LONG_LEN_MAX },
+		{ "mft",    NULL,   0, LZMA_MF_THREADS_MAX },
+		{ "hash",   hashes, 0, 0 },
+		{ "speed",  NULL,   1, LZMA_SPEED_TARGET_MAX },
 		{ NULL,     NULL,   0, 0 }
 	};
 
@@ -76,6 +76,10 @@
 #include "suffix.h"
 #include "util.h"
 
+#ifdef HAVE_ENCODERS
+#	include "train.h"
+#endif
+
 #ifdef HAVE_DECODERS
 #	include "list.h"
 #endif
@@ -308,34 +308,28 @@ size_t smart_compress_benchmark(const uint8_t *data,
 		uint32_t preset = presets[i];
 		if (preset > 9) continue;
 		
-		lzma_stream strm = LZMA_STREAM_INIT;
-		lzma_ret ret = lzma_easy_encoder(&strm, preset, LZMA_CHECK_CRC64);
-		
-		if (ret != LZMA_OK) {
-			lzma_end(&strm);
-			continue;
-		}
-		
-		// Allocate output buffer (worst case: no compression)
-		uint8_t *outbuf = malloc(data_size * 2);
-		if (outbuf == NULL) {
-			lzma_end(&strm);
+		lzma_options_lzma opt_lzma;
+		if (lzma_lzma_preset(&opt_lzma, preset)) {
 			continue;
 		}
 		
-		strm.next_in = data;
-		strm.avail_in = data_size;
-		strm.next_out = outbuf;
-		strm.avail_out = data_size * 2;
+		const lzma_filter filters[] = {
+			{ .id = LZMA_FILTER_LZMA2, .options = &opt_lzma },
+			{ .id = LZMA_VLI_UNKNOWN, .options = NULL },
+		};
 		
+		// Only the size of the compressed data is needed, so it
+		// isn't stored. The size excludes the .xz headers.
+		uint64_t out_size;
 		uint64_t start_time = mytime_get_elapsed();
-		ret = lzma_code(&strm, LZMA_FINISH);
+		lzma_ret ret = lzma_raw_encoded_size(filters, NULL, data, data_size,
+		                                     &out_size);
 		uint64_t end_time = mytime_get_elapsed();
 		
-		if (ret == LZMA_STREAM_END) {
+		if (ret == LZMA_OK) {
 			benchmark_result_t *result = &results[results_count];
 			result->preset = preset;
-			result->output_size_bytes = (data_size * 2) - strm.avail_out;
+			result->output_size_bytes = out_size;
 			result->compression_ratio = (double)result->output_size_bytes / (double)data_size;
 			
 			double elapsed_sec = (end_time > start_time) ? 
@@ -361,9 +355,6 @@ size_t smart_compress_benchmark(const uint8_t *data,
 			stats_total_speed += result->compression_speed_mbps;
 			stats_compression_count++;
 		}
-		
-		free(outbuf);
-		lzma_end(&strm);
 	}
 	
 	return results_count;
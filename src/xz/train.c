@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: 0BSD
+
+///////////////////////////////////////////////////////////////////////////////
+//
+/// \file       train.c
+/// \brief      Build a preset dictionary from sample files
+///
+/// Each input file is one sample. The dictionary is built with
+/// lzma_dict_train() after all the files have been read and written
+/// to standard output. It can be used with --dict-file=FILE when
+/// compressing and decompressing with --format=raw.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "private.h"
+
+
+/// Size of the dictionary set with --train
+static size_t train_size = TRAIN_SIZE_DEFAULT;
+
+/// The contents of all the sample files one after another
+static uint8_t *samples = NULL;
+static size_t samples_size = 0;
+static size_t samples_alloc = 0;
+
+/// Sizes of the sample files
+static size_t *sizes = NULL;
+static size_t sizes_count = 0;
+static size_t sizes_alloc = 0;
+
+
+extern void
+train_set_size(size_t new_size)
+{
+	train_size = new_size;
+	return;
+}
+
+
+extern void
+train_file(const char *filename)
+{
+	message_filename(filename);
+
+	file_pair *pair = io_open_src(filename);
+	if (pair == NULL)
+		return;
+
+	const size_t start = samples_size;
+	io_buf buf;
+
+	while (true) {
+		const size_t size = io_read(pair, &buf, IO_BUFFER_SIZE);
+		if (size == SIZE_MAX) {
+			// The partial sample is dropped.
+			samples_size = start;
+			io_close(pair, false);
+			return;
+		}
+
+		if (size == 0)
+			break;
+
+		if (samples_alloc - samples_size < size) {
+			if (samples_size > SIZE_MAX / 2 - size)
+				message_fatal("%s", message_strm(
+						LZMA_MEM_ERROR));
+
+			samples_alloc = 2 * (samples_size + size);
+			samples = xrealloc(samples, samples_alloc);
+		}
+
+		memcpy(samples + samples_size, buf.u8, size);
+		samples_size += size;
+	}
+
+	io_close(pair, false);
+
+	// Empty files are ignored.
+	if (samples_size == start)
+		return;
+
+	if (sizes_count == sizes_alloc) {
+		sizes_alloc = sizes_alloc == 0 ? 64 : 2 * sizes_alloc;
+		sizes = xrealloc(sizes, sizes_alloc * sizeof(size_t));
+	}
+
+	sizes[sizes_count++] = samples_size - start;
+	return;
+}
+
+
+extern void
+train_totals(void)
+{
+	uint8_t *dict = xmalloc(train_size == 0 ? 1 : train_size);
+	size_t dict_size = train_size;
+
+	const lzma_ret ret = lzma_dict_train(samples, sizes, sizes_count,
+			dict, &dict_size, NULL);
+	if (ret != LZMA_OK)
+		message_fatal("%s", message_strm(ret));
+
+	// Write errors are caught by tuklib_exit() like with --list.
+	(void)fwrite(dict, 1, dict_size, stdout);
+
+	free(dict);
+	free(sizes);
+	free(samples);
+	return;
+}
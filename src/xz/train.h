@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: 0BSD
+
+///////////////////////////////////////////////////////////////////////////////
+//
+/// \file       train.h
+/// \brief      Build a preset dictionary from sample files
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/// Default size of the dictionary with --train
+#define TRAIN_SIZE_DEFAULT (64 << 10)
+
+
+/// \brief      Set the size of the dictionary built with --train
+extern void train_set_size(size_t size);
+
+
+/// \brief      Read the given file as a sample for the dictionary
+extern void train_file(const char *filename);
+
+
+/// \brief      Build the dictionary from the samples and write it to stdout
+extern void train_totals(void);
@@ -152,11 +152,33 @@ write_text(FILE *file)
 }
 
 
+// File that has random data and text in turns. After a chunk of the
+// random data hasn't compressed, the LZMA2 encoder stores the rest of it
+// without trying to compress it. The text after it is compressed again.
+static void
+write_mixed(FILE *file)
+{
+	uint32_t n = 7;
+
+	for (size_t part = 0; part < 3; ++part) {
+		for (size_t i = 0; i < 150000; ++i) {
+			n = 101771 * n + 71777;
+			putc((uint8_t)(n >> 24), file);
+		}
+
+		for (size_t i = 0; i < 2000; ++i)
+			fprintf(file, "This is line %u of part %u.\n",
+					(unsigned)(i), (unsigned)(part));
+	}
+}
+
+
 int
 main(int argc, char **argv)
 {
 	maybe_create_test(argc, argv, abc);
 	maybe_create_test(argc, argv, random);
 	maybe_create_test(argc, argv, text);
+	maybe_create_test(argc, argv, mixed);
 	return EXIT_SUCCESS;
 }
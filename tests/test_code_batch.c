@@ -0,0 +1,273 @@
+// SPDX-License-Identifier: 0BSD
+
+///////////////////////////////////////////////////////////////////////////////
+//
+/// \file       test_code_batch.c
+/// \brief      Tests lzma_code_batch()
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "tests.h"
+
+
+#define INPUT_SIZE (200U << 10)
+#define OUTPUT_SIZE (INPUT_SIZE + INPUT_SIZE / 2)
+#define STREAMS 5
+
+
+static uint8_t input[STREAMS][INPUT_SIZE];
+
+#if defined(HAVE_ENCODERS) && defined(HAVE_DECODERS)
+static uint8_t compressed[STREAMS][OUTPUT_SIZE];
+static size_t compressed_size[STREAMS];
+static uint8_t out[STREAMS][INPUT_SIZE];
+#endif
+
+
+/// Fills buf with data that has a lot of literals but some matches too.
+/// Every seed gives a different mix.
+static void
+generate(uint8_t *buf, size_t size, uint32_t seed)
+{
+	size_t pos = 0;
+	while (pos < size) {
+		seed = seed * 1103515245 + 12345;
+		const uint32_t r = seed >> 16;
+
+		if (pos >= 64 && r % 8 == 0) {
+			const size_t dist = 1 + (r >> 3) % 64;
+			size_t len = 2 + (r >> 9) % 16;
+			while (len-- > 0 && pos < size) {
+				buf[pos] = buf[pos - dist];
+				++pos;
+			}
+		} else {
+			buf[pos++] = (uint8_t)('a' + r % 16);
+		}
+	}
+
+	return;
+}
+
+
+#if defined(HAVE_ENCODERS) && defined(HAVE_DECODERS)
+static void
+init_decoders(lzma_stream *strms, lzma_stream **ptrs)
+{
+	for (size_t i = 0; i < STREAMS; ++i) {
+		lzma_stream tmp = LZMA_STREAM_INIT;
+		strms[i] = tmp;
+		assert_lzma_ret(lzma_stream_decoder(&strms[i], UINT64_MAX, 0),
+				LZMA_OK);
+
+		strms[i].next_in = compressed[i];
+		strms[i].avail_in = compressed_size[i];
+		strms[i].next_out = out[i];
+		strms[i].avail_out = INPUT_SIZE;
+		ptrs[i] = &strms[i];
+	}
+
+	memset(out, 0, sizeof(out));
+	return;
+}
+#endif
+
+
+static void
+test_code_batch_finish(void)
+{
+#if !defined(HAVE_ENCODERS) || !defined(HAVE_DECODERS)
+	assert_skip("Encoder or decoder support disabled");
+#else
+	lzma_stream strms[STREAMS];
+	lzma_stream *ptrs[STREAMS];
+	lzma_ret rets[STREAMS];
+
+	// Decode everything with one call.
+	init_decoders(strms, ptrs);
+	assert_lzma_ret(lzma_code_batch(ptrs, rets, STREAMS, LZMA_FINISH),
+			LZMA_OK);
+
+	for (size_t i = 0; i < STREAMS; ++i) {
+		assert_lzma_ret(rets[i], LZMA_STREAM_END);
+		assert_uint_eq(strms[i].total_in, compressed_size[i]);
+		assert_uint_eq(strms[i].total_out, INPUT_SIZE);
+		assert_array_eq(out[i], input[i], INPUT_SIZE);
+	}
+
+	// The same streams decode again after a reset.
+	for (size_t i = 0; i < STREAMS; ++i) {
+		assert_lzma_ret(lzma_stream_reset(&strms[i]), LZMA_OK);
+		strms[i].next_in = compressed[i];
+		strms[i].avail_in = compressed_size[i];
+		strms[i].next_out = out[i];
+		strms[i].avail_out = INPUT_SIZE;
+	}
+
+	memset(out, 0, sizeof(out));
+	assert_lzma_ret(lzma_code_batch(ptrs, rets, STREAMS, LZMA_FINISH),
+			LZMA_OK);
+
+	for (size_t i = 0; i < STREAMS; ++i) {
+		assert_lzma_ret(rets[i], LZMA_STREAM_END);
+		assert_array_eq(out[i], input[i], INPUT_SIZE);
+		lzma_end(&strms[i]);
+	}
+#endif
+}
+
+
+static void
+test_code_batch_chunks(void)
+{
+#if !defined(HAVE_ENCODERS) || !defined(HAVE_DECODERS)
+	assert_skip("Encoder or decoder support disabled");
+#else
+	lzma_stream strms[STREAMS];
+	lzma_stream *ptrs[STREAMS];
+	lzma_ret rets[STREAMS];
+	init_decoders(strms, ptrs);
+
+	// Give each stream a different amount of input and output space
+	// per call. The streams that have finished are left out.
+	size_t count = STREAMS;
+	for (unsigned round = 0; count > 0; ++round) {
+		assert_true(round < 10000);
+
+		for (size_t i = 0; i < count; ++i) {
+			const size_t in_left = compressed_size[i]
+					- (size_t)(ptrs[i]->total_in);
+			const size_t out_left = INPUT_SIZE
+					- (size_t)(ptrs[i]->total_out);
+			ptrs[i]->avail_in = my_min(in_left,
+					(round * 7 + i * 311) % 4096 + 1);
+			ptrs[i]->avail_out = my_min(out_left,
+					(round * 13 + i * 997) % 8192 + 1);
+		}
+
+		assert_lzma_ret(lzma_code_batch(ptrs, rets, count, LZMA_RUN),
+				LZMA_OK);
+
+		size_t j = 0;
+		for (size_t i = 0; i < count; ++i) {
+			if (rets[i] == LZMA_OK) {
+				ptrs[j++] = ptrs[i];
+				continue;
+			}
+
+			assert_lzma_ret(rets[i], LZMA_STREAM_END);
+		}
+
+		count = j;
+	}
+
+	for (size_t i = 0; i < STREAMS; ++i) {
+		assert_uint_eq(strms[i].total_out, INPUT_SIZE);
+		assert_array_eq(out[i], input[i], INPUT_SIZE);
+		lzma_end(&strms[i]);
+	}
+#endif
+}
+
+
+static void
+test_code_batch_errors(void)
+{
+#if !defined(HAVE_ENCODERS) || !defined(HAVE_DECODERS)
+	assert_skip("Encoder or decoder support disabled");
+#else
+	lzma_stream strms[STREAMS];
+	lzma_stream *ptrs[STREAMS];
+	lzma_ret rets[STREAMS];
+	init_decoders(strms, ptrs);
+
+	// Corrupt the middle of the second stream. The other streams
+	// must decode normally.
+	compressed[1][compressed_size[1] / 2] ^= 0x5A;
+
+	assert_lzma_ret(lzma_code_batch(ptrs, rets, STREAMS, LZMA_FINISH),
+			LZMA_OK);
+	compressed[1][compressed_size[1] / 2] ^= 0x5A;
+
+	for (size_t i = 0; i < STREAMS; ++i) {
+		if (i == 1) {
+			assert_true(rets[i] == LZMA_DATA_ERROR
+					|| rets[i] == LZMA_BUF_ERROR);
+		} else {
+			assert_lzma_ret(rets[i], LZMA_STREAM_END);
+			assert_array_eq(out[i], input[i], INPUT_SIZE);
+		}
+
+		lzma_end(&strms[i]);
+	}
+
+	// Too little output space
+	init_decoders(strms, ptrs);
+	strms[2].avail_out = INPUT_SIZE / 3;
+
+	assert_lzma_ret(lzma_code_batch(ptrs, rets, STREAMS, LZMA_FINISH),
+			LZMA_OK);
+
+	for (size_t i = 0; i < STREAMS; ++i) {
+		if (i == 2) {
+			assert_lzma_ret(rets[i], LZMA_OK);
+			assert_uint_eq(strms[i].total_out, INPUT_SIZE / 3);
+			assert_array_eq(out[i], input[i], INPUT_SIZE / 3);
+		} else {
+			assert_lzma_ret(rets[i], LZMA_STREAM_END);
+			assert_array_eq(out[i], input[i], INPUT_SIZE);
+		}
+
+		lzma_end(&strms[i]);
+	}
+#endif
+}
+
+
+static void
+test_code_batch_args(void)
+{
+	lzma_stream strm = LZMA_STREAM_INIT;
+	lzma_stream *ptrs[2] = { &strm, NULL };
+	lzma_ret rets[2];
+
+	assert_lzma_ret(lzma_code_batch(NULL, rets, 1, LZMA_RUN),
+			LZMA_PROG_ERROR);
+	assert_lzma_ret(lzma_code_batch(ptrs, NULL, 1, LZMA_RUN),
+			LZMA_PROG_ERROR);
+	assert_lzma_ret(lzma_code_batch(ptrs, rets, 2, LZMA_RUN),
+			LZMA_PROG_ERROR);
+	assert_lzma_ret(lzma_code_batch(ptrs, rets, 0, LZMA_RUN), LZMA_OK);
+
+	// A stream without a coder gets the same result as from lzma_code().
+	assert_lzma_ret(lzma_code_batch(ptrs, rets, 1, LZMA_RUN), LZMA_OK);
+	assert_lzma_ret(rets[0], LZMA_PROG_ERROR);
+}
+
+
+extern int
+main(int argc, char **argv)
+{
+	tuktest_start(argc, argv);
+
+	for (size_t i = 0; i < STREAMS; ++i)
+		generate(input[i], INPUT_SIZE, (uint32_t)(i + 1));
+
+#if defined(HAVE_ENCODERS) && defined(HAVE_DECODERS)
+	for (size_t i = 0; i < STREAMS; ++i) {
+		compressed_size[i] = 0;
+		if (lzma_easy_buffer_encode((uint32_t)(i * 2 % 7),
+				LZMA_CHECK_CRC32, NULL, input[i], INPUT_SIZE,
+				compressed[i], &compressed_size[i],
+				OUTPUT_SIZE) != LZMA_OK)
+			tuktest_error("Compressing the test data failed");
+	}
+#endif
+
+	tuktest_run(test_code_batch_finish);
+	tuktest_run(test_code_batch_chunks);
+	tuktest_run(test_code_batch_errors);
+	tuktest_run(test_code_batch_args);
+
+	return tuktest_end();
+}
@@ -102,6 +102,7 @@ XZ="$XZ --memlimit-compress=48MiB --memlimit-decompress=5MiB \
 FILE=$1
 TMP_COMP="tmp_comp_$FILE"
 TMP_UNCOMP="tmp_uncomp_$FILE"
+TMP_DICT="tmp_dict_$FILE"
 
 case $FILE in
 	# compress_generated files will be created in the build directory
@@ -127,8 +128,8 @@ case $FILE in
 esac
 
 # Remove temporary now (in case they are something weird), and on exit.
-rm -f "$TMP_COMP" "$TMP_UNCOMP"
-trap 'rm -f "$TMP_COMP" "$TMP_UNCOMP"' 0
+rm -f "$TMP_COMP" "$TMP_UNCOMP" "$TMP_DICT"
+trap 'rm -f "$TMP_COMP" "$TMP_UNCOMP" "$TMP_DICT"' 0
 
 # Compress and decompress the file with various filter configurations.
 #
@@ -163,4 +164,99 @@ test_filter ARM64 arm64
 test_filter SPARC sparc
 test_filter RISCV riscv
 
+test_mf()
+{
+	if test -f ../config.h ; then
+		grep "define HAVE_MF_$1[ 1]*\$" ../config.h > /dev/null \
+			|| return
+	fi
+	shift
+	test_xz "$@"
+}
+
+test_mf HR4 --lzma2=dict=64KiB,nice=32,mode=fast,mf=hr4
+test_mf HR4 --lzma2=dict=64KiB,nice=273,mode=normal,mf=hr4
+test_mf SA --lzma2=dict=64KiB,nice=32,mode=fast,mf=sa
+test_mf SA --lzma2=dict=64KiB,nice=273,mode=normal,mf=sa
+
+# The long-distance matcher works with every match finder.
+test_xz --lzma2=dict=64KiB,mode=fast,mf=hc4,long=32
+test_xz --lzma2=dict=64KiB,mode=normal,mf=bt4,long=64
+
+# The match finder helper thread is used with the binary trees and
+# ignored otherwise.
+test_xz --lzma2=dict=64KiB,mode=fast,mf=bt2,mft=1
+test_xz --lzma2=dict=64KiB,mode=normal,mf=bt4,mft=1
+test_xz --lzma2=dict=64KiB,mode=normal,mf=hc4,mft=1
+
+# The multiplicative hash works with every match finder that hashes.
+test_xz --lzma2=dict=64KiB,mode=fast,mf=hc3,hash=mul
+test_xz --lzma2=dict=64KiB,mode=fast,mf=hc4,hash=mul
+test_xz --lzma2=dict=64KiB,mode=normal,mf=bt3,hash=mul
+test_xz --lzma2=dict=64KiB,mode=normal,mf=bt4,hash=mul,mft=1
+test_mf HR4 --lzma2=dict=64KiB,nice=32,mode=fast,mf=hr4,hash=mul
+
+# The speed target can change the mode and the match finder settings
+# between the LZMA2 chunks. A huge target makes the encoder use the fastest
+# settings and a tiny one keeps the slowest ones.
+test_xz --lzma2=dict=64KiB,mode=normal,mf=bt4,speed=1048576
+test_xz --lzma2=dict=64KiB,mode=lazy,mf=hc4,speed=1048576
+test_xz --lzma2=dict=64KiB,mode=normal,mf=bt4,mft=1,speed=1048576
+test_xz --lzma2=dict=64KiB,mode=normal,mf=bt4,speed=1
+
+# The lazy mode works with every match finder.
+test_xz --lzma2=dict=64KiB,nice=32,mode=lazy,mf=hc4
+test_xz --lzma2=dict=64KiB,nice=273,mode=lazy,mf=bt4
+test_mf HR4 --lzma2=dict=64KiB,nice=64,mode=lazy,mf=hr4
+
+# After a chunk that doesn't compress, the next bytes are stored without
+# encoding them as long as they look random. Make the Blocks end in the
+# middle of such a chunk.
+test_xz --block-size=100000 -1
+test_xz --block-size=100000 --lzma2=dict=64KiB,mode=normal,mf=bt4
+
+# An LZMA chunk after a stored chunk must use the positions of the LZMA2
+# stream for pos_state and the literal coders.
+test_xz --lzma2=dict=64KiB,lc=0,lp=2,pb=2,mode=normal,mf=bt4
+test_xz --lzma2=dict=64KiB,lc=1,lp=1,pb=3,mode=fast,mf=hc4
+
+# Train a preset dictionary from the file and use it with the raw format.
+# When the same file is compressed twice in one run, the match finder
+# state of the preset dictionary is restored for the second one, which
+# must give the same output as the first.
+test_dict()
+{
+	if $XZ -c --format=raw --lzma2=dict=64KiB,"$1" --dict-file="$TMP_DICT" \
+			"$FILE" > "$TMP_COMP" \
+			&& $XZ -dc --format=raw --lzma2=dict=64KiB,"$1" \
+				--dict-file="$TMP_DICT" "$TMP_COMP" \
+				> "$TMP_UNCOMP" \
+			&& cmp "$TMP_UNCOMP" "$FILE" ; then
+		:
+	else
+		echo "Preset dictionary failed: $1 $FILE"
+		exit 1
+	fi
+
+	if $XZ -c --format=raw --lzma2=dict=64KiB,"$1" --dict-file="$TMP_DICT" \
+			"$FILE" "$FILE" > "$TMP_UNCOMP" \
+			&& cat "$TMP_COMP" "$TMP_COMP" | cmp - "$TMP_UNCOMP" ; then
+		:
+	else
+		echo "Reused preset dictionary gives different output:" \
+				"$1 $FILE"
+		exit 1
+	fi
+}
+
+if $XZ --train=16KiB "$FILE" > "$TMP_DICT" ; then
+	:
+else
+	echo "Training a dictionary failed: $FILE"
+	exit 1
+fi
+
+test_dict mode=fast,mf=hc4
+test_dict mode=normal,mf=bt4
+
 exit 0
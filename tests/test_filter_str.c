@@ -191,6 +191,99 @@ test_lzma_str_to_filters(void)
 
 	lzma_filters_free(filters, NULL);
 
+	// Test the hash row match finder name.
+	error_pos = -1;
+	assert_true(lzma_str_to_filters("lzma2=mf=hr4", &error_pos,
+			filters, 0, NULL) == NULL);
+	assert_int_eq(error_pos, 12);
+
+	opts = filters[0].options;
+	assert_uint_eq(opts->mf, LZMA_MF_HR4);
+
+	lzma_filters_free(filters, NULL);
+
+	// Test the suffix array match finder name.
+	error_pos = -1;
+	assert_true(lzma_str_to_filters("lzma2=mf=sa", &error_pos,
+			filters, 0, NULL) == NULL);
+	assert_int_eq(error_pos, 11);
+
+	opts = filters[0].options;
+	assert_uint_eq(opts->mf, LZMA_MF_SA);
+
+	lzma_filters_free(filters, NULL);
+
+	// Test the long-distance matcher option and its range.
+	error_pos = -1;
+	assert_true(lzma_str_to_filters("lzma2=long=64", &error_pos,
+			filters, 0, NULL) == NULL);
+	assert_int_eq(error_pos, 13);
+
+	opts = filters[0].options;
+	assert_uint_eq(opts->ext_enable, LZMA_OPTIONS_LZMA_EXT);
+	assert_uint_eq(opts->long_len, 64);
+
+	lzma_filters_free(filters, NULL);
+
+	error_pos = -1;
+	assert_true(lzma_str_to_filters("lzma2=long=16", &error_pos,
+			filters, 0, NULL) != NULL);
+	assert_int_eq(error_pos, 11);
+
+	// Test the match finder helper thread option and its range.
+	error_pos = -1;
+	assert_true(lzma_str_to_filters("lzma2=mft=1", &error_pos,
+			filters, 0, NULL) == NULL);
+	assert_int_eq(error_pos, 11);
+
+	opts = filters[0].options;
+	assert_uint_eq(opts->mf_threads, 1);
+
+	lzma_filters_free(filters, NULL);
+
+	error_pos = -1;
+	assert_true(lzma_str_to_filters("lzma2=mft=2", &error_pos,
+			filters, 0, NULL) != NULL);
+	assert_int_eq(error_pos, 10);
+
+	// Test the hash function option.
+	error_pos = -1;
+	assert_true(lzma_str_to_filters("lzma2=hash=mul", &error_pos,
+			filters, 0, NULL) == NULL);
+	assert_int_eq(error_pos, 14);
+
+	opts = filters[0].options;
+	assert_uint_eq(opts->mf_hash, LZMA_MF_HASH_MUL);
+
+	lzma_filters_free(filters, NULL);
+
+	error_pos = -1;
+	assert_true(lzma_str_to_filters("lzma2=hash=crc", &error_pos,
+			filters, 0, NULL) != NULL);
+	assert_int_eq(error_pos, 11);
+
+	// Test the speed target option.
+	error_pos = -1;
+	assert_true(lzma_str_to_filters("lzma2=speed=50", &error_pos,
+			filters, 0, NULL) == NULL);
+	assert_int_eq(error_pos, 14);
+
+	opts = filters[0].options;
+	assert_uint_eq(opts->speed_target, 50);
+
+	lzma_filters_free(filters, NULL);
+
+	// Test the lazy mode.
+	error_pos = -1;
+	assert_true(lzma_str_to_filters("lzma2=mode=lazy", &error_pos,
+			filters, 0, NULL) == NULL);
+	assert_int_eq(error_pos, 15);
+
+	opts = filters[0].options;
+	assert_uint_eq(opts->mode, LZMA_MODE_LAZY);
+
+	lzma_filters_free(filters, NULL);
+
 #if defined(HAVE_ENCODER_X86) || defined(HAVE_DECODER_X86)
 	// Test BCJ Filter options.
 	error_pos = -1;
@@ -477,6 +570,27 @@ test_lzma_str_from_filters(void)
 	assert_lzma_ret(lzma_str_from_filters(&output_str, oversized_filters,
 			0, NULL), LZMA_OPTIONS_ERROR);
 
+	// The members that used to be reserved are included only
+	// if ext_enable says that they have been initialized.
+	opts.long_len = 64;
+	opts.speed_target = 50;
+	filters[0].id = LZMA_FILTER_LZMA2;
+	filters[0].options = &opts;
+	filters[1].id = LZMA_VLI_UNKNOWN;
+
+	assert_lzma_ret(lzma_str_from_filters(&output_str, filters,
+			LZMA_STR_ENCODER, NULL), LZMA_OK);
+	assert_true(strstr(output_str, "long=64") != NULL);
+	assert_true(strstr(output_str, "speed=50") != NULL);
+	free(output_str);
+
+	opts.ext_enable = 0;
+	assert_lzma_ret(lzma_str_from_filters(&output_str, filters,
+			LZMA_STR_ENCODER, NULL), LZMA_OK);
+	assert_true(strstr(output_str, "long=") == NULL);
+	assert_true(strstr(output_str, "speed=") == NULL);
+	free(output_str);
+
 	// Test with NULL filter options (when they cannot be NULL).
 	filters[0].id = LZMA_FILTER_LZMA2;
 	filters[0].options = NULL;
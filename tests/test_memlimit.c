@@ -156,6 +156,41 @@ test_memlimit_auto_decoder(void)
 }
 
 
+static void
+test_memlimit_small_block(void)
+{
+#if !defined(HAVE_ENCODERS) || !defined(HAVE_DECODERS)
+	assert_skip("Encoder or decoder support disabled");
+#else
+	// The Block Header has the Uncompressed Size so the 64 MiB
+	// dictionary of the preset 9 isn't needed for decoding.
+	uint8_t buf[sizeof(out)];
+	memset(buf, 'x', sizeof(buf));
+
+	uint8_t comp[1024];
+	size_t comp_size = 0;
+	assert_lzma_ret(lzma_easy_buffer_encode(9, LZMA_CHECK_CRC32, NULL,
+			buf, sizeof(buf), comp, &comp_size, sizeof(comp)),
+			LZMA_OK);
+
+	lzma_stream strm = LZMA_STREAM_INIT;
+	assert_lzma_ret(lzma_stream_decoder(&strm, MEMLIMIT_HIGH_ENOUGH, 0),
+			LZMA_OK);
+
+	strm.next_in = comp;
+	strm.avail_in = comp_size;
+	strm.next_out = out;
+	strm.avail_out = sizeof(out);
+
+	assert_lzma_ret(lzma_code(&strm, LZMA_FINISH), LZMA_STREAM_END);
+	assert_true(lzma_memusage(&strm) <= MEMLIMIT_HIGH_ENOUGH);
+	assert_array_eq(out, buf, sizeof(buf));
+
+	lzma_end(&strm);
+#endif
+}
+
+
 extern int
 main(int argc, char **argv)
 {
@@ -167,6 +202,7 @@ main(int argc, char **argv)
 	tuktest_run(test_memlimit_stream_decoder_mt);
 	tuktest_run(test_memlimit_alone_decoder);
 	tuktest_run(test_memlimit_auto_decoder);
+	tuktest_run(test_memlimit_small_block);
 
 	return tuktest_end();
 }
@@ -0,0 +1,201 @@
+// SPDX-License-Identifier: 0BSD
+
+///////////////////////////////////////////////////////////////////////////////
+//
+/// \file       test_stream_reset.c
+/// \brief      Tests lzma_stream_reset()
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "tests.h"
+
+
+#define INPUT_SIZE (100U << 10)
+#define OUTPUT_SIZE (INPUT_SIZE + INPUT_SIZE / 2)
+
+
+static uint8_t input[INPUT_SIZE];
+static uint8_t other[INPUT_SIZE];
+
+#if defined(HAVE_ENCODERS) && defined(HAVE_DECODERS)
+static uint8_t fresh[OUTPUT_SIZE];
+static size_t fresh_size;
+static uint8_t out[OUTPUT_SIZE];
+#endif
+
+
+/// Fills buf with words picked from a small vocabulary so that the data
+/// compresses well but not trivially.
+static void
+generate(uint8_t *buf, size_t size, uint32_t seed)
+{
+	static const char *const words[] = {
+		"lorem ", "ipsum ", "dolor ", "sit ", "amet, ",
+		"consectetur ", "adipiscing ", "elit. ", "sed ", "do\n",
+	};
+
+	size_t pos = 0;
+	while (pos < size) {
+		seed = seed * 1103515245 + 12345;
+		const char *word = words[(seed >> 16) % ARRAY_SIZE(words)];
+		const size_t len = my_min(strlen(word), size - pos);
+		memcpy(buf + pos, word, len);
+		pos += len;
+	}
+
+	return;
+}
+
+
+#if defined(HAVE_ENCODERS) && defined(HAVE_DECODERS)
+/// Codes in[in_size] to out[] in one call and returns the output size.
+static size_t
+code_all(lzma_stream *strm, const uint8_t *in, size_t in_size,
+		uint8_t *buf, size_t buf_size)
+{
+	strm->next_in = in;
+	strm->avail_in = in_size;
+	strm->next_out = buf;
+	strm->avail_out = buf_size;
+
+	assert_lzma_ret(lzma_code(strm, LZMA_FINISH), LZMA_STREAM_END);
+	assert_uint_eq(strm->total_in, in_size);
+	assert_uint_eq(strm->total_out, buf_size - strm->avail_out);
+
+	return buf_size - strm->avail_out;
+}
+#endif
+
+
+static void
+test_stream_reset_encoder(void)
+{
+#if !defined(HAVE_ENCODERS) || !defined(HAVE_DECODERS)
+	assert_skip("Encoder or decoder support disabled");
+#else
+	lzma_stream strm = LZMA_STREAM_INIT;
+
+	// Compress something else first, then the input after a reset.
+	// The output must be the same as with a freshly initialized
+	// encoder.
+	assert_lzma_ret(lzma_easy_encoder(&strm, 6, LZMA_CHECK_CRC64),
+			LZMA_OK);
+	code_all(&strm, other, sizeof(other), out, sizeof(out));
+
+	assert_lzma_ret(lzma_stream_reset(&strm), LZMA_OK);
+	assert_uint_eq(strm.total_in, 0);
+	assert_uint_eq(strm.total_out, 0);
+
+	size_t out_size = code_all(&strm, input, sizeof(input),
+			out, sizeof(out));
+	assert_uint_eq(out_size, fresh_size);
+	assert_array_eq(out, fresh, fresh_size);
+
+	// Reset in the middle of a stream.
+	assert_lzma_ret(lzma_stream_reset(&strm), LZMA_OK);
+	strm.next_in = other;
+	strm.avail_in = sizeof(other) / 2;
+	strm.next_out = out;
+	strm.avail_out = sizeof(out);
+	assert_lzma_ret(lzma_code(&strm, LZMA_RUN), LZMA_OK);
+
+	assert_lzma_ret(lzma_stream_reset(&strm), LZMA_OK);
+	out_size = code_all(&strm, input, sizeof(input), out, sizeof(out));
+	assert_uint_eq(out_size, fresh_size);
+	assert_array_eq(out, fresh, fresh_size);
+
+	lzma_end(&strm);
+#endif
+}
+
+
+static void
+test_stream_reset_decoder(void)
+{
+#if !defined(HAVE_ENCODERS) || !defined(HAVE_DECODERS)
+	assert_skip("Encoder or decoder support disabled");
+#else
+	lzma_stream strm = LZMA_STREAM_INIT;
+	assert_lzma_ret(lzma_stream_decoder(&strm, UINT64_MAX, 0), LZMA_OK);
+
+	for (unsigned i = 0; i < 3; ++i) {
+		if (i > 0)
+			assert_lzma_ret(lzma_stream_reset(&strm), LZMA_OK);
+
+		assert_uint_eq(code_all(&strm, fresh, fresh_size,
+				out, sizeof(out)), sizeof(input));
+		assert_array_eq(out, input, sizeof(input));
+	}
+
+	// Reset in the middle of a stream.
+	assert_lzma_ret(lzma_stream_reset(&strm), LZMA_OK);
+	strm.next_in = fresh;
+	strm.avail_in = fresh_size / 2;
+	strm.next_out = out;
+	strm.avail_out = sizeof(out);
+	assert_lzma_ret(lzma_code(&strm, LZMA_RUN), LZMA_OK);
+
+	assert_lzma_ret(lzma_stream_reset(&strm), LZMA_OK);
+	assert_uint_eq(code_all(&strm, fresh, fresh_size, out, sizeof(out)),
+			sizeof(input));
+	assert_array_eq(out, input, sizeof(input));
+
+	lzma_end(&strm);
+#endif
+}
+
+
+static void
+test_stream_reset_unsupported(void)
+{
+	assert_lzma_ret(lzma_stream_reset(NULL), LZMA_PROG_ERROR);
+
+	lzma_stream strm = LZMA_STREAM_INIT;
+	assert_lzma_ret(lzma_stream_reset(&strm), LZMA_PROG_ERROR);
+
+#if defined(HAVE_ENCODER_LZMA2)
+	lzma_options_lzma opt;
+	assert_false(lzma_lzma_preset(&opt, 1));
+
+	const lzma_filter filters[] = {
+		{ .id = LZMA_FILTER_LZMA2, .options = &opt },
+		{ .id = LZMA_VLI_UNKNOWN, .options = NULL },
+	};
+
+	assert_lzma_ret(lzma_raw_encoder(&strm, filters), LZMA_OK);
+	assert_lzma_ret(lzma_stream_reset(&strm), LZMA_PROG_ERROR);
+	lzma_end(&strm);
+#endif
+}
+
+
+extern int
+main(int argc, char **argv)
+{
+	tuktest_start(argc, argv);
+
+	generate(input, sizeof(input), 1);
+	generate(other, sizeof(other), 2);
+
+#if defined(HAVE_ENCODERS) && defined(HAVE_DECODERS)
+	lzma_stream strm = LZMA_STREAM_INIT;
+	if (lzma_easy_encoder(&strm, 6, LZMA_CHECK_CRC64) != LZMA_OK)
+		tuktest_error("lzma_easy_encoder() failed");
+
+	strm.next_in = input;
+	strm.avail_in = sizeof(input);
+	strm.next_out = fresh;
+	strm.avail_out = sizeof(fresh);
+	if (lzma_code(&strm, LZMA_FINISH) != LZMA_STREAM_END)
+		tuktest_error("Compressing the test data failed");
+
+	fresh_size = sizeof(fresh) - strm.avail_out;
+	lzma_end(&strm);
+#endif
+
+	tuktest_run(test_stream_reset_encoder);
+	tuktest_run(test_stream_reset_decoder);
+	tuktest_run(test_stream_reset_unsupported);
+
+	return tuktest_end();
+}
@@ -54,6 +54,7 @@ if(BUILD_TESTING)
         test_bcj_exact_size
         test_block_header
         test_check
+        test_code_batch
         test_filter_flags
         test_filter_str
         test_hardware
@@ -62,6 +63,7 @@ if(BUILD_TESTING)
         test_lzip_decoder
         test_memlimit
         test_stream_flags
+        test_stream_reset
         test_vli
     )
 
@@ -192,7 +194,8 @@ if(BUILD_TESTING)
 
         foreach(T compress_generated_abc
                   compress_generated_text
-                  compress_generated_random)
+                  compress_generated_random
+                  compress_generated_mixed)
             add_test(NAME "test_${T}"
                 COMMAND "${CMAKE_CURRENT_SOURCE_DIR}/tests/test_compress.sh"
                         "${T}" ".."